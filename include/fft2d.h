@@ -111,6 +111,28 @@ void rifft2d(float *data, int M2, int M);
 /* OUTPUTS */
 /* *data = output data array	*/
 
+void rfft2d_work(float *data, int M2, int M, float *work);
+void rifft2d_work(float *data, int M2, int M, float *work);
+/* Same as rfft2d and rifft2d, but transposing columns through the caller's */
+/* *work (at least 8*pow(2,M2) floats) instead of the private storage. */
+/* fft2dInit must still have been called for the tables; with separate */
+/* work arrays several threads can transform at once. */
+
+void fft2d_work(float *data, int M2, int M, float *work);
+void ifft2d_work(float *data, int M2, int M, float *work);
+/* The same for fft2d and ifft2d. */
+
+void ctranspose(float *indata, int iRsiz, float *outdata, int oRsiz, int Nrows, int Ncols);
+/* not in-place complex float matrix transpose, done in cache sized tiles */
+/* INPUTS */
+/* *indata = input data array	*/
+/* iRsiz = offset in complex values between rows of input data array	*/
+/* oRsiz = offset in complex values between rows of output data array	*/
+/* Nrows = number of rows in input data array	*/
+/* Ncols = number of columns in input data array	*/
+/* OUTPUTS */
+/* *outdata = output data array	*/
+
 void rspect2dprod(float *data1, float *data2, float *outdata, int N2, int N1);
 /* When multiplying a pair of 2d spectra from rfft2d care must be taken to multiply the*/
 /* four real values seperately from the complex ones. This routine does it correctly.*/
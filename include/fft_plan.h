@@ -0,0 +1,74 @@
+#ifndef _FFT_PLAN_H_
+#define _FFT_PLAN_H_
+/*
+fft_plan.h:
+	This file is an external interface to asf_fft.a.
+It contains planned, cached 1-D and 2-D fft's.  Also see fft.h and fft2d.h
+*/
+/*******************************************************************
+	Ask for a plan once for each shape of transform you need, then
+	execute it on as many arrays as you like.  Plans are cached on
+	their type, direction, size and layout, so asking again for the same
+	one just returns it; they live until fft_plan_cleanup is called,
+	so do not free them.  Planning is serialized internally, and
+	one plan may be executed from several threads at once on
+	different data.
+
+	The transforms are done either by the fftlib routines in
+	fft.h/fft2d.h (the default) or by single precision FFTW 3 when
+	asf_fft is built with ASF_FFT_FFTW defined ("make FFT_BACKEND=fftw",
+	or "scons --fftw").  The results are the same either way, up to
+	rounding, and follow fftlib's conventions:
+	forward:  X[k] = sum x[j] exp(-2 pi i jk/N)
+	inverse:  x[j] = 1/N sum X[k] exp(+2 pi i jk/N)
+	so an inverse undoes a forward, as iffts undoes ffts.  Real
+	transforms store their spectra in the packed layouts of
+	rffts and rfft2d, so rspectprod and rspect2dprod work on them.
+
+	Only power of 2 sizes are supported.
+	*** Warning *** with the fftlib backend plans use fftlib's tables,
+	so do not call fftFree or fft2dFree while any plan is in use.
+*******************************************************************/
+
+/* Transform types */
+#define FFT_COMPLEX 0	/* complex to complex */
+#define FFT_REAL 1	/* real to packed complex forward, the reverse inverse */
+
+/* Directions */
+#define FFT_FORWARD -1
+#define FFT_INVERSE 1
+
+typedef struct fft_plan fft_plan;
+
+fft_plan *fft_plan_1d(int type, int dir, int N, int howmany, int stride,
+		int dist);
+/* Plan a batch of 1d transforms, done in-place	*/
+/* INPUTS */
+/* type = FFT_COMPLEX or FFT_REAL */
+/* dir = FFT_FORWARD or FFT_INVERSE */
+/* N = fft size (a power of 2) */
+/* howmany = number of transforms in the batch */
+/* stride, dist = layout of the batch.  FFT_COMPLEX: element k of transform j */
+/*   is the complex value (pair of floats) at index j*dist + k*stride, so */
+/*   rows of an array are stride 1, dist N and columns are stride ncols, dist 1. */
+/*   FFT_REAL: stride must be 1, and transform j is the N floats at j*dist. */
+/* OUTPUTS */
+/* returns the plan */
+
+fft_plan *fft_plan_2d(int type, int dir, int rows, int cols);
+/* Plan a 2d transform of a rows by cols array stored by rows, done in-place	*/
+/* FFT_COMPLEX arrays hold complex values, FFT_REAL ones floats */
+/* (the spectra being laid out as rfft2d leaves them) */
+/* rows and cols are powers of 2, at least 2 each for FFT_REAL */
+
+void fft_execute(const fft_plan *plan, float *data);
+/* Run a plan on *data, in-place.  Complex values are pairs of floats, */
+/* real part first (complexFloat arrays can be passed cast to float *) */
+
+const char *fft_backend(void);
+/* Name of the backend doing the transforms, "fftlib" or "fftw" */
+
+void fft_plan_cleanup(void);
+/* Free every cached plan.  None of them may be used afterwards */
+
+#endif
@@ -1,7 +1,11 @@
 /*********************
 This matrix transpose is in a seperate file because it should always be double precision.
 *********************/
+#include <stddef.h>
 #include "dxpose.h"
+
+#define XPOSE_TILE 64	/* columns transposed per pass */
+
 void dxpose(xdouble *indata, int iRsiz, xdouble *outdata, int oRsiz, int Nrows, int Ncols){
 /* not in-place double precision matrix transpose	*/
 /* INPUTS */
@@ -19,6 +23,8 @@ xdouble	*idata; 	/* pointer to input data */
 xdouble	*odata; 	/* pointer to output data */
 int 	RowCnt;		/* row counter */
 int 	ColCnt;		/* col counter */
+int 	TileStart;	/* first column of this tile */
+int 	TileCols;	/* columns in this tile */
 xdouble	T0; 		/* data storage */
 xdouble	T1; 		/* data storage */
 xdouble	T2; 		/* data storage */
@@ -36,43 +42,48 @@ const int inRsizd6 = inRsizd4+inRsizd2;
 const int inRsizd7 = inRsizd4+inRsizd3;
 const int inRsizd8 = 8*iRsiz;
 
-ocol = outdata;
-irow = indata;
-for (RowCnt=Nrows/8; RowCnt>0; RowCnt--){
-	idata = irow;
-	odata = ocol;
-	for (ColCnt=Ncols; ColCnt>0; ColCnt--){
-		T0 = *idata;
-		T1 = *(idata+inRsizd1);
-		T2 = *(idata+inRsizd2);
-		T3 = *(idata+inRsizd3);
-		T4 = *(idata+inRsizd4);
-		T5 = *(idata+inRsizd5);
-		T6 = *(idata+inRsizd6);
-		T7 = *(idata+inRsizd7);
-		*odata = T0;
-		*(odata+1) = T1;
-		*(odata+2) = T2;
-		*(odata+3) = T3;
-		*(odata+4) = T4;
-		*(odata+5) = T5;
-		*(odata+6) = T6;
-		*(odata+7) = T7;
-		idata++;
-		odata += oRsiz;
-	}
-	irow += inRsizd8;
-	ocol += 8;
-}
-if (Nrows%8 != 0){
-	for (ColCnt=Ncols; ColCnt>0; ColCnt--){
-		idata = irow++;
+/* Columns are done XPOSE_TILE at a time, so the output rows being */
+/* filled stay in the cache (and TLB) while every 8 row strip passes */
+for (TileStart=0; TileStart<Ncols; TileStart+=XPOSE_TILE){
+	TileCols = (Ncols-TileStart < XPOSE_TILE) ? Ncols-TileStart : XPOSE_TILE;
+	ocol = outdata + (size_t)TileStart*oRsiz;
+	irow = indata + TileStart;
+	for (RowCnt=Nrows/8; RowCnt>0; RowCnt--){
+		idata = irow;
 		odata = ocol;
-		ocol += oRsiz;
-		for (RowCnt=Nrows%8; RowCnt>0; RowCnt--){
+		for (ColCnt=TileCols; ColCnt>0; ColCnt--){
 			T0 = *idata;
-			*odata++ = T0;
-			idata += iRsiz;
+			T1 = *(idata+inRsizd1);
+			T2 = *(idata+inRsizd2);
+			T3 = *(idata+inRsizd3);
+			T4 = *(idata+inRsizd4);
+			T5 = *(idata+inRsizd5);
+			T6 = *(idata+inRsizd6);
+			T7 = *(idata+inRsizd7);
+			*odata = T0;
+			*(odata+1) = T1;
+			*(odata+2) = T2;
+			*(odata+3) = T3;
+			*(odata+4) = T4;
+			*(odata+5) = T5;
+			*(odata+6) = T6;
+			*(odata+7) = T7;
+			idata++;
+			odata += oRsiz;
+		}
+		irow += inRsizd8;
+		ocol += 8;
+	}
+	if (Nrows%8 != 0){
+		for (ColCnt=TileCols; ColCnt>0; ColCnt--){
+			idata = irow++;
+			odata = ocol;
+			ocol += oRsiz;
+			for (RowCnt=Nrows%8; RowCnt>0; RowCnt--){
+				T0 = *idata;
+				*odata++ = T0;
+				idata += iRsiz;
+			}
 		}
 	}
 }
@@ -59,12 +59,26 @@ for (i1=8*sizeof(int)-1; i1>=0; i1--){
 fftFree();
 }
 
-void fft2d(float *data, int M2, int M){
+void ctranspose(float *indata, int iRsiz, float *outdata, int oRsiz, int Nrows, int Ncols){
+/* not in-place complex float matrix transpose, the corner turn between row and column ffts */
+/* INPUTS */
+/* *indata = input data array	*/
+/* iRsiz = offset in complex values between rows of input data array	*/
+/* oRsiz = offset in complex values between rows of output data array	*/
+/* Nrows = number of rows in input data array	*/
+/* Ncols = number of columns in input data array	*/
+/* OUTPUTS */
+/* *outdata = output data array	*/
+cxpose(indata, iRsiz, outdata, oRsiz, Nrows, Ncols);
+}
+
+void fft2d_work(float *data, int M2, int M, float *work){
 /* Compute 2D complex fft and return results in-place	*/
 /* INPUTS */
 /* *data = input data array	*/
 /* M2 = log2 of fft size number of rows */
 /* M = log2 of fft size number of columns */
+/* *work = column storage of at least 8*pow(2,M2) floats */
 /* OUTPUTS */
 /* *data = output data array	*/
 int i1;
@@ -72,26 +86,27 @@ if((M2>0)&&(M>0)){
 	ffts(data, M, POW2(M2));
 	if (M>2)
 		for (i1=0; i1<POW2(M); i1+=4){
-			cxpose(data + i1*2, POW2(M), Array2d[M2], POW2(M2), POW2(M2), 4);
-			ffts(Array2d[M2], M2, 4);
-			cxpose(Array2d[M2], POW2(M2), data + i1*2, POW2(M), 4, POW2(M2));
+			cxpose(data + i1*2, POW2(M), work, POW2(M2), POW2(M2), 4);
+			ffts(work, M2, 4);
+			cxpose(work, POW2(M2), data + i1*2, POW2(M), 4, POW2(M2));
 		}
 	else{
-		cxpose(data, POW2(M), Array2d[M2], POW2(M2), POW2(M2), POW2(M));
-		ffts(Array2d[M2], M2, POW2(M));
-		cxpose(Array2d[M2], POW2(M2), data, POW2(M), POW2(M), POW2(M2));
+		cxpose(data, POW2(M), work, POW2(M2), POW2(M2), POW2(M));
+		ffts(work, M2, POW2(M));
+		cxpose(work, POW2(M2), data, POW2(M), POW2(M), POW2(M2));
 	}
 }
 else
 	ffts(data, M2+M, 1);
 }
 
-void ifft2d(float *data, int M2, int M){
+void ifft2d_work(float *data, int M2, int M, float *work){
 /* Compute 2D complex ifft and return results in-place	*/
 /* INPUTS */
 /* *data = input data array	*/
 /* M2 = log2 of fft size number of rows */
 /* M = log2 of fft size number of columns */
+/* *work = column storage of at least 8*pow(2,M2) floats */
 /* OUTPUTS */
 /* *data = output data array	*/
 int i1;
@@ -99,20 +114,30 @@ if((M2>0)&&(M>0)){
 	iffts(data, M, POW2(M2));
 	if (M>2)
 		for (i1=0; i1<POW2(M); i1+=4){
-			cxpose(data + i1*2, POW2(M), Array2d[M2], POW2(M2), POW2(M2), 4);
-			iffts(Array2d[M2], M2, 4);
-			cxpose(Array2d[M2], POW2(M2), data + i1*2, POW2(M), 4, POW2(M2));
+			cxpose(data + i1*2, POW2(M), work, POW2(M2), POW2(M2), 4);
+			iffts(work, M2, 4);
+			cxpose(work, POW2(M2), data + i1*2, POW2(M), 4, POW2(M2));
 		}
 	else{
-		cxpose(data, POW2(M), Array2d[M2], POW2(M2), POW2(M2), POW2(M));
-		iffts(Array2d[M2], M2, POW2(M));
-		cxpose(Array2d[M2], POW2(M2), data, POW2(M), POW2(M), POW2(M2));
+		cxpose(data, POW2(M), work, POW2(M2), POW2(M2), POW2(M));
+		iffts(work, M2, POW2(M));
+		cxpose(work, POW2(M2), data, POW2(M), POW2(M), POW2(M2));
 	}
 }
 else
 	iffts(data, M2+M, 1);
 }
 
+void fft2d(float *data, int M2, int M){
+/* Compute 2D complex fft and return results in-place, using the storage set up by fft2dInit */
+fft2d_work(data, M2, M, Array2d[M2]);
+}
+
+void ifft2d(float *data, int M2, int M){
+/* Compute 2D complex ifft and return results in-place, using the storage set up by fft2dInit */
+ifft2d_work(data, M2, M, Array2d[M2]);
+}
+
 int fft3dInit(int L, int M2, int M){
 	/* init for fft3d, ifft3d*/
 	/* malloc storage for 4 columns and 4 pages of 3d ffts*/
@@ -250,7 +275,7 @@ else
 			if(M==0) ifft2d(data, M3, M2);
 }
 
-void rfft2d(float *data, int M2, int M){
+void rfft2d_work(float *data, int M2, int M, float *work){
 /* Compute 2D real fft and return results in-place	*/
 /* First performs real fft on rows using size from M to compute positive frequencies */
 /* then performs transform on columns using size from M2 to compute wavenumbers */
@@ -265,40 +290,41 @@ void rfft2d(float *data, int M2, int M){
 /* *data = input data array	*/
 /* M2 = log2 of fft size number of rows in */
 /* M = log2 of fft size number of columns in */
+/* *work = column storage of at least 8*pow(2,M2) floats */
 /* OUTPUTS */
 /* *data = output data array	*/
 int i1;
 if((M2>0)&&(M>0)){
 	rffts(data, M, POW2(M2));
 	if (M==1){
-		cxpose(data, POW2(M)/2, Array2d[M2]+POW2(M2)*2, POW2(M2), POW2(M2), 1);
-		xpose(Array2d[M2]+POW2(M2)*2, 2, Array2d[M2], POW2(M2), POW2(M2), 2);
-		rffts(Array2d[M2], M2, 2);
-		cxpose(Array2d[M2], POW2(M2), data, POW2(M)/2, 1, POW2(M2));
+		cxpose(data, POW2(M)/2, work+POW2(M2)*2, POW2(M2), POW2(M2), 1);
+		xpose(work+POW2(M2)*2, 2, work, POW2(M2), POW2(M2), 2);
+		rffts(work, M2, 2);
+		cxpose(work, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
 	}
 	else if (M==2){
-		cxpose(data, POW2(M)/2, Array2d[M2]+POW2(M2)*2, POW2(M2), POW2(M2), 1);
-		xpose(Array2d[M2]+POW2(M2)*2, 2, Array2d[M2], POW2(M2), POW2(M2), 2);
-		rffts(Array2d[M2], M2, 2);
-		cxpose(Array2d[M2], POW2(M2), data, POW2(M)/2, 1, POW2(M2));
+		cxpose(data, POW2(M)/2, work+POW2(M2)*2, POW2(M2), POW2(M2), 1);
+		xpose(work+POW2(M2)*2, 2, work, POW2(M2), POW2(M2), 2);
+		rffts(work, M2, 2);
+		cxpose(work, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
 
-		cxpose(data + 2, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 1);
-		ffts(Array2d[M2], M2, 1);
-		cxpose(Array2d[M2], POW2(M2), data + 2, POW2(M)/2, 1, POW2(M2));
+		cxpose(data + 2, POW2(M)/2, work, POW2(M2), POW2(M2), 1);
+		ffts(work, M2, 1);
+		cxpose(work, POW2(M2), data + 2, POW2(M)/2, 1, POW2(M2));
 	}
 	else{
-		cxpose(data, POW2(M)/2, Array2d[M2]+POW2(M2)*2, POW2(M2), POW2(M2), 1);
-		xpose(Array2d[M2]+POW2(M2)*2, 2, Array2d[M2], POW2(M2), POW2(M2), 2);
-		rffts(Array2d[M2], M2, 2);
-		cxpose(Array2d[M2], POW2(M2), data, POW2(M)/2, 1, POW2(M2));
+		cxpose(data, POW2(M)/2, work+POW2(M2)*2, POW2(M2), POW2(M2), 1);
+		xpose(work+POW2(M2)*2, 2, work, POW2(M2), POW2(M2), 2);
+		rffts(work, M2, 2);
+		cxpose(work, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
 
-		cxpose(data + 2, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 3);
-		ffts(Array2d[M2], M2, 3);
-		cxpose(Array2d[M2], POW2(M2), data + 2, POW2(M)/2, 3, POW2(M2));
+		cxpose(data + 2, POW2(M)/2, work, POW2(M2), POW2(M2), 3);
+		ffts(work, M2, 3);
+		cxpose(work, POW2(M2), data + 2, POW2(M)/2, 3, POW2(M2));
 		for (i1=4; i1<POW2(M)/2; i1+=4){
-			cxpose(data + i1*2, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 4);
-			ffts(Array2d[M2], M2, 4);
-			cxpose(Array2d[M2], POW2(M2), data + i1*2, POW2(M)/2, 4, POW2(M2));
+			cxpose(data + i1*2, POW2(M)/2, work, POW2(M2), POW2(M2), 4);
+			ffts(work, M2, 4);
+			cxpose(work, POW2(M2), data + i1*2, POW2(M)/2, 4, POW2(M2));
 		}
 	}
 }
@@ -306,46 +332,47 @@ else
 	rffts(data, M2+M, 1);
 }
 
-void rifft2d(float *data, int M2, int M){
+void rifft2d_work(float *data, int M2, int M, float *work){
 /* Compute 2D real ifft and return results in-place	*/
 /* The input must be in the order as outout from rfft2d */
 /* INPUTS */
 /* *data = input data array	*/
 /* M2 = log2 of fft size number of rows out */
 /* M = log2 of fft size number of columns out */
+/* *work = column storage of at least 8*pow(2,M2) floats */
 /* OUTPUTS */
 /* *data = output data array	*/
 int i1;
 if((M2>0)&&(M>0)){
 	if (M==1){
-		cxpose(data, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 1);
-		riffts(Array2d[M2], M2, 2);
-		xpose(Array2d[M2], POW2(M2), Array2d[M2]+POW2(M2)*2, 2, 2, POW2(M2));
-		cxpose(Array2d[M2]+POW2(M2)*2, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
+		cxpose(data, POW2(M)/2, work, POW2(M2), POW2(M2), 1);
+		riffts(work, M2, 2);
+		xpose(work, POW2(M2), work+POW2(M2)*2, 2, 2, POW2(M2));
+		cxpose(work+POW2(M2)*2, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
 	}
 	else if (M==2){
-		cxpose(data, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 1);
-		riffts(Array2d[M2], M2, 2);
-		xpose(Array2d[M2], POW2(M2), Array2d[M2]+POW2(M2)*2, 2, 2, POW2(M2)); 
-		cxpose(Array2d[M2]+POW2(M2)*2, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
+		cxpose(data, POW2(M)/2, work, POW2(M2), POW2(M2), 1);
+		riffts(work, M2, 2);
+		xpose(work, POW2(M2), work+POW2(M2)*2, 2, 2, POW2(M2)); 
+		cxpose(work+POW2(M2)*2, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
 
-		cxpose(data + 2, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 1);
-		iffts(Array2d[M2], M2, 1);
-		cxpose(Array2d[M2], POW2(M2), data + 2, POW2(M)/2, 1, POW2(M2));
+		cxpose(data + 2, POW2(M)/2, work, POW2(M2), POW2(M2), 1);
+		iffts(work, M2, 1);
+		cxpose(work, POW2(M2), data + 2, POW2(M)/2, 1, POW2(M2));
 	}
 	else{
-		cxpose(data, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 1);
-		riffts(Array2d[M2], M2, 2);
-		xpose(Array2d[M2], POW2(M2), Array2d[M2]+POW2(M2)*2, 2, 2, POW2(M2));
-		cxpose(Array2d[M2]+POW2(M2)*2, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
+		cxpose(data, POW2(M)/2, work, POW2(M2), POW2(M2), 1);
+		riffts(work, M2, 2);
+		xpose(work, POW2(M2), work+POW2(M2)*2, 2, 2, POW2(M2));
+		cxpose(work+POW2(M2)*2, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
 
-		cxpose(data + 2, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 3);
-		iffts(Array2d[M2], M2, 3);
-		cxpose(Array2d[M2], POW2(M2), data + 2, POW2(M)/2, 3, POW2(M2));
+		cxpose(data + 2, POW2(M)/2, work, POW2(M2), POW2(M2), 3);
+		iffts(work, M2, 3);
+		cxpose(work, POW2(M2), data + 2, POW2(M)/2, 3, POW2(M2));
 		for (i1=4; i1<POW2(M)/2; i1+=4){
-			cxpose(data + i1*2, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 4);
-			iffts(Array2d[M2], M2, 4);
-			cxpose(Array2d[M2], POW2(M2), data + i1*2, POW2(M)/2, 4, POW2(M2));
+			cxpose(data + i1*2, POW2(M)/2, work, POW2(M2), POW2(M2), 4);
+			iffts(work, M2, 4);
+			cxpose(work, POW2(M2), data + i1*2, POW2(M)/2, 4, POW2(M2));
 		}
 	}
 	riffts(data, M, POW2(M2));
@@ -354,6 +381,16 @@ else
 	riffts(data, M2+M, 1);
 }
 
+void rfft2d(float *data, int M2, int M){
+/* Compute 2D real fft and return results in-place, using the storage set up by fft2dInit */
+rfft2d_work(data, M2, M, Array2d[M2]);
+}
+
+void rifft2d(float *data, int M2, int M){
+/* Compute 2D real ifft and return results in-place, using the storage set up by fft2dInit */
+rifft2d_work(data, M2, M, Array2d[M2]);
+}
+
 void rspect2dprod(float *data1, float *data2, float *outdata, int N2, int N1){
 /* When multiplying a pair of 2d spectra from rfft2d care must be taken to multiply the*/
 /* four real values seperately from the complex ones. This routine does it correctly.*/
@@ -0,0 +1,200 @@
+/*******************************************************************
+fft_bench: times the planned FFTs (fft_plan.h) against direct fftlib
+calls, on the two shapes that matter most to the tools:
+
+  - range lines as ardop range compresses them: many rows of complex
+    samples, each transformed forward and back.
+  - fftMatch correlation chips: square 2d real transforms, forward and
+    back.
+
+The forward spectra and the inverse results are each compared with
+fftlib's, so a backend that packs, signs or scales differently from
+fftlib shows up here.  Build with "make fft_bench" in this directory;
+add FFT_BACKEND=fftw to time FFTW instead of the built-in fftlib.
+
+Usage: fft_bench [-lines <n>] [-range <n>] [-chip <n>] [-reps <n>]
+*******************************************************************/
+#include "asf.h"
+#include "fft.h"
+#include "fft2d.h"
+#include "fft_plan.h"
+#include <glib.h>
+
+/* Range lines transformed per batched FFT, as in ardop's rciq */
+#define BLOCK 16
+
+static double seconds(gint64 start)
+{
+  return (g_get_monotonic_time() - start)/1e6;
+}
+
+static int log2_int(int n)
+{
+  int m = 0;
+  while ((1 << m) < n)
+    ++m;
+  return m;
+}
+
+static void fill(float *data, int n)
+{
+  int ii;
+  for (ii=0; ii<n; ++ii)
+    data[ii] = (float)rand()/RAND_MAX - 0.5;
+}
+
+static double max_diff(const float *a, const float *b, int n)
+{
+  double d = 0;
+  int ii;
+  for (ii=0; ii<n; ++ii)
+    if (fabs(a[ii] - b[ii]) > d)
+      d = fabs(a[ii] - b[ii]);
+  return d;
+}
+
+static void bench_range(int lines, int range)
+{
+  int m = log2_int(range);
+  int size = 2*range*lines;
+  float *orig = MALLOC(sizeof(float)*size);
+  float *a = MALLOC(sizeof(float)*size);
+  float *b = MALLOC(sizeof(float)*size);
+  double t_lib, t_plan, d_fwd = 0, d_inv = 0;
+  gint64 start;
+  int ii;
+
+  fill(orig, size);
+
+  // Line at a time, the way ardop used to
+  memcpy(a, orig, sizeof(float)*size);
+  fftInit(m);
+  start = g_get_monotonic_time();
+  for (ii=0; ii<lines; ++ii)
+    ffts(a + (size_t)2*ii*range, m, 1);
+  t_lib = seconds(start);
+
+  // Batched and planned
+  memcpy(b, orig, sizeof(float)*size);
+  start = g_get_monotonic_time();
+  for (ii=0; ii<lines; ii+=BLOCK) {
+    int n = MIN(BLOCK, lines - ii);
+    fft_execute(fft_plan_1d(FFT_COMPLEX, FFT_FORWARD, range, n, 1, range),
+                b + (size_t)2*ii*range);
+  }
+  t_plan = seconds(start);
+  d_fwd = max_diff(a, b, size);
+
+  start = g_get_monotonic_time();
+  for (ii=0; ii<lines; ++ii)
+    iffts(a + (size_t)2*ii*range, m, 1);
+  t_lib += seconds(start);
+
+  start = g_get_monotonic_time();
+  for (ii=0; ii<lines; ii+=BLOCK) {
+    int n = MIN(BLOCK, lines - ii);
+    fft_execute(fft_plan_1d(FFT_COMPLEX, FFT_INVERSE, range, n, 1, range),
+                b + (size_t)2*ii*range);
+  }
+  t_plan += seconds(start);
+  d_inv = max_diff(a, b, size);
+
+  printf("Range lines, %d x %d complex, forward and inverse:\n", lines, range);
+  printf("  fftlib, line by line:   %8.3f s\n", t_lib);
+  printf("  %-6s, batches of %2d: %8.3f s  (%.2fx)\n", fft_backend(), BLOCK,
+         t_plan, t_lib/t_plan);
+  printf("  largest difference, forward: %g  inverse: %g\n\n", d_fwd, d_inv);
+
+  FREE(orig);
+  FREE(a);
+  FREE(b);
+}
+
+static void bench_chip(int chip, int reps)
+{
+  int m = log2_int(chip);
+  int size = chip*chip;
+  float *orig = MALLOC(sizeof(float)*size);
+  float *a = MALLOC(sizeof(float)*size);
+  float *b = MALLOC(sizeof(float)*size);
+  double t_lib, t_plan, d_fwd = 0, d_inv = 0;
+  gint64 start;
+  int ii;
+
+  fill(orig, size);
+
+  // Each rep starts over from the same data, so that the last one
+  // leaves both spectra and both inverses to compare
+  fft2dInit(m, m);
+  t_lib = t_plan = 0;
+  for (ii=0; ii<reps; ++ii) {
+    memcpy(a, orig, sizeof(float)*size);
+    start = g_get_monotonic_time();
+    rfft2d(a, m, m);
+    t_lib += seconds(start);
+
+    memcpy(b, orig, sizeof(float)*size);
+    start = g_get_monotonic_time();
+    fft_execute(fft_plan_2d(FFT_REAL, FFT_FORWARD, chip, chip), b);
+    t_plan += seconds(start);
+    d_fwd = max_diff(a, b, size);
+
+    start = g_get_monotonic_time();
+    rifft2d(a, m, m);
+    t_lib += seconds(start);
+
+    start = g_get_monotonic_time();
+    fft_execute(fft_plan_2d(FFT_REAL, FFT_INVERSE, chip, chip), b);
+    t_plan += seconds(start);
+    d_inv = max_diff(a, b, size);
+  }
+
+  printf("Correlation chips, %d x %d real, forward and inverse, %d times:\n",
+         chip, chip, reps);
+  printf("  fftlib rfft2d:   %8.3f s\n", t_lib);
+  printf("  %-6s planned:  %8.3f s  (%.2fx)\n", fft_backend(), t_plan,
+         t_lib/t_plan);
+  printf("  largest difference, forward: %g  inverse: %g\n\n", d_fwd, d_inv);
+
+  FREE(orig);
+  FREE(a);
+  FREE(b);
+}
+
+static void usage(void)
+{
+  printf("Usage: fft_bench [-lines <n>] [-range <n>] [-chip <n>] [-reps <n>]\n"
+         "  -lines  range lines to transform (default 4096)\n"
+         "  -range  range FFT length (default 8192)\n"
+         "  -chip   correlation chip size (default 512)\n"
+         "  -reps   chip transforms to time (default 20)\n"
+         "Sizes must be powers of 2.\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  int lines = 4096, range = 8192, chip = 512, reps = 20;
+  int ii;
+
+  for (ii=1; ii<argc; ++ii) {
+    if (ii+1 >= argc)
+      usage();
+    if (strcmp(argv[ii], "-lines") == 0) lines = atoi(argv[++ii]);
+    else if (strcmp(argv[ii], "-range") == 0) range = atoi(argv[++ii]);
+    else if (strcmp(argv[ii], "-chip") == 0) chip = atoi(argv[++ii]);
+    else if (strcmp(argv[ii], "-reps") == 0) reps = atoi(argv[++ii]);
+    else usage();
+  }
+  if (lines < 1 || reps < 1 || range < 4 || chip < 4 ||
+      (1 << log2_int(range)) != range || (1 << log2_int(chip)) != chip)
+    usage();
+
+  printf("FFT backend: %s\n\n", fft_backend());
+  bench_range(lines, range);
+  bench_chip(chip, reps);
+
+  fft_plan_cleanup();
+  fft2dFree();
+  return 0;
+}
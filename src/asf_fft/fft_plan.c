@@ -0,0 +1,445 @@
+/*******************************************************************
+Planned, cached fft's on top of either fftlib or FFTW (see fft_plan.h).
+
+Plans are kept on a list and looked up by their shape, so callers can
+ask for a plan wherever they need one without keeping it around
+themselves.  Planning happens under a lock, since neither fftInit nor
+the FFTW planner may run in two threads at once; executing a plan
+touches nothing shared, so it doesn't need the lock.
+
+With FFTW the real transforms are done out of place into a scratch
+spectrum, which is then packed into the layout rffts/rfft2d use (and
+unpacked again, filling in the conjugate symmetric half, for the
+inverse), so callers see the same data whichever backend is built.
+*******************************************************************/
+#include "asf.h"
+#include "fft.h"
+#include "fft2d.h"
+#include "fft_plan.h"
+#include <glib.h>
+#include <string.h>
+#ifdef ASF_FFT_FFTW
+#include <fftw3.h>
+#endif
+
+struct fft_plan {
+  int type, dir;
+  int rank;		/* 1 or 2 */
+  int n;		/* transform size, number of columns for 2d */
+  int rows;		/* number of rows for 2d, 1 for 1d */
+  int howmany, stride, dist;
+  int m, m2;		/* log2 of n and rows */
+#ifdef ASF_FFT_FFTW
+  fftwf_plan fftw;
+#endif
+  struct fft_plan *next;
+};
+
+G_LOCK_DEFINE_STATIC(fft_plans);
+static fft_plan *plans = NULL;
+
+static int log2_size(int n)
+{
+  int m = 0;
+
+  while ((1 << m) < n)
+    ++m;
+  if (n < 1 || (1 << m) != n)
+    asfPrintError("FFT sizes must be powers of 2, not %d\n", n);
+  return m;
+}
+
+static int same_shape(const fft_plan *a, const fft_plan *b)
+{
+  return a->type == b->type && a->dir == b->dir && a->rank == b->rank &&
+    a->n == b->n && a->rows == b->rows && a->howmany == b->howmany &&
+    a->stride == b->stride && a->dist == b->dist;
+}
+
+#ifdef ASF_FFT_FFTW
+
+const char *fft_backend(void)
+{
+  return "fftw";
+}
+
+// Complex values in the scratch spectrum of a real transform
+static size_t spectrum_size(const fft_plan *p)
+{
+  return (size_t)p->rows * p->howmany * (p->n/2 + 1);
+}
+
+static void backend_plan(fft_plan *p)
+{
+  unsigned flags = FFTW_ESTIMATE | FFTW_UNALIGNED;
+  int sign = p->dir == FFT_FORWARD ? FFTW_FORWARD : FFTW_BACKWARD;
+  int n = p->n;
+  size_t len;
+
+  // FFTW_ESTIMATE leaves the arrays alone, they are only needed to
+  // tell the planner where the data will go
+  if (p->rank == 2)
+    len = (size_t)p->rows * n;
+  else
+    len = (size_t)(p->howmany - 1)*p->dist + (size_t)(n - 1)*p->stride + 1;
+
+  if (p->type == FFT_COMPLEX) {
+    fftwf_complex *buf = fftwf_malloc(sizeof(fftwf_complex)*len);
+    if (p->rank == 2)
+      p->fftw = fftwf_plan_dft_2d(p->rows, n, buf, buf, sign, flags);
+    else
+      p->fftw = fftwf_plan_many_dft(1, &n, p->howmany,
+                                    buf, NULL, p->stride, p->dist,
+                                    buf, NULL, p->stride, p->dist,
+                                    sign, flags);
+    fftwf_free(buf);
+  }
+  else {
+    float *r = fftwf_malloc(sizeof(float)*len);
+    fftwf_complex *c = fftwf_malloc(sizeof(fftwf_complex)*spectrum_size(p));
+    if (p->rank == 2 && p->dir == FFT_FORWARD)
+      p->fftw = fftwf_plan_dft_r2c_2d(p->rows, n, r, c, flags);
+    else if (p->rank == 2)
+      p->fftw = fftwf_plan_dft_c2r_2d(p->rows, n, c, r, flags);
+    else if (p->dir == FFT_FORWARD)
+      p->fftw = fftwf_plan_many_dft_r2c(1, &n, p->howmany,
+                                        r, NULL, 1, p->dist,
+                                        c, NULL, 1, n/2 + 1, flags);
+    else
+      p->fftw = fftwf_plan_many_dft_c2r(1, &n, p->howmany,
+                                        c, NULL, 1, n/2 + 1,
+                                        r, NULL, 1, p->dist, flags);
+    fftwf_free(r);
+    fftwf_free(c);
+  }
+
+  if (!p->fftw)
+    asfPrintError("FFTW could not plan a %dx%d transform\n", p->rows, n);
+}
+
+static void backend_destroy(fft_plan *p)
+{
+  fftwf_destroy_plan(p->fftw);
+}
+
+// The half spectrum Y (n/2+1 values) of a real row, packed as rffts
+// leaves it: Re Y[0], Re Y[n/2], then Y[1] .. Y[n/2-1]
+static void pack_1d(const fftwf_complex *Y, float *out, int n)
+{
+  int k;
+
+  out[0] = Y[0][0];
+  out[1] = Y[n/2][0];
+  for (k=1; k<n/2; ++k) {
+    out[2*k] = Y[k][0];
+    out[2*k+1] = Y[k][1];
+  }
+}
+
+static void unpack_1d(const float *in, fftwf_complex *Y, int n)
+{
+  int k;
+
+  Y[0][0] = in[0];
+  Y[0][1] = 0;
+  Y[n/2][0] = in[1];
+  Y[n/2][1] = 0;
+  for (k=1; k<n/2; ++k) {
+    Y[k][0] = in[2*k];
+    Y[k][1] = in[2*k+1];
+  }
+}
+
+// rfft2d's layout, seen as a rows x cols/2 complex array D: column c>0
+// is Y's column c.  Y's columns 0 and cols/2 are the spectra of real
+// columns, so only their first halves are kept, packed as rffts does
+// (Re Y[0][x], Re Y[rows/2][x], Y[1][x] .. Y[rows/2-1][x]): the kx=0
+// one in the top half of D's column 0, the kx=cols/2 one below it.
+static void pack_2d(const fftwf_complex *Y, float *out, int rows, int cols)
+{
+  int h = cols/2 + 1, nyq = cols/2;
+  int r, c, k;
+
+  for (r=0; r<rows; ++r) {
+    const fftwf_complex *y = Y + (size_t)r*h;
+    float *d = out + (size_t)r*cols;
+    for (c=1; c<cols/2; ++c) {
+      d[2*c] = y[c][0];
+      d[2*c+1] = y[c][1];
+    }
+  }
+  for (k=1; k<rows/2; ++k) {
+    float *top = out + (size_t)k*cols;
+    float *bottom = out + (size_t)(rows/2 + k)*cols;
+    top[0] = Y[(size_t)k*h][0];
+    top[1] = Y[(size_t)k*h][1];
+    bottom[0] = Y[(size_t)k*h + nyq][0];
+    bottom[1] = Y[(size_t)k*h + nyq][1];
+  }
+  out[0] = Y[0][0];
+  out[1] = Y[(size_t)rows/2*h][0];
+  out[(size_t)rows/2*cols] = Y[nyq][0];
+  out[(size_t)rows/2*cols + 1] = Y[(size_t)rows/2*h + nyq][0];
+}
+
+static void unpack_2d(const float *in, fftwf_complex *Y, int rows, int cols)
+{
+  int h = cols/2 + 1, nyq = cols/2;
+  int r, c, k;
+
+  for (r=0; r<rows; ++r) {
+    fftwf_complex *y = Y + (size_t)r*h;
+    const float *d = in + (size_t)r*cols;
+    for (c=1; c<cols/2; ++c) {
+      y[c][0] = d[2*c];
+      y[c][1] = d[2*c+1];
+    }
+  }
+  for (k=1; k<rows/2; ++k) {
+    const float *top = in + (size_t)k*cols;
+    const float *bottom = in + (size_t)(rows/2 + k)*cols;
+    fftwf_complex *y = Y + (size_t)k*h;
+    fftwf_complex *ym = Y + (size_t)(rows - k)*h;
+    y[0][0] = top[0];
+    y[0][1] = top[1];
+    ym[0][0] = top[0];
+    ym[0][1] = -top[1];
+    y[nyq][0] = bottom[0];
+    y[nyq][1] = bottom[1];
+    ym[nyq][0] = bottom[0];
+    ym[nyq][1] = -bottom[1];
+  }
+  Y[0][0] = in[0];
+  Y[0][1] = 0;
+  Y[(size_t)rows/2*h][0] = in[1];
+  Y[(size_t)rows/2*h][1] = 0;
+  Y[nyq][0] = in[(size_t)rows/2*cols];
+  Y[nyq][1] = 0;
+  Y[(size_t)rows/2*h + nyq][0] = in[(size_t)rows/2*cols + 1];
+  Y[(size_t)rows/2*h + nyq][1] = 0;
+}
+
+static void scale_row(float *data, size_t count, size_t step, float scale)
+{
+  size_t ii;
+
+  for (ii=0; ii<count; ++ii)
+    data[ii*step] *= scale;
+}
+
+static void backend_execute(const fft_plan *p, float *data)
+{
+  float scale = 1.0/((float)p->rows * p->n);
+  int n = p->n, j;
+
+  if (p->type == FFT_COMPLEX) {
+    fftwf_execute_dft(p->fftw, (fftwf_complex *)data, (fftwf_complex *)data);
+    if (p->dir == FFT_INVERSE) {
+      if (p->rank == 2 || (p->stride == 1 && p->dist == n))
+        scale_row(data, (size_t)2*p->rows*p->howmany*n, 1, scale);
+      else
+        for (j=0; j<p->howmany; ++j) {
+          float *row = data + (size_t)2*j*p->dist;
+          scale_row(row, n, 2*p->stride, scale);
+          scale_row(row + 1, n, 2*p->stride, scale);
+        }
+    }
+  }
+  else {
+    fftwf_complex *spec = fftwf_malloc(sizeof(fftwf_complex)*spectrum_size(p));
+    if (p->dir == FFT_FORWARD) {
+      fftwf_execute_dft_r2c(p->fftw, data, spec);
+      if (p->rank == 2)
+        pack_2d(spec, data, p->rows, n);
+      else
+        for (j=0; j<p->howmany; ++j)
+          pack_1d(spec + (size_t)j*(n/2 + 1), data + (size_t)j*p->dist, n);
+    }
+    else {
+      if (p->rank == 2)
+        unpack_2d(data, spec, p->rows, n);
+      else
+        for (j=0; j<p->howmany; ++j)
+          unpack_1d(data + (size_t)j*p->dist, spec + (size_t)j*(n/2 + 1), n);
+      fftwf_execute_dft_c2r(p->fftw, spec, data);
+      if (p->rank == 2)
+        scale_row(data, (size_t)p->rows*n, 1, scale);
+      else
+        for (j=0; j<p->howmany; ++j)
+          scale_row(data + (size_t)j*p->dist, n, 1, scale);
+    }
+    fftwf_free(spec);
+  }
+}
+
+#else
+
+const char *fft_backend(void)
+{
+  return "fftlib";
+}
+
+static void backend_plan(fft_plan *p)
+{
+  if (fftInit(p->m) != 0 || (p->rank == 2 && fftInit(p->m2) != 0))
+    asfPrintError("Could not set up the tables for a %dx%d FFT\n",
+                  p->rows, p->n);
+}
+
+static void backend_destroy(fft_plan *p)
+{
+  // The tables are fftlib's and may be shared with other callers
+}
+
+static void backend_execute(const fft_plan *p, float *data)
+{
+  int forward = p->dir == FFT_FORWARD;
+  int n = p->n, j, k;
+
+  if (p->rank == 2) {
+    // Column storage for the transposes, see rfft2d_work()
+    float *work = MALLOC(sizeof(float)*8*p->rows);
+    if (p->type == FFT_COMPLEX && forward)
+      fft2d_work(data, p->m2, p->m, work);
+    else if (p->type == FFT_COMPLEX)
+      ifft2d_work(data, p->m2, p->m, work);
+    else if (forward)
+      rfft2d_work(data, p->m2, p->m, work);
+    else
+      rifft2d_work(data, p->m2, p->m, work);
+    FREE(work);
+  }
+  else if (p->type == FFT_REAL) {
+    if (p->dist == n) {
+      if (forward) rffts(data, p->m, p->howmany);
+      else riffts(data, p->m, p->howmany);
+    }
+    else
+      for (j=0; j<p->howmany; ++j) {
+        if (forward) rffts(data + (size_t)j*p->dist, p->m, 1);
+        else riffts(data + (size_t)j*p->dist, p->m, 1);
+      }
+  }
+  else if (p->stride == 1 && p->dist == n) {
+    if (forward) ffts(data, p->m, p->howmany);
+    else iffts(data, p->m, p->howmany);
+  }
+  else {
+    // Gather each strided transform into a contiguous row and back
+    float *buf = MALLOC(sizeof(float)*2*n);
+    for (j=0; j<p->howmany; ++j) {
+      float *t = data + (size_t)2*j*p->dist;
+      for (k=0; k<n; ++k) {
+        buf[2*k] = t[(size_t)2*k*p->stride];
+        buf[2*k+1] = t[(size_t)2*k*p->stride + 1];
+      }
+      if (forward) ffts(buf, p->m, 1);
+      else iffts(buf, p->m, 1);
+      for (k=0; k<n; ++k) {
+        t[(size_t)2*k*p->stride] = buf[2*k];
+        t[(size_t)2*k*p->stride + 1] = buf[2*k+1];
+      }
+    }
+    FREE(buf);
+  }
+}
+
+#endif
+
+static fft_plan *get_plan(const fft_plan *shape)
+{
+  fft_plan *p;
+
+  G_LOCK(fft_plans);
+  for (p=plans; p; p=p->next)
+    if (same_shape(p, shape))
+      break;
+  if (!p) {
+    p = MALLOC(sizeof(fft_plan));
+    *p = *shape;
+    backend_plan(p);
+    p->next = plans;
+    plans = p;
+  }
+  G_UNLOCK(fft_plans);
+
+  return p;
+}
+
+static void check_type(int type, int dir)
+{
+  if (type != FFT_COMPLEX && type != FFT_REAL)
+    asfPrintError("Unknown FFT type %d\n", type);
+  if (dir != FFT_FORWARD && dir != FFT_INVERSE)
+    asfPrintError("Unknown FFT direction %d\n", dir);
+}
+
+fft_plan *fft_plan_1d(int type, int dir, int N, int howmany, int stride,
+                      int dist)
+{
+  fft_plan shape;
+
+  check_type(type, dir);
+  if (howmany < 1 || stride < 1 || dist < 0)
+    asfPrintError("Bad FFT batch: %d transforms, stride %d, distance %d\n",
+                  howmany, stride, dist);
+  if (type == FFT_REAL && (stride != 1 || N < 2 || (howmany > 1 && dist < N)))
+    asfPrintError("Real FFTs must be at least 2 points long and stored "
+                  "in separate rows\n");
+
+  memset(&shape, 0, sizeof(shape));
+  shape.type = type;
+  shape.dir = dir;
+  shape.rank = 1;
+  shape.n = N;
+  shape.rows = 1;
+  shape.howmany = howmany;
+  shape.stride = stride;
+  shape.dist = howmany > 1 ? dist : (type == FFT_REAL ? N : N*stride);
+  shape.m = log2_size(N);
+
+  return get_plan(&shape);
+}
+
+fft_plan *fft_plan_2d(int type, int dir, int rows, int cols)
+{
+  fft_plan shape;
+
+  check_type(type, dir);
+  if (type == FFT_REAL && (rows < 2 || cols < 2))
+    asfPrintError("Real 2d FFTs must be at least 2x2, not %dx%d\n",
+                  rows, cols);
+
+  memset(&shape, 0, sizeof(shape));
+  shape.type = type;
+  shape.dir = dir;
+  shape.rank = 2;
+  shape.n = cols;
+  shape.rows = rows;
+  shape.howmany = 1;
+  shape.stride = 1;
+  shape.dist = cols;
+  shape.m = log2_size(cols);
+  shape.m2 = log2_size(rows);
+
+  return get_plan(&shape);
+}
+
+void fft_execute(const fft_plan *plan, float *data)
+{
+  backend_execute(plan, data);
+}
+
+void fft_plan_cleanup(void)
+{
+  fft_plan *p, *next;
+
+  G_LOCK(fft_plans);
+  for (p=plans; p; p=next) {
+    next = p->next;
+    backend_destroy(p);
+    FREE(p);
+  }
+  plans = NULL;
+  G_UNLOCK(fft_plans);
+}
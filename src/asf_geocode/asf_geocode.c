@@ -26,8 +26,8 @@ trouble, and use edit_man_header. :)
 "             [-force] [-resample-method <method>] [-height <height>]\n"\
 "             [-datum <datum>] [-pixel-size <pixel size>] [-band <band_id | all>]\n"\
 "             [-log <file>] [-write-proj-file <file>] [-read-proj-file <file>]\n"\
-"             [-save-mapping] [-background <value>] [-quiet] [-license]\n"\
-"             [-version] [-help]\n"\
+"             [-save-mapping] [-background <value>] [-threads <count>]\n"\
+"             [-quiet] [-license] [-version] [-help]\n"\
 "             <in_base_name> <out_base_name>\n"\
 "\n"\
 "   Use the -help option for more projection parameter controls.\n"
@@ -58,6 +58,10 @@ trouble, and use edit_man_header. :)
 "          original file, the other the sample numbers.  Together, these\n"\
 "          define the mapping of pixels performed by the geocoding.\n"\
 "\n"\
+"     -threads <count>\n"\
+"          Resample the image using this many threads.  Use 0 for one\n"\
+"          thread per processor.  The default is 1.\n"\
+"\n"\
 "     -log <log file>\n"\
 "          Output will be written to a specified log file.\n"\
 "\n"\
@@ -189,6 +193,8 @@ main (int argc, char **argv)
   double background_val = 0.0;
   // Should we save the mapping files?
   int save_map_flag;
+  // Number of threads to resample with
+  int thread_count = 1;
 
   if (detect_flag_options(argc, argv, "-help", "--help", "-h", NULL)) {
     print_help();
@@ -205,6 +211,8 @@ main (int argc, char **argv)
   }
   quietflag = detect_flag_options(argc, argv, "-quiet", "--quiet", NULL);
   save_map_flag = extract_flag_options(&argc, &argv, "-save-mapping", "--save_mapping", NULL);
+  extract_int_options(&argc, &argv, &thread_count, "-threads", "--threads", NULL);
+  asf_geocode_set_thread_count(thread_count);
 
   handle_license_and_version_args(argc, argv, ASF_NAME_STRING);
 
@@ -2,11 +2,12 @@
 NAME: asf_igram_coh - Calculates an interferogram, a coherence image and
                       multilooks interfergram
 
-SYNOPSIS: asf_igram_coh [-look linexsamp] [-step linexsample]
+SYNOPSIS: asf_igram_coh [-look linexsamp] [-step linexsample] [-two-band]
              <master> <slave> <output>
 
         -look   Set look box line and sample.  Default 15x3
         -step   Set step boc line and sample.  Default 5x1
+        -two-band  Also write two-band (amplitude and phase) interferograms
         master  Complex master image
         slave   Complex slave image
         output  Basename of the output files
@@ -45,7 +46,7 @@ DESCRIPTION:
 *									      *
 ******************************************************************************/
 
-#define VERSION 1.0
+#define VERSION 1.1
 
 #include "asf.h"
 #include "asf_meta.h"
@@ -55,7 +56,8 @@ void usage(char *name)
 {
  printf("\n"
 	"USAGE:\n"
-	"   %s [-look lxs] [-step lxs] <master> <slave> <output>\n",name);
+	"   %s [-look lxs] [-step lxs] [-two-band] <master> <slave> <output>\n",
+	name);
  printf("\n"
 	"REQUIRED ARGUMENTS:\n"
 	"   master   Complex master image\n"
@@ -65,7 +67,10 @@ void usage(char *name)
 	"   -look lxs   Change look box (l)ine and (s)ample.\n"
 	"               (Read from meta file by default)\n"
 	"   -step lxs   change step box (l)ine and (s)ample.\n"
-	"               (Read from meta file by default)\n");
+	"               (Read from meta file by default)\n"
+	"   -two-band   Also write the single-look and multilooked\n"
+	"               interferograms as two-band images (amplitude and\n"
+	"               phase), <output>_igram.img and <output>_igram_ml.img\n");
  printf("\n"
 	"DESCRIPTION:\n"
 	"   A correlation calculator to estimate interferogram quality\n");
@@ -80,6 +85,7 @@ int main(int argc, char *argv[])
   char masterFile[255], slaveFile[255], outFile[255];
   int sample_count, line_count;
   int stepLine, stepSample, lookLine, lookSample, lookFlag=FALSE, stepFlag=FALSE;
+  int products = IGRAM_DEFAULT;
   meta_parameters *inMeta;
 
   logflag = 0;
@@ -111,6 +117,9 @@ int main(int argc, char *argv[])
       }
       stepFlag=TRUE;
     }
+    else if (strmatch(key,"-two-band")) {
+      products |= IGRAM_TWO_BAND | IGRAM_ML_TWO_BAND;
+    }
     else {printf("\n   ***Invalid option:  %s\n",argv[currArg-1]); usage(argv[0]);}
   }
   if ((argc-currArg) < 3) {printf("   Insufficient arguments.\n"); usage(argv[0]);}
@@ -145,8 +154,8 @@ int main(int argc, char *argv[])
 
   // Call the library function to get the work done
   float average;
-  asf_igram_coh(lookLine, lookSample, stepLine, stepSample, 
-		masterFile, slaveFile, outFile, &average);
+  asf_igram_coh_ext(lookLine, lookSample, stepLine, stepSample,
+		    masterFile, slaveFile, outFile, products, &average);
 
   return(0);
 }
@@ -39,7 +39,7 @@
 /* There are some different versions of the metadata files around.
    This token defines the current version, which this header is
    designed to correspond with.  */
-#define META_VERSION 3.6
+#define META_VERSION 3.7
 
 /******************** Metadata Utilities ***********************/
 /*  These structures are used by the meta_get* routines.
@@ -68,6 +68,12 @@
 // Flag to write ENVI header files for all viewable images
 extern int dump_envi_header;
 
+// Byte order of image files
+typedef enum {
+  BIG_ENDIAN_DATA=0,
+  LITTLE_ENDIAN_DATA
+} data_byte_order_t;
+
 typedef enum {
   RAW_IMAGE=1,
   COMPLEX_IMAGE,
@@ -208,6 +214,13 @@ typedef struct {
   double bit_error_rate;     /* Fraction of bits which are in error.       */
   int missing_lines;         /* Number of missing lines in data take       */
   float no_data;             /* Value indicating no data for this pixel    */
+  data_byte_order_t byte_order; // version 3.7
+  /* Byte order of the samples in the image file. Images are big endian
+   * unless they say otherwise. Little endian images are only understood by
+   * the line I/O routines (get_float_line etc.) and by FloatImage, so only
+   * request them for files that are always read and written that way.
+   * meta_copy sets it back to big endian, since a copy usually describes
+   * a new image, and most writers only write big endian.               */
 } meta_general;
 
 
@@ -557,6 +570,9 @@ typedef struct {
 	double integrated_sidelobe_ratio;
 } meta_quality;
 
+/* Cached per-column range geometry, private to meta_get.c */
+struct meta_geometry;
+
 /********************************************************************
  * General ASF metadta structure.  Collection of all above.
  */
@@ -581,6 +597,7 @@ typedef struct {
   meta_dem           *dem;             // Can be NULL
   meta_latlon        *latlon;          // Can be NULL
   meta_quality       *quality;         // Can be NULL
+  struct meta_geometry *geometry;      // Can be NULL, see meta_get.c
     /* Deprecated elements from old metadata format.  */
   meta_state_vectors *stVec;         /* Can be NULL (check!).  */
   geo_parameters  *geo;
@@ -707,6 +724,14 @@ double meta_look(meta_parameters *sar,double y,double x);
 double slant_from_incid(double incid,double er,double ht);
 double look_from_incid(double incid,double er,double ht);
 
+/* meta_get_slant (for ground range images), meta_incid and meta_look
+   keep a table of their values at each sample of a slant or ground range
+   image, when the earth radius and satellite height are fixed in the
+   metadata, and answer from it at whole-numbered samples.  The table
+   notices edits to the fields it was built from and rebuilds itself;
+   this drops it explicitly. */
+void meta_geometry_invalidate(meta_parameters *meta);
+
 /************* Geolocation ***********************
 Geolocation Calls: in meta_get_geo.c.
 Here, latitude and longitude are always in degrees.*/
@@ -5,7 +5,6 @@ io_util:
 
 #include "asf.h"
 #include "asf_meta.h"
-#include "asf_endian.h"
 #include "asf_complex.h"
 
 /*******************************************************************************
@@ -33,28 +32,172 @@ int data_type2sample_size(int data_type)
 }
 
 
+/*******************************************************************************
+ * Sample conversion kernels. Samples of the simple type src_type are converted
+ * to dest_type with a plain C cast. Complex data is handled as twice as many
+ * samples of the corresponding simple type. The switches are outside the loops,
+ * so each loop is a straight run the compiler can vectorize. */
+
+/* Size in bytes of the chunks used when data has to be converted on its way to
+ * or from the file. Chunks live on the stack, so the I/O routines need no heap
+ * memory and are safe to use from several threads on different files. */
+#define CONVERSION_CHUNK_BYTES 32768
+
+/* Simple data type making up one element of a (possibly complex) data type */
+static int element_type(int data_type)
+{
+  return (data_type >= COMPLEX_BYTE) ? data_type - COMPLEX_BYTE + ASF_BYTE
+                                     : data_type;
+}
+
+/* Number of elements per sample of data_type */
+static int elements_per_sample(int data_type)
+{
+  return (data_type >= COMPLEX_BYTE) ? 2 : 1;
+}
+
+/* True iff the samples of the image described by meta have to be byte swapped
+ * on the way to or from the host. Images are big endian unless the metadata
+ * says otherwise. */
+static int needs_byte_swap(meta_parameters *meta)
+{
+  const int one = 1;
+  int host_is_little_endian = *((const char *) &one);
+  return host_is_little_endian != (meta->general->byte_order == LITTLE_ENDIAN_DATA);
+}
+
+/* Reverse the byte order of count elements of element_size bytes each. */
+static void swap_elements(void *buffer, size_t element_size, size_t count)
+{
+  size_t ii;
+  switch (element_size) {
+    case 2:
+      {
+        unsigned short *p = (unsigned short *) buffer;
+        for (ii=0; ii<count; ii++)
+          p[ii] = (unsigned short) ((p[ii] >> 8) | (p[ii] << 8));
+      }
+      break;
+    case 4:
+      {
+        unsigned int *p = (unsigned int *) buffer;
+        for (ii=0; ii<count; ii++)
+          p[ii] = ((p[ii] >> 24) | ((p[ii] >> 8) & 0xff00) |
+                   ((p[ii] << 8) & 0xff0000) | (p[ii] << 24));
+      }
+      break;
+    case 8:
+      {
+        unsigned long long *p = (unsigned long long *) buffer;
+        for (ii=0; ii<count; ii++) {
+          unsigned long long v = p[ii];
+          v = ((v >> 8) & 0x00ff00ff00ff00ffULL) | ((v & 0x00ff00ff00ff00ffULL) << 8);
+          v = ((v >> 16) & 0x0000ffff0000ffffULL) | ((v & 0x0000ffff0000ffffULL) << 16);
+          p[ii] = (v >> 32) | (v << 32);
+        }
+      }
+      break;
+  }
+}
+
+#define CONVERT_ELEMENTS(SRC_T, DEST_T) \
+  { \
+    const SRC_T *s = (const SRC_T *) src; \
+    DEST_T *d = (DEST_T *) dest; \
+    for (ii=0; ii<count; ii++) \
+      d[ii] = (DEST_T) s[ii]; \
+  }
+
+#define CONVERT_ELEMENTS_FROM(SRC_T) \
+  switch (dest_type) { \
+    case ASF_BYTE:  CONVERT_ELEMENTS(SRC_T, unsigned char); break; \
+    case INTEGER16: CONVERT_ELEMENTS(SRC_T, short int); break; \
+    case INTEGER32: CONVERT_ELEMENTS(SRC_T, int); break; \
+    case REAL32:    CONVERT_ELEMENTS(SRC_T, float); break; \
+    case REAL64:    CONVERT_ELEMENTS(SRC_T, double); break; \
+  }
+
+/* Convert count elements of simple type src_type to simple type dest_type. */
+static void convert_elements(const void *src, int src_type,
+                             void *dest, int dest_type, size_t count)
+{
+  size_t ii;
+  switch (src_type) {
+    case ASF_BYTE:  CONVERT_ELEMENTS_FROM(unsigned char); break;
+    case INTEGER16: CONVERT_ELEMENTS_FROM(short int); break;
+    case INTEGER32: CONVERT_ELEMENTS_FROM(int); break;
+    case REAL32:    CONVERT_ELEMENTS_FROM(float); break;
+    case REAL64:    CONVERT_ELEMENTS_FROM(double); break;
+  }
+}
+
+/*******************************************************************************
+ * Read num_samples samples of data_type from the current position in file into
+ * dest, converting them to dest_data_type and to the native byte order. When no
+ * conversion is needed, the data is read straight into dest. Returns the number
+ * of samples read. */
+static int get_sample_run(FILE *file, int data_type, int swap, int num_samples,
+                          void *dest, int dest_data_type)
+{
+  int src_type = element_type(data_type);
+  int dest_type = element_type(dest_data_type);
+  int per_sample = elements_per_sample(data_type);
+  size_t element_size = data_type2sample_size(src_type);
+  size_t sample_size = element_size * per_sample;
+  int samples_gotten = 0;
+
+  if (src_type == dest_type) {
+    samples_gotten = ASF_FREAD(dest, sample_size, num_samples, file);
+    if (swap && element_size > 1)
+      swap_elements(dest, element_size, (size_t) samples_gotten * per_sample);
+    return samples_gotten;
+  }
+
+  double chunk[CONVERSION_CHUNK_BYTES / sizeof(double)];
+  int chunk_samples = CONVERSION_CHUNK_BYTES / sample_size;
+  size_t dest_sample_size = data_type2sample_size(dest_data_type);
+  while (samples_gotten < num_samples) {
+    int count = num_samples - samples_gotten;
+    if (count > chunk_samples)
+      count = chunk_samples;
+    int got = ASF_FREAD(chunk, sample_size, count, file);
+    if (swap && element_size > 1)
+      swap_elements(chunk, element_size, (size_t) got * per_sample);
+    convert_elements(chunk, src_type,
+                     (char *) dest + (size_t) samples_gotten * dest_sample_size,
+                     dest_type, (size_t) got * per_sample);
+    samples_gotten += got;
+    if (got < count)
+      break;
+  }
+
+  return samples_gotten;
+}
+
 /*******************************************************************************
  * Get x number of lines of data (any data type) and fill a pre-allocated array
- * with it. The data is assumed to be in big endian format and will be converted
- * to the native machine's format. The line_number argument is the zero-indexed
- * line number to get. The dest argument must be a pointer to existing memory.
- * Returns the amount of samples successfully read & converted. */
+ * with it. The data is assumed to be in big endian format (unless the metadata
+ * says it is little endian) and will be converted to the native machine's
+ * format. The line_number argument is the zero-indexed line number to get. The
+ * dest argument must be a pointer to existing memory. Full lines are read with
+ * a single seek and read. Returns the amount of samples successfully read &
+ * converted. */
 int get_data_lines(FILE *file, meta_parameters *meta,
        int line_number, int num_lines_to_get,
        int sample_number, int num_samples_to_get,
        void *dest, int dest_data_type)
 {
-  int ii;               /* Sample index.  */
+  int ii;               /* Line index.  */
   int samples_gotten=0; /* Number of samples retrieved */
-  int line_samples_gotten;
   size_t sample_size;   /* Sample size in bytes.  */
-  void *temp_buffer;    /* Buffer for unconverted data.  */
+  size_t dest_sample_size;
   int sample_count = meta->general->sample_count;
   int line_count = meta->general->line_count;
   int band_count = meta->general->band_count;
   int data_type    = meta->general->data_type;
   int num_lines_left = line_count * band_count - line_number;
   int num_samples_left = sample_count - sample_number;
+  int swap = needs_byte_swap(meta);
   long long offset;
 
   // Check whether data conversion is possible
@@ -84,12 +227,17 @@ int get_data_lines(FILE *file, meta_parameters *meta,
 
   /* Determine sample size.  */
   sample_size = data_type2sample_size(data_type);
+  dest_sample_size = data_type2sample_size(dest_data_type);
 
-  temp_buffer = MALLOC( sample_size * num_lines_to_get * num_samples_to_get);
-
+  // Whole lines lie one after the other in the file, so they can be read
+  // in one go.
+  int contiguous = (num_samples_to_get == sample_count);
+  int runs = contiguous ? 1 : num_lines_to_get;
+  int run_samples = contiguous ? num_lines_to_get * num_samples_to_get
+                               : num_samples_to_get;
 
   // Scan to the beginning of the line sample.
-  for (ii=0; ii<num_lines_to_get; ii++) {
+  for (ii=0; ii<runs; ii++) {
     offset = (long long)sample_size *
         ((long long)sample_count * ((long long)line_number + (long long)ii) + (long long)sample_number);
     if (offset<0) {
@@ -103,132 +251,11 @@ int get_data_lines(FILE *file, meta_parameters *meta,
                       offset, sample_size, sample_count, line_number, ii, sample_number);
     }
     FSEEK64(file, offset, SEEK_SET);
-    line_samples_gotten = ASF_FREAD(temp_buffer+ii*num_samples_to_get*sample_size,
-        sample_size, num_samples_to_get, file);
-    samples_gotten += line_samples_gotten;
-  }
-
-  /* Fill in destination array.  */
-  switch (data_type) {
-    case REAL32:
-      for ( ii=0; ii<samples_gotten; ii++ ) {
-        ieee_big32(((float*)temp_buffer)[ii]);
-        switch (dest_data_type) {
-         case ASF_BYTE:((unsigned char*)dest)[ii] = ((float*)temp_buffer)[ii];break;
-         case INTEGER16:((short int*)dest)[ii] = ((float*)temp_buffer)[ii];break;
-         case INTEGER32:((int*)dest)[ii] = ((float*)temp_buffer)[ii];break;
-         case REAL32:((float*)dest)[ii] = ((float*)temp_buffer)[ii];break;
-         case REAL64:((double*)dest)[ii] = ((float*)temp_buffer)[ii];break;
-        }
-      }
-      break;
-    case COMPLEX_REAL32:
-      for ( ii=0; ii<samples_gotten*2; ii++ ) {
-        ieee_big32(((float*)temp_buffer)[ii]);
-        switch (dest_data_type) {
-         case COMPLEX_BYTE:((unsigned char*)dest)[ii] = ((float*)temp_buffer)[ii];break;
-         case COMPLEX_INTEGER16:((short int*)dest)[ii] = ((float*)temp_buffer)[ii];break;
-         case COMPLEX_INTEGER32:((int*)dest)[ii] = ((float*)temp_buffer)[ii];break;
-         case COMPLEX_REAL32:((float*)dest)[ii] = ((float*)temp_buffer)[ii];break;
-         case COMPLEX_REAL64:((double*)dest)[ii] = ((float*)temp_buffer)[ii];break;
-        }
-      }
-      break;
-    case ASF_BYTE:
-      for ( ii=0; ii<samples_gotten; ii++ ) {
-        switch (dest_data_type) {
-         case ASF_BYTE:((unsigned char*)dest)[ii] = ((unsigned char*)temp_buffer)[ii];break;
-         case INTEGER16:((short int*)dest)[ii] = ((unsigned char*)temp_buffer)[ii];break;
-         case INTEGER32:((int*)dest)[ii] = ((unsigned char*)temp_buffer)[ii];break;
-         case REAL32:((float*)dest)[ii] = ((unsigned char*)temp_buffer)[ii];break;
-         case REAL64:((double*)dest)[ii] = ((unsigned char*)temp_buffer)[ii];break;
-        }
-      }
-     break;
-    case INTEGER16:
-      for ( ii=0; ii<samples_gotten; ii++ ) {
-        big16(((short int *)temp_buffer)[ii]);
-        switch (dest_data_type) {
-         case ASF_BYTE:((unsigned char*)dest)[ii] = ((short int*)temp_buffer)[ii];break;
-         case INTEGER16:((short int*)dest)[ii] = ((short int*)temp_buffer)[ii];break;
-         case INTEGER32:((int*)dest)[ii] = ((short int*)temp_buffer)[ii];break;
-         case REAL32:((float*)dest)[ii] = ((short int*)temp_buffer)[ii];break;
-         case REAL64:((double*)dest)[ii] = ((short int*)temp_buffer)[ii];break;
-        }
-      }
-      break;
-    case INTEGER32:
-      for ( ii=0; ii<samples_gotten; ii++ ) {
-        big32(((int *)temp_buffer)[ii]);
-        switch (dest_data_type) {
-         case ASF_BYTE:((unsigned char*)dest)[ii] = ((int*)temp_buffer)[ii];break;
-         case INTEGER16:((short int*)dest)[ii] = ((int*)temp_buffer)[ii];break;
-         case INTEGER32:((int*)dest)[ii] = ((int*)temp_buffer)[ii];break;
-         case REAL32:((float*)dest)[ii] = ((int*)temp_buffer)[ii];break;
-         case REAL64:((double*)dest)[ii] = ((int*)temp_buffer)[ii];break;
-        }
-      }
-      break;
-    case REAL64:
-      for ( ii=0; ii<samples_gotten; ii++ ) {
-        ieee_big64(((double*)temp_buffer)[ii]);
-        switch (dest_data_type) {
-         case ASF_BYTE:((unsigned char*)dest)[ii] = ((double*)temp_buffer)[ii];break;
-         case INTEGER16:((short int*)dest)[ii] = ((double*)temp_buffer)[ii];break;
-         case INTEGER32:((int*)dest)[ii] = ((double*)temp_buffer)[ii];break;
-         case REAL32:((float*)dest)[ii] = ((double*)temp_buffer)[ii];break;
-         case REAL64:((double*)dest)[ii] = ((double*)temp_buffer)[ii];break;
-        }
-      }
-    case COMPLEX_BYTE:
-      for ( ii=0; ii<samples_gotten*2; ii++ ) {
-        switch (dest_data_type) {
-         case COMPLEX_BYTE:((unsigned char*)dest)[ii] = ((unsigned char*)temp_buffer)[ii];break;
-         case COMPLEX_INTEGER16:((short int*)dest)[ii] = ((unsigned char*)temp_buffer)[ii];break;
-         case COMPLEX_INTEGER32:((int*)dest)[ii] = ((unsigned char*)temp_buffer)[ii];break;
-         case COMPLEX_REAL32:((float*)dest)[ii] = ((unsigned char*)temp_buffer)[ii];break;
-         case COMPLEX_REAL64:((double*)dest)[ii] = ((unsigned char*)temp_buffer)[ii];break;
-        }
-      }
-      break;
-    case COMPLEX_INTEGER16:
-      for ( ii=0; ii<samples_gotten*2; ii++ ) {
-        big16(((short int *)temp_buffer)[ii]);
-         switch (dest_data_type) {
-         case COMPLEX_BYTE:((unsigned char*)dest)[ii] = ((short int*)temp_buffer)[ii];break;
-         case COMPLEX_INTEGER16:((short int*)dest)[ii] = ((short int*)temp_buffer)[ii];break;
-         case COMPLEX_INTEGER32:((int*)dest)[ii] = ((short int*)temp_buffer)[ii];break;
-         case COMPLEX_REAL32:((float*)dest)[ii] = ((short int*)temp_buffer)[ii];break;
-         case COMPLEX_REAL64:((double*)dest)[ii] = ((short int*)temp_buffer)[ii];break;
-        }
-      }
-      break;
-    case COMPLEX_INTEGER32:
-      for ( ii=0; ii<samples_gotten*2; ii++ ) {
-        big32(((int *)temp_buffer)[ii]);
-        switch (dest_data_type) {
-         case COMPLEX_BYTE:((unsigned char*)dest)[ii] = ((int*)temp_buffer)[ii];break;
-         case COMPLEX_INTEGER16:((short int*)dest)[ii] = ((int*)temp_buffer)[ii];break;
-         case COMPLEX_INTEGER32:((int*)dest)[ii] = ((int*)temp_buffer)[ii];break;
-         case COMPLEX_REAL32:((float*)dest)[ii] = ((int*)temp_buffer)[ii];break;
-         case COMPLEX_REAL64:((double*)dest)[ii] = ((int*)temp_buffer)[ii];break;
-        }
-      }
-      break;
-    case COMPLEX_REAL64:
-      for ( ii=0; ii<samples_gotten*2; ii++ ) {
-        ieee_big64(((double*)temp_buffer)[ii]);
-        switch (dest_data_type) {
-         case COMPLEX_BYTE:((unsigned char*)dest)[ii] = ((double*)temp_buffer)[ii];break;
-         case COMPLEX_INTEGER16:((short int*)dest)[ii] = ((double*)temp_buffer)[ii];break;
-         case COMPLEX_INTEGER32:((int*)dest)[ii] = ((double*)temp_buffer)[ii];break;
-         case COMPLEX_REAL32:((float*)dest)[ii] = ((double*)temp_buffer)[ii];break;
-         case COMPLEX_REAL64:((double*)dest)[ii] = ((double*)temp_buffer)[ii];break;
-        }
-      }
+    samples_gotten += get_sample_run(file, data_type, swap, run_samples,
+        (char *) dest + (size_t) ii * run_samples * dest_sample_size,
+        dest_data_type);
   }
 
-  FREE(temp_buffer);
   return samples_gotten;
 }
 
@@ -370,22 +397,23 @@ int get_complexFloat_lines(FILE *file, meta_parameters *meta, int line_number,
 
 /*******************************************************************************
  * Write x number of lines of any data type to file in the data format specified
- * by the meta structure. It is always written in big endian format. Returns the
- * amount of samples successfully converted & written. Will not write more lines
- * than specified in the supplied meta struct. */
+ * by the meta structure. It is written in big endian format, unless the meta
+ * structure asks for little endian. Returns the amount of samples successfully
+ * converted & written. Will not write more lines than specified in the supplied
+ * meta struct. */
 static int put_data_lines(FILE *file, meta_parameters *meta, int band_number,
                           int line_number_in_band, int num_lines_to_put,
                           const void *source, int source_data_type)
 {
-  int ii;               /* Sample index.                       */
-  int samples_put;      /* Number of samples written           */
+  int samples_put=0;    /* Number of samples written           */
   size_t sample_size;   /* Sample size in bytes.               */
-  void *out_buffer;     /* Buffer of converted data to write.  */
+  size_t source_sample_size;
   int sample_count       = meta->general->sample_count;
   int data_type          = meta->general->data_type;
   int num_samples_to_put = num_lines_to_put * sample_count;
   int line_number        = meta->general->line_count * band_number +
                                line_number_in_band;
+  int swap               = needs_byte_swap(meta);
 
   if ((source_data_type>=COMPLEX_BYTE) && (data_type<=REAL64)) {
     printf("\nput_data_lines: Cannot put complex data into a simple data file. Exiting.\n\n");
@@ -403,6 +431,7 @@ static int put_data_lines(FILE *file, meta_parameters *meta, int band_number,
 
   /* Determine sample size.  */
   sample_size = data_type2sample_size(data_type);
+  source_sample_size = data_type2sample_size(source_data_type);
 
   /* Make sure not to make file bigger than meta says it should be */
   if (line_number > meta->general->line_count * meta->general->band_count) {
@@ -418,130 +447,35 @@ static int put_data_lines(FILE *file, meta_parameters *meta, int band_number,
 		  num_lines_to_put, line_number, meta->general->band_count);
 
   FSEEK64(file, (long long)sample_size*sample_count*line_number, SEEK_SET);
-  out_buffer = MALLOC( sample_size * sample_count * num_lines_to_put );
 
-  /* Fill in destination array.  */
-  switch (data_type) {
-    case REAL32:
-      for ( ii=0; ii<num_samples_to_put; ii++ ) {
-        switch (source_data_type) {
-         case ASF_BYTE:((float*)out_buffer)[ii] = ((unsigned char*)source)[ii];break;
-         case INTEGER16:((float*)out_buffer)[ii] = ((short int*)source)[ii];break;
-         case INTEGER32:((float*)out_buffer)[ii] = ((int*)source)[ii];break;
-         case REAL32:((float*)out_buffer)[ii] = ((float*)source)[ii];break;
-         case REAL64:((float*)out_buffer)[ii] = ((double*)source)[ii];break;
-        }
-        ieee_big32( ((float*)out_buffer)[ii] );
-      }
-      break;
-    case COMPLEX_REAL32:
-      for ( ii=0; ii<num_samples_to_put*2; ii++ ) {
-        switch (source_data_type) {
-         case COMPLEX_BYTE:((float*)out_buffer)[ii] = ((unsigned char*)source)[ii];break;
-         case COMPLEX_INTEGER16:((float*)out_buffer)[ii] = ((short int*)source)[ii];break;
-         case COMPLEX_INTEGER32:((float*)out_buffer)[ii] = ((int*)source)[ii];break;
-         case COMPLEX_REAL32:((float*)out_buffer)[ii] = ((float*)source)[ii];break;
-         case COMPLEX_REAL64:((float*)out_buffer)[ii] = ((double*)source)[ii];break;
-        }
-        ieee_big32( ((float*)out_buffer)[ii] );
-      }
-      break;
-    case ASF_BYTE:
-      for ( ii=0; ii<num_samples_to_put; ii++ ) {
-        switch (source_data_type) {
-         case ASF_BYTE:((unsigned char*)out_buffer)[ii] = ((unsigned char*)source)[ii];break;
-         case INTEGER16:((unsigned char*)out_buffer)[ii] = ((short int*)source)[ii];break;
-         case INTEGER32:((unsigned char*)out_buffer)[ii] = ((int*)source)[ii];break;
-         case REAL32:((unsigned char*)out_buffer)[ii] = ((float*)source)[ii];break;
-         case REAL64:((unsigned char*)out_buffer)[ii] = ((double*)source)[ii];break;
-        }
-      }
-      break;
-    case INTEGER16:
-      for ( ii=0; ii<num_samples_to_put; ii++ ) {
-        switch (source_data_type) {
-         case ASF_BYTE:((short int*)out_buffer)[ii] = ((unsigned char*)source)[ii];break;
-         case INTEGER16:((short int*)out_buffer)[ii] = ((short int*)source)[ii];break;
-         case INTEGER32:((short int*)out_buffer)[ii] = ((int*)source)[ii];break;
-         case REAL32:((short int*)out_buffer)[ii] = ((float*)source)[ii];break;
-         case REAL64:((short int*)out_buffer)[ii] = ((double*)source)[ii];break;
-        }
-        big16( ((short int*)out_buffer)[ii] );
-      }
-      break;
-    case INTEGER32:
-      for ( ii=0; ii<num_samples_to_put; ii++ ) {
-        switch (source_data_type) {
-         case ASF_BYTE:((int*)out_buffer)[ii] = ((unsigned char*)source)[ii];break;
-         case INTEGER16:((int*)out_buffer)[ii] = ((short int*)source)[ii];break;
-         case INTEGER32:((int*)out_buffer)[ii] = ((int*)source)[ii];break;
-         case REAL32:((int*)out_buffer)[ii] = ((float*)source)[ii];break;
-         case REAL64:((int*)out_buffer)[ii] = ((double*)source)[ii];break;
-        }
-        big32( ((int*)out_buffer)[ii] );
-      }
-      break;
-    case REAL64:
-      for ( ii=0; ii<num_samples_to_put; ii++ ) {
-        switch (source_data_type) {
-         case ASF_BYTE:((double*)out_buffer)[ii] = ((unsigned char*)source)[ii];break;
-         case INTEGER16:((double*)out_buffer)[ii] = ((short int*)source)[ii];break;
-         case INTEGER32:((double*)out_buffer)[ii] = ((int*)source)[ii];break;
-         case REAL32:((double*)out_buffer)[ii] = ((float*)source)[ii];break;
-         case REAL64:((double*)out_buffer)[ii] = ((double*)source)[ii];break;
-        }
-        ieee_big64( ((double*)out_buffer)[ii] );
-      }
-      break;
-    case COMPLEX_BYTE:
-      for ( ii=0; ii<num_samples_to_put*2; ii++ )
-        switch (source_data_type) {
-         case COMPLEX_BYTE:((unsigned char*)out_buffer)[ii] = ((unsigned char*)source)[ii];break;
-         case COMPLEX_INTEGER16:((unsigned char*)out_buffer)[ii] = ((short int*)source)[ii];break;
-         case COMPLEX_INTEGER32:((unsigned char*)out_buffer)[ii] = ((int*)source)[ii];break;
-         case COMPLEX_REAL32:((unsigned char*)out_buffer)[ii] = ((float*)source)[ii];break;
-         case COMPLEX_REAL64:((unsigned char*)out_buffer)[ii] = ((double*)source)[ii];break;
-        }
-     break;
-    case COMPLEX_INTEGER16:
-      for ( ii=0; ii<num_samples_to_put*2; ii++ ) {
-        switch (source_data_type) {
-         case COMPLEX_BYTE:((short int*)out_buffer)[ii] = ((unsigned char*)source)[ii];break;
-         case COMPLEX_INTEGER16:((short int*)out_buffer)[ii] = ((short int*)source)[ii];break;
-         case COMPLEX_INTEGER32:((short int*)out_buffer)[ii] = ((int*)source)[ii];break;
-         case COMPLEX_REAL32:((short int*)out_buffer)[ii] = ((float*)source)[ii];break;
-         case COMPLEX_REAL64:((short int*)out_buffer)[ii] = ((double*)source)[ii];break;
-        }
-        big16( ((short int*)out_buffer)[ii] );
-      }
-      break;
-    case COMPLEX_INTEGER32:
-      for ( ii=0; ii<num_samples_to_put*2; ii++ ) {
-        switch (source_data_type) {
-         case COMPLEX_BYTE:((int*)out_buffer)[ii] = ((unsigned char*)source)[ii];break;
-         case COMPLEX_INTEGER16:((int*)out_buffer)[ii] = ((short int*)source)[ii];break;
-         case COMPLEX_INTEGER32:((int*)out_buffer)[ii] = ((int*)source)[ii];break;
-         case COMPLEX_REAL32:((int*)out_buffer)[ii] = ((float*)source)[ii];break;
-         case COMPLEX_REAL64:((int*)out_buffer)[ii] = ((double*)source)[ii];break;
-        }
-        big32( ((int*)out_buffer)[ii] );
-      }
-      break;
-    case COMPLEX_REAL64:
-      for ( ii=0; ii<num_samples_to_put*2; ii++ ) {
-        switch (source_data_type) {
-         case COMPLEX_BYTE:((double*)out_buffer)[ii] = ((unsigned char*)source)[ii];break;
-         case COMPLEX_INTEGER16:((double*)out_buffer)[ii] = ((short int*)source)[ii];break;
-         case COMPLEX_INTEGER32:((double*)out_buffer)[ii] = ((int*)source)[ii];break;
-         case COMPLEX_REAL32:((double*)out_buffer)[ii] = ((float*)source)[ii];break;
-         case COMPLEX_REAL64:((double*)out_buffer)[ii] = ((double*)source)[ii];break;
-        }
-        ieee_big64( ((double*)out_buffer)[ii] );
-      }
-      break;
+  int src_type = element_type(source_data_type);
+  int out_type = element_type(data_type);
+  int per_sample = elements_per_sample(data_type);
+  size_t element_size = data_type2sample_size(out_type);
+
+  /* Data which needs neither converting nor swapping goes straight out.  */
+  if (src_type == out_type && (!swap || element_size == 1)) {
+    samples_put = ASF_FWRITE(source, sample_size, num_samples_to_put, file);
+  }
+  /* Everything else is converted a chunk at a time.  */
+  else {
+    double chunk[CONVERSION_CHUNK_BYTES / sizeof(double)];
+    int chunk_samples = CONVERSION_CHUNK_BYTES / sample_size;
+    while (samples_put < num_samples_to_put) {
+      int count = num_samples_to_put - samples_put;
+      if (count > chunk_samples)
+        count = chunk_samples;
+      convert_elements(
+          (const char *) source + (size_t) samples_put * source_sample_size,
+          src_type, chunk, out_type, (size_t) count * per_sample);
+      if (swap && element_size > 1)
+        swap_elements(chunk, element_size, (size_t) count * per_sample);
+      int put = ASF_FWRITE(chunk, sample_size, count, file);
+      samples_put += put;
+      if (put < count)
+        break;
+    }
   }
-  samples_put = ASF_FWRITE(out_buffer, sample_size, num_samples_to_put, file);
-  FREE(out_buffer);
 
   if ( samples_put != num_samples_to_put ) {
     printf("put_data_lines: failed to write the correct number of samples\n");
@@ -16,6 +16,9 @@ meta_parameters *meta_copy(meta_parameters *src)
   if (src->general) {
     if (!ret->general) ret->general = meta_general_init();
     memcpy(ret->general, src->general, sizeof(meta_general));
+    // The copy is for an image yet to be written, and only the line I/O
+    // routines write anything but big endian
+    ret->general->byte_order = BIG_ENDIAN_DATA;
   } else
     ret->general = NULL;
 
@@ -16,6 +16,8 @@ PROGRAM HISTORY:
   1.6 - P. Denny    01/03     Added meta_get_system
 ****************************************************************/
 #include <assert.h>
+#include <string.h>
+#include <pthread.h>
 #include "asf.h"
 #include "asf_nan.h"
 #include "asf_meta.h"
@@ -34,6 +36,35 @@ PROGRAM HISTORY:
 #endif
 #define MAX(a,b) (((a) > (b)) ? (a) : (b))
 
+/**********************************************************
+ * Range geometry tables.
+ * For slant and ground range images whose earth radius and
+ * satellite height are given in the metadata, slant range,
+ * incidence and look angle depend only on the sample, so
+ * they are worked out once per column and kept with the
+ * metadata.  The table remembers the fields it was built
+ * from, and is rebuilt if any of them have been edited. */
+struct meta_geometry {
+  char image_type;
+  int sample_count;
+  int start_sample;
+  double x_pixel_size;
+  double slant_range_first_pixel;
+  double slant_shift;
+  double earth_radius;
+  double satellite_height;
+  double incid_a[6];
+  char sensor[FIELD_STRING_MAX];
+  char sensor_name[FIELD_STRING_MAX];
+
+  double *slant;
+  double *incid;
+  double *look;
+};
+
+static const struct meta_geometry *geometry_tables(meta_parameters *meta,
+                                                   double xSample);
+
 /*General Calls:*/
 
 /*********************************************************
@@ -87,13 +118,8 @@ double meta_get_time(meta_parameters *meta,double yLine, double xSample)
     }
     return 0.0;/*<- for whining compilers.*/
 }
-double meta_get_slant(meta_parameters *meta,double yLine, double xSample)
+static double slant_range(meta_parameters *meta,double yLine, double xSample)
 {
-  // No effort has been made to make this routine work with
-  // pseudoprojected images.
-  assert (meta->projection == NULL
-      || meta->projection->type != LAT_LONG_PSEUDO_PROJECTION);
-
     if (meta->sar->image_type=='S')/*Slant range is easy.*/
         return meta->sar->slant_range_first_pixel
             + (xSample+meta->general->start_sample) * meta->general->x_pixel_size
@@ -125,6 +151,21 @@ double meta_get_slant(meta_parameters *meta,double yLine, double xSample)
     }
     return 0.0;/*<- for whining compilers.*/
 }
+double meta_get_slant(meta_parameters *meta,double yLine, double xSample)
+{
+  // No effort has been made to make this routine work with
+  // pseudoprojected images.
+  assert (meta->projection == NULL
+      || meta->projection->type != LAT_LONG_PSEUDO_PROJECTION);
+
+  // Slant range images are cheaper to work out than to look up
+  if (meta->sar->image_type=='G') {
+    const struct meta_geometry *g = geometry_tables(meta, xSample);
+    if (g)
+      return g->slant[(int)xSample];
+  }
+  return slant_range(meta, yLine, xSample);
+}
 
 /*******************************************************
  * meta_get_dop:
@@ -238,11 +279,18 @@ stateVector meta_get_stVec(meta_parameters *meta,double time)
       ret = meta_interp_stVec(meta, time);
     }
     else {
-      // Use standard interpolation scheme
-      stVecNo=0;
-      while (stVecNo < meta->state_vectors->vector_count - 2
-	     && meta->state_vectors->vecs[stVecNo+1].time<time)
+      // Use standard interpolation scheme.  State vectors are normally
+      // evenly spaced, so start from where time would fall if they are,
+      // then step to the last pair that starts before it.
+      int count = meta->state_vectors->vector_count;
+      state_loc *vecs = meta->state_vectors->vecs;
+      double spacing = (vecs[count-1].time - vecs[0].time) / (count-1);
+      double guess = spacing > 0 ? (time - vecs[0].time) / spacing : 0;
+      stVecNo = guess < 0 ? 0 : guess > count-2 ? count-2 : (int)guess;
+      while (stVecNo < count - 2 && vecs[stVecNo+1].time<time)
 	stVecNo++;
+      while (stVecNo > 0 && vecs[stVecNo].time>=time)
+	stVecNo--;
       interp_stVec(&meta->state_vectors->vecs[stVecNo].vec,
 		   meta->state_vectors->vecs[stVecNo].time,
 		   &meta->state_vectors->vecs[stVecNo+1].vec,
@@ -271,19 +319,9 @@ int meta_uses_incid_polynomial(meta_parameters *meta)
  * meta_incid:  Returns the incidence angle
  * This is the angle measured by the target between straight
  * up and the satellite. Returns radians.*/
-double meta_incid(meta_parameters *meta,double y,double x)
+static double incidence(meta_parameters *meta,double y,double x)
 {
-  // No effort has been made to make this routine work with
-  // pseudoprojected images.
-  if (strcmp_case(meta->general->sensor, "UAVSAR") == 0)
-    // placeholder for incidence angle information, most likely coming from
-    // a band in the image file
-    return 0.0;
-  else
-    assert (meta->projection == NULL || 
-	    meta->projection->type != LAT_LONG_PSEUDO_PROJECTION);
-
-  double sr = meta_get_slant(meta,y,x);
+  double sr = slant_range(meta,y,x);
 
   if (meta_uses_incid_polynomial(meta)) {
     // Use the incidence angle polynomial if it is available and non-zero.
@@ -303,11 +341,36 @@ double meta_incid(meta_parameters *meta,double y,double x)
     return PI-acos((SQR(sr) + SQR(er) - SQR(ht)) / (2.0*sr*er));
   }
 }
+double meta_incid(meta_parameters *meta,double y,double x)
+{
+  const struct meta_geometry *g = geometry_tables(meta, x);
+  if (g)
+    return g->incid[(int)x];
+
+  // No effort has been made to make this routine work with
+  // pseudoprojected images.
+  if (strcmp_case(meta->general->sensor, "UAVSAR") == 0)
+    // placeholder for incidence angle information, most likely coming from
+    // a band in the image file
+    return 0.0;
+  else
+    assert (meta->projection == NULL || 
+	    meta->projection->type != LAT_LONG_PSEUDO_PROJECTION);
+
+  return incidence(meta, y, x);
+}
 
 /**********************************************************
  * meta_look: Return the look angle
  * This is the angle measured by the satellite between
  * earth's center and the target point x. Returns radians*/
+static double look_angle(meta_parameters *meta,double y,double x)
+{
+    double sr = slant_range(meta,y,x);
+    double er = meta_get_earth_radius(meta,y,x);
+    double ht = meta_get_sat_height(meta,y,x);
+    return acos((SQR(sr) + SQR(ht) - SQR(er)) / (2.0*sr*ht));
+}
 double meta_look(meta_parameters *meta,double y,double x)
 {
   // No effort has been made to make this routine work with
@@ -315,10 +378,10 @@ double meta_look(meta_parameters *meta,double y,double x)
   assert (meta->projection == NULL
       || meta->projection->type != LAT_LONG_PSEUDO_PROJECTION);
 
-    double sr = meta_get_slant(meta,y,x);
-    double er = meta_get_earth_radius(meta,y,x);
-    double ht = meta_get_sat_height(meta,y,x);
-    return acos((SQR(sr) + SQR(ht) - SQR(er)) / (2.0*sr*ht));
+  const struct meta_geometry *g = geometry_tables(meta, x);
+  if (g)
+    return g->look[(int)x];
+  return look_angle(meta, y, x);
 }
 
 /* meta_yaw: return yaw value at the specified point in radians */
@@ -419,3 +482,130 @@ stateVector meta_interp_stVec(meta_parameters *meta,double time)
 
   return outVec;
 }
+
+// asf_meta doesn't link glib, so this is a plain pthread mutex, with
+// explicit barriers around the unlocked read of meta->geometry
+static pthread_mutex_t meta_geometry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Compare bit patterns, so that unset (NaN) fields compare equal
+static int same_double(double a, double b)
+{
+  return memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+static int geometry_matches(const struct meta_geometry *g,
+                            meta_parameters *meta)
+{
+  int ii;
+
+  if (g->image_type != meta->sar->image_type ||
+      g->sample_count != meta->general->sample_count ||
+      g->start_sample != meta->general->start_sample ||
+      !same_double(g->x_pixel_size, meta->general->x_pixel_size) ||
+      !same_double(g->slant_range_first_pixel,
+                   meta->sar->slant_range_first_pixel) ||
+      !same_double(g->slant_shift, meta->sar->slant_shift) ||
+      !same_double(g->earth_radius, meta->sar->earth_radius) ||
+      !same_double(g->satellite_height, meta->sar->satellite_height))
+    return FALSE;
+  for (ii=0; ii<6; ++ii)
+    if (!same_double(g->incid_a[ii], meta->sar->incid_a[ii]))
+      return FALSE;
+  return strcmp(g->sensor, meta->general->sensor) == 0 &&
+    strcmp(g->sensor_name, meta->general->sensor_name) == 0;
+}
+
+static int geometry_cacheable(meta_parameters *meta)
+{
+  return meta->sar &&
+    (meta->sar->image_type=='S' || meta->sar->image_type=='G') &&
+    (meta->projection == NULL ||
+     meta->projection->type != LAT_LONG_PSEUDO_PROJECTION) &&
+    meta->general->sample_count > 0 &&
+    meta_is_valid_double(meta->sar->earth_radius) &&
+    meta_is_valid_double(meta->sar->satellite_height) &&
+    strcmp_case(meta->general->sensor, "UAVSAR") != 0;
+}
+
+static struct meta_geometry *geometry_new(meta_parameters *meta)
+{
+  struct meta_geometry *g = MALLOC(sizeof(struct meta_geometry));
+  int ns = meta->general->sample_count;
+  int ii;
+
+  g->image_type = meta->sar->image_type;
+  g->sample_count = ns;
+  g->start_sample = meta->general->start_sample;
+  g->x_pixel_size = meta->general->x_pixel_size;
+  g->slant_range_first_pixel = meta->sar->slant_range_first_pixel;
+  g->slant_shift = meta->sar->slant_shift;
+  g->earth_radius = meta->sar->earth_radius;
+  g->satellite_height = meta->sar->satellite_height;
+  for (ii=0; ii<6; ++ii)
+    g->incid_a[ii] = meta->sar->incid_a[ii];
+  strcpy(g->sensor, meta->general->sensor);
+  strcpy(g->sensor_name, meta->general->sensor_name);
+
+  g->slant = MALLOC(sizeof(double)*ns);
+  g->incid = MALLOC(sizeof(double)*ns);
+  g->look = MALLOC(sizeof(double)*ns);
+  for (ii=0; ii<ns; ++ii) {
+    g->slant[ii] = slant_range(meta, 0, ii);
+    g->incid[ii] = incidence(meta, 0, ii);
+    g->look[ii] = look_angle(meta, 0, ii);
+  }
+
+  return g;
+}
+
+static void geometry_free(struct meta_geometry *g)
+{
+  if (g) {
+    FREE(g->slant);
+    FREE(g->incid);
+    FREE(g->look);
+    FREE(g);
+  }
+}
+
+// Returns the tables to use for sample xSample, or NULL if it has to be
+// worked out the long way.  Several threads may share a meta structure
+// while it isn't being edited, so building the tables is locked.
+static const struct meta_geometry *geometry_tables(meta_parameters *meta,
+                                                   double xSample)
+{
+  struct meta_geometry *g;
+
+  if (!meta->sar || xSample < 0 || xSample >= meta->general->sample_count ||
+      xSample != (int)xSample)
+    return NULL;
+
+  g = meta->geometry;
+  __sync_synchronize();
+  if (g && geometry_matches(g, meta))
+    return g;
+  if (!geometry_cacheable(meta))
+    return NULL;
+
+  pthread_mutex_lock(&meta_geometry_lock);
+  g = meta->geometry;
+  if (!g || !geometry_matches(g, meta)) {
+    struct meta_geometry *old = g;
+    g = geometry_new(meta);
+    // the tables must be complete before anyone can see the pointer
+    __sync_synchronize();
+    meta->geometry = g;
+    geometry_free(old);
+  }
+  pthread_mutex_unlock(&meta_geometry_lock);
+
+  return g;
+}
+
+void meta_geometry_invalidate(meta_parameters *meta)
+{
+  pthread_mutex_lock(&meta_geometry_lock);
+  geometry_free(meta->geometry);
+  meta->geometry = NULL;
+  pthread_mutex_unlock(&meta_geometry_lock);
+}
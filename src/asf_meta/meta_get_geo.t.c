@@ -158,3 +158,38 @@ void test_meta_get_lineSamp()
 {
 }
 
+// Whole samples come from the per-column geometry tables, fractional
+// ones are computed directly -- the two should agree, and editing the
+// metadata should not leave stale values behind.
+static void geometry_test(const char *filename)
+{
+  meta_parameters *meta = meta_read(filename);
+  int ns = meta->general->sample_count;
+  double x, incid, incid1, look, look1, before;
+
+  for (x = 0; x < ns; x += ns/4) {
+    incid = meta_incid(meta, 0, x);
+    incid1 = meta_incid(meta, 0, x + 1e-7);
+    CU_ASSERT(within_tol(incid, incid1, 1e-6));
+    look = meta_look(meta, 0, x);
+    look1 = meta_look(meta, 0, x + 1e-7);
+    CU_ASSERT(within_tol(look, look1, 1e-6));
+    CU_ASSERT(within_tol(meta_get_slant(meta, 0, x),
+                         meta_get_slant(meta, 0, x + 1e-7), 1e-6));
+  }
+
+  before = meta_incid(meta, 0, ns/2);
+  meta->sar->slant_range_first_pixel += 1000;
+  incid = meta_incid(meta, 0, ns/2);
+  incid1 = meta_incid(meta, 0, ns/2 + 1e-7);
+  CU_ASSERT(within_tol(incid, incid1, 1e-6));
+  CU_ASSERT(fabs(incid - before) > 1e-6);
+
+  meta_free(meta);
+}
+
+void test_meta_geometry()
+{
+  geometry_test("test_input/ers1.meta");
+}
+
@@ -66,6 +66,7 @@ meta_general *meta_general_init(void)
   general->bit_error_rate = MAGIC_UNSET_DOUBLE;
   general->missing_lines = MAGIC_UNSET_INT;
   general->no_data = MAGIC_UNSET_DOUBLE;
+  general->byte_order = BIG_ENDIAN_DATA;
   return general;
 }
 
@@ -461,6 +462,7 @@ meta_parameters *raw_init(void)
   meta->dem             = NULL;
   meta->latlon          = NULL;
   meta->quality         = NULL;
+  meta->geometry        = NULL;
 
   meta->meta_version = META_VERSION;
 
@@ -612,6 +614,7 @@ void meta_free(meta_parameters *meta)
     meta->dem = NULL;
     FREE(meta->quality);
     meta->quality = NULL;
+    meta_geometry_invalidate(meta);
     if (meta->latlon) {
       FREE(meta->latlon->lat);
       FREE(meta->latlon->lon);
@@ -10,6 +10,32 @@
 #define SQR(A) ((A)*(A))
 #define ecc2(minor,major) (1.0 - ((minor*minor)/(major*major)))
 
+/* The map projections libproj does for us go through a projection
+   context; its setup is cached by libasf_proj, so making one for each
+   point is cheap. */
+static void libproj_to_latlon(meta_projection *proj, double x, double y,
+                              double z, double *lat, double *lon,
+                              double *height)
+{
+  proj_context_t *ctx = proj_context_new(proj->type, &(proj->param),
+                                         proj->datum);
+  proj_context_inverse(ctx, 1, &x, &y, z == ASF_PROJ_NO_HEIGHT ? NULL : &z,
+                       lat, lon, height);
+  proj_context_free(ctx);
+}
+
+static void libproj_from_latlon(meta_projection *proj, double lat,
+                                double lon, double height,
+                                double *x, double *y, double *z)
+{
+  proj_context_t *ctx = proj_context_new(proj->type, &(proj->param),
+                                         proj->datum);
+  proj_context_forward(ctx, 1, &lat, &lon,
+                       height == ASF_PROJ_NO_HEIGHT ? NULL : &height,
+                       x, y, z);
+  proj_context_free(ctx);
+}
+
 /*Convert projection units (meters) to geodetic latitude and longitude (degrees).*/
 void proj_to_latlon(meta_projection *proj, double x, double y, double z,
         double *lat, double *lon, double *height)
@@ -20,31 +46,15 @@ void proj_to_latlon(meta_projection *proj, double x, double y, double z,
   switch(proj->type)
     {
     case ALBERS_EQUAL_AREA:
-      project_albers_inv(&(proj->param), x, y, z, lat, lon, height, proj->datum);
-      break;
     case LAMBERT_AZIMUTHAL_EQUAL_AREA:
-      project_lamaz_inv(&(proj->param), x, y, z, lat, lon, height, proj->datum);
-      break;
     case LAMBERT_CONFORMAL_CONIC:
-      project_lamcc_inv(&(proj->param), x, y, z, lat, lon, height, proj->datum);
-      break;
     case POLAR_STEREOGRAPHIC:
-      project_ps_inv(&(proj->param), x, y, z, lat, lon, height, proj->datum);
-      break;
     case UNIVERSAL_TRANSVERSE_MERCATOR:
-      project_utm_inv(&(proj->param), x, y, z, lat, lon, height, proj->datum);
-      break;
     case MERCATOR:
-      project_mer_inv(&(proj->param), x, y, z, lat, lon, height, proj->datum);
-      break;
     case EQUI_RECTANGULAR:
-      project_eqr_inv(&(proj->param), x, y, z, lat, lon, height, proj->datum);
-      break;
     case EQUIDISTANT:
-      project_eqc_inv(&(proj->param), x, y, z, lat, lon, height, proj->datum);
-      break;
     case SINUSOIDAL:
-      project_sin_inv(&(proj->param), x, y, z, lat, lon, height, proj->datum);
+      libproj_to_latlon(proj, x, y, z, lat, lon, height);
       break;
     case SCANSAR_PROJECTION:
       asfPrintError("'proj_to_latlon' not defined for SCANSAR_PROJECTION.\n"
@@ -619,35 +629,19 @@ void latlon_to_proj(meta_projection *proj, char look_dir,
       ll_ac(proj, look_dir, lat, lon, y, x);
       break;
     case ALBERS_EQUAL_AREA:
-      project_albers(&(proj->param), lat, lon, height, x, y, z, proj->datum);
-      break;
     case LAMBERT_AZIMUTHAL_EQUAL_AREA:
-      project_lamaz(&(proj->param), lat, lon, height, x, y, z, proj->datum);
-      break;
     case LAMBERT_CONFORMAL_CONIC:
-      project_lamcc(&(proj->param), lat, lon, height, x, y, z, proj->datum);
-      break;
     case POLAR_STEREOGRAPHIC:
-      project_ps(&(proj->param), lat, lon, height, x, y, z, proj->datum);
-      break;
     case UNIVERSAL_TRANSVERSE_MERCATOR:
-      project_utm(&(proj->param), lat, lon, height, x, y, z, proj->datum);
-      break;
     case MERCATOR:
-      project_mer(&(proj->param), lat, lon, height, x, y, z, proj->datum);
+    case SINUSOIDAL:
+      libproj_from_latlon(proj, lat, lon, height, x, y, z);
       break;
     case EQUI_RECTANGULAR:
-      // Some special treatment required for PROJ4 limitation
-      geoc_lat = atan(tan(lat)/(1-ecc2(proj->re_minor,proj->re_major)));
-      project_eqr(&(proj->param), geoc_lat, lon, height, x, y, z, proj->datum);
-      break;
     case EQUIDISTANT:
       // Some special treatment required for PROJ4 limitation
       geoc_lat = atan(tan(lat)/(1-ecc2(proj->re_minor,proj->re_major)));
-      project_eqc(&(proj->param), geoc_lat, lon, height, x, y, z, proj->datum);
-      break;
-    case SINUSOIDAL:
-      project_sin(&(proj->param), lat, lon, height, x, y, x, proj->datum);
+      libproj_from_latlon(proj, geoc_lat, lon, height, x, y, z);
       break;
     case LAT_LONG_PSEUDO_PROJECTION:
       *x = lon*R2D;
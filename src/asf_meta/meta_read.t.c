@@ -214,8 +214,53 @@ static void test_ers1()
   test_meta("test_input/palsar_fbd.meta", test_palsar_fbd_values);
 }
 
+static void test_byte_order()
+{
+  meta_parameters *meta = meta_read("test_input/ers1.meta");
+  CU_ASSERT(meta->general->byte_order == BIG_ENDIAN_DATA);
+
+  // Little endian is kept through a write and read back ...
+  meta->general->byte_order = LITTLE_ENDIAN_DATA;
+  meta_write(meta, "tmp.meta");
+  meta_free(meta);
+  meta = meta_read("tmp.meta");
+  unlink("tmp.meta");
+  CU_ASSERT(meta->general->byte_order == LITTLE_ENDIAN_DATA);
+
+  // ... and the samples go to the file that way
+  float line[3] = { 1.5, -2.25, 3e10 }, back[3];
+  unsigned char raw[sizeof(line)];
+  meta->general->data_type = REAL32;
+  meta->general->line_count = 1;
+  meta->general->sample_count = 3;
+  FILE *fp = FOPEN("tmp.img", "wb");
+  put_float_line(fp, meta, 0, line);
+  FCLOSE(fp);
+  fp = FOPEN("tmp.img", "rb");
+  CU_ASSERT(fread(raw, 1, sizeof(raw), fp) == sizeof(raw));
+  CU_ASSERT(raw[0] == 0x00 && raw[1] == 0x00 &&
+            raw[2] == 0xc0 && raw[3] == 0x3f); // 1.5
+  get_float_line(fp, meta, 0, back);
+  FCLOSE(fp);
+  unlink("tmp.img");
+  CU_ASSERT(back[0] == line[0] && back[1] == line[1] && back[2] == line[2]);
+
+  // A copy is for a new image, which is big endian
+  meta_parameters *mc = meta_copy(meta);
+  CU_ASSERT(mc->general->byte_order == BIG_ENDIAN_DATA);
+  meta_write(mc, "tmp.meta");
+  meta_free(mc);
+  mc = meta_read("tmp.meta");
+  unlink("tmp.meta");
+  CU_ASSERT(mc->general->byte_order == BIG_ENDIAN_DATA);
+
+  meta_free(mc);
+  meta_free(meta);
+}
+
 void test_meta_read()
 {
   test_ers1();
+  test_byte_order();
 }
 
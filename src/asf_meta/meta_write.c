@@ -406,6 +406,10 @@ void meta_write(meta_parameters *meta, const char *file_name)
       "Number of missing lines in data take");
   meta_put_double_lf(fp,"no_data:", meta->general->no_data, 4,
       "Value indicating no data for a pixel");
+  // Only written for little endian images, which older versions can't read
+  if (META_VERSION >= 3.7 && meta->general->byte_order == LITTLE_ENDIAN_DATA)
+    meta_put_string(fp,"byte_order:", "LITTLE_ENDIAN",
+        "Byte order of the image samples [BIG_ENDIAN; LITTLE_ENDIAN]");
   meta_put_string(fp,"}", "","End general");
 
   /* SAR block.  */
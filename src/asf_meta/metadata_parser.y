@@ -611,6 +611,17 @@ void fill_structure_field(char *field_name, void *valp)
       { MGENERAL->missing_lines = VALP_AS_INT; return; }
     if ( !strcmp(field_name, "no_data") )
       { MGENERAL->no_data = (float) VALP_AS_DOUBLE; return; }
+    if ( !strcmp(field_name, "byte_order") ) {
+      if ( !strcmp(VALP_AS_CHAR_POINTER, "LITTLE_ENDIAN") )
+        MGENERAL->byte_order = LITTLE_ENDIAN_DATA;
+      else if ( !strcmp(VALP_AS_CHAR_POINTER, "BIG_ENDIAN") )
+        MGENERAL->byte_order = BIG_ENDIAN_DATA;
+      else {
+        warning_message("Unrecognized byte_order (%s).\n",VALP_AS_CHAR_POINTER);
+        MGENERAL->byte_order = BIG_ENDIAN_DATA;
+      }
+      return;
+    }
   }
 
   /* Fields which normally go in the sar block of the metadata file.  */
@@ -3,6 +3,7 @@
 void test_xml();
 void test_meta_get_latLon();
 void test_meta_get_lineSamp();
+void test_meta_geometry();
 void test_read_proj_file();
 void test_meta_read();
 void test_date();
@@ -30,7 +31,8 @@ int main()
        (NULL == CU_add_test(pSuite, "date", test_date)) ||
        (NULL == CU_add_test(pSuite, "longdate", test_longdate)) ||
        (NULL == CU_add_test(pSuite, "meta_get_latLon", test_meta_get_latLon)) ||
-       (NULL == CU_add_test(pSuite, "meta_get_lineSamp", test_meta_get_lineSamp)))
+       (NULL == CU_add_test(pSuite, "meta_get_lineSamp", test_meta_get_lineSamp)) ||
+       (NULL == CU_add_test(pSuite, "meta_geometry", test_meta_geometry)))
    {
       CU_cleanup_registry();
       return CU_get_error();
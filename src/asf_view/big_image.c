@@ -767,15 +767,40 @@ GdkPixbuf * make_big_image(ImageInfo *ii, int show_crosshair)
     }
 
     if (!mask) {
+        // Fetch from the cache a display row at a time: for each line
+        // we need, one call gets the samples at all biw columns.  The
+        // averaging below needs up to 3 lines and 3 samples per pixel.
+        int navg = zoom<2 ? 1 : (zoom<3 ? 2 : 3);
+        int fac = zoom<4 ? 1 : (int)floor(zoom/3);
+        int *samps = MALLOC(sizeof(int)*biw*navg);
+        int *inside = MALLOC(sizeof(int)*biw);
+        unsigned char *rows = MALLOC(sizeof(unsigned char)*biw*navg*3*navg);
         int mm = 0;
         for (i=0; i<bih; ++i) {
+            double l, s;
+            int l2 = 0;
+            int any_inside = FALSE;
             for (j=0; j<biw; ++j) {
-                double l, s;
                 img2ls(j,i,&l,&s);
+                inside[j] = !(l<0 || l>=ii->nl || s<0 || s>=ii->ns);
+                if (inside[j]) {
+                    any_inside = TRUE;
+                    l2 = (int)floor(l);
+                }
+                for (n=0; n<navg; ++n)
+                    samps[j*navg+n] = (int)floor(s) + n*fac;
+            }
+
+            if (any_inside) {
+                for (m=0; m<navg; ++m)
+                    cached_image_get_rgb_row(ii->data_ci, l2+m*fac, samps,
+                                             biw*navg, rows+m*biw*navg*3);
+            }
 
+            for (j=0; j<biw; ++j) {
                 unsigned char r, g, b;
 
-                if (l<0 || l>=ii->nl || s<0 || s>=ii->ns) {
+                if (!inside[j]) {
                     r = background_red;
                     g = background_green;
                     b = background_blue;
@@ -783,62 +808,21 @@ GdkPixbuf * make_big_image(ImageInfo *ii, int show_crosshair)
                 else {
                     // here we have some averaging, that will make the
                     // images look a bit smoother when zoomed out
-                    if (zoom<2) {
-                        // one-to-one (or thereabouts) view -- no averaging
-                        cached_image_get_rgb(ii->data_ci, (int)floor(l),
-                            (int)floor(s), &r, &g, &b);
-                    }
-                    else if (zoom<3) {
-                        // 2x view -- average 4 pixels to produce 1.
-                        int l2 = (int)floor(l);
-                        int s2 = (int)floor(s);
-                        unsigned char r1,r2,r3,r4,g1,g2,g3,g4,b1,b2,b3,b4;
-                        cached_image_get_rgb(ii->data_ci, l2,   s2,   &r1,&g1,&b1);
-                        cached_image_get_rgb(ii->data_ci, l2+1, s2,   &r2,&g2,&b2);
-                        cached_image_get_rgb(ii->data_ci, l2,   s2+1, &r3,&g3,&b3);
-                        cached_image_get_rgb(ii->data_ci, l2+1, s2+1, &r4,&g4,&b4);
-                        r=(r1+r2+r3+r4)/4;
-                        g=(g1+g2+g3+g4)/4;
-                        b=(b1+b2+b3+b4)/4;
-                    }
-                    else if (zoom<4) {
-                        // 3x view -- average 9 pixels to produce 1.
-                        int l2 = (int)floor(l);
-                        int s2 = (int)floor(s);
-                        int rt=0, gt=0, bt=0;
-                        for (m=0; m<3; ++m) {
-                            for (n=0; n<3; ++n) {
-                                cached_image_get_rgb(ii->data_ci, l2+m, s2+n,
-                                                    &r, &g, &b);
-                                rt += (int)r;
-                                gt += (int)g;
-                                bt += (int)b;
-                            }
-                        }
-                        r = (unsigned char) (rt/9);
-                        g = (unsigned char) (gt/9);
-                        b = (unsigned char) (bt/9);
-                    }
-                    else {
-                        // 4x or greater view -- average 9 pixels to produce 1.
-                        int l2 = (int)floor(l);
-                        int s2 = (int)floor(s);
-                        int fac = (int)floor(zoom/3);
-                        int rt=0, gt=0, bt=0;
-                        for (m=0; m<3; ++m) {
-                            for (n=0; n<3; ++n) {
-                                cached_image_get_rgb(ii->data_ci,
-                                                    l2+m*fac, s2+n*fac,
-                                                    &r, &g, &b);
-                                rt += (int)r;
-                                gt += (int)g;
-                                bt += (int)b;
-                            }
+                    //   1x view -- no averaging
+                    //   2x view -- average 4 pixels to produce 1
+                    //   3x or greater view -- average 9 pixels to produce 1
+                    int rt=0, gt=0, bt=0;
+                    for (m=0; m<navg; ++m) {
+                        unsigned char *p = rows + (m*biw + j)*navg*3;
+                        for (n=0; n<navg; ++n) {
+                            rt += (int)p[3*n];
+                            gt += (int)p[3*n+1];
+                            bt += (int)p[3*n+2];
                         }
-                        r = (unsigned char) (rt/9);
-                        g = (unsigned char) (gt/9);
-                        b = (unsigned char) (bt/9);
                     }
+                    r = (unsigned char) (rt/(navg*navg));
+                    g = (unsigned char) (gt/(navg*navg));
+                    b = (unsigned char) (bt/(navg*navg));
                 }
 
                 int p = 3*mm;
@@ -848,6 +832,9 @@ GdkPixbuf * make_big_image(ImageInfo *ii, int show_crosshair)
                 ++mm;
             }
         }
+        free(samps);
+        free(inside);
+        free(rows);
     }
     else { // mask applied
         // this code is largely the same as above except we need to
@@ -40,8 +40,20 @@ round (double arg)
 
 #include "asf_glib.h"
 
-// at 64MB tiles, this is ~1.5GB
-static const int MAX_TILES = 24;
+// Tiles are TILE_SIZE pixels on a side, but never so tall that a band
+// (tile_nl full-width rows) is more than about BAND_BYTES
+#define TILE_SIZE 512
+#define BAND_BYTES (64*1024*1024)
+
+// ~1.5GB of cached tiles
+static const size_t MAX_CACHE_BYTES = (size_t)24*BAND_BYTES;
+
+// Returned for pixels outside the image -- big enough for any data type
+static unsigned char zero_pixel[12];
+
+// The clients and the libraries under them weren't written to be called
+// from two threads at once, so every read goes through this
+static GMutex read_lock;
 
 // quit blathering?
 int quiet = FALSE;
@@ -63,133 +75,260 @@ static int data_size(CachedImage *self)
     }
 }
 
-static void print_cache_size(CachedImage *self)
+static size_t tile_bytes(CachedImage *self)
 {
-    int i;
-    int size=0;
-    int ds = data_size(self);
-    for (i=0; i<self->n_tiles; ++i)
-        size += ds*self->rows_per_tile*self->ns;
+    return (size_t)data_size(self)*self->tile_nl*self->tile_ns;
+}
 
+static size_t band_bytes(CachedImage *self)
+{
+    return (size_t)data_size(self)*self->tile_nl*self->ns;
+}
+
+static void print_cache_size(CachedImage *self)
+{
     asfPrintStatus("Cache size is %.1f megabytes.\n",
-        (float)size/1024./1024.);
+        (float)(self->n_slots*tile_bytes(self))/1024./1024.);
 }
 
-static unsigned char *get_pixel(CachedImage *self, int line, int samp)
+// Read band number "band" from the file.  Rows past the end of the
+// image are zeroed, so they don't show old data.
+static void read_band(CachedImage *self, int band, unsigned char *dest)
 {
-    // check if outside the image
-    static unsigned char zero = 0;
-    if (line<0 || samp<0 || line >= self->nl || samp >= self->ns)
-        return &zero;
+    int rs = band*self->tile_nl;
+    int rows_to_get = MIN(self->tile_nl, self->nl - rs);
 
-    // size of each pixel
-    int ds = data_size(self);
+    memset(dest, 0, band_bytes(self));
 
-    int i;
-    for (i=0; i<self->n_tiles; ++i) {
-        int rs = self->rowstarts[i];
-        if (rs >= 0) {
-            if (line >= rs && line < rs+self->rows_per_tile) {
-                // found the right cache
-                assert(self->cache[i]);
-
-                // this probably won't ever happen, but here we go anyway
-                if (self->n_access > 1024*1024*1024) {
-                    asfPrintStatus("Resetting n_access.\n");
-                    for (i=0; i<self->n_tiles; ++i)
-                        self->access_counts[i] = 0;
-                    self->n_access = 1;
-                }
-
-                // mark this as the most recently accessed
-                self->access_counts[i] = self->n_access++;
-
-                // return pointer to the cached value
-                return &self->cache[i][((line-rs)*self->ns + samp)*ds];
-            }
+    g_mutex_lock(&read_lock);
+    self->client->read_fn(rs, rows_to_get, (void*)dest,
+        self->client->read_client_info, self->meta, self->client->data_type);
+    g_mutex_unlock(&read_lock);
+}
+
+static gpointer prefetch_thread(gpointer data)
+{
+    CachedImage *self = (CachedImage*)data;
+
+    g_mutex_lock(&self->lock);
+    while (!self->prefetch_quit) {
+        int band = self->prefetch_wanted;
+        if (band < 0) {
+            g_cond_wait(&self->cond, &self->lock);
+            continue;
         }
+
+        // whatever was in the buffer is about to be overwritten
+        self->prefetch_wanted = -1;
+        self->prefetch_ready = -1;
+        self->prefetch_reading = band;
+        g_mutex_unlock(&self->lock);
+
+        read_band(self, band, self->prefetch);
+
+        g_mutex_lock(&self->lock);
+        self->prefetch_reading = -1;
+        self->prefetch_ready = band;
+        g_cond_broadcast(&self->cond);
     }
+    g_mutex_unlock(&self->lock);
+
+    return NULL;
+}
+
+static int sign(int i)
+{
+    return i > 0 ? 1 : (i < 0 ? -1 : 0);
+}
+
+// mark this slot as the most recently accessed
+static void touch(CachedImage *self, int spot)
+{
+    // this probably won't ever happen, but here we go anyway
+    if (self->n_access > 1024*1024*1024) {
+        int i;
+        asfPrintStatus("Resetting n_access.\n");
+        for (i=0; i<self->n_slots; ++i)
+            self->access_counts[i] = 0;
+        self->n_access = 1;
+    }
+
+    self->access_counts[spot] = self->n_access++;
+}
+
+// Find a slot for a new tile: a new one if we can still allocate,
+// otherwise the least recently used one, which is dropped from the index
+static int get_slot(CachedImage *self)
+{
+    int i, spot = 0;
 
-    int spot = 0;
     if (!self->reached_max_tiles) {
-        assert(self->cache[self->n_tiles] == NULL);
-        unsigned char *data = malloc(ds*self->ns*self->rows_per_tile);
+        assert(self->cache[self->n_slots] == NULL);
+        unsigned char *data = malloc(tile_bytes(self));
         if (!data) {
             // if this is the first tile -- abort, we are out of memory
-            if (self->n_tiles == 0)
+            if (self->n_slots == 0)
                 asfPrintError("Failed to allocate cache of %ld bytes.\n"
-                              "Out of memory.\n",
-                              ds*self->ns*self->rows_per_tile);
+                              "Out of memory.\n", (long)tile_bytes(self));
             // couldn't allocate the next tile -- must dump existing
             if (!quiet)
-                asfPrintStatus("reached max # of tiles: %d\n", self->n_tiles);
+                asfPrintStatus("reached max # of tiles: %d\n", self->n_slots);
             print_cache_size(self);
             self->reached_max_tiles = TRUE;
         } else {
-            spot = self->n_tiles;
+            spot = self->n_slots++;
             self->cache[spot] = data;
-            ++self->n_tiles;
+            if (self->n_slots == self->max_slots) {
+                if (!quiet)
+                    asfPrintStatus("Fully loaded with %d tiles.\n",
+                                   self->n_slots);
+                print_cache_size(self);
+                self->reached_max_tiles = TRUE;
+            }
+            return spot;
+        }
+    }
+
+    int least_access_count = self->access_counts[0];
+    for (i=1; i<self->n_slots; ++i) {
+        if (self->access_counts[i] < least_access_count) {
+            least_access_count = self->access_counts[i];
+            spot = i;
         }
     }
 
-    if (self->reached_max_tiles) {
-        // dump an existing cached tile
-        // not found in the cache -- find least used spot
-        int least_access_count = self->access_counts[0];
-        for (i=0; i<self->n_tiles; ++i) {
-            if (self->access_counts[i] < least_access_count) {
-                least_access_count = self->access_counts[i];
-                spot = i;
+    if (self->tile_of_slot[spot] >= 0)
+        self->index[self->tile_of_slot[spot]] = -1;
+    self->tile_of_slot[spot] = -1;
+
+    return spot;
+}
+
+// Copy the tiles of a band that was just read into the cache.  A band
+// of a wide image can hold more tiles than we want to throw out for it,
+// so only up to half the cache is filed, nearest the wanted column and
+// leaning in the direction we are panning.  The wanted tile is filed
+// last, making it the most recently used.
+static void file_band(CachedImage *self, int band, int col, int dc,
+                      const unsigned char *src)
+{
+    int ds = data_size(self);
+    int n = MIN(MAX(1, self->max_slots/2), self->n_tile_cols);
+    int lo, hi, d, k, r;
+
+    if (dc > 0)
+        lo = col - n/4;
+    else if (dc < 0)
+        lo = col - (n - 1 - n/4);
+    else
+        lo = col - (n - 1)/2;
+    lo = MAX(0, MIN(lo, self->n_tile_cols - n));
+    hi = lo + n - 1;
+
+    for (d = MAX(col-lo, hi-col); d >= 0; --d) {
+        for (k=0; k<2; ++k) {
+            int c = k==0 ? col-d : col+d;
+            if (c < lo || c > hi || (k==1 && d==0))
+                continue;
+
+            int tile = band*self->n_tile_cols + c;
+            int spot = self->index[tile];
+            if (spot < 0) {
+                spot = get_slot(self);
+                int w = MIN(self->tile_ns, self->ns - c*self->tile_ns);
+                for (r=0; r<self->tile_nl; ++r)
+                    memcpy(self->cache[spot] + (size_t)r*self->tile_ns*ds,
+                           src + ((size_t)r*self->ns + c*self->tile_ns)*ds,
+                           (size_t)w*ds);
+                self->index[tile] = spot;
+                self->tile_of_slot[spot] = tile;
             }
+            touch(self, spot);
         }
     }
+}
 
-    if (!self->reached_max_tiles && self->n_tiles == MAX_TILES) {
-        if (!quiet)
-            asfPrintStatus("Fully loaded with %d tiles.\n", self->n_tiles);
-        print_cache_size(self);
-        self->reached_max_tiles = TRUE;
+// Bring tile (tr,tc) into the cache, from the prefetched band if that's
+// the one, then start reading the next band in the direction we are
+// panning.  Returns the tile's slot.
+static int load_tile(CachedImage *self, int tr, int tc)
+{
+    int dr = self->last_tile_row < 0 ? 0 : sign(tr - self->last_tile_row);
+    int dc = self->last_tile_col < 0 ? 0 : sign(tc - self->last_tile_col);
+    int rs = tr*self->tile_nl;
+    int rows = MIN(self->tile_nl, self->nl - rs);
+    int from_prefetch = FALSE;
+
+    if (self->prefetcher) {
+        g_mutex_lock(&self->lock);
+        if (self->prefetch_wanted == tr)
+            self->prefetch_wanted = -1;
+        while (self->prefetch_reading == tr)
+            g_cond_wait(&self->cond, &self->lock);
+        if (self->prefetch_ready == tr) {
+            // the prefetcher can't start on another band until we let go
+            // of the lock, so the buffer is safe to copy from here
+            if (!quiet)
+                asfPrintStatus("Cache: using prefetched rows %d-%d\n",
+                               rs, rs+rows);
+            file_band(self, tr, tc, dc, self->prefetch);
+            self->prefetch_ready = -1;
+            from_prefetch = TRUE;
+        }
+        g_mutex_unlock(&self->lock);
     }
 
-    // load info from file
-    assert(spot >= 0 && spot < self->n_tiles);
-    assert(self->cache[spot] != NULL);
+    if (!from_prefetch) {
+        if (!self->band)
+            self->band = MALLOC(band_bytes(self));
+        if (!quiet)
+            asfPrintStatus("Cache: loading rows %d-%d\n", rs, rs+rows);
+        read_band(self, tr, self->band);
+        file_band(self, tr, tc, dc, self->band);
+    }
 
-    // clear out the cache -- we may not fill up the tile, if
-    // we are near the end of the file, and we don't want old data
-    // to appear
-    int ns = self->ns;
-    memset(self->cache[spot], 0, ds*ns*self->rows_per_tile);
+    int next = tr + dr;
+    if (self->prefetcher && dr != 0 && next >= 0 && next < self->n_tile_rows &&
+        self->index[next*self->n_tile_cols + tc] < 0)
+    {
+        g_mutex_lock(&self->lock);
+        if (self->prefetch_reading != next && self->prefetch_ready != next) {
+            self->prefetch_wanted = next;
+            g_cond_broadcast(&self->cond);
+        }
+        g_mutex_unlock(&self->lock);
+    }
 
-    // update where this cache entry starts
-    int rs = (line / self->rows_per_tile) * self->rows_per_tile;
-    self->rowstarts[spot] = rs;
+    self->last_tile_row = tr;
+    self->last_tile_col = tc;
 
-    // mark this tile as the most recently accessed
-    self->access_counts[spot] = self->n_access++;
+    assert(self->index[tr*self->n_tile_cols + tc] >= 0);
+    return self->index[tr*self->n_tile_cols + tc];
+}
 
-    //printf("Updated entry #%d:\n"
-    //    "     row start: %d\n"
-    //    "     row end: %d\n"
-    //    "     access count: %d\n", spot,
-    //    rs, rs+self->rows_per_tile-1, self->access_counts[spot]);
-
-    // ensure we don't read past the end of the file
-    int rows_to_get = self->rows_per_tile;
-    if (rs + self->rows_per_tile > self->nl)
-        rows_to_get = self->nl - rs;
-
-    if (!quiet) {
-        asfPrintStatus("Cache: loading into spot #%d: rows %d-%d\n",
-            spot, rs, rs+rows_to_get);
-        //print_cache_size(self);
-    }
+// Where "line" starts in tile column "tc", loading the tile if needed.
+static unsigned char *tile_row(CachedImage *self, int line, int tc)
+{
+    int tr = line / self->tile_nl;
+    int spot = self->index[tr*self->n_tile_cols + tc];
+    if (spot < 0)
+        spot = load_tile(self, tr, tc);
+    else
+        touch(self, spot);
+
+    return self->cache[spot] +
+        (size_t)(line - tr*self->tile_nl)*self->tile_ns*data_size(self);
+}
 
-    self->client->read_fn(rs, rows_to_get, (void*)(self->cache[spot]),
-        self->client->read_client_info, self->meta, self->client->data_type);
+static unsigned char *get_pixel(CachedImage *self, int line, int samp)
+{
+    // check if outside the image
+    if (line<0 || samp<0 || line >= self->nl || samp >= self->ns)
+        return zero_pixel;
 
-    assert((line-rs)*self->ns + samp <= self->ns*self->rows_per_tile);
-    return &self->cache[spot][((line-rs)*self->ns + samp)*ds];
+    int tc = samp / self->tile_ns;
+    return tile_row(self, line, tc) +
+        (size_t)(samp - tc*self->tile_ns)*data_size(self);
 }
 
 void load_thumbnail_data(CachedImage *self, int thumb_size_x, int thumb_size_y,
@@ -224,9 +363,11 @@ void load_thumbnail_data(CachedImage *self, int thumb_size_x, int thumb_size_y,
 
         quiet=FALSE;
     } else {
+        g_mutex_lock(&read_lock);
         self->client->thumb_fn(thumb_size_x, thumb_size_y,
             self->meta, self->client->read_client_info, dest_void,
             self->client->data_type);
+        g_mutex_unlock(&read_lock);
     }
 }
 
@@ -256,48 +397,76 @@ CachedImage * cached_image_new_from_file(
     self->ns = meta->general->sample_count;
     asfPrintStatus("Image is %dx%d LxS\n", self->nl, self->ns);
 
+    int ds = data_size(self);
     if (client->require_full_load) {
         // Use only 1 tile -- load entire image into it
         // (client tells us we should do it this way)
         // will it fit?  Who knows.  Assume it will, MALLOC will fail
         // if it actually does not.
-        self->rows_per_tile = self->nl;
+        self->tile_nl = self->nl;
+        self->tile_ns = self->ns;
     } else {
-        // how many rows per tile?
-        // We will use ~64 Meg tiles
-        self->rows_per_tile = 64*1024*1024 / (self->ns*data_size(self));
+        // Square tiles, read in bands of up to ~64 Meg
+        self->tile_ns = MIN(TILE_SIZE, self->ns);
+        self->tile_nl = MIN(TILE_SIZE, BAND_BYTES / (self->ns*ds));
+        self->tile_nl = MAX(1, MIN(self->tile_nl, self->nl));
 
         // test line -- uncomment this for very small tiles
-        //self->rows_per_tile = 2*1024*1024 / (self->ns*data_size(self));
+        //self->tile_nl = self->tile_ns = 16;
     }
 
-    asfPrintStatus("Using %d rows per tile.\n", self->rows_per_tile);
+    asfPrintStatus("Using %dx%d LxS tiles.\n", self->tile_nl, self->tile_ns);
 
-    int n_tiles_required = (int)ceil((double)self->nl / self->rows_per_tile);
-    self->entire_image_fits = n_tiles_required <= MAX_TILES;
+    self->n_tile_rows = (self->nl + self->tile_nl - 1) / self->tile_nl;
+    self->n_tile_cols = (self->ns + self->tile_ns - 1) / self->tile_ns;
+    int n_tiles_required = self->n_tile_rows*self->n_tile_cols;
+    int budget = (int)MIN((size_t)INT_MAX, MAX_CACHE_BYTES/tile_bytes(self));
+    self->entire_image_fits = n_tiles_required <= budget;
     // self->entire_image_fits = FALSE; // uncomment to test thumb_fn
+    self->max_slots = MAX(1, MIN(n_tiles_required, budget));
 
     // at the beginning, we have no tiles
-    self->n_tiles = 0;
+    self->n_slots = 0;
     self->reached_max_tiles = FALSE;
 
     int i;
-    self->rowstarts = MALLOC(sizeof(int)*MAX_TILES);
-    self->cache = MALLOC(sizeof(float*)*MAX_TILES);
-    self->access_counts = MALLOC(sizeof(int)*MAX_TILES);
-    for (i=0; i<MAX_TILES; ++i) {
-        self->rowstarts[i] = -1;
+    self->index = MALLOC(sizeof(int)*n_tiles_required);
+    for (i=0; i<n_tiles_required; ++i)
+        self->index[i] = -1;
+    self->tile_of_slot = MALLOC(sizeof(int)*self->max_slots);
+    self->cache = MALLOC(sizeof(unsigned char*)*self->max_slots);
+    self->access_counts = MALLOC(sizeof(int)*self->max_slots);
+    for (i=0; i<self->max_slots; ++i) {
+        self->tile_of_slot[i] = -1;
         self->cache[i] = NULL;
         self->access_counts[i] = 0;
     }
 
     self->n_access = 0;
+    self->band = NULL;
+    self->last_tile_row = self->last_tile_col = -1;
 
     asfPrintStatus("Number of tiles required for the entire image: %d\n",
         n_tiles_required);
     asfPrintStatus("Fits in memory: %s\n",
         self->entire_image_fits ? "Yes" : "No");
 
+    // If it all fits, it's all read in for the thumbnail anyway, and
+    // there's nothing to read ahead
+    g_mutex_init(&self->lock);
+    g_cond_init(&self->cond);
+    self->prefetch = NULL;
+    self->prefetch_wanted = -1;
+    self->prefetch_reading = -1;
+    self->prefetch_ready = -1;
+    self->prefetch_quit = FALSE;
+    self->prefetcher = NULL;
+    if (!self->entire_image_fits && self->n_tile_rows > 1) {
+        self->prefetch = MALLOC(band_bytes(self));
+        self->prefetcher = g_thread_new("cache prefetch", prefetch_thread,
+                                        self);
+    }
+
     return self;
 }
 
@@ -320,12 +489,11 @@ float cached_image_get_pixel (CachedImage *self, int line, int samp)
     return 0;
 }
 
-void cached_image_get_rgb(CachedImage *self, int line, int samp,
-                          unsigned char *r, unsigned char *g,
-                          unsigned char *b)
+static void pixel_rgb(CachedImage *self, unsigned char *p,
+                      unsigned char *r, unsigned char *g, unsigned char *b)
 {
     if (self->data_type == GREYSCALE_FLOAT) {
-        float f = cached_image_get_pixel(self, line, samp);
+        float f = *((float*)p);
         if (have_lut()) {
             // do not scale in the case of a lut
             apply_lut((int)f, r, g, b);
@@ -336,16 +504,16 @@ void cached_image_get_rgb(CachedImage *self, int line, int samp,
     }
     else if (self->data_type == GREYSCALE_BYTE) {
         if (have_lut()) {
-            apply_lut((int)(*(get_pixel(self, line, samp))), r, g, b);
+            apply_lut((int)(*p), r, g, b);
         }
         else {
-            float f = (float) *(get_pixel(self, line, samp));
+            float f = (float) *p;
             *r = *g = *b =
                 (unsigned char)calc_scaled_pixel_value(self->stats, f);
         }
     }
     else if (self->data_type == RGB_BYTE) {
-        unsigned char *uc = get_pixel(self, line, samp);
+        unsigned char *uc = p;
 
         *r = (unsigned char)calc_rgb_scaled_pixel_value(self->stats_r,
                                                         (float)uc[0]);
@@ -355,7 +523,7 @@ void cached_image_get_rgb(CachedImage *self, int line, int samp,
                                                         (float)uc[2]);
     }
     else if (self->data_type == RGB_FLOAT) {
-        float *f = (float*)get_pixel(self, line, samp);
+        float *f = (float*)p;
 
         *r = (unsigned char)calc_rgb_scaled_pixel_value(self->stats_r,f[0]);
         *g = (unsigned char)calc_rgb_scaled_pixel_value(self->stats_g,f[1]);
@@ -368,6 +536,44 @@ void cached_image_get_rgb(CachedImage *self, int line, int samp,
     }
 }
 
+void cached_image_get_rgb(CachedImage *self, int line, int samp,
+                          unsigned char *r, unsigned char *g,
+                          unsigned char *b)
+{
+    pixel_rgb(self, get_pixel(self, line, samp), r, g, b);
+}
+
+void cached_image_get_rgb_row(CachedImage *self, int line,
+                              const int *samps, int n, unsigned char *rgb)
+{
+    int ds = data_size(self);
+    int line_ok = line >= 0 && line < self->nl;
+    int curr_tc = -1;
+    unsigned char *row = NULL;
+    int k;
+
+    for (k=0; k<n; ++k) {
+        int samp = samps[k];
+        unsigned char *p;
+
+        if (!line_ok || samp < 0 || samp >= self->ns) {
+            p = zero_pixel;
+        }
+        else {
+            // loading a tile may push out an earlier one, but we only
+            // ever hang on to the row of the current tile
+            int tc = samp / self->tile_ns;
+            if (tc != curr_tc) {
+                row = tile_row(self, line, tc);
+                curr_tc = tc;
+            }
+            p = row + (size_t)(samp - tc*self->tile_ns)*ds;
+        }
+
+        pixel_rgb(self, p, rgb+3*k, rgb+3*k+1, rgb+3*k+2);
+    }
+}
+
 void cached_image_get_rgb_float(CachedImage *self, int line, int samp,
                                 float *r, float *g, float *b)
 {
@@ -402,7 +608,18 @@ void cached_image_get_rgb_float(CachedImage *self, int line, int samp,
 void cached_image_free (CachedImage *self)
 {
     int i;
-    for (i=0; i<self->n_tiles; ++i) {
+
+    if (self->prefetcher) {
+        g_mutex_lock(&self->lock);
+        self->prefetch_quit = TRUE;
+        g_cond_broadcast(&self->cond);
+        g_mutex_unlock(&self->lock);
+        g_thread_join(self->prefetcher);
+    }
+    g_mutex_clear(&self->lock);
+    g_cond_clear(&self->cond);
+
+    for (i=0; i<self->n_slots; ++i) {
         if (self->cache[i])
             free(self->cache[i]);
     }
@@ -410,7 +627,10 @@ void cached_image_free (CachedImage *self)
     if (self->client->free_fn)
       self->client->free_fn(self->client->read_client_info);
 
-    free(self->rowstarts);
+    FREE(self->prefetch);
+    FREE(self->band);
+    free(self->index);
+    free(self->tile_of_slot);
     free(self->access_counts);
     free(self->cache);
     free(self->client);
@@ -419,4 +639,3 @@ void cached_image_free (CachedImage *self)
 
     free(self);
 }
-
@@ -18,7 +18,7 @@
 //  cache.c:
 //    data_size()
 //    cached_image_get_pixel()
-//    cached_image_get_rgb()
+//    pixel_rgb()
 //  stats.c:
 //    generate_thumbnail_data()
 //  big_image.c:
@@ -94,17 +94,41 @@ typedef struct {
 //---------------------------------------------------------------------------
 // Here is the ImageCache stuff.  The global ImageCache that holds the
 // loaded image is "data_ci".  This is all private data.
+//
+// The image is cut into tiles of tile_nl x tile_ns pixels, each kept in
+// one of the cache slots.  "index" maps a tile (by tile row and column)
+// straight to its slot, or -1 if it isn't loaded.  Clients can only
+// read whole rows, so a miss reads the full-width band of tile_nl rows
+// holding the tile and files as many of that band's tiles as it can
+// spare room for.  When the image doesn't fit, a worker thread reads the
+// next band ahead in the direction the user is panning.  Only the main thread touches the
+// slots and the index; the worker only fills "prefetch".
 typedef struct {
   int nl, ns;               // Image dimensions.
   ClientInterface *client;  // pointers to data read implementations
-  int n_tiles;              // Number of tiles in memory
-  int reached_max_tiles;    // Have we loaded as many tiles as we can?
-  int rows_per_tile;        // Number of rows in each tile
+  int tile_nl, tile_ns;     // Tile dimensions
+  int n_tile_rows;          // Number of tile rows (bands) in the image
+  int n_tile_cols;          // Number of tile columns in the image
+  int *index;               // Slot holding each tile, or -1
+  int n_slots;              // Number of slots allocated so far
+  int max_slots;            // Most slots we will allocate
+  int reached_max_tiles;    // Have we allocated as many slots as we can?
   int entire_image_fits;    // TRUE if we can load the entire image
-  int *rowstarts;           // Row numbers starting each tile
+  int *tile_of_slot;        // Tile held in each slot, or -1
   unsigned char **cache;    // Cached values (floats, unsigned chars ...)
   int *access_counts;       // Updated when a tile is accessed
-  int n_access;             // used to find oldest tile
+  int n_access;             // used to find least recently used tile
+  unsigned char *band;      // Buffer for bands read on a miss
+  int last_tile_row;        // Tile of the previous miss, to find the
+  int last_tile_col;        //   direction we are panning in
+  GThread *prefetcher;      // NULL if not prefetching
+  GMutex lock;              // Protects the prefetch fields below
+  GCond cond;
+  unsigned char *prefetch;  // Band read by the prefetcher
+  int prefetch_wanted;      // Band the prefetcher should read next, or -1
+  int prefetch_reading;     // Band being read into "prefetch", or -1
+  int prefetch_ready;       // Band sitting in "prefetch", or -1
+  int prefetch_quit;        // Tells the prefetcher to exit
   ssv_data_type_t data_type;// type of data we have
   meta_parameters *meta;    // metadata -- don't own this pointer
   ImageStats *stats;        // not owned by us, not populated by us
@@ -124,6 +148,11 @@ void cached_image_get_rgb(CachedImage *self, int line, int samp,
                           unsigned char *b);
 void cached_image_get_rgb_float(CachedImage *self, int line, int samp,
                                 float *r, float *g, float *b);
+// Same as calling cached_image_get_rgb() for samples samps[0..n-1] of
+// one line, with rgb getting 3 bytes per sample -- but the tile lookup
+// is done once per tile instead of once per pixel.
+void cached_image_get_rgb_row(CachedImage *self, int line,
+                              const int *samps, int n, unsigned char *rgb);
 
 void load_thumbnail_data(CachedImage *self, int thumb_size_x, int thumb_size_y,
                          void *dest);
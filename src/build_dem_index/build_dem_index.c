@@ -0,0 +1,115 @@
+#define ASF_NAME_STRING "build_dem_index"
+
+#define ASF_USAGE_STRING \
+"   "ASF_NAME_STRING" [-log <logfile>] [-quiet] <dem directory> [...]\n"
+
+#define ASF_DESCRIPTION_STRING \
+"     This program creates or refreshes the index of DEM footprints that\n"\
+"     asf_terrcorr uses when it is given a directory of DEMs, instead of a\n"\
+"     single DEM.  Only the DEMs that were added or changed since the index\n"\
+"     was last built are read.  The index is kept in the file\n"\
+"     "DEM_INDEX_FILE" in each of the directories.\n"
+
+#include <stdio.h>
+#include <asf.h>
+#include <asf_meta.h>
+#include <asf_license.h>
+#include <asf_contact.h>
+#include <asf_terrcorr.h>
+
+// Print minimalistic usage info & exit
+static void build_dem_index_usage(const char *name)
+{
+  asfPrintStatus("\n"
+      "Usage:\n"
+      ASF_USAGE_STRING
+      "\n");
+  exit(EXIT_FAILURE);
+}
+
+// Print the help info & exit
+static void print_help(void)
+{
+  asfPrintStatus(
+      "\n"
+      "Tool name:\n   " ASF_NAME_STRING "\n\n"
+      "Usage:\n" ASF_USAGE_STRING "\n"
+      "Description:\n" ASF_DESCRIPTION_STRING "\n"
+      "Version:\n   " SVN_REV " (part of " TOOL_SUITE_NAME " " MAPREADY_VERSION_STRING ")\n\n");
+  exit(EXIT_SUCCESS);
+}
+
+static int strmatches(const char *key, ...)
+{
+    va_list ap;
+    char *arg = NULL;
+    int found = FALSE;
+
+    va_start(ap, key);
+    do {
+        arg = va_arg(ap, char *);
+        if (arg) {
+            if (strcmp(key, arg) == 0) {
+                found = TRUE;
+                break;
+            }
+        }
+    } while (arg);
+
+    return found;
+}
+
+// work around a hard-coded function call in CHECK_ARG macro
+#define usage build_dem_index_usage
+
+// Main program body.
+int
+main (int argc, char *argv[])
+{
+  int currArg = 1;
+  const int n=1024;
+
+  handle_license_and_version_args(argc, argv, ASF_NAME_STRING);
+  asfSplashScreen(argc, argv);
+
+  if (argc >= 2 && strmatches(argv[1],"-help","--help",NULL))
+    print_help();
+  if (argc<2)
+    build_dem_index_usage(ASF_NAME_STRING);
+
+  while (currArg < argc) {
+    char *key = argv[currArg++];
+    if (strmatches(key,"-help","--help",NULL)) {
+        print_help(); // doesn't return
+    }
+    else if (strmatches(key,"-log","--log",NULL)) {
+      CHECK_ARG(1);
+      strncpy_safe(logFile,GET_ARG(1),n);
+      fLog = FOPEN(logFile, "a");
+      logflag = TRUE;
+    }
+    else if (strmatches(key,"-quiet","--quiet","-q",NULL)) {
+      quietflag = TRUE;
+    }
+    else {
+      --currArg;
+      break;
+    }
+  }
+
+  if (currArg >= argc) {
+    printf("Insufficient arguments.  Expected a DEM directory.\n");
+    build_dem_index_usage(argv[0]);
+  }
+
+  for (; currArg < argc; ++currArg) {
+    if (!is_dir(argv[currArg]))
+      asfPrintError("Not a directory: %s\n", argv[currArg]);
+    int n_dems = build_dem_index(argv[currArg]);
+    asfPrintStatus("%s: %d DEM%s in the index.\n", argv[currArg], n_dems,
+                   n_dems == 1 ? "" : "s");
+  }
+
+  asfPrintStatus("Done.\n");
+  return EXIT_SUCCESS;
+}
@@ -95,6 +95,9 @@ PROGRAM HISTORY:
     5.6      2/04       P. Denny    - Change license from GPL to ASF. Change
                                         name from fico to coregister_fine.
     5.7      7/05       R. Gens     - Took care of endianess issue.
+    5.8                               - Keep both images open and read each
+                                        row of grid points once; correlate
+                                        the points of a row in parallel.
 
 HARDWARE/SOFTWARE LIMITATIONS:
 
@@ -110,13 +113,16 @@ BUGS:
 #include "asf_meta.h"
 #include "ifm.h"
 #include "asf_endian.h"
+#include "fft_plan.h"
+#include <assert.h>
+#include <glib.h>
 
 #define borderX 80	/*Distances from edge of image to start correlating.*/
 #define borderY 80
 #define minSNR 0.30	/*SNR's below this will be deleted.*/
 #define maxDisp 1.8	/*Forward and reverse correlations which differ by more 
 			  than this will be deleted.*/
-#define VERSION 5.7
+#define VERSION 5.8
 
 /*Read-only, informational globals:*/
 int wid, len;			/*Width and length of source images.*/
@@ -124,6 +130,35 @@ int intOffsetX, intOffsetY;	/*Image offset estimates from coregister_coarse.*/
 int srcSize=32, trgSize;
 float xMEP=4.1,yMEP=6.1;	/*Maximum Error Pixel values.*/
 complexFloat cZero;
+int pointNo=0;
+int gridResolution=20;	/*Grid points along each axis.*/
+
+/*An image, open for the whole run, and the band of lines around the
+current row of grid points.  The band is as tall as a target chip, so
+both the forward and the backward correlations of every point in the
+row read their chips from it.*/
+typedef struct {
+  FILE *fp;
+  meta_parameters *meta;
+  int ns;
+  int ampFlag;              /*REAL32 data, read as complex with 0 phase*/
+  complexFloat *band;       /*trgSize lines*/
+  float *ampBand;
+  int bandY;                /*first line in the band, -1 if none*/
+} fine_image;
+
+/*Per-thread working arrays*/
+typedef struct {
+  complexFloat *s, *t, *product;
+  float *peaks;
+} fine_workspace;
+
+/*A grid point, and what the forward and backward correlations made of it*/
+typedef struct {
+  int x1, y1, x2, y2;
+  int inBounds, good;
+  float dxFW, dyFW, snrFW, dxBW, dyBW, snrBW;
+} fine_point;
 
 /*Function declarations */
 void usage(char *name);
@@ -133,7 +168,14 @@ void initSourcePts(char *gridRes);
 bool getNextPoint(int *x1,int *y1,int *x2,int *y2);
 bool outOfBounds(int x1, int y1, int x2, int y2, int srcSize, int trgSize);
 
-void getPeak(int x1,int y1,char *szImg1,int x2,int y2,char *szImg2,float *dx,float *dy, float *snr,int fft_flag);
+void openImage(fine_image *img, char *szImg);
+void closeImage(fine_image *img);
+void readBand(fine_image *img, int y);
+void correlateRow(fine_image *img1, fine_image *img2, fine_point *points,
+		  int n, int fft_flag);
+void getPeak(int x1,int y1,const fine_image *img1,int x2,int y2,
+	     const fine_image *img2,fine_workspace *ws,float *dx,float *dy,
+	     float *snr,int fft_flag);
 void topOffPeak(float *peaks,int i, int j, int maxI, int maxJ,float *dx,float *dy);
 float getPhaseCoherence(complexFloat *igram,int sizeX,int sizeY);
 float getFFTCorrelation(complexFloat *igram,int sizeX,int sizeY);
@@ -144,11 +186,12 @@ int main(int argc, char *argv[])
 {
   char szOut[MAXNAME], szCtrl[MAXNAME], szImg1[MAXNAME], szImg2[MAXNAME];
   int fft_flag=0;
-  int x1, x2, y1, y2;
+  int ii, row;
   int goodPoints,attemptedPoints;
   FILE *fp_output;
-  char gridRes[256];
-  meta_parameters *meta;
+  char gridRes[256] = "";
+  fine_image img1, img2;
+  fine_point *points;
   
   /* parse command line */
   logflag=quietflag=FALSE;
@@ -199,11 +242,18 @@ int main(int argc, char *argv[])
   /* calculate parameters */
   trgSize = 2*srcSize;
   
-  /* determine size of input files */
-  meta = meta_read(szImg1);
-  wid = meta->general->sample_count;
-  len = meta->general->line_count;
-  meta_free(meta);
+  if (fft_flag && (srcSize & (srcSize-1)))
+    {
+      sprintf(errbuf,"   ERROR: The chip size (%d) must be a power of 2 "
+	      "for FFT matching.\n",srcSize);
+      printErr(errbuf);
+    }
+  
+  /* open both images, and determine their size */
+  openImage(&img1, szImg1);
+  openImage(&img2, szImg2);
+  wid = img1.ns;
+  len = img1.meta->general->line_count;
   
   /* initialize params before looping */
   cZero = Czero();
@@ -212,42 +262,46 @@ int main(int argc, char *argv[])
   fp_output=FOPEN(szOut,"w");
   
   initSourcePts(gridRes);
+  points = (fine_point *) MALLOC(sizeof(fine_point)*gridResolution);
   
-  /* Loop over grid, performing forward and backward correlations */
+  /* Loop over the grid a row at a time, performing forward and backward
+     correlations for every point in the row */
   goodPoints=attemptedPoints=0;
-  while (getNextPoint(&x1,&y1,&x2,&y2))
+  for (row=0; row<gridResolution; row++)
     {
-      float dx,dy,snr,dxFW,dyFW,snrFW,dxBW,dyBW,snrBW;
-      attemptedPoints++;
-      /*Check bounds...*/
-      if (!(outOfBounds(x1, y1, x2, y2, srcSize, trgSize) ||
-	    outOfBounds(x2, y2, x1, y1, srcSize, trgSize)))
+      int n=0;
+      while (n<gridResolution && getNextPoint(&points[n].x1,&points[n].y1,
+					       &points[n].x2,&points[n].y2))
+	n++;
+      if (n==0)
+	break;
+      correlateRow(&img1,&img2,points,n,fft_flag);
+      
+      for (ii=0; ii<n; ii++)
 	{
-	  /*...check forward correlation...*/
-	  getPeak(x1,y1,szImg1,x2,y2,szImg2,&dxFW,&dyFW,&snrFW,fft_flag);
-	  if (snrFW>minSNR)
-	    {
-	      /*...check backward correlation...*/
-	      getPeak(x2,y2,szImg2,x1,y1,szImg1,&dxBW,&dyBW,&snrBW,fft_flag);
-	      dxBW*=-1.0;dyBW*=-1.0;
-	      if ((snrBW>minSNR)&&
-		  (fabs(dxFW-dxBW)<maxDisp)&&
-		  (fabs(dyFW-dyBW)<maxDisp))
-		{
-		  goodPoints++;
-		  dx=(dxFW+dxBW)/2;
-		  dy=(dyFW+dyBW)/2;
-		  snr=snrFW*snrBW;
-		  fprintf(fp_output,"%6d %6d %8.5f %8.5f %4.2f\n",
-			  x1,y1,x2+dx,y2+dy,snr);
-		  fflush(fp_output);
-		  if (!quietflag && (goodPoints <= 10 || !(goodPoints%100)))
-		    printf("\t%6d %6d %8.5f %8.5f %4.2f/%4.2f\n",
-			   x1,y1,dx,dy,snrFW,snrBW);
-		}
-	    }
+	  fine_point *p = &points[ii];
+	  float dx,dy,snr;
+	  attemptedPoints++;
+	  if (!p->good)
+	    continue;
+	  goodPoints++;
+	  dx=(p->dxFW+p->dxBW)/2;
+	  dy=(p->dyFW+p->dyBW)/2;
+	  snr=p->snrFW*p->snrBW;
+	  fprintf(fp_output,"%6d %6d %8.5f %8.5f %4.2f\n",
+		  p->x1,p->y1,p->x2+dx,p->y2+dy,snr);
+	  if (!quietflag && (goodPoints <= 10 || !(goodPoints%100)))
+	    printf("\t%6d %6d %8.5f %8.5f %4.2f/%4.2f\n",
+		   p->x1,p->y1,dx,dy,p->snrFW,p->snrBW);
 	}
-    } /* end while(getNextPoint) */
+      fflush(fp_output);
+    }
+  
+  FCLOSE(fp_output);
+  FREE(points);
+  closeImage(&img1);
+  closeImage(&img2);
+  fft_plan_cleanup();
   
   if (goodPoints<20)
     {
@@ -307,8 +361,6 @@ void readControlFile(char *filename)
   FCLOSE(fp);
 }
 
-int pointNo=0;
-int gridResolution=20;
 void initSourcePts(char *gridRes)
 {
   /*Check to see if the last parameter contains a number, the grid resolution*/
@@ -334,20 +386,160 @@ bool getNextPoint(int *x1,int *y1,int *x2,int *y2)
   pointNo++;
   return TRUE;
 }
+void openImage(fine_image *img, char *szImg)
+{
+  img->meta = meta_read(szImg);
+  img->ns = img->meta->general->sample_count;
+  img->ampFlag = img->meta->general->data_type == REAL32;
+  img->fp = FOPEN(szImg, "rb");
+  img->band = (complexFloat *) MALLOC(sizeof(complexFloat)*trgSize*img->ns);
+  img->ampBand = img->ampFlag ?
+    (float *) MALLOC(sizeof(float)*trgSize*img->ns) : NULL;
+  img->bandY = -1;
+}
+
+void closeImage(fine_image *img)
+{
+  FCLOSE(img->fp);
+  FREE(img->band);
+  if (img->ampBand)
+    FREE(img->ampBand);
+  meta_free(img->meta);
+}
+
+/*readBand: load the trgSize lines centered (as the chips are) on line y*/
+void readBand(fine_image *img, int y)
+{
+  int ii, first = y-trgSize/2+1;
+  
+  if (first == img->bandY)
+    return;
+  if (img->ampFlag) {
+    get_float_lines(img->fp, img->meta, first, trgSize, img->ampBand);
+    for (ii=0; ii<trgSize*img->ns; ii++) {
+      img->band[ii].real = img->ampBand[ii];
+      img->band[ii].imag = 0.0;
+    }
+  }
+  else
+    get_complexFloat_lines(img->fp, img->meta, first, trgSize, img->band);
+  img->bandY = first;
+}
+
+/*The points of one grid row, shared by the threads correlating them*/
+struct point_row {
+  const fine_image *img1, *img2;
+  fine_point *points;
+  int n, fft_flag;
+  gint next;
+};
+
+struct point_thread {
+  struct point_row *row;
+  fine_workspace ws;
+};
+
+static gpointer point_row_thread(gpointer data)
+{
+  struct point_thread *t = data;
+  struct point_row *row = t->row;
+  int ii;
+  
+  while ((ii = g_atomic_int_add(&row->next, 1)) < row->n)
+    {
+      fine_point *p = &row->points[ii];
+      p->good = FALSE;
+      if (!p->inBounds)
+	continue;
+      /*...check forward correlation...*/
+      getPeak(p->x1,p->y1,row->img1,p->x2,p->y2,row->img2,&t->ws,
+	      &p->dxFW,&p->dyFW,&p->snrFW,row->fft_flag);
+      if (p->snrFW>minSNR)
+	{
+	  /*...check backward correlation...*/
+	  getPeak(p->x2,p->y2,row->img2,p->x1,p->y1,row->img1,&t->ws,
+		  &p->dxBW,&p->dyBW,&p->snrBW,row->fft_flag);
+	  p->dxBW*=-1.0;p->dyBW*=-1.0;
+	  p->good = (p->snrBW>minSNR)&&
+	    (fabs(p->dxFW-p->dxBW)<maxDisp)&&
+	    (fabs(p->dyFW-p->dyBW)<maxDisp);
+	}
+    }
+  
+  return NULL;
+}
+
+/*correlateRow: forward and backward correlations for a row of grid
+points (which all have the same y1 and y2), spread over the processors.*/
+void correlateRow(fine_image *img1, fine_image *img2, fine_point *points,
+		  int n, int fft_flag)
+{
+  static struct point_thread *workers=NULL; /*Keep working arrays around*/
+  static GThread **threads;
+  static int thread_count;
+  struct point_row row;
+  int ii, tt, any=FALSE;
+  
+  for (ii=0; ii<n; ii++)
+    {
+      fine_point *p = &points[ii];
+      /*Check bounds...*/
+      p->inBounds = !(outOfBounds(p->x1,p->y1,p->x2,p->y2,srcSize,trgSize) ||
+		      outOfBounds(p->x2,p->y2,p->x1,p->y1,srcSize,trgSize));
+      p->good = FALSE;
+      any = any || p->inBounds;
+    }
+  if (!any)
+    return;
+  readBand(img1, points[0].y1);
+  readBand(img2, points[0].y2);
+  
+  /*Allocate working arrays if we haven't already done so.*/
+  if (workers==NULL)
+    {
+      thread_count = MAX(1, MIN((int)g_get_num_processors(), n));
+      workers = (struct point_thread *)
+	MALLOC(sizeof(struct point_thread)*thread_count);
+      threads = (GThread **) MALLOC(sizeof(GThread *)*thread_count);
+      for (tt=0; tt<thread_count; tt++)
+	{
+	  fine_workspace *ws = &workers[tt].ws;
+	  ws->s = (complexFloat *)(MALLOC(srcSize*srcSize*sizeof(complexFloat)));
+	  ws->t = (complexFloat *)(MALLOC(trgSize*trgSize*sizeof(complexFloat)));
+	  ws->product = (complexFloat *)(MALLOC(srcSize*srcSize*sizeof(complexFloat)));
+	  ws->peaks=(float *)MALLOC(sizeof(float)*trgSize*trgSize);
+	}
+    }
+  
+  row.img1 = img1;
+  row.img2 = img2;
+  row.points = points;
+  row.n = n;
+  row.fft_flag = fft_flag;
+  row.next = 0;
+  for (tt=0; tt<thread_count; tt++)
+    workers[tt].row = &row;
+  for (tt=1; tt<thread_count; tt++)
+    threads[tt] = g_thread_new("coregister_fine", point_row_thread,
+			       &workers[tt]);
+  point_row_thread(&workers[0]);
+  for (tt=1; tt<thread_count; tt++)
+    g_thread_join(threads[tt]);
+}
+
 /*getPeak:
 This function computes a correlation peak, with SNR, between
-the two given images at the given points.
+the two given images at the given points.  Both images' bands must
+hold the lines around the points.
 */
-void getPeak(int x1,int y1,char *szImg1,int x2,int y2,char *szImg2,
+void getPeak(int x1,int y1,const fine_image *img1,int x2,int y2,
+	     const fine_image *img2,fine_workspace *ws,
 	     float *peakX,float *peakY, float *snr,int fft_flag)
 {
-  FILE *fpSource, *fpTarget;
-  meta_parameters *metaSource, *metaTarget;
-  static float *peaks;
-  static complexFloat *bufSource, *bufTarget; 
-  static complexFloat *s=NULL, *t, *product; /*Keep working arrays around */
-  static float *bufAmpSource, *bufAmpTarget;
-  int srcSamples, trgSamples;
+  complexFloat *s = ws->s, *t = ws->t, *product = ws->product;
+  float *peaks = ws->peaks;
+  const complexFloat *bufSource, *bufTarget;
+  int srcSamples = img1->ns, trgSamples = img2->ns;
   int peakMaxX, peakMaxY, x,y,xOffset,yOffset,count;
   int xOffsetStart, yOffsetStart, xOffsetEnd, yOffsetEnd;
   float dx,dy,accel1 = (float)(trgSize/2 - srcSize/2);
@@ -364,56 +556,13 @@ void getPeak(int x1,int y1,char *szImg1,int x2,int y2,char *szImg2,
   xOffsetEnd = (trgSize/2 - srcSize/2) + (int)(xMEP);
   yOffsetStart = (trgSize/2 - srcSize/2) - (int)(yMEP);
   yOffsetEnd = (trgSize/2 - srcSize/2) + (int)(yMEP);
- 
-  /* Read metadata */
-  metaSource = meta_read(szImg1);
-  metaTarget = meta_read(szImg2);
-  srcSamples = metaSource->general->sample_count;
-  trgSamples = metaTarget->general->sample_count;
-  int ii, ampFlag = FALSE;
-  if (metaSource->general->data_type == REAL32)
-    ampFlag = TRUE;
-
-  /*Allocate working arrays if we haven't already done so.*/
-  if (ampFlag && s==NULL) {
-    bufAmpSource = (float *) MALLOC(sizeof(float)*srcSize*srcSamples);
-    bufAmpTarget = (float *) MALLOC(sizeof(float)*trgSize*trgSamples);
-  }
-  if (s==NULL)
-    {
-      bufSource = (complexFloat *) MALLOC(sizeof(complexFloat)*srcSize*srcSamples);
-      bufTarget = (complexFloat *) MALLOC(sizeof(complexFloat)*trgSize*trgSamples);
-      s = (complexFloat *)(MALLOC(srcSize*srcSize*sizeof(complexFloat)));
-      t = (complexFloat *)(MALLOC(trgSize*trgSize*sizeof(complexFloat)));
-      product = (complexFloat *)(MALLOC(srcSize*srcSize*sizeof(complexFloat)));
-      peaks=(float *)MALLOC(sizeof(float)*trgSize*trgSize);
-    }
   
-  /* Open files, read lines and create subset */
-  fpSource = FOPEN(szImg1, "rb");
-  fpTarget = FOPEN(szImg2, "rb");
-  if (ampFlag) {
-    get_float_lines(fpSource, metaSource, y1-srcSize/2+1, srcSize, 
-		    bufAmpSource);
-    for (ii=0; ii<srcSize*srcSamples; ii++) {
-      bufSource[ii].real = bufAmpSource[ii];
-      bufSource[ii].imag = 0.0;
-    }
-    get_float_lines(fpTarget, metaTarget, y2-trgSize/2+1, trgSize, 
-		    bufAmpTarget);
-    for (ii=0; ii<trgSize*trgSamples; ii++) {
-      bufTarget[ii].real = bufAmpTarget[ii];
-      bufTarget[ii].imag = 0.0;
-    }
-  }
-  else {
-    get_complexFloat_lines(fpSource, metaSource, y1-srcSize/2+1, srcSize, 
-			   bufSource);
-    get_complexFloat_lines(fpTarget, metaTarget, y2-trgSize/2+1, trgSize, 
-			   bufTarget);
-  }
-  FCLOSE(fpSource);
-  FCLOSE(fpTarget);
+  /* Create the subsets, out of the bands */
+  assert(y1-srcSize/2+1 >= img1->bandY &&
+	 y1+srcSize/2 < img1->bandY+trgSize);
+  assert(y2-trgSize/2+1 == img2->bandY);
+  bufSource = img1->band + (y1-srcSize/2+1-img1->bandY)*srcSamples;
+  bufTarget = img2->band;
   for (y=0; y<srcSize; y++) {
     int srcIndex = y*srcSize;
     for (x=0; x<srcSize; x++)
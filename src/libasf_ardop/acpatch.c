@@ -42,6 +42,8 @@ DESCRIPTION: Performs azimuth compression for a SAR signal patch
 RETURN VALUE:
 
 SPECIAL CONSIDERATIONS:
+    The range lines are spread over ardop_thread_count() threads,
+    except when writing per-line debugging output.
 
 PROGRAM HISTORY:   Converted from FORTRAN subroutine for ROI.f 	T. Logan 8/96
 ***************************************************************************/
@@ -51,29 +53,181 @@ PROGRAM HISTORY:   Converted from FORTRAN subroutine for ROI.f 	T. Logan 8/96
 
 int ac_direction=0;/*Used only by dop_prf*/
 
-void acpatch(patch *p,const satellite *s)
-{
 #define sinCosTableEntries 4096
 #define sinCosTableBitmask 0x0fff
 
-
-	static complexFloat *sinCosTable=NULL;
-	float sinCosTableConv=1.0/pi2*sinCosTableEntries;
+/*Filled in once, by acpatch, before any threads use it.*/
+static complexFloat *sinCosTable=NULL;
+static const float sinCosTableConv=1.0/pi2*sinCosTableEntries;
 #define sinCos(phase) (sinCosTable[((int)((phase)*sinCosTableConv))&sinCosTableBitmask])
 
+struct acpatch_job {
+	patch *p;
+	const satellite *s;
+	complexFloat **ref;/*One reference function buffer per thread.*/
+};
+
+static void acpatch_line(void *data,int thread,int lineNo)
+{
+	struct acpatch_job *job=(struct acpatch_job *)data;
+	patch *p=job->p;
+	const satellite *s=job->s;
+	complexFloat *ref=job->ref[thread];
+	int lineOffset=lineNo*p->n_az;/*Offset to the current line in the trans array.*/
+
 	float  r, y, f0, f_rate;
 	int    np/*, ind*/;
-	complexFloat *ref=(complexFloat *)MALLOC(sizeof(complexFloat)*p->n_az);
 	float  phase, az_resamp;
 	float  dop_deskew;
 	int    n, nfc, nf0;
-	int    lineNo, j;
+	int    j;
 	complexFloat cZero=Czero();
 	float pixel2time=1.0/s->prf;
 	float *win;
 	/*float alpha;*/
 
-	
+	r = p->slantToFirst + (float)lineNo*p->slantPer;
+	f0 = p->fd + p->fdd*lineNo + p->fddd*lineNo*lineNo;
+	f_rate=getDopplerRate(r,f0,p->g);
+	np = (int)(r*s->refPerRange)/2;
+
+	/*Compute the pixel shift for this line.*/
+	/*az_resamp=Pixel shift caused by resampling function*/
+	az_resamp = p->yResampScale * lineNo + p->yResampOffset;
+	dop_deskew = s->a2*f0*r-s->dop_precomp;
+	y =  (az_resamp - dop_deskew)*pi2/(float)p->n_az;
+
+	/* create reference function */
+	for (j=0; j<p->n_az ; j++)
+		ref[j] = cZero;
+
+	phase = PI * pow(f0,2.0)/f_rate;
+	ref[0] = sinCos(phase);
+
+	/* Check to see if we are going to truncate the bandwidth in azimuth */
+/* Jeremy Made a big change here!
+	s->pctbwaz=0.5; */
+	if (s->pctbwaz!=0)
+		np=np*(1-s->pctbwaz);
+
+	if (ac_direction==0)
+	  for (j = 1; j <= np; j++)
+	  { /*Normal case: write both halves of reference function*/
+		float t = j*pixel2time;
+		float quadratic_phase=PI * f_rate*t*t;
+		float linear_phase=pi2*f0*t;
+		ref[j] = sinCos(quadratic_phase+linear_phase);
+		ref[p->n_az-j] = sinCos(quadratic_phase-linear_phase);
+	  }
+	else
+	  for (j = 1; j <= np; j++)
+	  { /*Loop for dop_prf: write only one half of reference function*/
+		float t = j*pixel2time;
+		float quadratic_phase=PI * f_rate*t*t;
+		float linear_phase=pi2*f0*t;
+		if (ac_direction>0)
+		  ref[j] = sinCos(quadratic_phase+linear_phase);
+		else
+		  ref[p->n_az-j] = sinCos(quadratic_phase-linear_phase);
+	  }
+
+	if (s->hamming == 1)
+	{
+		FILE *hamFile;
+		float weight;
+		hamFile=FOPEN("Hamming.window","w");
+
+		win=(float *)MALLOC(sizeof(float)*p->n_az);
+		for(j=0;j<p->n_az;j++)
+			win[j]=0.0;
+
+		/* Use a azimuth reference weighting function (Hamming Window) */
+		for(j=0;j<np;j++)
+		{
+			weight=0.8;
+			win[j]=weight-(1.0-weight)*-cos(2.0*PI*j/(2*np));
+			win[p->n_az-j-1]=weight-(1.0-weight)*-cos(2.0*PI*j/(2*np));
+		}
+		for(j=0;j<p->n_az;j++)
+		{
+			fprintf(hamFile,"%f\n",win[j]);
+			ref[j]=Csmul(win[j],ref[j]);
+		}
+		FCLOSE(hamFile);
+		free(win);
+	}
+
+/*	if (s->kaiser == 1)
+        {
+
+
+		FILE *kaiIn;
+
+		kaiIn=FOPEN("Kaiser.window","r");
+
+                win=(float *)MALLOC(sizeof(float)*p->n_az);
+                for(j=0;j<p->n_az;j++)
+                {
+			fscanf(kaiIn,"%f",&win[j]);
+
+                }
+		FCLOSE(kaiIn);
+                for(j=0;j<p->n_az;j++)
+                        ref[j]=Csmul(win[j],ref[j]);
+
+                        free(win);
+        } */
+
+        if (s->debugFlag & AZ_REF_T)
+            debugWritePatch_Line(lineNo, ref, "az_ref_t", p->n_range,
+                                 p->n_az);
+
+	/* forward transform the reference */
+	cfft1d(p->n_az,ref,-1);
+
+	if (s->debugFlag & AZ_REF_F)
+            debugWritePatch_Line(lineNo, ref, "az_ref_f", p->n_range,
+                                 p->n_az);
+
+	/* multiply the reference by the data */
+	if (!(s->debugFlag & NO_AZIMUTH))
+	{
+                int k;
+		n = NINT(f0/s->prf);
+		nf0 = p->n_az*(f0-n*s->prf)/s->prf;
+		nfc = nf0 + p->n_az/2;
+		if (nfc > p->n_az) nfc = nfc - p->n_az;
+		phase = - y * nf0;
+		for (k = 0; k<nfc; k++)
+		{
+			p->trans[lineOffset+k] =
+			    Cmul(Cmul(p->trans[lineOffset+k],Cconj(ref[k])),sinCos(phase));
+			phase += y;
+		}
+		phase = - y * nf0;
+		for (k = p->n_az-1; k>= nfc; k--)
+		{
+			p->trans[lineOffset+k]  =
+		    	Cmul(Cmul(p->trans[lineOffset+k],Cconj(ref[k])),sinCos(phase));
+			phase -= y;
+		}
+	}
+        if (s->debugFlag & AZ_X_F)
+            debugWritePatch_Line(lineNo, &(p->trans[lineOffset]),
+                                 "az_X_f", p->n_range, p->n_az);
+	/* inverse transform the product */
+	cfft1d(p->n_az,&(p->trans[lineOffset]),1);
+
+	if (!quietflag && (lineNo%1024 == 0))
+          asfPrintStatus("   ...Processing Line %i\n",lineNo);
+}
+
+void acpatch(patch *p,const satellite *s)
+{
+	struct acpatch_job job;
+	int nThreads=MIN(ardop_thread_count(),p->n_range);
+	int t;
+
 	if (sinCosTable==NULL)
 	{
 		int tableIndex;
@@ -86,146 +240,22 @@ void acpatch(patch *p,const satellite *s)
 		}
 	}
 
-	for (lineNo=0; lineNo< p->n_range; lineNo++)
-	{
-		int lineOffset=lineNo*p->n_az;/*Offset to the current line in the trans array.*/
-
-		r = p->slantToFirst + (float)lineNo*p->slantPer;
-		f0 = p->fd + p->fdd*lineNo + p->fddd*lineNo*lineNo;
-		f_rate=getDopplerRate(r,f0,p->g);
-		np = (int)(r*s->refPerRange)/2;
-
-		/*Compute the pixel shift for this line.*/
-		/*az_resamp=Pixel shift caused by resampling function*/
-		az_resamp = p->yResampScale * lineNo + p->yResampOffset;
-		dop_deskew = s->a2*f0*r-s->dop_precomp;
-		y =  (az_resamp - dop_deskew)*pi2/(float)p->n_az;
-		
-		/* create reference function */
-		for (j=0; j<p->n_az ; j++) 
-			ref[j] = cZero;
-		
-		phase = PI * pow(f0,2.0)/f_rate;
-		ref[0] = sinCos(phase);
-		
-		/* Check to see if we are going to truncate the bandwidth in azimuth */
-/* Jeremy Made a big change here!
-		s->pctbwaz=0.5; */
-		if (s->pctbwaz!=0)
-			np=np*(1-s->pctbwaz);
-
-		if (ac_direction==0)
-		  for (j = 1; j <= np; j++)
-		  { /*Normal case: write both halves of reference function*/
-			float t = j*pixel2time;
-			float quadratic_phase=PI * f_rate*t*t;
-			float linear_phase=pi2*f0*t;
-			ref[j] = sinCos(quadratic_phase+linear_phase);
-			ref[p->n_az-j] = sinCos(quadratic_phase-linear_phase);
-		  }
-		else
-		  for (j = 1; j <= np; j++)
-		  { /*Loop for dop_prf: write only one half of reference function*/
-			float t = j*pixel2time;
-			float quadratic_phase=PI * f_rate*t*t;
-			float linear_phase=pi2*f0*t;
-			if (ac_direction>0)
-			  ref[j] = sinCos(quadratic_phase+linear_phase);
-			else
-			  ref[p->n_az-j] = sinCos(quadratic_phase-linear_phase);
-		  }
-		
-		if (s->hamming == 1)
-		{
-			FILE *hamFile;
-			float weight;
-			hamFile=FOPEN("Hamming.window","w");
-
-			win=(float *)MALLOC(sizeof(float)*p->n_az);
-			for(j=0;j<p->n_az;j++)
-				win[j]=0.0;
-
-			/* Use a azimuth reference weighting function (Hamming Window) */
-			for(j=0;j<np;j++)
-			{
-				weight=0.8;
-				win[j]=weight-(1.0-weight)*-cos(2.0*PI*j/(2*np));
-				win[p->n_az-j-1]=weight-(1.0-weight)*-cos(2.0*PI*j/(2*np));
-			}	
-			for(j=0;j<p->n_az;j++)
-			{
-				fprintf(hamFile,"%f\n",win[j]);
-				ref[j]=Csmul(win[j],ref[j]);
-			}
-			FCLOSE(hamFile);
-			free(win);
-		}
+	/*The per-line debugging output and the Hamming window file are
+	written a line at a time, in order-- keep those to one thread.*/
+	if (s->hamming == 1 || (s->debugFlag & (AZ_REF_T|AZ_REF_F|AZ_X_F)))
+		nThreads=1;
 
-	/*	if (s->kaiser == 1)
-                {
+	job.p=p;
+	job.s=s;
+	job.ref=(complexFloat **)MALLOC(sizeof(complexFloat *)*nThreads);
+	for (t=0; t<nThreads; t++)
+		job.ref[t]=(complexFloat *)MALLOC(sizeof(complexFloat)*p->n_az);
 
+	cfft1d(p->n_az,NULL,0);
+	parallel_for(p->n_range,nThreads,acpatch_line,&job);
 
-			FILE *kaiIn;
-
-			kaiIn=FOPEN("Kaiser.window","r");
-
-                        win=(float *)MALLOC(sizeof(float)*p->n_az);
-                        for(j=0;j<p->n_az;j++)
-                        {       
-				fscanf(kaiIn,"%f",&win[j]);
-			
-                        }
-			FCLOSE(kaiIn);
-                        for(j=0;j<p->n_az;j++)
-                                ref[j]=Csmul(win[j],ref[j]);
-                                
-                                free(win);
-                } */
-
-                if (s->debugFlag & AZ_REF_T)
-                    debugWritePatch_Line(lineNo, ref, "az_ref_t", p->n_range,
-                                         p->n_az);
-		
-		/* forward transform the reference */
-		cfft1d(p->n_az,ref,-1);
-		
-		if (s->debugFlag & AZ_REF_F)
-                    debugWritePatch_Line(lineNo, ref, "az_ref_f", p->n_range,
-                                         p->n_az);
-		
-		/* multiply the reference by the data */
-		if (!(s->debugFlag & NO_AZIMUTH))
-		{
-                        int k;
-			n = NINT(f0/s->prf);
-			nf0 = p->n_az*(f0-n*s->prf)/s->prf;
-			nfc = nf0 + p->n_az/2;
-			if (nfc > p->n_az) nfc = nfc - p->n_az;
-			phase = - y * nf0;
-			for (k = 0; k<nfc; k++)
-			{
-				p->trans[lineOffset+k] =
-				    Cmul(Cmul(p->trans[lineOffset+k],Cconj(ref[k])),sinCos(phase));
-				phase += y;
-			} 
-			phase = - y * nf0;
-			for (k = p->n_az-1; k>= nfc; k--)
-			{
-				p->trans[lineOffset+k]  =
-			    	Cmul(Cmul(p->trans[lineOffset+k],Cconj(ref[k])),sinCos(phase));
-				phase -= y;
-			}
-		}
-                if (s->debugFlag & AZ_X_F)
-                    debugWritePatch_Line(lineNo, &(p->trans[lineOffset]),
-                                         "az_X_f", p->n_range, p->n_az);
-		/* inverse transform the product */
-		cfft1d(p->n_az,&(p->trans[lineOffset]),1);
-
-		if (!quietflag && (lineNo%1024 == 0))
-                  asfPrintStatus("   ...Processing Line %i\n",lineNo);
-	}
-	FREE((void *)ref);
+	for (t=0; t<nThreads; t++)
+		FREE(job.ref[t]);
+	FREE(job.ref);
 	if (s->debugFlag & AZ_X_T) debugWritePatch(p,"az_X_t");
 }
-
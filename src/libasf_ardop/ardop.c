@@ -70,9 +70,10 @@ HARDWARE/SOFTWARE LIMITATIONS:
              n_range = number of lines in the azimuth (range samples)
 
     n_az is defined is ardop_def.h as 4096, and a full swath of ERS CCSD
-    data includes 5616 range samples, so size(trans) = 176 Mbytes.  When
-    this is combined with the rest of the storage requirements for the
-    program, 200+ Mbytes are needed.
+    data includes 5616 range samples, so size(trans) = 176 Mbytes.  Two
+    patches are kept, since one is written out while the next is being
+    processed, along with the raw signal data for two patches (about 50
+    Mbytes each), so 450+ Mbytes are needed.
 
     Because of the 1000+ azimuth lines of overhead per patch, it is best
     NOT to decrease the defined value of n_az.  Rather, one should decrease
@@ -88,6 +89,12 @@ ALGORITHM DESCRIPTION:
     perform azimuth compression (acpatch)
     transpose the patch and write it in azimuth lines to output
 
+    The patches are pipelined: the signal data for the next patch is
+    read, and the previous patch written, in background threads while
+    the current one is processed.  Within a patch, the range lines,
+    azimuth lines and range columns are spread over all processors
+    (see parallel.c).
+
 ALGORITHM REFERENCES:
     This program and all subroutines were converted from Fortran programs
     donated by Howard Zebker, and extensively modified.
@@ -100,6 +107,57 @@ BUGS:
 #include "asf.h"
 #include "asf_meta.h"
 #include "ardop_defs.h"
+#include <glib.h>
+
+/*First signal line of the given patch (patches count from 1).*/
+static int patchLine(const file *f,int patchNo)
+{
+    return f->firstLineToProcess + (patchNo-1) * f->n_az_valid;
+}
+
+/*Reads the signal data for the next patch, in the background.*/
+struct patch_reader {
+    signalPatch *sig;
+    const getRec *signalGetRec;
+    int fromLine,fromSample;
+};
+
+static gpointer read_patch_thread(gpointer data)
+{
+    struct patch_reader *rd=(struct patch_reader *)data;
+    readSignalPatch(rd->sig,rd->signalGetRec,rd->fromLine,rd->fromSample);
+    return NULL;
+}
+
+/*Writes out a finished patch, in the background.  The main thread is
+printing its own progress meanwhile, so the writer prints nothing and
+times itself; finish_write reports once it is joined.*/
+struct patch_writer {
+    const patch *p;
+    const satellite *s;
+    meta_parameters *meta;
+    const file *f;
+    int patchNo;
+    gint64 usec;
+};
+
+static gpointer write_patch_thread(gpointer data)
+{
+    struct patch_writer *wr=(struct patch_writer *)data;
+    gint64 start=g_get_monotonic_time();
+    writePatchData(wr->p,wr->s,wr->meta,wr->f,wr->patchNo,FALSE);
+    wr->usec=g_get_monotonic_time()-start;
+    return NULL;
+}
+
+static void finish_write(GThread *writer,const struct patch_writer *wr)
+{
+    g_thread_join(writer);
+    if (!quietflag) printf("   WROTE PATCH %i OUT\n",wr->patchNo);
+    reportPatchWritten(wr->p,wr->f);
+    if (!quietflag) printf("   elapsed time = %i seconds.\n\n",
+                           (int)(wr->usec/1000000));
+}
 
 int ardop(struct INPUT_ARDOP_PARAMS * params_in)
 {
@@ -109,7 +167,8 @@ int ardop(struct INPUT_ARDOP_PARAMS * params_in)
     fill_default_ardop_params(&params);
 
 /*Structures: these are passed to the sub-routines which need them.*/
-    patch *p;
+    patch *p[2];
+    signalPatch *sig[2];
     satellite *s;
     rangeRef *r;
     getRec *signalGetRec;
@@ -117,7 +176,12 @@ int ardop(struct INPUT_ARDOP_PARAMS * params_in)
 
 /*Variables.*/
     int n_az,n_range;/*Region to be processed.*/
-    int patchNo;/*Loop counter.*/
+    int patchNo,ii;/*Loop counters.*/
+    int nPatches;/*Patches that fit in the input file.*/
+    meta_parameters *metaOut;
+    struct patch_reader rd;
+    struct patch_writer wr;
+    GThread *reader=NULL,*writer=NULL;
 
 /*Setup metadata*/
     /*Create ARDOP_PARAMS struct as well as meta_parameters.*/
@@ -196,32 +260,72 @@ int ardop(struct INPUT_ARDOP_PARAMS * params_in)
     }
 
 /*
-Create "patch" of data.  This patch is re-used to process
-all of the input data.
+Count the patches that fit in the input file.
 */
-    p=newPatch(n_az,n_range);
+    for (nPatches=0; nPatches<f->nPatches; nPatches++)
+        if (patchLine(f,nPatches+1)+n_az>signalGetRec->nLines)
+            break;
+
+/*
+Create the patches of data.  While one patch is processed, the signal
+data for the next is read in by one thread, and the previous patch is
+written out by another, so there are two of each.  They are re-used
+to process all of the input data.
+*/
+    for (ii=0; ii<2; ii++) {
+        p[ii]=newPatch(n_az,n_range);
+        sig[ii]=newSignalPatch(signalGetRec,n_az,n_range+r->refLen);
+    }
+/*The writer gets its own copy of the metadata-- writePatch updates it.*/
+    metaOut=meta_copy(meta);
+
+    if (nPatches>0)
+        readSignalPatch(sig[0],signalGetRec,patchLine(f,1),f->skipFile);
 
 /*Loop over each patch of data present, and process it.*/
-    for (patchNo=1; patchNo<=f->nPatches; patchNo++)
+    for (patchNo=1; patchNo<=nPatches; patchNo++)
     {
-        int lineToBeRead;
+        int cur=(patchNo-1)%2;
         if (!quietflag) printf("\n   *****    PROCESSING PATCH %i    *****\n\n",patchNo);
 
-        lineToBeRead = f->firstLineToProcess + (patchNo-1) * f->n_az_valid;
-        if (lineToBeRead+p->n_az>signalGetRec->nLines) {
-          if (!quietflag) printf("   Read all the patches in the input file.\n");
-          if (logflag) printLog("   Read all the patches in the input file.\n");
-          break;
+        /*Start reading the next patch.*/
+        if (reader) g_thread_join(reader);
+        reader=NULL;
+        if (patchNo<nPatches) {
+            rd.sig=sig[1-cur];
+            rd.signalGetRec=signalGetRec;
+            rd.fromLine=patchLine(f,patchNo+1);
+            rd.fromSample=f->skipFile;
+            reader=g_thread_new("ardop_read",read_patch_thread,&rd);
         }
 
         /*Update patch parameters for location.*/
-        setPatchLoc(p,s,meta,f->skipFile,f->skipSamp,lineToBeRead);
-        processPatch(p,signalGetRec,r,s);/*SAR Process patch.*/
-        writePatch(p,s,meta,f,patchNo);/*Output patch data to file.*/
+        setPatchLoc(p[cur],s,meta,f->skipFile,f->skipSamp,patchLine(f,patchNo));
+        compressPatch(p[cur],sig[cur],signalGetRec,r,s);/*SAR Process patch.*/
+
+        /*Output patch data to file, once the previous one is out.*/
+        if (writer) finish_write(writer,&wr);
+        update_status("Range-doppler done");
+        if (!quietflag) printf("   WRITING PATCH %i OUT...\n",patchNo);
+        wr.p=p[cur];
+        wr.s=s;
+        wr.meta=metaOut;
+        wr.f=f;
+        wr.patchNo=patchNo;
+        writer=g_thread_new("ardop_write",write_patch_thread,&wr);
     } /***********************end patch loop***********************************/
+    if (writer) finish_write(writer,&wr);
 
+    if (nPatches<f->nPatches) {
+        if (!quietflag) printf("   Read all the patches in the input file.\n");
+        if (logflag) printLog("   Read all the patches in the input file.\n");
+    }
 
-    destroyPatch(p);
+    for (ii=0; ii<2; ii++) {
+        destroyPatch(p[ii]);
+        destroySignalPatch(sig[ii]);
+    }
+    meta_free(metaOut);
 /*  if (!quietflag) printf("\nPROGRAM COMPLETED\n\n");*/
 
     if (logflag) {
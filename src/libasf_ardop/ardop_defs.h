@@ -86,6 +86,7 @@ void cfft1d(int n, complexFloat *c, int dir);
 
 /*-------------Structures:---------------
 patch: a chunk of SAR data, throughout the processor.
+signalPatch: the raw signal data a patch is made from, for rciq.
 rangeRef: the range reference function, for rciq.
 satellite: sundry imaging-related parameters, for rmpatch and acpatch.
 file: parameters describing output file.
@@ -101,6 +102,14 @@ typedef struct {
 	int fromSample,fromLine;/*Patch's location in original file.*/
 } patch;
 
+typedef struct {
+	int n_az,maxSamples;/*Number of lines; room for samples per line.*/
+	int readSamples;/*Samples actually read from each line.*/
+	int fromSample,fromLine;/*Location in the signal file.*/
+	int sampleSize;/*Bytes per raw signal sample.*/
+	unsigned char *raw;/*Raw signal bytes-- line y starts at raw[y*maxSamples*sampleSize].*/
+} signalPatch;
+
 typedef struct {
 	int refLen;/*Length of reference function, in samples.*/
 	int rangeFFT;/*Length of FFTs for range reference function.*/
@@ -182,14 +191,29 @@ void debugWritePatch_Line(int lineNo, complexFloat *line, char *basename,
                           int n_range, int n_az);
 void processPatch(patch *p,const getRec *signalGetRec,
 	const rangeRef *r,const satellite *s);
+void compressPatch(patch *p,const signalPatch *sig,const getRec *signalGetRec,
+	const rangeRef *r,const satellite *s);
 void writePatch(const patch *p,const satellite *s,meta_parameters *meta,
 	const file *f,int patchNo);
+void writePatchData(const patch *p,const satellite *s,meta_parameters *meta,
+	const file *f,int patchNo,int verbose);
+void reportPatchWritten(const patch *p,const file *f);
 void destroyPatch(patch *p);
 
 /*-------Routines to manipulate patches.----------*/
-void rciq(patch *p,const getRec *signalGetRec,const rangeRef *r);
+signalPatch *newSignalPatch(const getRec *signalGetRec,int n_az,int maxSamples);
+void readSignalPatch(signalPatch *sig,const getRec *signalGetRec,
+	int fromLine,int fromSample);
+void destroySignalPatch(signalPatch *sig);
+void rciq(patch *p,const signalPatch *sig,const getRec *signalGetRec,const rangeRef *r);
 void rmpatch(patch *p,const satellite *s);
 void acpatch(patch *p,const satellite *s);
 void antptn_correct(meta_parameters *meta,complexFloat *outputBuf,int curLine,int numSamples,const satellite *s);
 void writeTable(meta_parameters *meta, const satellite *s, int numSamples);
+
+/*-------Spreading work over threads (parallel.c).----------*/
+typedef void (*parallelFunc)(void *data,int thread,int item);
+void parallel_for(int nItems,int nThreads,parallelFunc fn,void *data);
+int ardop_thread_count(void);
+void ardop_set_thread_count(int n);
 #endif
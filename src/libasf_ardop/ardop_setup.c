@@ -37,6 +37,10 @@
 #include "odl.h"
 #include <math.h>
 #include <assert.h>
+#ifdef linux
+#include <stdlib.h>
+#include <sys/mman.h>
+#endif
 
 /*-------------------------------------------------------------------------*/
 /*    The following is the list of all parameters needed to run ardop.c      */
@@ -315,6 +319,28 @@ file *newFile(void)
     return f;
 }
 
+/*
+allocTrans:
+Storage for a patch's trans array.  The corner turns sweep through it
+a column at a time, touching a different page for every range bin, so
+where transparent huge pages are available big arrays are aligned for
+them and ask for them-- a hint the kernel is free to ignore.
+*/
+#define HUGE_PAGE_BYTES (2*1024*1024)
+static complexFloat *allocTrans(int n_range,int n_az)
+{
+    size_t bytes=(size_t)n_range*n_az*sizeof(complexFloat);
+#if defined(linux) && defined(MADV_HUGEPAGE)
+    void *mem;
+    if (bytes>=HUGE_PAGE_BYTES && posix_memalign(&mem,HUGE_PAGE_BYTES,bytes)==0)
+    {
+        madvise(mem,bytes,MADV_HUGEPAGE);
+        return (complexFloat *)mem;
+    }
+#endif
+    return (complexFloat *)MALLOC(bytes);
+}
+
 /*
 newPatch:
 Creates a patch of data.  Sets relevant parameters from globals,
@@ -325,7 +351,7 @@ patch *newPatch(int num_az,int num_range)
     patch *p=(patch *)MALLOC(sizeof(patch));
     p->n_az=num_az;
     p->n_range=num_range;
-    p->trans =(complexFloat *) MALLOC (p->n_range*p->n_az*sizeof(complexFloat));
+    p->trans=allocTrans(p->n_range,p->n_az);
     p->slantPer=rngpix;
     p->g=NULL;
     return p;
@@ -341,7 +367,7 @@ patch *copyPatch(patch *oldPatch)
         complexFloat *old_trans = oldPatch->trans;
     patch *p=(patch *)MALLOC(sizeof(patch));
     *p = *oldPatch;
-    p->trans =(complexFloat *) MALLOC (p->n_range*p->n_az*sizeof(complexFloat));
+    p->trans=allocTrans(p->n_range,p->n_az);
     memcpy(p->trans,old_trans,p->n_range*p->n_az*sizeof(complexFloat));
     return p;
 }
@@ -35,39 +35,24 @@ DESCRIPTION:
 RETURN VALUE:	None
 
 SPECIAL CONSIDERATIONS:
-   Automatically initializes fft cosine/coefficients array.
-   Keeps work array EVEN if different size fft is called for.
+   The transforms are planned and cached by size in asf_fft (see
+   fft_plan.h), so initializing (dir == 0) is optional, and any
+   number of threads may transform at once.  Callers doing many
+   lines at a time should use a batched fft_plan_1d() directly.
 
 ****************************************************************/
 #include "asf.h"
 #include "asf_meta.h"
 #include "ardop_defs.h"
-#include "fft.h"
+#include "fft_plan.h"
 
 void cfft1d(int n, complexFloat *c, int dir)
 {
-        static int prev_m = 0;
- 	int m=(int)(log(n)/log(2.0)+0.5);
 	if (dir == 0)
 	{
-            //printf("fftInit called for m=%d\n", m);
-            if (prev_m != m) {
-                if (prev_m > 0) {
-                    //printf("Freeing FFT data for m=%d\n", prev_m);
-                    fftFree();
-                }
-		int ret=fftInit(m);
-		if (ret!=0) {
-		  sprintf(errbuf,"   ERROR: Problem %d in FFT!\n",ret);
-		  printErr(errbuf);
-		}
-                prev_m = m;
-            } else {
-                //printf("Already initialized FFT for m=%d.\n", m);
-            }
+		fft_plan_1d(FFT_COMPLEX,FFT_FORWARD,n,1,1,n);
+		fft_plan_1d(FFT_COMPLEX,FFT_INVERSE,n,1,1,n);
 	}
-	if (dir > 0)  iffts((float *)c,m,1);
-	if (dir < 0)  ffts((float *)c,m, 1);
+	if (dir > 0)  fft_execute(fft_plan_1d(FFT_COMPLEX,FFT_INVERSE,n,1,1,n),(float *)c);
+	if (dir < 0)  fft_execute(fft_plan_1d(FFT_COMPLEX,FFT_FORWARD,n,1,1,n),(float *)c);
 }
-
-
@@ -0,0 +1,104 @@
+/****************************************************************
+FUNCTION NAME: parallel_for - run a loop body on several threads
+
+SYNTAX: parallel_for(nItems,nThreads,fn,data)
+
+PARAMETERS:
+    NAME:       TYPE:           PURPOSE:
+    --------------------------------------------------------
+    nItems      int             Number of loop iterations
+    nThreads    int             Threads to spread them over
+    fn          parallelFunc    Loop body, called as fn(data,thread,item)
+    data        void *          Passed through to fn
+
+DESCRIPTION:
+    The iterations are handed out one at a time from a shared
+    counter, so a thread that finishes early simply takes the next
+    one.  "thread" runs from 0 to nThreads-1 and is meant for
+    indexing per-thread work buffers.  The calling thread does its
+    share of the work as thread 0.  With one thread the iterations
+    run in order, in the calling thread.
+
+RETURN VALUE: None -- returns when every iteration is done.
+
+SPECIAL CONSIDERATIONS:
+    ardop_thread_count() is the number of processors unless it has
+    been set with ardop_set_thread_count().
+****************************************************************/
+#include "asf.h"
+#include "asf_meta.h"
+#include "ardop_defs.h"
+#include <glib.h>
+
+static int thread_count = 0;
+
+void ardop_set_thread_count(int n)
+{
+  thread_count = n;
+}
+
+int ardop_thread_count(void)
+{
+  if (thread_count <= 0)
+    return MAX(1, (int)g_get_num_processors());
+  return thread_count;
+}
+
+struct parallel_job {
+  int nItems;
+  int nextItem;
+  parallelFunc fn;
+  void *data;
+};
+
+struct parallel_thread {
+  struct parallel_job *job;
+  int thread;
+};
+
+static gpointer parallel_thread(gpointer data)
+{
+  struct parallel_thread *t = data;
+  struct parallel_job *job = t->job;
+  int item;
+
+  while ((item = g_atomic_int_add(&job->nextItem, 1)) < job->nItems)
+    job->fn(job->data, t->thread, item);
+
+  return NULL;
+}
+
+void parallel_for(int nItems,int nThreads,parallelFunc fn,void *data)
+{
+  struct parallel_job job;
+  int tt;
+
+  if (nThreads > nItems) nThreads = nItems;
+  if (nThreads <= 1) {
+    for (tt=0; tt<nItems; tt++)
+      fn(data, 0, tt);
+    return;
+  }
+
+  job.nItems = nItems;
+  job.nextItem = 0;
+  job.fn = fn;
+  job.data = data;
+
+  struct parallel_thread *workers =
+    MALLOC(sizeof(struct parallel_thread)*nThreads);
+  GThread **threads = MALLOC(sizeof(GThread *)*nThreads);
+
+  for (tt=0; tt<nThreads; tt++) {
+    workers[tt].job = &job;
+    workers[tt].thread = tt;
+  }
+  for (tt=1; tt<nThreads; tt++)
+    threads[tt] = g_thread_new("ardop", parallel_thread, &workers[tt]);
+  parallel_thread(&workers[0]);
+  for (tt=1; tt<nThreads; tt++)
+    g_thread_join(threads[tt]);
+
+  FREE(workers);
+  FREE(threads);
+}
@@ -23,6 +23,8 @@ BUGS:
 #include "asf_meta.h"
 #include "ardop_defs.h"
 #include <assert.h>
+#include "fft2d.h"
+#include "fft_plan.h"
 #include <asf_export.h>
 #include <asf_sar.h>
 
@@ -291,29 +293,58 @@ void debugWritePatch(const patch *p,char *basename)
   Performs all processing necessary on the given patch.
   Expects a fully prepared patch.
 
-  - read in & range compress the data (rciq).
-  - fft the data along azimuth.
-  - range migrate the data (rmpatch).
-  - azimuth compress the data (acpatch).
+  - read in the raw signal data for the patch.
+  - range compress, range migrate and azimuth compress it (compressPatch).
   the data is returned in the patch's trans array.
 */
 void processPatch(patch *p,const getRec *signalGetRec,const rangeRef *r,
           const satellite *s)
 {
-  int i;
+  signalPatch *sig=newSignalPatch(signalGetRec,p->n_az,p->n_range+r->refLen);
 
+  readSignalPatch(sig,signalGetRec,p->fromLine,p->fromSample);
+  compressPatch(p,sig,signalGetRec,r,s);
+  destroySignalPatch(sig);
+}
+
+/*Range bins transformed together along azimuth, as one batched FFT.*/
+#define AZ_FFT_BLOCK 16
+
+static void azimuth_fft_block(void *data,int thread,int block)
+{
+  patch *p=(patch *)data;
+  int fromLine=block*AZ_FFT_BLOCK;
+  int nLines=MIN(AZ_FFT_BLOCK,p->n_range-fromLine);
+  fft_execute(fft_plan_1d(FFT_COMPLEX,FFT_FORWARD,p->n_az,nLines,1,p->n_az),
+              (float *)&p->trans[fromLine*p->n_az]);
+}
+
+/*
+  compressPatch:
+  Performs all processing necessary on the given patch,
+  from raw signal data that has already been read.
+
+  - range compress the data (rciq).
+  - fft the data along azimuth.
+  - range migrate the data (rmpatch).
+  - azimuth compress the data (acpatch).
+  the data is returned in the patch's trans array.
+*/
+void compressPatch(patch *p,const signalPatch *sig,const getRec *signalGetRec,
+          const rangeRef *r,const satellite *s)
+{
   update_status("Range compressing");
   if (!quietflag) printf("   RANGE COMPRESSING CHANNELS...\n");
   elapse(0);
-  rciq(p,signalGetRec,r);
+  rciq(p,sig,signalGetRec,r);
   if (!quietflag) elapse(1);
   if (s->debugFlag & AZ_RAW_T) debugWritePatch(p,"az_raw_t");
 
   update_status("Starting azimuth compression");
   if (!quietflag) printf("   TRANSFORMING LINES...\n");
   elapse(0);
-  cfft1d(p->n_az,NULL,0);
-  for (i=0; i<p->n_range; i++) cfft1d(p->n_az,&p->trans[i*p->n_az],-1);
+  parallel_for((p->n_range+AZ_FFT_BLOCK-1)/AZ_FFT_BLOCK,ardop_thread_count(),
+               azimuth_fft_block,p);
   if (!quietflag) elapse(1);
   if (s->debugFlag & AZ_RAW_F) debugWritePatch(p,"az_raw_f");
   if (!(s->debugFlag & NO_RCM))
@@ -333,18 +364,25 @@ void processPatch(patch *p,const getRec *signalGetRec,const rangeRef *r,
 
   /*    if (!quietflag) printf("  Range-Doppler done...\n");*/
 }
+/*Output lines transposed out of the patch's trans array at once.*/
+#define WRITE_BLOCK 64
+
 /*
-  writePatch:
-  Outputs one full patch of data to the given file.
+  writePatchData:
+  Outputs one full patch of data to the given file.  Progress is only
+  printed if verbose is set: ardop calls this from its writer thread
+  while the next patch is being processed, and reports from the main
+  thread instead.
 */
-void writePatch(const patch *p,const satellite *s,meta_parameters *meta,
-    const file *f,int patchNo)
+void writePatchData(const patch *p,const satellite *s,meta_parameters *meta,
+    const file *f,int patchNo,int verbose)
 {
   int outLine;       /* Counter for line base output */
   FILE *fp_amp,*fp_cpx;  /* File pointers for the amplitude and  complex outputs*/
   FILE *fp_pwr,*fp_sig;  /* File pointers for the power and Sigma_0 outputs */
   FILE *fp_gam,*fp_bet;  /* File pointers for the Gamma_0 and Beta_0 outputs */
-  complexFloat *outputBuf; /* Buffer for one line of patch = n_range    */
+  complexFloat *outputBuf; /* One line of patch = n_range, in lineBlock  */
+  complexFloat *lineBlock; /* WRITE_BLOCK lines, corner turned out of trans */
   complexFloat *mlBuf;   /* Buffer for multilooking the amplitude image */
   float *amps;           /* Output Amplitude  = n_az/nlooks X n_range */
   float *pwrs;       /* Output power */
@@ -362,15 +400,11 @@ void writePatch(const patch *p,const satellite *s,meta_parameters *meta,
     writeNoiseTable=1;  /* If first patch AND antenna pattern correction,
                write the noise table */
 
-  update_status("Range-doppler done");
-  if (!quietflag) printf("   WRITING PATCH OUT...\n");
-  elapse(0);
-
   /* Allocate buffer space  ------------------------*/
   amps = (float *) MALLOC(p->n_range*sizeof(float));
   pwrs = (float *) MALLOC(p->n_range*sizeof(float));
 
-  outputBuf = (complexFloat *)MALLOC(p->n_range*sizeof(complexFloat));
+  lineBlock = (complexFloat *)MALLOC(p->n_range*WRITE_BLOCK*sizeof(complexFloat));
   mlBuf = (complexFloat *)MALLOC(p->n_range*f->nlooks*sizeof(complexFloat));
 
   meta->general->center_latitude = NAN;
@@ -446,27 +480,30 @@ void writePatch(const patch *p,const satellite *s,meta_parameters *meta,
       int base = f->firstOutputLine+outLine; /* loop counter for transposed data */
 
       if(writeNoiseTable==1) {
-          if (!quietflag) printf("   Writing .noise and .ant files\n");
+          if (verbose) printf("   Writing .noise and .ant files\n");
       }
 
       /* Print statement for the antenna pattern correction option */
       if(s->vecLen==0) {
-          if(!quietflag && (outLine % 1024 == 0)) {
+          if(verbose && (outLine % 1024 == 0)) {
               printf("   ...Writing Line %i\n",outLine);
           }
       }
       if(s->vecLen!=0) {
-          if(!quietflag && (outLine % 1024 == 0)) {
+          if(verbose && (outLine % 1024 == 0)) {
               printf("   ...Writing Line %i and applying Antenna Pattern Correction\n",
                      outLine);
           }
       }
 
-      /* Fill up the buffers */
+      /* Fill up the buffers: the patch's lines are the columns of
+         trans, so a block of them is transposed out at a time */
+      if (outLine % WRITE_BLOCK == 0)
+          ctranspose((float *)&p->trans[base],p->n_az,(float *)lineBlock,
+                     p->n_range,p->n_range,MIN(WRITE_BLOCK,f->n_az_valid-outLine));
+      outputBuf = &lineBlock[(outLine % WRITE_BLOCK)*p->n_range];
       for (j=0; j<p->n_range; j++,base+=p->n_az)
       {
-          outputBuf[j] = p->trans[base];
-
           /* For speed, if we aren't correcting the antenna pattern,
              write the multi-look buffer now */
           if(s->vecLen==0)
@@ -488,7 +525,7 @@ void writePatch(const patch *p,const satellite *s,meta_parameters *meta,
           }
 
           antptn_correct(meta,outputBuf,base,p->n_range,s);
-          if(!quietflag && (j==0)) printf("   Correcting Line %d\n",outLine);
+          if(verbose && (j==0)) printf("   Correcting Line %d\n",outLine);
 
           /* Otherwise, write the multi-look buffer now */
           for(j=0;j<p->n_range;j++)
@@ -550,17 +587,9 @@ void writePatch(const patch *p,const satellite *s,meta_parameters *meta,
   if (s->imageType.beta)
     FCLOSE(fp_bet);
 
-  if (!quietflag) printf("\n");
-  if (logflag) printLog("\n");
-  if (!quietflag) {
-    printf("   AMPLITUDE IMAGE FINISHED: Wrote %i lines and %i samples\n",
-           f->n_az_valid/f->nlooks,p->n_range);
-    printf("   PATCH FINISHED: Wrote %i lines of %i samples (float)\n\n",
-           f->n_az_valid,p->n_range);
-  }
   FREE((void *)amps);
   FREE((void *)pwrs);
-  FREE((void *)outputBuf);
+  FREE((void *)lineBlock);
   FREE((void *)mlBuf);
   meta_free(metaAmp);
   meta_free(metaCpx);
@@ -568,6 +597,36 @@ void writePatch(const patch *p,const satellite *s,meta_parameters *meta,
   if (metaSigma) meta_free(metaSigma);
   if (metaGamma) meta_free(metaGamma);
   if (metaBeta)  meta_free(metaBeta);
+}
+
+/*
+  reportPatchWritten:
+  Prints what writePatchData wrote out for a patch.
+*/
+void reportPatchWritten(const patch *p,const file *f)
+{
+  if (!quietflag) printf("\n");
+  if (logflag) printLog("\n");
+  if (!quietflag) {
+    printf("   AMPLITUDE IMAGE FINISHED: Wrote %i lines and %i samples\n",
+           f->n_az_valid/f->nlooks,p->n_range);
+    printf("   PATCH FINISHED: Wrote %i lines of %i samples (float)\n\n",
+           f->n_az_valid,p->n_range);
+  }
+}
+
+/*
+  writePatch:
+  Outputs one full patch of data to the given file, with progress.
+*/
+void writePatch(const patch *p,const satellite *s,meta_parameters *meta,
+    const file *f,int patchNo)
+{
+  update_status("Range-doppler done");
+  if (!quietflag) printf("   WRITING PATCH OUT...\n");
+  elapse(0);
+  writePatchData(p,s,meta,f,patchNo,!quietflag);
+  reportPatchWritten(p,f);
   if (!quietflag) elapse(1);
 }
 
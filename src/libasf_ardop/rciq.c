@@ -19,26 +19,34 @@
 *									      *
 ******************************************************************************/
 /****************************************************************
-FUNCTION NAME: rciq - Read a patch from file
+FUNCTION NAME: rciq - Range compress a patch
 
-SYNTAX: rciq(p,signalGetRec,r)
+SYNTAX: rciq(p,sig,signalGetRec,r)
 
 PARAMETERS:
     NAME:       TYPE:           PURPOSE:
     --------------------------------------------------------
     p		patch 		Output storage
-    signalGetRec getRec		Allow raw signal data input.
+    sig		signalPatch	Raw signal data for the patch
+    signalGetRec getRec		Describes the raw signal data.
     r		rangeRef	Range Reference Function
 
 DESCRIPTION:
-    Read raw signal data for a single patch,
+    For each line of raw signal data in the patch,
     Perform a forward transform on the data,
     Multiply the data by the reference function,
     Perform a reverse transform on the data.
 
+    The lines are independent.  They are transformed in blocks
+    of RCIQ_BLOCK, one batched FFT per block (see fft_plan.h),
+    and the blocks are spread over ardop_thread_count() threads,
+    each with its own FFT buffers.
+
 RETURN VALUE: None
 
 SPECIAL CONSIDERATIONS:
+    The signal data is read separately (readSignalPatch), so the
+    next patch can be read while this one is being compressed.
 
 PROGRAM HISTORY:  Converted from H Zebker's rciq.c - T. Logan 8/96
 ****************************************************************/
@@ -46,55 +54,108 @@ PROGRAM HISTORY:  Converted from H Zebker's rciq.c - T. Logan 8/96
 #include "asf_meta.h"
 #include "ardop_defs.h"
 #include "read_signal.h"
+#include "fft2d.h"
+#include "fft_plan.h"
+#include <assert.h>
 
 extern struct ARDOP_PARAMS g;/*ARDOP Globals, defined in ardop_params.h*/
 
-void rciq(patch *p,const getRec *signalGetRec,const rangeRef *r)
+/*newSignalPatch: room for n_az lines of up to maxSamples raw samples.*/
+signalPatch *newSignalPatch(const getRec *signalGetRec,int n_az,int maxSamples)
 {
-  static complexFloat *fft=NULL;
-  register int i,lineNo;
-  int readSamples=p->n_range+r->refLen;/*readSamples is the number of samples 
-				  of uncompressed signal which are to be read in.*/
-  patch *r_f=NULL, *raw_f=NULL, *raw_t=NULL, *r_x_f = NULL;
+  signalPatch *sig=(signalPatch *)MALLOC(sizeof(signalPatch));
+  sig->n_az=n_az;
+  sig->maxSamples=maxSamples;
+  sig->readSamples=0;
+  sig->fromSample=sig->fromLine=0;
+  sig->sampleSize=signalGetRec->sampleSize;
+  sig->raw=(unsigned char *)MALLOC((size_t)n_az*maxSamples*sig->sampleSize);
+  return sig;
+}
 
-  if (g.iflag & RANGE_REF_MAP) r_f=copyPatch(p);
-  if (g.iflag & RANGE_RAW_F) raw_f=copyPatch(p);
-  if (g.iflag & RANGE_RAW_T) raw_t=copyPatch(p);
-  if (g.iflag & RANGE_X_F) r_x_f=copyPatch(p);
+/*readSignalPatch: read the raw signal lines of the patch starting at
+fromLine, fromSample.*/
+void readSignalPatch(signalPatch *sig,const getRec *signalGetRec,
+	int fromLine,int fromSample)
+{
+  int lineNo;
+  size_t lineBytes=(size_t)sig->maxSamples*sig->sampleSize;
 
-/*Initialize fft buffer.*/
-  if (fft==NULL)
-    fft=(complexFloat *)MALLOC(sizeof(complexFloat)*r->rangeFFT);
+  sig->fromLine=fromLine;
+  sig->fromSample=fromSample;
 
 /*Check to see if we're reading past the end of the file.*/
-  if (p->fromSample+readSamples>signalGetRec->nSamples)
-    readSamples=signalGetRec->nSamples-p->fromSample;
+  sig->readSamples=sig->maxSamples;
+  if (fromSample+sig->readSamples>signalGetRec->nSamples)
+    sig->readSamples=signalGetRec->nSamples-fromSample;
 
-/* Initialize the FFT routine */
-  cfft1d(r->rangeFFT,fft,0);	
+  for (lineNo=0; lineNo<sig->n_az; lineNo++)
+    readSignalLine(signalGetRec,fromLine+lineNo,sig->raw+lineNo*lineBytes,
+                   fromSample,sig->readSamples);
+}
 
-  for (lineNo=0; lineNo<p->n_az; lineNo++)
-  {
-    if(!quietflag && ((lineNo%1024) == 0)) 
-      asfPrintStatus("   ...Processing Line %i\n",lineNo); 
+void destroySignalPatch(signalPatch *sig)
+{
+  FREE(sig->raw);
+  FREE(sig);
+}
 
-  /*Read i/q values into fft input buffer.*/
-    getSignalLine(signalGetRec,p->fromLine+lineNo,fft,p->fromSample,readSamples);
+/*Lines range compressed together, with one batched FFT each way.*/
+#define RCIQ_BLOCK 16
 
-  /*Zero-fill the end of the FFT buffer.*/	
+struct rciq_job {
+  patch *p;
+  const signalPatch *sig;
+  const getRec *signalGetRec;
+  const rangeRef *r;
+  complexFloat **fft;/*One block of FFT buffers per thread.*/
+  patch *r_f, *raw_f, *raw_t, *r_x_f;/*Debugging patches, or NULL.*/
+};
+
+static void copy_line(patch *dest,int lineNo,const complexFloat *src)
+{
+  register int i;
+  for (i=0; i<dest->n_range; i++)
+    dest->trans[i*dest->n_az+lineNo]=src[i];
+}
+
+static void rciq_block(void *data,int thread,int block)
+{
+  struct rciq_job *job=(struct rciq_job *)data;
+  patch *p=job->p;
+  const signalPatch *sig=job->sig;
+  const rangeRef *r=job->r;
+  int fromLine=block*RCIQ_BLOCK;
+  int nLines=MIN(RCIQ_BLOCK,p->n_az-fromLine);
+  register int i;
+  int l;
+  int readSamples=sig->readSamples;
+
+/*Unpack i/q values into the fft input buffers, zero-filling the ends.*/
+  for (l=0; l<nLines; l++)
+  {
+    int lineNo=fromLine+l;
+    complexFloat *fft=job->fft[thread]+(size_t)l*r->rangeFFT;
+    if(!quietflag && ((lineNo%1024) == 0))
+      asfPrintStatus("   ...Processing Line %i\n",lineNo);
+    unpackSignalLine(job->signalGetRec,sig->fromLine+lineNo,
+                     sig->raw+(size_t)lineNo*sig->maxSamples*sig->sampleSize,
+                     fft,sig->fromSample,readSamples);
     for (i=readSamples;i<r->rangeFFT;i++)
       fft[i].real = fft[i].imag = 0.0;
-    if (raw_t) {
-      for (i=0; i<p->n_range; i++) 
-        raw_t->trans[i*p->n_az+lineNo]=fft[i];
-    }
-  /* forward transform the data.*/
-      cfft1d(r->rangeFFT,fft,-1);
-      if (raw_f) {
-        for (i=0; i<p->n_range; i++)
-          raw_f->trans[i*p->n_az+lineNo]=fft[i];
-      }
-  /*Multiply by the reference function*/
+    if (job->raw_t) copy_line(job->raw_t,lineNo,fft);
+  }
+
+/* forward transform the data.*/
+  fft_execute(fft_plan_1d(FFT_COMPLEX,FFT_FORWARD,r->rangeFFT,nLines,1,r->rangeFFT),
+              (float *)job->fft[thread]);
+
+/*Multiply by the reference function*/
+  for (l=0; l<nLines; l++)
+  {
+    int lineNo=fromLine+l;
+    complexFloat *fft=job->fft[thread]+(size_t)l*r->rangeFFT;
+    if (job->raw_f) copy_line(job->raw_f,lineNo,fft);
     if (!(g.iflag & NO_RANGE))
     {
       for (i=0; i<r->rangeFFT; i++)
@@ -104,26 +165,54 @@ void rciq(patch *p,const getRec *signalGetRec,const rangeRef *r)
         fft[i].imag = tmp_r*r->ref[i].imag + fft[i].imag*r->ref[i].real;
       }
     }
-    if (r_x_f) {
-      for (i=0; i<p->n_range; i++) 
-	r_x_f->trans[i*p->n_az+lineNo] = fft[i];
-    }
+    if (job->r_x_f) copy_line(job->r_x_f,lineNo,fft);
+  }
 
-  /*Reverse transform the (now range-compressed) data.*/
-    cfft1d(r->rangeFFT,fft,1);
+/*Reverse transform the (now range-compressed) data.*/
+  fft_execute(fft_plan_1d(FFT_COMPLEX,FFT_INVERSE,r->rangeFFT,nLines,1,r->rangeFFT),
+              (float *)job->fft[thread]);
 
-  /* Copy data into the p->trans array - transposed */
-    for (i=0; i<p->n_range; i++) 
-      p->trans[i*p->n_az+lineNo]=fft[i];
-    if (r_f) {
-      for (i=0; i<p->n_range; i++)
-       r_f->trans[i*p->n_az+lineNo] = r->ref[i];
-    }
-  }
-  if (r_f) {debugWritePatch(r_f,"range_ref_map"); destroyPatch(r_f);}
-  if (raw_t) {debugWritePatch(raw_t,"range_raw_t"); destroyPatch(raw_t);}
-  if (raw_f) {debugWritePatch(raw_f,"range_raw_f"); destroyPatch(raw_f);}
-  if (r_x_f) {debugWritePatch(r_x_f,"range_X_f"); destroyPatch(r_x_f);}
-  return;
+/* Copy data into the p->trans array - transposed, a tile at a time */
+  ctranspose((float *)job->fft[thread],r->rangeFFT,
+             (float *)&p->trans[fromLine],p->n_az,nLines,p->n_range);
+  if (job->r_f)
+    for (l=0; l<nLines; l++)
+      copy_line(job->r_f,fromLine+l,r->ref);
 }
 
+void rciq(patch *p,const signalPatch *sig,const getRec *signalGetRec,const rangeRef *r)
+{
+  struct rciq_job job;
+  int nBlocks=(p->n_az+RCIQ_BLOCK-1)/RCIQ_BLOCK;
+  int nThreads=MIN(ardop_thread_count(),nBlocks);
+  int t;
+
+  assert(sig->n_az==p->n_az);
+
+  job.p=p;
+  job.sig=sig;
+  job.signalGetRec=signalGetRec;
+  job.r=r;
+  job.r_f=job.raw_f=job.raw_t=job.r_x_f=NULL;
+  if (g.iflag & RANGE_REF_MAP) job.r_f=copyPatch(p);
+  if (g.iflag & RANGE_RAW_F) job.raw_f=copyPatch(p);
+  if (g.iflag & RANGE_RAW_T) job.raw_t=copyPatch(p);
+  if (g.iflag & RANGE_X_F) job.r_x_f=copyPatch(p);
+
+/*Initialize fft buffers.*/
+  job.fft=(complexFloat **)MALLOC(sizeof(complexFloat *)*nThreads);
+  for (t=0; t<nThreads; t++)
+    job.fft[t]=(complexFloat *)MALLOC(sizeof(complexFloat)*r->rangeFFT*RCIQ_BLOCK);
+
+  parallel_for(nBlocks,nThreads,rciq_block,&job);
+
+  for (t=0; t<nThreads; t++)
+    FREE(job.fft[t]);
+  FREE(job.fft);
+
+  if (job.r_f) {debugWritePatch(job.r_f,"range_ref_map"); destroyPatch(job.r_f);}
+  if (job.raw_t) {debugWritePatch(job.raw_t,"range_raw_t"); destroyPatch(job.raw_t);}
+  if (job.raw_f) {debugWritePatch(job.raw_f,"range_raw_f"); destroyPatch(job.raw_f);}
+  if (job.r_x_f) {debugWritePatch(job.r_x_f,"range_X_f"); destroyPatch(job.r_x_f);}
+  return;
+}
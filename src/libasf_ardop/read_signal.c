@@ -148,42 +148,48 @@ getRec * fillOutGetRec(char file[])
     return r;
 }
 /****************************************
-getSignalLine:
-    Fetches and unpacks a single line of signal data
-into the given array.
+clipSignalLine:
+    Works out which part of a line of signal data a read of
+readLen samples starting at readStart covers.  Returns 0 if the
+line is outside the file.
 */
-void getSignalLine(const getRec *r,long long lineNo,complexFloat *destArr,int readStart,int readLen)
+static int clipSignalLine(const getRec *r,long long lineNo,int readStart,int readLen,
+                          int *left,int *leftClip,int *rightClip)
 {
-    int x;
-    int left,leftClip,rightClip;
     int windowShift=0;
-    float agcScale=1.0;
-    complexFloat czero=Czero();
 
-/*If the line is out of bounds, return zeros.*/
     if ((lineNo>=r->nLines)||(lineNo<0))
-    {
-        for (x=0;x<readLen;x++)
-            destArr[x]=czero;
-        return;
-    }
-/*Fetch window shift and AGC comp. if possible*/
+        return 0;
+
+/*Fetch window shift if possible*/
     if (r->lines!=NULL)
-    {
         windowShift=r->lines[lineNo].shiftBy;
-        agcScale=r->lines[lineNo].scaleBy;
-    }
 
 /*Compute which part of the line we'll read in.*/
-    leftClip=left=readStart-windowShift;
-    if (leftClip<0) {leftClip=0; /*left=0;*/}
-    rightClip=left+readLen;
-    if (rightClip>r->nSamples) rightClip=r->nSamples;
+    *leftClip=*left=readStart-windowShift;
+    if (*leftClip<0) {*leftClip=0; /*left=0;*/}
+    *rightClip=*left+readLen;
+    if (*rightClip>r->nSamples) *rightClip=r->nSamples;
+    return 1;
+}
+
+/****************************************
+readSignalLine:
+    Reads the raw bytes of a single line of signal data into raw,
+which must have room for readLen samples.  Only this touches the
+file, so lines can be read by one thread and unpacked by others.
+*/
+void readSignalLine(const getRec *r,long long lineNo,unsigned char *raw,int readStart,int readLen)
+{
+    int left,leftClip,rightClip;
+
+    if (!clipSignalLine(r,lineNo,readStart,readLen,&left,&leftClip,&rightClip))
+        return;
 
 /*Read line of raw signal data.*/
     FSEEK64(r->fp_in,r->header+lineNo*r->lineSize+leftClip*r->sampleSize,0);
     if (rightClip-leftClip!=
-        fread(r->inputArr,r->sampleSize,rightClip-leftClip,r->fp_in))
+        fread(raw,r->sampleSize,rightClip-leftClip,r->fp_in))
         {
          sprintf(errbuf,"   ERROR: Problem reading signal data file on line %lld!\n",lineNo);
 /*       fprintf(stderr,"Read length = %d, Left = %d Readstart = %d\n",readLen, left,readStart);
@@ -191,6 +197,31 @@ void getSignalLine(const getRec *r,long long lineNo,complexFloat *destArr,int re
              ,r->nLines, r->nSamples, rightClip, leftClip, windowShift); */
          printErr(errbuf);
         }
+}
+
+/****************************************
+unpackSignalLine:
+    Unpacks a line read by readSignalLine into the given array.
+*/
+void unpackSignalLine(const getRec *r,long long lineNo,const unsigned char *raw,
+                      complexFloat *destArr,int readStart,int readLen)
+{
+    int x;
+    int left,leftClip,rightClip;
+    float agcScale=1.0;
+    complexFloat czero=Czero();
+
+/*If the line is out of bounds, return zeros.*/
+    if (!clipSignalLine(r,lineNo,readStart,readLen,&left,&leftClip,&rightClip))
+    {
+        for (x=0;x<readLen;x++)
+            destArr[x]=czero;
+        return;
+    }
+/*Fetch AGC comp. if possible*/
+    if (r->lines!=NULL)
+        agcScale=r->lines[lineNo].scaleBy;
+
     leftClip-=left;
     rightClip-=left;
 
@@ -204,22 +235,33 @@ void getSignalLine(const getRec *r,long long lineNo,complexFloat *destArr,int re
         for (x=leftClip;x<rightClip;x++)
         {
             int index=2*(x-leftClip);
-            destArr[x].real=agcScale*(r->inputArr[index+1]-r->dcOffsetQ);
-            destArr[x].imag=agcScale*(r->inputArr[index]-r->dcOffsetI);
+            destArr[x].real=agcScale*(raw[index+1]-r->dcOffsetQ);
+            destArr[x].imag=agcScale*(raw[index]-r->dcOffsetI);
         }
     else /*if (r->flipIQ=='n')*/
         /*is Raw data (one byte I, next byte Q)*/
         for (x=leftClip;x<rightClip;x++)
         {
             int index=2*(x-leftClip);
-            destArr[x].real=agcScale*(r->inputArr[index]-r->dcOffsetI);
-            destArr[x].imag=agcScale*(r->inputArr[index+1]-r->dcOffsetQ);
+            destArr[x].real=agcScale*(raw[index]-r->dcOffsetI);
+            destArr[x].imag=agcScale*(raw[index+1]-r->dcOffsetQ);
         }
 
 /*Fill the right side with zeros.*/
     for (x=rightClip;x<readLen;x++)
         destArr[x]=czero;
 }
+
+/****************************************
+getSignalLine:
+    Fetches and unpacks a single line of signal data
+into the given array.
+*/
+void getSignalLine(const getRec *r,long long lineNo,complexFloat *destArr,int readStart,int readLen)
+{
+    readSignalLine(r,lineNo,r->inputArr,readStart,readLen);
+    unpackSignalLine(r,lineNo,r->inputArr,destArr,readStart,readLen);
+}
 /**************************************
 freeGetRec:
     Disposes of a getRec structure.
@@ -28,6 +28,10 @@ typedef struct {
 /*For fetching SAR echo data:*/
 getRec * fillOutGetRec(char file[]);
 void getSignalLine(const getRec *r,long long lineNo,complexFloat *destArr,int readStart,int readLen);
+/*The two halves of getSignalLine: reading needs the file, unpacking doesn't.*/
+void readSignalLine(const getRec *r,long long lineNo,unsigned char *raw,int readStart,int readLen);
+void unpackSignalLine(const getRec *r,long long lineNo,const unsigned char *raw,
+	complexFloat *destArr,int readStart,int readLen);
 void freeGetRec(getRec *r);
 
 /*For fetching the range pulse replica (range reference function).*/
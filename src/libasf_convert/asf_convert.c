@@ -2644,6 +2644,8 @@ static char *do_processing(convert_config *cfg, const char *inFile_in, int saveD
     double average_height = cfg->geocoding->height;
     double pixel_size = cfg->geocoding->pixel;
     float background_val = cfg->geocoding->background;
+
+    asf_geocode_set_thread_count(cfg->geocoding->threads);
     
     // When terrain correcting, ignore average height -- the height
     // has already been corrected for.
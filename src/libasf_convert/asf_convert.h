@@ -227,6 +227,7 @@ typedef struct
   char *resampling;       // resampling method: NEAREST_NEIGHBOR, BILINEAR, BICUBIC
   int force;              // force flag
   float background;       // value to use for pixels outside the image
+  int threads;            // number of resampling threads, 0 = one per CPU
 } s_geocoding;
 
 typedef struct
@@ -642,6 +642,7 @@ convert_config *init_fill_convert_config(char *configFile)
   strcpy(cfg->geocoding->resampling, "BILINEAR");
   cfg->geocoding->force = 0;
   cfg->geocoding->background = DEFAULT_NO_DATA_VALUE;
+  cfg->geocoding->threads = 1;
 
   cfg->export->format = (char *)MALLOC(sizeof(char)*25);
   strcpy(cfg->export->format, "GEOTIFF");
@@ -921,6 +922,8 @@ convert_config *init_fill_convert_config(char *configFile)
           cfg->geocoding->background = read_int(line, "background");
         if (strncmp(test, "force", 5)==0)
           cfg->geocoding->force = read_int(line, "force");
+        if (strncmp(test, "threads", 7)==0)
+          cfg->geocoding->threads = read_int(line, "threads");
 
         // Export
         if (strncmp(test, "output format", 13)==0)
@@ -1404,6 +1407,8 @@ convert_config *read_convert_config(char *configFile)
         cfg->geocoding->background = read_double(line, "background");
       if (strncmp(test, "force", 5)==0)
         cfg->geocoding->force = read_int(line, "force");
+      if (strncmp(test, "threads", 7)==0)
+        cfg->geocoding->threads = read_int(line, "threads");
       FREE(test);
     }
 
@@ -2207,6 +2212,11 @@ int write_convert_config(char *configFile, convert_config *cfg)
                 "# South America for a data set that is covering Alaska would lead to huge\n"
                 "# distortions. These checks can be overwritten by setting the force option.\n\n");
       fprintf(fConfig, "force = %i\n", cfg->geocoding->force);
+      if (!shortFlag)
+        fprintf(fConfig, "\n# The resampling can be spread over several threads, which speeds\n"
+                "# up geocoding on machines with more than one processor.  Setting this\n"
+                "# to 0 uses one thread per processor.  The default is 1.\n\n");
+      fprintf(fConfig, "threads = %i\n", cfg->geocoding->threads);
     }
     // Testdata generation - for internal use only
     // Creates a subset of probably map projected data
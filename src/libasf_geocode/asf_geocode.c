@@ -360,103 +360,168 @@ struct data_to_fit {
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-// Hold your nose...
+// Reverse mapping from output projection coordinates to input pixel
+// coordinates.
 //
-// These used to be function scoped statics in reverse_map_x and
-// reverse_map_y routines, but that broke horribly when this program
-// got converted into a library function because they never got reset
-// between calls, so now these are globals so that we can reset them
-// all to their initial state when we get to the end of the function.
-// The little '_rmx' and '_rmy' suffixes help remind us that these
-// globals go with the reverse_map_x and reverse_map_y routines,
-// repsectively.
-
-  // True iff this is our first time through this routine.
-  static gboolean first_time_through_rmx = TRUE;
-  // Accelerators and interpolators for the all the vertical columns
-  // of sample points.  Filled in first time through routine.
-  static gsl_interp_accel **y_accel_rmx;
-  static gsl_spline **y_spline_rmx;
-  // Current accelerator and interpolator.  Updated when y argument is
-  // different between calls.
-  static gsl_interp_accel *crnt_accel_rmx;
-  static gsl_spline *crnt_rmx;
-  // Value of y for which current interpolator works.
-  static double last_y_rmx;
-
-  // True iff this is our first time through this routine.
-  static gboolean first_time_through_rmy = TRUE;
-  // Accelerators and interpolators for the all the vertical columns
-  // of sample points.  Filled in first time through routine.
-  static gsl_interp_accel **y_accel_rmy;
-  static gsl_spline **y_spline_rmy;
-  // Current accelerator and interpolator.  Updated when y argument is
-  // different between calls.
-  static gsl_interp_accel *crnt_accel_rmy;
-  static gsl_spline *crnt_rmy;
-  // Value of y for which current interpolator works.
-  static double last_y_rmy;
+// The model is a set of splines running vertically through the
+// columns of the sparse grid, one set for x pixel indicies and one
+// for y pixel indicies.  To map a point we evaluate every column
+// spline at the point's y coordinate and then run a horizontal spline
+// through the results, which is evaluated at the point's x coordinate.
+//
+// The column splines are built once per input image and are only read
+// after that, so any number of threads may share them.  Everything
+// that changes between calls (the lookup accelerators and the current
+// horizontal splines) lives in a reverse_map_cursor, of which each
+// thread needs its own.
+
+struct reverse_map {
+  size_t sgs;                   // Sparse grid size, in points on a side.
+  const double *xprojs;         // Projection x coordinates of first row.
+  gsl_spline **x_columns;       // Column splines for x pixel index.
+  gsl_spline **y_columns;       // Column splines for y pixel index.
+};
 
-///////////////////////////////////////////////////////////////////////////////
+struct reverse_map_cursor {
+  const struct reverse_map *rm;
+  // Accelerators for all the column splines.
+  gsl_interp_accel **x_column_accel;
+  gsl_interp_accel **y_column_accel;
+  // Horizontal splines and their accelerators for the current y.
+  gsl_interp_accel *x_accel;
+  gsl_interp_accel *y_accel;
+  gsl_spline *x_row;
+  gsl_spline *y_row;
+  double *points;               // Scratch space for row spline setup.
+  gboolean have_row;            // True iff the row splines are set up...
+  double last_y;                // ...for this value of y.
+};
 
-// Reverse map from projection coordinates x, y to input pixel
-// coordinate X.  This function looks at the data to fit on the first
-// time through, in order to set up vertical splines, after which this
-// argument is mostly ignored.  But not entirely, so you can't free or
-// change the dtf.  Mapping is efficient only if the y coordinates are
-// usually identical between calls, since when y changes a new spline
-// between splines has to be created.
-static double
-reverse_map_x (struct data_to_fit *dtf, double x, double y)
+// Build the column splines from the sparse grid in dtf.  The dtf must
+// not be freed or changed while rm is in use.
+static void
+reverse_map_init (struct reverse_map *rm, struct data_to_fit *dtf)
 {
-  // Convenience aliases.
   size_t sgs = dtf->sparse_grid_size;
-  double *xprojs = dtf->sparse_x_proj;
   double *yprojs = dtf->sparse_y_proj;
-  double *xpixs = dtf->sparse_x_pix;
-
-  if ( G_UNLIKELY (first_time_through_rmx || y != last_y_rmx) ) {
-    if ( !first_time_through_rmx ) {
-      // Free the spline from the last line.
-      gsl_interp_accel_free (crnt_accel_rmx);
-      gsl_spline_free (crnt_rmx);
-    } else {
-      // Its our first time through, so set up the splines for the
-      // grid point columns.
-      y_accel_rmx = g_new (gsl_interp_accel *, sgs);
-      y_spline_rmx = g_new (gsl_spline *, sgs);
-      size_t ii;
-      for ( ii = 0 ; ii < sgs ; ii++ ) {
-  gsl_vector *cypv = gsl_vector_alloc (sgs);
-  gsl_vector *cxpixv = gsl_vector_alloc (sgs);
-  size_t jj;
-  for ( jj = 0 ; jj < sgs ; jj++ ) {
-    gsl_vector_set (cypv, jj, yprojs[jj * sgs + ii]);
-    gsl_vector_set (cxpixv, jj, xpixs[jj * sgs + ii]);
-  }
-  y_accel_rmx[ii] = gsl_interp_accel_alloc ();
-  y_spline_rmx[ii] = gsl_spline_alloc (gsl_interp_cspline, sgs);
-  gsl_spline_init (y_spline_rmx[ii], cypv->data, cxpixv->data, sgs);
-  gsl_vector_free (cxpixv);
-  gsl_vector_free (cypv);
-      }
-      first_time_through_rmx = FALSE;
-    }
-    // Set up the spline that runs horizontally, between the column
-    // splines.
-    crnt_accel_rmx = gsl_interp_accel_alloc ();
-    crnt_rmx = gsl_spline_alloc (gsl_interp_cspline, sgs);
-    double *crnt_points = g_new (double, sgs);
-    size_t ii;
-    for ( ii = 0 ; ii < sgs ; ii++ ) {
-      crnt_points[ii] = gsl_spline_eval_check (y_spline_rmx[ii], y, y_accel_rmx[ii]);
+
+  rm->sgs = sgs;
+  rm->xprojs = dtf->sparse_x_proj;
+  rm->x_columns = g_new (gsl_spline *, sgs);
+  rm->y_columns = g_new (gsl_spline *, sgs);
+
+  double *cyprojs = g_new (double, sgs);
+  double *cxpixs = g_new (double, sgs);
+  double *cypixs = g_new (double, sgs);
+  size_t ii;
+  for ( ii = 0 ; ii < sgs ; ii++ ) {
+    size_t jj;
+    for ( jj = 0 ; jj < sgs ; jj++ ) {
+      cyprojs[jj] = yprojs[jj * sgs + ii];
+      cxpixs[jj] = dtf->sparse_x_pix[jj * sgs + ii];
+      cypixs[jj] = dtf->sparse_y_pix[jj * sgs + ii];
     }
-    gsl_spline_init (crnt_rmx, xprojs, crnt_points, sgs);
-    g_free (crnt_points);
-    last_y_rmx = y;
+    rm->x_columns[ii] = gsl_spline_alloc (gsl_interp_cspline, sgs);
+    gsl_spline_init (rm->x_columns[ii], cyprojs, cxpixs, sgs);
+    rm->y_columns[ii] = gsl_spline_alloc (gsl_interp_cspline, sgs);
+    gsl_spline_init (rm->y_columns[ii], cyprojs, cypixs, sgs);
+  }
+  g_free (cypixs);
+  g_free (cxpixs);
+  g_free (cyprojs);
+}
+
+static void
+reverse_map_free (struct reverse_map *rm)
+{
+  size_t ii;
+  for ( ii = 0 ; ii < rm->sgs ; ii++ ) {
+    gsl_spline_free (rm->x_columns[ii]);
+    gsl_spline_free (rm->y_columns[ii]);
+  }
+  g_free (rm->x_columns);
+  g_free (rm->y_columns);
+}
+
+static void
+reverse_map_cursor_init (struct reverse_map_cursor *rmc,
+                         const struct reverse_map *rm)
+{
+  size_t sgs = rm->sgs;
+
+  rmc->rm = rm;
+  rmc->x_column_accel = g_new (gsl_interp_accel *, sgs);
+  rmc->y_column_accel = g_new (gsl_interp_accel *, sgs);
+  size_t ii;
+  for ( ii = 0 ; ii < sgs ; ii++ ) {
+    rmc->x_column_accel[ii] = gsl_interp_accel_alloc ();
+    rmc->y_column_accel[ii] = gsl_interp_accel_alloc ();
+  }
+  rmc->x_accel = gsl_interp_accel_alloc ();
+  rmc->y_accel = gsl_interp_accel_alloc ();
+  rmc->x_row = gsl_spline_alloc (gsl_interp_cspline, sgs);
+  rmc->y_row = gsl_spline_alloc (gsl_interp_cspline, sgs);
+  rmc->points = g_new (double, sgs);
+  rmc->have_row = FALSE;
+  rmc->last_y = 0.0;
+}
+
+static void
+reverse_map_cursor_free (struct reverse_map_cursor *rmc)
+{
+  size_t ii;
+  for ( ii = 0 ; ii < rmc->rm->sgs ; ii++ ) {
+    gsl_interp_accel_free (rmc->x_column_accel[ii]);
+    gsl_interp_accel_free (rmc->y_column_accel[ii]);
+  }
+  g_free (rmc->x_column_accel);
+  g_free (rmc->y_column_accel);
+  gsl_interp_accel_free (rmc->x_accel);
+  gsl_interp_accel_free (rmc->y_accel);
+  gsl_spline_free (rmc->x_row);
+  gsl_spline_free (rmc->y_row);
+  g_free (rmc->points);
+}
+
+// Set up the splines that run horizontally between the column splines
+// at projection coordinate y, unless they are already set up for it.
+// Mapping is efficient only if the y coordinates are usually identical
+// between calls.
+static void
+reverse_map_seek (struct reverse_map_cursor *rmc, double y)
+{
+  if ( G_LIKELY (rmc->have_row && y == rmc->last_y) ) {
+    return;
+  }
+
+  const struct reverse_map *rm = rmc->rm;
+  size_t ii;
+  for ( ii = 0 ; ii < rm->sgs ; ii++ ) {
+    rmc->points[ii] = gsl_spline_eval_check (rm->x_columns[ii], y,
+                                             rmc->x_column_accel[ii]);
+  }
+  gsl_spline_init (rmc->x_row, rm->xprojs, rmc->points, rm->sgs);
+  gsl_interp_accel_reset (rmc->x_accel);
+
+  for ( ii = 0 ; ii < rm->sgs ; ii++ ) {
+    rmc->points[ii] = gsl_spline_eval_check (rm->y_columns[ii], y,
+                                             rmc->y_column_accel[ii]);
   }
+  gsl_spline_init (rmc->y_row, rm->xprojs, rmc->points, rm->sgs);
+  gsl_interp_accel_reset (rmc->y_accel);
+
+  rmc->have_row = TRUE;
+  rmc->last_y = y;
+}
+
+// Reverse map from projection coordinates x, y to input pixel
+// coordinate X.
+static double
+reverse_map_x (struct reverse_map_cursor *rmc, double x, double y)
+{
+  reverse_map_seek (rmc, y);
 
-  double ret = gsl_spline_eval_check (crnt_rmx, x, crnt_accel_rmx);
+  double ret = gsl_spline_eval_check (rmc->x_row, x, rmc->x_accel);
 
   if (!meta_is_valid_double(ret)) {
     asfPrintError("reverse_map_x invalid at L,S: %f,%f: %f\n", y,x,ret);
@@ -465,60 +530,13 @@ reverse_map_x (struct data_to_fit *dtf, double x, double y)
   return ret;
 }
 
-// This routine is analagous to reverse_map_x, including the same
-// caveats and confusing behavior.
+// This routine is analagous to reverse_map_x.
 static double
-reverse_map_y (struct data_to_fit *dtf, double x, double y)
+reverse_map_y (struct reverse_map_cursor *rmc, double x, double y)
 {
-  size_t sgs = dtf->sparse_grid_size;
-  double *xprojs = dtf->sparse_x_proj;
-  double *yprojs = dtf->sparse_y_proj;
-  double *ypixs = dtf->sparse_y_pix;
-
-  if ( G_UNLIKELY (first_time_through_rmy || y != last_y_rmy) ) {
-    if ( !first_time_through_rmy ) {
-      // Free the spline from the last line.
-      gsl_interp_accel_free (crnt_accel_rmy);
-      gsl_spline_free (crnt_rmy);
-    } else {
-      // Its our first time through, so set up the splines for the
-      // grid point columns.
-      y_accel_rmy = g_new (gsl_interp_accel *, sgs);
-      y_spline_rmy = g_new (gsl_spline *, sgs);
-      size_t ii;
-      for ( ii = 0 ; ii < sgs ; ii++ ) {
-  // Current y projection value.
-  gsl_vector *cypv = gsl_vector_alloc (sgs);
-  // Current y pixel value.
-  gsl_vector *cypixv = gsl_vector_alloc (sgs);
-  size_t jj;
-  for ( jj = 0 ; jj < sgs ; jj++ ) {
-    gsl_vector_set (cypv, jj, yprojs[jj * sgs + ii]);
-    gsl_vector_set (cypixv, jj, ypixs[jj * sgs + ii]);
-  }
-  y_accel_rmy[ii] = gsl_interp_accel_alloc ();
-  y_spline_rmy[ii] = gsl_spline_alloc (gsl_interp_cspline, sgs);
-  gsl_spline_init (y_spline_rmy[ii], cypv->data, cypixv->data, sgs);
-  gsl_vector_free (cypixv);
-  gsl_vector_free (cypv);
-      }
-      first_time_through_rmy = FALSE;
-    }
-    // Set up the spline that runs horizontally, between the column
-    // splines.
-    crnt_accel_rmy = gsl_interp_accel_alloc ();
-    crnt_rmy = gsl_spline_alloc (gsl_interp_cspline, sgs);
-    double *crnt_points = g_new (double, sgs);
-    size_t ii;
-    for ( ii = 0 ; ii < sgs ; ii++ ) {
-      crnt_points[ii] = gsl_spline_eval_check (y_spline_rmy[ii], y, y_accel_rmy[ii]);
-    }
-    gsl_spline_init (crnt_rmy, xprojs, crnt_points, sgs);
-    g_free (crnt_points);
-    last_y_rmy = y;
-  }
+  reverse_map_seek (rmc, y);
 
-  double ret = gsl_spline_eval_check (crnt_rmy, x, crnt_accel_rmy);
+  double ret = gsl_spline_eval_check (rmc->y_row, x, rmc->y_accel);
 
   if (!meta_is_valid_double(ret)) {
     asfPrintError("reverse_map_y invalid at L,S %f,%f: %f\n", y, x, ret);
@@ -527,6 +545,265 @@ reverse_map_y (struct data_to_fit *dtf, double x, double y)
   return ret;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+//
+// Dense reverse mapping grid
+//
+// Even with the row splines reused, the spline model costs a pass over
+// all the column splines for every output row and a spline evaluation
+// for every output pixel.  The mapping is very smooth at the scale of
+// a few output pixels, so instead we evaluate the model only at the
+// nodes of a regular grid over the output image, and interpolate
+// bilinearly between the nodes.  The node spacing is halved until the
+// interpolated values stay within GRID_TOLERANCE input pixels of the
+// spline model at the center of every grid cell, but not below
+// GRID_MIN_SPACING, which keeps the grid to a small fraction of the
+// size of the output image.
+//
+// The last row and column of nodes are pulled in to the last output
+// row and column, so the last cells may be narrower than the others.
+
+// Node spacing we start out with, in output pixels.
+#define GRID_MAX_SPACING 32
+// Closest we let the nodes get, in output pixels.
+#define GRID_MIN_SPACING 8
+// Largest difference from the spline model we accept, in input pixels.
+#define GRID_TOLERANCE 0.05
+
+struct reverse_map_grid {
+  size_t spacing;               // Distance between nodes in output pixels.
+  size_t nx, ny;                // Number of nodes in x and y.
+  size_t size_x, size_y;        // Output image size.
+  double *x_pix;                // Input pixel x coordinates at nodes.
+  double *y_pix;                // Input pixel y coordinates at nodes.
+};
+
+// Find the cell of the n nodes along an axis of size pixels which
+// holds (possibly fractional) pixel position pos, and how far across
+// the cell pos is.  Positions off the ends of the axis extrapolate.
+static void
+grid_locate (size_t spacing, size_t n, size_t size, double pos,
+             size_t *cell, double *t)
+{
+  if ( n == 1 ) {
+    *cell = 0;
+    *t = 0.0;
+    return;
+  }
+
+  size_t c = pos <= 0 ? 0 : MIN ((size_t) (pos / spacing), n - 2);
+  size_t p0 = c * spacing;
+  size_t p1 = MIN (p0 + spacing, size - 1);
+  *cell = c;
+  *t = (pos - p0) / (p1 - p0);
+}
+
+// Interpolate the input pixel coordinates for output pixel position
+// oix, oiy.
+static void
+reverse_map_grid_point (const struct reverse_map_grid *g, double oix,
+                        double oiy, double *x_pix, double *y_pix)
+{
+  size_t cx, cy;
+  double tx, ty;
+  grid_locate (g->spacing, g->nx, g->size_x, oix, &cx, &tx);
+  grid_locate (g->spacing, g->ny, g->size_y, oiy, &cy, &ty);
+
+  size_t i00 = cy * g->nx + cx;
+  size_t i01 = g->nx > 1 ? i00 + 1 : i00;
+  size_t i10 = g->ny > 1 ? i00 + g->nx : i00;
+  size_t i11 = i10 + (i01 - i00);
+
+  double top = g->x_pix[i00] + tx * (g->x_pix[i01] - g->x_pix[i00]);
+  double bottom = g->x_pix[i10] + tx * (g->x_pix[i11] - g->x_pix[i10]);
+  *x_pix = top + ty * (bottom - top);
+
+  top = g->y_pix[i00] + tx * (g->y_pix[i01] - g->y_pix[i00]);
+  bottom = g->y_pix[i10] + tx * (g->y_pix[i11] - g->y_pix[i10]);
+  *y_pix = top + ty * (bottom - top);
+}
+
+// Interpolate the input pixel coordinates for every pixel of output
+// row oiy into x_pix and y_pix, which must have room for size_x values.
+// Within a cell the coordinates change by a constant step from one
+// pixel to the next, so this is just a running sum per cell.
+static void
+reverse_map_grid_row (const struct reverse_map_grid *g, size_t oiy,
+                      double *x_pix, double *y_pix)
+{
+  size_t cy;
+  double ty;
+  grid_locate (g->spacing, g->ny, g->size_y, oiy, &cy, &ty);
+
+  const double *x0 = g->x_pix + cy * g->nx;
+  const double *x1 = g->ny > 1 ? x0 + g->nx : x0;
+  const double *y0 = g->y_pix + cy * g->nx;
+  const double *y1 = g->ny > 1 ? y0 + g->nx : y0;
+
+  if ( g->nx == 1 ) {
+    x_pix[0] = x0[0] + ty * (x1[0] - x0[0]);
+    y_pix[0] = y0[0] + ty * (y1[0] - y0[0]);
+    return;
+  }
+
+  size_t cx;
+  for ( cx = 0 ; cx < g->nx - 1 ; cx++ ) {
+    size_t p0 = cx * g->spacing;
+    size_t p1 = MIN (p0 + g->spacing, g->size_x - 1);
+    // The last cell includes its right hand node.
+    size_t end = cx == g->nx - 2 ? p1 + 1 : p1;
+
+    double xa = x0[cx] + ty * (x1[cx] - x0[cx]);
+    double xb = x0[cx + 1] + ty * (x1[cx + 1] - x0[cx + 1]);
+    double ya = y0[cx] + ty * (y1[cx] - y0[cx]);
+    double yb = y0[cx + 1] + ty * (y1[cx + 1] - y0[cx + 1]);
+    double dx = (xb - xa) / (p1 - p0);
+    double dy = (yb - ya) / (p1 - p0);
+
+    size_t oix;
+    for ( oix = p0 ; oix < end ; oix++ ) {
+      x_pix[oix] = xa + (oix - p0) * dx;
+      y_pix[oix] = ya + (oix - p0) * dy;
+    }
+  }
+}
+
+// Evaluate the spline model at the grid nodes.
+static void
+reverse_map_grid_fill (struct reverse_map_grid *g,
+                       struct reverse_map_cursor *rmc, meta_projection *op)
+{
+  size_t ii, jj;
+  for ( jj = 0 ; jj < g->ny ; jj++ ) {
+    double y = op->startY + MIN (jj * g->spacing, g->size_y - 1) * op->perY;
+    for ( ii = 0 ; ii < g->nx ; ii++ ) {
+      double x = op->startX + MIN (ii * g->spacing, g->size_x - 1) * op->perX;
+      g->x_pix[jj * g->nx + ii] = reverse_map_x (rmc, x, y);
+      g->y_pix[jj * g->nx + ii] = reverse_map_y (rmc, x, y);
+    }
+  }
+}
+
+// Largest distance between the grid and the spline model at the
+// centers of the grid cells.
+static double
+reverse_map_grid_deviation (const struct reverse_map_grid *g,
+                            struct reverse_map_cursor *rmc,
+                            meta_projection *op)
+{
+  double worst = 0.0;
+  size_t ii, jj;
+  // A grid only one node wide or high still has cells along the other
+  // axis.
+  for ( jj = 0 ; jj < MAX (g->ny, 2) - 1 ; jj++ ) {
+    size_t oiy = (jj * g->spacing + MIN ((jj + 1) * g->spacing,
+                                         g->size_y - 1)) / 2;
+    double y = op->startY + oiy * op->perY;
+    for ( ii = 0 ; ii < MAX (g->nx, 2) - 1 ; ii++ ) {
+      size_t oix = (ii * g->spacing + MIN ((ii + 1) * g->spacing,
+                                           g->size_x - 1)) / 2;
+      double x = op->startX + oix * op->perX;
+      double gx, gy;
+      reverse_map_grid_point (g, oix, oiy, &gx, &gy);
+      double ex = gx - reverse_map_x (rmc, x, y);
+      double ey = gy - reverse_map_y (rmc, x, y);
+      worst = MAX (worst, sqrt (ex * ex + ey * ey));
+    }
+  }
+
+  return worst;
+}
+
+// Build the grid for an output image of size_x by size_y pixels with
+// projection op, from the spline model behind rmc.
+static void
+reverse_map_grid_init (struct reverse_map_grid *g,
+                       struct reverse_map_cursor *rmc, meta_projection *op,
+                       size_t size_x, size_t size_y)
+{
+  g->size_x = size_x;
+  g->size_y = size_y;
+  g->spacing = GRID_MAX_SPACING;
+
+  for ( ; ; ) {
+    g->nx = (size_x - 1 + g->spacing - 1) / g->spacing + 1;
+    g->ny = (size_y - 1 + g->spacing - 1) / g->spacing + 1;
+    g->x_pix = g_new (double, g->nx * g->ny);
+    g->y_pix = g_new (double, g->nx * g->ny);
+    reverse_map_grid_fill (g, rmc, op);
+
+    double deviation = reverse_map_grid_deviation (g, rmc, op);
+    if ( deviation <= GRID_TOLERANCE ) {
+      break;
+    }
+    if ( g->spacing / 2 < GRID_MIN_SPACING ) {
+      asfPrintWarning ("Reverse mapping grid is as fine as it gets (node "
+                       "spacing %d output pixels), but still differs from "
+                       "the mapping model by up to %.3f input pixels.\n",
+                       (int) g->spacing, deviation);
+      break;
+    }
+
+    g_free (g->x_pix);
+    g_free (g->y_pix);
+    g->spacing /= 2;
+  }
+}
+
+static void
+reverse_map_grid_free (struct reverse_map_grid *g)
+{
+  g_free (g->x_pix);
+  g_free (g->y_pix);
+}
+
+// Set up a projection context for the batched transforms below.  The
+// lat/long pseudoprojection doesn't need libproj here (see
+// project_lat_long_pseudo), so NULL is returned for it.
+static proj_context_t *
+geocode_context_new (projection_type_t projection_type,
+                     project_parameters_t *pps, datum_type_t datum)
+{
+  if (projection_type == LAT_LONG_PSEUDO_PROJECTION)
+    return NULL;
+  return proj_context_new (projection_type, pps, datum);
+}
+
+// Convert length points from projection coordinates x, y to lat, lon
+// (radians), at the average height.
+static int
+geocode_unproject_row (proj_context_t *ctx, long length, const double *x,
+                       const double *y, double *lat, double *lon)
+{
+  if (!ctx) {
+    long ii;
+    for (ii = 0; ii < length; ii++) {
+      lat[ii] = y[ii] * D2R;
+      lon[ii] = x[ii] * D2R;
+    }
+    return TRUE;
+  }
+  return proj_context_inverse (ctx, length, x, y, NULL, lat, lon, NULL);
+}
+
+// Convert length points from lat, lon (radians) and height to
+// projection coordinates x, y.
+static int
+geocode_project_row (proj_context_t *ctx, long length, const double *lat,
+                     const double *lon, const double *height,
+                     double *x, double *y)
+{
+  if (!ctx) {
+    long ii;
+    for (ii = 0; ii < length; ii++) {
+      x[ii] = lon[ii] * R2D;
+      y[ii] = lat[ii] * R2D;
+    }
+    return TRUE;
+  }
+  return proj_context_forward (ctx, length, lat, lon, height, x, y, NULL);
+}
+
 static void determine_projection_fns(int projection_type, project_t **project,
                                      project_arr_t **project_arr, unproject_t **unproject,
                                      unproject_arr_t **unproject_arr)
@@ -670,6 +947,317 @@ static float dem_sample(FloatImage *dem, float x, float y,
     return 0; // not reached
 }
 
+///////////////////////////////////////////////////////////////////////////////
+//
+// Row resampling engine
+//
+// When a single image is geocoded, each output row depends only on the
+// reverse mapping and the input image, so rows can be computed in any
+// order by any number of threads.  The output rows are divided into
+// blocks which the threads take from a shared counter as they finish
+// their previous ones, so a thread that hits a slow part of the image
+// (tile cache misses, say) doesn't hold the others up.  Finished
+// blocks are parked in a small ring of buffers until every block
+// before them has been written, since the output file is written
+// strictly in row order.  A thread that gets too far ahead of the
+// writer waits for a free buffer, which bounds the memory used.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Number of threads used to resample the image, 1 means no threads
+// are started at all.
+static int geocode_thread_count = 1;
+
+// Output rows handed to a thread at a time.
+#define ROWS_PER_BLOCK 16
+
+void asf_geocode_set_thread_count(int thread_count)
+{
+  if (thread_count <= 0)
+    thread_count = g_get_num_processors();
+  geocode_thread_count = thread_count;
+}
+
+// Everything needed to resample output rows from one band of a single
+// input image.  None of this changes while rows are being computed.
+struct resample_job {
+  const struct reverse_map_grid *grid;
+  meta_parameters *imd;
+  meta_parameters *omd;
+  // Exactly one of these is non-NULL.
+  FloatImage *iim;
+  UInt8Image *iim_b;
+  float_image_sample_method_t float_image_sample_method;
+  uint8_image_sample_method_t uint8_image_sample_method;
+  size_t ii_size_x, ii_size_y;    // Input image size.
+  size_t oix_max;                 // Output image width.
+  float background_val;
+};
+
+// Compute output row oiy into output_line, and into line_out and
+// samp_out as well if they are non-NULL.  x_pix and y_pix are scratch
+// space for oix_max values each.  Byte output values which had to be
+// clamped are added to the out of range counters.
+static void
+resample_row (const struct resample_job *job, size_t oiy,
+              double *x_pix, double *y_pix, float *output_line,
+              float *line_out, float *samp_out,
+              unsigned long *out_of_range_negative,
+              unsigned long *out_of_range_positive)
+{
+  meta_parameters *imd = job->imd;
+  meta_parameters *omd = job->omd;
+  ssize_t ii_size_x = job->ii_size_x;
+  ssize_t ii_size_y = job->ii_size_y;
+  size_t oix;
+
+  reverse_map_grid_row (job->grid, oiy, x_pix, y_pix);
+
+  for ( oix = 0 ; oix < job->oix_max ; oix++ ) {
+    double input_x_pixel = x_pix[oix];
+    double input_y_pixel = y_pix[oix];
+
+    gboolean outside = (input_x_pixel < 0 ||
+                        input_x_pixel > ii_size_x - 1.0 ||
+                        input_y_pixel < 0 ||
+                        input_y_pixel > ii_size_y - 1.0);
+
+    if (line_out)
+      line_out[oix] = outside ? 0 : input_y_pixel;
+    if (samp_out)
+      samp_out[oix] = outside ? 0 : input_x_pixel;
+
+    if (outside) {
+      output_line[oix] = job->background_val;
+      continue;
+    }
+
+    float value;
+    if (job->iim_b) {
+      value = uint8_image_sample(job->iim_b, input_x_pixel, input_y_pixel,
+                                 job->uint8_image_sample_method);
+    }
+    else if ( imd->general->image_data_type == DEM ) {
+      value = dem_sample(job->iim, input_x_pixel, input_y_pixel,
+                         job->float_image_sample_method);
+    }
+    else {
+      value = float_image_sample(job->iim, input_x_pixel, input_y_pixel,
+                                 job->float_image_sample_method);
+      if (imd->general->radiometry >= r_SIGMA_DB &&
+          imd->general->radiometry <= r_GAMMA_DB)
+        value = 10.0 * log10(value);
+
+      if (omd->general->data_type == ASF_BYTE && value < 0.0) {
+        value = 0.0;
+        (*out_of_range_negative)++;
+      }
+      if (omd->general->data_type == ASF_BYTE && value > 255.0) {
+        value = 255.0;
+        (*out_of_range_positive)++;
+      }
+    }
+
+    output_line[oix] = value;
+  }
+}
+
+// A block of consecutive output rows, computed by one thread.
+struct row_block {
+  size_t first_row;
+  size_t row_count;
+  float *values;
+  float *lines;                 // NULL unless saving the mapping.
+  float *samples;               // Likewise.
+  gboolean done;                // True iff the block awaits writing.
+};
+
+struct resample_pool {
+  const struct resample_job *job;
+  size_t oiy_max;
+  size_t block_count;
+  size_t next_block;            // Next block to hand to a thread.
+  size_t written_blocks;        // Blocks written out so far.
+  size_t slot_count;            // Block b is computed in slots[b % slot_count].
+  struct row_block *slots;
+  unsigned long out_of_range_negative;
+  unsigned long out_of_range_positive;
+  GMutex lock;
+  GCond changed;                // Signalled when a block is done or written.
+};
+
+static gpointer
+resample_pool_thread (gpointer data)
+{
+  struct resample_pool *pool = data;
+  const struct resample_job *job = pool->job;
+  double *x_pix = g_new (double, job->oix_max);
+  double *y_pix = g_new (double, job->oix_max);
+  unsigned long negative = 0, positive = 0;
+
+  g_mutex_lock (&pool->lock);
+  for ( ; ; ) {
+    while (pool->next_block < pool->block_count &&
+           pool->next_block >= pool->written_blocks + pool->slot_count)
+      g_cond_wait (&pool->changed, &pool->lock);
+    if (pool->next_block >= pool->block_count)
+      break;
+    size_t block = pool->next_block++;
+    g_mutex_unlock (&pool->lock);
+
+    struct row_block *rb = &pool->slots[block % pool->slot_count];
+    rb->first_row = block * ROWS_PER_BLOCK;
+    rb->row_count = MIN (ROWS_PER_BLOCK, pool->oiy_max - rb->first_row);
+    size_t jj;
+    for ( jj = 0 ; jj < rb->row_count ; jj++ ) {
+      size_t offset = jj * job->oix_max;
+      resample_row (job, rb->first_row + jj, x_pix, y_pix,
+                    rb->values + offset,
+                    rb->lines ? rb->lines + offset : NULL,
+                    rb->samples ? rb->samples + offset : NULL,
+                    &negative, &positive);
+    }
+
+    g_mutex_lock (&pool->lock);
+    rb->done = TRUE;
+    g_cond_broadcast (&pool->changed);
+  }
+  pool->out_of_range_negative += negative;
+  pool->out_of_range_positive += positive;
+  g_mutex_unlock (&pool->lock);
+
+  g_free (x_pix);
+  g_free (y_pix);
+
+  return NULL;
+}
+
+// Resample all oiy_max rows of the output image and write them to
+// outFp (and the mapping to outLineFp and outSampFp, if those are
+// non-NULL) in order.
+static void
+resample_rows (const struct resample_job *job, size_t oiy_max,
+               FILE *outFp, FILE *outLineFp, FILE *outSampFp,
+               unsigned long *out_of_range_negative,
+               unsigned long *out_of_range_positive)
+{
+  meta_parameters *omd = job->omd;
+  size_t oix_max = job->oix_max;
+  size_t block_count = (oiy_max + ROWS_PER_BLOCK - 1) / ROWS_PER_BLOCK;
+  int thread_count = MIN ((size_t) geocode_thread_count, block_count);
+  size_t oiy;
+
+  if (thread_count <= 1) {
+    double *x_pix = g_new (double, oix_max);
+    double *y_pix = g_new (double, oix_max);
+    float *output_line = MALLOC(sizeof(float)*oix_max);
+    float *line_out = outLineFp ? MALLOC(sizeof(float)*oix_max) : NULL;
+    float *samp_out = outSampFp ? MALLOC(sizeof(float)*oix_max) : NULL;
+
+    for (oiy = 0 ; oiy < oiy_max ; oiy++) {
+      asfLineMeter(oiy, oiy_max);
+      resample_row (job, oiy, x_pix, y_pix, output_line, line_out, samp_out,
+                    out_of_range_negative, out_of_range_positive);
+      put_float_line(outFp, omd, oiy, output_line);
+      if (line_out)
+        put_float_line(outLineFp, omd, oiy, line_out);
+      if (samp_out)
+        put_float_line(outSampFp, omd, oiy, samp_out);
+    }
+    g_free (x_pix);
+    g_free (y_pix);
+    FREE(output_line);
+    FREE(line_out);
+    FREE(samp_out);
+    return;
+  }
+
+  asfPrintStatus("Resampling with %d threads.\n", thread_count);
+
+  struct resample_pool pool;
+  pool.job = job;
+  pool.oiy_max = oiy_max;
+  pool.block_count = block_count;
+  pool.next_block = 0;
+  pool.written_blocks = 0;
+  pool.slot_count = 2 * thread_count;
+  pool.slots = g_new0 (struct row_block, pool.slot_count);
+  pool.out_of_range_negative = 0;
+  pool.out_of_range_positive = 0;
+  g_mutex_init (&pool.lock);
+  g_cond_init (&pool.changed);
+
+  size_t block_size = ROWS_PER_BLOCK * oix_max;
+  size_t ii;
+  for ( ii = 0 ; ii < pool.slot_count ; ii++ ) {
+    pool.slots[ii].values = g_new (float, block_size);
+    if (outLineFp)
+      pool.slots[ii].lines = g_new (float, block_size);
+    if (outSampFp)
+      pool.slots[ii].samples = g_new (float, block_size);
+  }
+
+  // The input image is read by all the threads at once.
+  if (job->iim)
+    float_image_set_concurrent_access (job->iim, TRUE);
+  else
+    uint8_image_set_concurrent_access (job->iim_b, TRUE);
+
+  GThread **threads = g_new (GThread *, thread_count);
+  int tt;
+  for ( tt = 0 ; tt < thread_count ; tt++ )
+    threads[tt] = g_thread_new ("asf_geocode", resample_pool_thread, &pool);
+
+  // Write the blocks out as they come in.
+  size_t block;
+  for ( block = 0 ; block < block_count ; block++ ) {
+    struct row_block *rb = &pool.slots[block % pool.slot_count];
+
+    g_mutex_lock (&pool.lock);
+    while (!rb->done)
+      g_cond_wait (&pool.changed, &pool.lock);
+    g_mutex_unlock (&pool.lock);
+
+    size_t jj;
+    for ( jj = 0 ; jj < rb->row_count ; jj++ ) {
+      oiy = rb->first_row + jj;
+      asfLineMeter(oiy, oiy_max);
+      put_float_line(outFp, omd, oiy, rb->values + jj * oix_max);
+      if (rb->lines)
+        put_float_line(outLineFp, omd, oiy, rb->lines + jj * oix_max);
+      if (rb->samples)
+        put_float_line(outSampFp, omd, oiy, rb->samples + jj * oix_max);
+    }
+
+    g_mutex_lock (&pool.lock);
+    rb->done = FALSE;
+    pool.written_blocks++;
+    g_cond_broadcast (&pool.changed);
+    g_mutex_unlock (&pool.lock);
+  }
+
+  for ( tt = 0 ; tt < thread_count ; tt++ )
+    g_thread_join (threads[tt]);
+  g_free (threads);
+
+  if (job->iim)
+    float_image_set_concurrent_access (job->iim, FALSE);
+  else
+    uint8_image_set_concurrent_access (job->iim_b, FALSE);
+
+  *out_of_range_negative += pool.out_of_range_negative;
+  *out_of_range_positive += pool.out_of_range_positive;
+
+  for ( ii = 0 ; ii < pool.slot_count ; ii++ ) {
+    g_free (pool.slots[ii].values);
+    g_free (pool.slots[ii].lines);
+    g_free (pool.slots[ii].samples);
+  }
+  g_free (pool.slots);
+  g_cond_clear (&pool.changed);
+  g_mutex_clear (&pool.lock);
+}
+
 int asf_geocode_utm(resample_method_t resample_method, double average_height,
                     datum_type_t datum, double pixel_size,
                     char *band_id, char *in_base_name, char *out_base_name,
@@ -1712,18 +2300,19 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
 
   double *projX = MALLOC(sizeof(double)*oix_max);
   double *projY = MALLOC(sizeof(double)*oix_max);
+  // Input pixel coordinates of an output row, when mosaicing
+  double *grid_x = MALLOC(sizeof(double)*oix_max);
+  double *grid_y = MALLOC(sizeof(double)*oix_max);
 
   // When mosaicing -- use banded_float_image to store the output, write
   //                   it out after processing all inputs
-  // When geocoding -- use float arrays to store the output, and write it
-  //                   out line-by-line
+  // When geocoding -- resample_rows writes the output line-by-line
 
-  // one and only one of these will be non-NULL.  The flag output_by_line
+  // output_bfi is non-NULL iff we are mosaicing.  The flag output_by_line
   // indicates which one
   BandedFloatImage *output_bfi = NULL;
   FloatImage *tfi = NULL;
   UInt8Image *tbi = NULL;
-  float *output_line = NULL;
   int output_by_line = n_input_images == 1;
 
   if (n_input_images > 1) {
@@ -1754,9 +2343,6 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
         }
     }
   }
-  else {
-    output_line = MALLOC(sizeof(float)*oix_max);
-  }
 
   // loop over the input images
   for(i=0; i<n_input_images; ++i) {
@@ -1873,16 +2459,12 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
     // Convenience alias (valid iff input_projected).
     meta_projection *ipb = imd->projection;
     project_parameters_t *ipp = (ipb) ? &imd->projection->param : NULL;
-    project_t *project_input;
-    unproject_t *unproject_input;
 
     if ( ((imd->sar && imd->sar->image_type == 'P') ||
           imd->general->image_data_type == DEM)
         && imd->projection && imd->projection->type != SCANSAR_PROJECTION )
     {
         input_projected = TRUE;
-        determine_projection_fns(imd->projection->type, &project_input, NULL,
-          &unproject_input, NULL);
     }
 
       // This would be the place to do the resampling of geocoded images
@@ -1940,98 +2522,148 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
       size_t current_sparse_mapping = 0;
       size_t ii;
       
+      // The grid is projected a row at a time, and the libproj setup
+      // for each projection is done just once.
+      proj_context_t *output_ctx =
+        geocode_context_new (projection_type, pp, datum);
+      proj_context_t *input_ctx = NULL;
+      if ( input_projected )
+        input_ctx = geocode_context_new (imd->projection->type, ipp,
+                                         imd->projection->datum);
+      double *row_xproj = g_new (double, grid_size);
+      double *row_yproj = g_new (double, grid_size);
+      double *row_lat = g_new (double, grid_size);
+      double *row_lon = g_new (double, grid_size);
+      double *row_height = g_new (double, grid_size);
+      double *row_ipcx = g_new (double, grid_size);
+      double *row_ipcy = g_new (double, grid_size);
+
       for ( ii = 0 ; ii < grid_size ; ii++ ) {
         size_t jj;
         for ( jj = 0 ; jj < grid_size ; jj++ ) {
-					g_assert (sizeof (long int) >= sizeof (size_t));
-					// Projection coordinates for the current grid point.
-					double cxproj = min_x + x_spacing * jj;
-					double cyproj = min_y + y_spacing * ii;
-		
-					// Corresponding latitude and longitude.
-					double lat, lon;
-					ret = unproject (pp, cxproj, cyproj, ASF_PROJ_NO_HEIGHT,
-							 &lat, &lon, NULL, datum);
-					if ( !ret ) {
-						// Details of the error should have already been printed.
-						asfPrintError ("Projection Error!\n");
-					}
-					else if ( !meta_is_valid_double(lat) || !meta_is_valid_double(lon)) {
-						asfPrintError ("unproject nan: %d,%d: %f, %f -> %f, %f\n",
-																 ii, jj, cxproj, cyproj, lat, lon);
-								} 
-					lat *= R2D;
-					lon *= R2D;
-					//printf("%zu,%zu: %f %f -> %f %f\n", ii, jj, cxproj, cyproj, lat, lon); 
-
-					// here we have some kludgery to handle crossing the meridian
-					if (fabs(lon-lon_0) > 300) {
-						if (lon_0 < 0 && lon > 0) lon -= 360;
-						if (lon_0 > 0 && lon < 0) lon += 360;
-					}
-		
-					// Corresponding pixel indicies in input image.
-					double x_pix, y_pix;
-					if ( input_projected ) {
-						// Input projection coordinates of the current pixel.
-						double ipcx, ipcy, ipcz;
-						ret = project_input (ipp, D2R*lat, D2R*lon, average_height,
-							 &ipcx, &ipcy, &ipcz, imd->projection->datum);
-						if ( ret == 0 ) {
-							asfPrintError ("Projection Error!\n");
-						}
-						else if ( !meta_is_valid_double(ipcx) || !meta_is_valid_double(ipcy)) {
-							asfPrintError ("project nan: %d,%d: %f, %f -> %f, %f\n",
-																	 ii, jj, lat, lon, ipcx, ipcy);
-									} 
-						g_assert (ret);
-						// Find the input image pixel indicies corresponding to input
-						// projection coordinates.
-						x_pix = (ipcx - ipb->startX) / ipb->perX;
-						y_pix = (ipcy - ipb->startY) / ipb->perY;
-						//printf("%zu,%zu: %f %f -> %f %f\n", ii, jj, lat, lon, x_pix, y_pix); 
-					}
-					else {
-						ret = meta_get_lineSamp (imd, lat, lon, average_height,
-									 &y_pix, &x_pix);
-						//printf("lat: %f, lon: %f, x_pix: %f, y_pix: %f\n", 
-						//	lat, lon, x_pix, y_pix);
-						//g_assert (ret == 0);
-						if (ret != 0) {
-							asfPrintError("Failed to determine line and sample from "
-								"latitude and longitude\n"
-								"Lat: %f, Lon: %f\n", lat, lon);
-						}
-						else if ( !meta_is_valid_double(x_pix) || !meta_is_valid_double(y_pix)) {
-							asfPrintError ("meta_get_lineSamp nan: %d,%d: %f, %f -> %f, %f\n",
-																	 ii, jj, lat, lon, x_pix, y_pix);
-						} 
-					}
-		
-					g_assert(current_mapping < mapping_count);
-					dtf.x_proj[current_mapping] = cxproj;
-					dtf.y_proj[current_mapping] = cyproj;
-					dtf.x_pix[current_mapping] = x_pix;
-					dtf.y_pix[current_mapping] = y_pix;
-
-					if ( ii % sparse_grid_sample_stride == 0 &&
-							 jj % sparse_grid_sample_stride == 0 ) {
-						g_assert(current_sparse_mapping < sparse_mapping_count);
-						dtf.sparse_x_proj[current_sparse_mapping] = cxproj;
-						dtf.sparse_y_proj[current_sparse_mapping] = cyproj;
-						dtf.sparse_x_pix[current_sparse_mapping] = x_pix;
-						dtf.sparse_y_pix[current_sparse_mapping] = y_pix;
-						current_sparse_mapping++;
-					}
-					current_mapping++;
-		
-					asfPercentMeter((float)current_mapping / (float)(grid_size*grid_size));
+          // Projection coordinates for the current grid point.
+          row_xproj[jj] = min_x + x_spacing * jj;
+          row_yproj[jj] = min_y + y_spacing * ii;
+          row_height[jj] = average_height;
+        }
+
+        // Corresponding latitudes and longitudes.
+        ret = geocode_unproject_row (output_ctx, grid_size, row_xproj,
+                                     row_yproj, row_lat, row_lon);
+        if ( !ret ) {
+          // Details of the error should have already been printed.
+          asfPrintError ("Projection Error!\n");
+        }
+        for ( jj = 0 ; jj < grid_size ; jj++ ) {
+          double lat = row_lat[jj];
+          double lon = row_lon[jj];
+          if ( !meta_is_valid_double(lat) || !meta_is_valid_double(lon)) {
+            asfPrintError ("unproject nan: %d,%d: %f, %f -> %f, %f\n",
+                           ii, jj, row_xproj[jj], row_yproj[jj], lat, lon);
+          }
+          lat *= R2D;
+          lon *= R2D;
+
+          // here we have some kludgery to handle crossing the meridian
+          if (fabs(lon-lon_0) > 300) {
+            if (lon_0 < 0 && lon > 0) lon -= 360;
+            if (lon_0 > 0 && lon < 0) lon += 360;
+          }
+
+          row_lat[jj] = lat;
+          row_lon[jj] = lon;
+        }
+
+        // Input projection coordinates of the grid points.
+        if ( input_projected ) {
+          for ( jj = 0 ; jj < grid_size ; jj++ ) {
+            row_lat[jj] *= D2R;
+            row_lon[jj] *= D2R;
+          }
+          ret = geocode_project_row (input_ctx, grid_size, row_lat, row_lon,
+                                     row_height, row_ipcx, row_ipcy);
+          if ( ret == 0 ) {
+            asfPrintError ("Projection Error!\n");
+          }
+        }
+
+        for ( jj = 0 ; jj < grid_size ; jj++ ) {
+          g_assert (sizeof (long int) >= sizeof (size_t));
+          double cxproj = row_xproj[jj];
+          double cyproj = row_yproj[jj];
+
+          // Corresponding pixel indicies in input image.
+          double x_pix, y_pix;
+          if ( input_projected ) {
+            double ipcx = row_ipcx[jj];
+            double ipcy = row_ipcy[jj];
+            if ( !meta_is_valid_double(ipcx) || !meta_is_valid_double(ipcy)) {
+              asfPrintError ("project nan: %d,%d: %f, %f -> %f, %f\n",
+                             ii, jj, row_lat[jj] * R2D, row_lon[jj] * R2D,
+                             ipcx, ipcy);
+            }
+            // Find the input image pixel indicies corresponding to input
+            // projection coordinates.
+            x_pix = (ipcx - ipb->startX) / ipb->perX;
+            y_pix = (ipcy - ipb->startY) / ipb->perY;
+          }
+          else {
+            double lat = row_lat[jj];
+            double lon = row_lon[jj];
+            ret = meta_get_lineSamp (imd, lat, lon, average_height,
+                                     &y_pix, &x_pix);
+            if (ret != 0) {
+              asfPrintError("Failed to determine line and sample from "
+                            "latitude and longitude\n"
+                            "Lat: %f, Lon: %f\n", lat, lon);
+            }
+            else if ( !meta_is_valid_double(x_pix) ||
+                      !meta_is_valid_double(y_pix)) {
+              asfPrintError ("meta_get_lineSamp nan: %d,%d: %f, %f -> %f, %f\n",
+                             ii, jj, lat, lon, x_pix, y_pix);
+            }
+          }
+
+          g_assert(current_mapping < mapping_count);
+          dtf.x_proj[current_mapping] = cxproj;
+          dtf.y_proj[current_mapping] = cyproj;
+          dtf.x_pix[current_mapping] = x_pix;
+          dtf.y_pix[current_mapping] = y_pix;
+
+          if ( ii % sparse_grid_sample_stride == 0 &&
+               jj % sparse_grid_sample_stride == 0 ) {
+            g_assert(current_sparse_mapping < sparse_mapping_count);
+            dtf.sparse_x_proj[current_sparse_mapping] = cxproj;
+            dtf.sparse_y_proj[current_sparse_mapping] = cyproj;
+            dtf.sparse_x_pix[current_sparse_mapping] = x_pix;
+            dtf.sparse_y_pix[current_sparse_mapping] = y_pix;
+            current_sparse_mapping++;
+          }
+          current_mapping++;
+
+          asfPercentMeter((float)current_mapping / (float)(grid_size*grid_size));
         }
       }
+
+      g_free (row_ipcy);
+      g_free (row_ipcx);
+      g_free (row_height);
+      g_free (row_lon);
+      g_free (row_lat);
+      g_free (row_yproj);
+      g_free (row_xproj);
+      proj_context_free (input_ctx);
+      proj_context_free (output_ctx);
       
+      // Fit the spline model to the sparse grid.
+      struct reverse_map rm;
+      reverse_map_init (&rm, &dtf);
+      struct reverse_map_cursor rmc;
+      reverse_map_cursor_init (&rmc, &rm);
+
       // Here are some convenience macros for the spline model.
-#define X_PIXEL(x, y) reverse_map_x (&dtf, x, y)
-#define Y_PIXEL(x, y) reverse_map_y (&dtf, x, y)
+#define X_PIXEL(x, y) reverse_map_x (&rmc, x, y)
+#define Y_PIXEL(x, y) reverse_map_y (&rmc, x, y)
       
       // We want to choke if our worst point in the model is off by this
       // many pixels or more.
@@ -2284,6 +2916,39 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
 					asfPrintStatus ("Lower right y corner error: %f\n", lr_y_corner_error);
         }
       }
+
+      // Resampling reads the mapping from a dense grid of spline model
+      // values.  Check the grid against the analytically projected
+      // control points the same way the spline model was checked.
+      struct reverse_map_grid grid;
+      reverse_map_grid_init (&grid, &rmc, omd->projection, oix_max, oiy_max);
+      {
+        double largest_grid_error = 0.0;
+        for ( ii = 0 ; ii < dtf.n ; ii++ ) {
+          double gx, gy;
+          reverse_map_grid_point (&grid,
+                  (dtf.x_proj[ii] - omd->projection->startX) / omd->projection->perX,
+                  (dtf.y_proj[ii] - omd->projection->startY) / omd->projection->perY,
+                  &gx, &gy);
+          double x_error = gx - dtf.x_pix[ii];
+          double y_error = gy - dtf.y_pix[ii];
+          largest_grid_error = MAX (largest_grid_error,
+                                    sqrt (x_error*x_error + y_error*y_error));
+        }
+        asfPrintStatus ("Mapping grid spacing %d, maximum error against the "
+                        "control points: %g\n", (int) grid.spacing,
+                        largest_grid_error);
+        if ( largest_grid_error > max_allowable_error ) {
+          print_large_error_blurb(force_flag);
+          report_func("Largest mapping grid error was larger than maximum "
+                      "allowed! %f > %f\n", largest_grid_error,
+                      max_allowable_error);
+        }
+      }
+
+      // The spline model is only needed to build the grid.
+      reverse_map_cursor_free (&rmc);
+      reverse_map_free (&rm);
       
       // Now the mapping function is calculated and we can apply that to
       // all the bands in the file (or to the single band selected with
@@ -2334,8 +2999,11 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
 						FREE(sample_filename);
 						FREE(sample_metaname);
 			
-						line_out = MALLOC(sizeof(float)*oix_max);
-						samp_out = MALLOC(sizeof(float)*oix_max);
+						// resample_rows has buffers of its own
+						if (!output_by_line) {
+							line_out = MALLOC(sizeof(float)*oix_max);
+							samp_out = MALLOC(sizeof(float)*oix_max);
+						}
 			
 						// prevent doing the line/sample file again
 						save_line_sample_mapping = FALSE;
@@ -2352,7 +3020,7 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
 					if (process_as_byte)
 						iim_b = uint8_image_band_new_from_metadata(imd, kk, input_image);
 					else
-						iim = float_image_band_new_from_metadata(imd, kk, input_image);
+						iim = float_image_band_new_from_metadata_mapped(imd, kk, input_image);
 		
 					asfPrintStatus("Resampling input image into output image "
 						 "coordinate space...\n");
@@ -2364,16 +3032,37 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
 					}
 		
 					if (output_by_line)
-						g_assert(outFp && output_line && !output_bfi);
+						g_assert(outFp && !output_bfi);
 					else
-						g_assert(!outFp && !output_line && output_bfi);
+						g_assert(!outFp && output_bfi);
 		
+					if (output_by_line) {
+						struct resample_job job;
+						job.grid = &grid;
+						job.imd = imd;
+						job.omd = omd;
+						job.iim = iim;
+						job.iim_b = iim_b;
+						job.float_image_sample_method = float_image_sample_method;
+						job.uint8_image_sample_method = uint8_image_sample_method;
+						job.ii_size_x = ii_size_x;
+						job.ii_size_y = ii_size_y;
+						job.oix_max = oix_max;
+						job.background_val = background_val;
+
+						resample_rows(&job, oiy_max, outFp, outLineFp, outSampFp,
+						              &out_of_range_negative,
+						              &out_of_range_positive);
+					}
+					else {
 					// Set the pixels of the output image.
 					size_t oix, oiy;    // Output image pixel indicies.
 					for (oiy = 0 ; oiy < oiy_max ; oiy++) {
 			
 						asfLineMeter(oiy, oiy_max);
 			
+						reverse_map_grid_row (&grid, oiy, grid_x, grid_y);
+
 						int oix_first_valid = -1;
 						int oix_last_valid = -1;
 			
@@ -2389,8 +3078,8 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
 							// Determine pixel of interest in input image.  The fractional
 							// part is desired, we will use some sampling method to
 							// interpolate between pixel values.
-							double input_x_pixel = X_PIXEL (oix_pc, oiy_pc);
-							double input_y_pixel = Y_PIXEL (oix_pc, oiy_pc);
+							double input_x_pixel = grid_x[oix];
+							double input_y_pixel = grid_y[oix];
 	
 							if (line_out) {
 								if (input_y_pixel < 0 || input_x_pixel < 0)
@@ -2425,11 +3114,8 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
 									input_y_pixel < 0 || 
 									input_y_pixel > (ssize_t) ii_size_y - 1.0 ) {
 								if (i == 0) { // first image
-									if (output_by_line)
-										output_line[oix] = background_val;
-									else
-										banded_float_image_set_pixel(output_bfi, kk, oix, oiy,
-												 background_val);
+									banded_float_image_set_pixel(output_bfi, kk, oix, oiy,
+											 background_val);
 								}
 							}
 							// Otherwise, set to the value from the appropriate position in
@@ -2482,13 +3168,9 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
 						// will set this in the output image, otherwise we risk
 						// overwriting real data with background.
 						if (i==0) {
-							if (output_by_line)
-								output_line[oix] = value;
-							else {
-								banded_float_image_set_pixel(output_bfi, kk, oix, oiy, 
-										 value);
-								//uint8_image_set_pixel(tbi, oix, oiy, 1);
-							}
+							banded_float_image_set_pixel(output_bfi, kk, oix, oiy, 
+									 value);
+							//uint8_image_set_pixel(tbi, oix, oiy, 1);
 						}
 					}
 					else {
@@ -2505,10 +3187,6 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
 						// New images are intialized with zeros (at least float_image
 						// does that). So we need to check for that when looking for
 						// values.
-						if (output_by_line) {
-							output_line[oix] = value;
-						}
-						else {
 													ref_value = 
 								banded_float_image_get_pixel(output_bfi, kk, oix, oiy);
 													if (overlap == MIN_OVERLAP && ref_value != 0 && 
@@ -2529,7 +3207,6 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
 													}
 													banded_float_image_set_pixel(output_bfi, kk, oix, oiy, 
 									 value);
-						}
 					}
 	      }
 	    } // end of for-each-sample-in-line set output values
@@ -2587,17 +3264,13 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
 	    }
 	    */
 
-	    // write the line, if we're doing line-by-line output
-	    if (output_by_line) {
-              put_float_line(outFp, omd, oiy, output_line);
-	    }
-	    
 	    if (line_out)
               put_float_line(outLineFp, omd, oiy, line_out);
 	    if (samp_out)
               put_float_line(outSampFp, omd, oiy, samp_out);
 	    
 	  } // End of for-each-line set output values
+					} // End of 'if output by line else mosaic'
 	  
 	  // done writing this band
 	  if (output_by_line)
@@ -2638,31 +3311,8 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
         unlink(input_image);
       }
       
-      /////////////////////////////////////////////////////////////////////////
-      //
-      // Clear out all the persistent spline memory goop used by the
-      // reverse_map_x and reverse_map_y routines (see comments near the
-      // declarations of these variables).
-      //
-      
-      size_t sgs = dtf.sparse_grid_size; // Convenience alias.
-      
-      first_time_through_rmx = TRUE;
-      first_time_through_rmy = TRUE;
-      for ( ii = 0 ; ii < sgs ; ii++ ) {
-				gsl_interp_accel_free (y_accel_rmx[ii]);
-				gsl_interp_accel_free (y_accel_rmy[ii]);
-				gsl_spline_free (y_spline_rmx[ii]);
-				gsl_spline_free (y_spline_rmy[ii]);
-      }
-      g_free (y_accel_rmx);
-      g_free (y_accel_rmy);
-      g_free (y_spline_rmx);
-      g_free (y_spline_rmy);
-      gsl_interp_accel_free (crnt_accel_rmx);
-      gsl_interp_accel_free (crnt_accel_rmy);
-      gsl_spline_free (crnt_rmx);
-      gsl_spline_free (crnt_rmy);
+      // Done with the mapping grid.
+      reverse_map_grid_free (&grid);
       
       /////////////////////////////////////////////////////////////////////////
       // Done with the data being modeled.
@@ -2693,10 +3343,10 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
 
   free(projX);
   free(projY);
+  free(grid_x);
+  free(grid_y);
 
-  if (output_by_line)
-    free(output_line);
-  else {
+  if (!output_by_line) {
     // write the output image
     int kk;
     asfPrintStatus("\nGenerating final output.\n");
@@ -3,7 +3,7 @@
 #include "ardop_defs.h"
 #include "asf_insar.h"
 #include "functions.h"
-#include "fft.h"
+#include "fft_plan.h"
 #include "ifm.h"
 #include "asf_endian.h"
 
@@ -41,60 +41,24 @@ int coregister_coarse(char *masterFile, char *slaveFile,
 
 // Fine coregistration
 
+// The 2d transform is done in place on a cached plan (see fft_plan.h),
+// so the interferogram is overwritten.
 float getFFTCorrelation(complexFloat *igram, int sizeX, int sizeY)
 {
-  int line, samp;
-  int fftpowr;
+  int ii;
   float ampTmp=0;
   float maxAmp=0;
-  complexFloat *fftBuf;
-  complexFloat *fftTemp;
-  complexFloat *fft;
-  
-  fft = (complexFloat *)MALLOC(sizeof(complexFloat)*sizeX*sizeX);
-  fftTemp = (complexFloat *)MALLOC(sizeof(complexFloat)*sizeX*sizeX);
-  fftpowr = (log(sizeX)/log(2));
-  fftInit(fftpowr);
-  
-  // First do the FFT of each line
-  for(line=0; line<sizeX; line++) {
-    fftBuf = &igram[line*sizeX];
-    ffts((float *)fftBuf, fftpowr, 1);
-    for(samp=0; samp<sizeX; samp++) {
-      fftTemp[line*sizeX+samp].real = fftBuf[samp].real;
-      fftTemp[line*sizeX+samp].imag = fftBuf[samp].imag;
-    }
-  }
-  
-  // Now do the FFT of the columns of the FFT'd lines
-  for(samp=0; samp<sizeX; samp++) {
-      
-    // Fill up the FFT buffer
-    for(line=0;line<sizeX;line++) {
-      fftBuf[line].real = fftTemp[line*sizeX+samp].real;
-      fftBuf[line].imag = fftTemp[line*sizeX+samp].imag;
-    }
-      
-    // Do the FFT
-    ffts((float *)fftBuf, fftpowr, 1);
-    for(line=0;line<sizeX;line++) {
-      fft[line*sizeX+samp].real = fftBuf[line].real;
-      fft[line*sizeX+samp].imag = fftBuf[line].imag;
-    }
-  }
-  free(fftTemp);
-  fftFree();
-  
+
+  fft_execute(fft_plan_2d(FFT_COMPLEX, FFT_FORWARD, sizeX, sizeX),
+              (float *)igram);
+
   // Now we have a two dimension FFT that we can search to find the max value
-  for(line=0; line<sizeX; line++) {
-    for(samp=0; samp<sizeX; samp++) {
-      ampTmp=sqrt(fft[line*sizeX+samp].real*fft[line*sizeX+samp].real +
-		  fft[line*sizeX+samp].imag*fft[line*sizeX+samp].imag);
-      if(ampTmp>maxAmp)
-	maxAmp=ampTmp;
-    }
+  for(ii=0; ii<sizeX*sizeX; ii++) {
+    ampTmp=sqrt(igram[ii].real*igram[ii].real +
+                igram[ii].imag*igram[ii].imag);
+    if(ampTmp>maxAmp)
+      maxAmp=ampTmp;
   }
-  free(fft);
   return maxAmp;
 }
 
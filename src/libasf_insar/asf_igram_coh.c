@@ -2,68 +2,298 @@
 #include "asf_meta.h"
 #include "asf_insar.h"
 #include "asf_raster.h"
+#include <glib.h>
+
+// The images are processed in blocks of IGRAM_BLOCK multilooked lines.
+// While one block is worked on, the next one is read in by another
+// thread; the block itself is split into strips of columns, done in
+// parallel, and then only the requested products are written out.
+#define IGRAM_BLOCK 32
+
+// Columns of multilooked output in each strip, at least
+#define IGRAM_STRIP 64
+
+typedef struct {
+  int lookLine, lookSample, stepLine, stepSample;
+  int ns, nl;                 // single-look size
+  int ml_ns, ml_nl;           // multilooked size
+} igram_geometry;
+
+// Lines [first, first+n_lines) of both images
+typedef struct {
+  complexFloat *master, *slave;
+  int first, n_lines;
+} igram_input;
+
+typedef struct {
+  FILE *fpMaster, *fpSlave;
+  meta_parameters *meta;
+  igram_input *in;
+} igram_reader;
+
+static gpointer read_block_thread(gpointer data)
+{
+  igram_reader *rd = data;
+  igram_input *in = rd->in;
+
+  get_complexFloat_lines(rd->fpMaster, rd->meta, in->first, in->n_lines,
+                         in->master);
+  get_complexFloat_lines(rd->fpSlave, rd->meta, in->first, in->n_lines,
+                         in->slave);
+  return NULL;
+}
+
+// One block of output: single-look lines [first, first+n_sl) and
+// multilooked lines [ml_first, ml_first+n_ml).  Products that were not
+// asked for are NULL.
+typedef struct {
+  const igram_geometry *g;
+  const igram_input *in;
+  int first, n_sl, ml_first, n_ml;
+  float *amp, *phase;
+  float *ml_amp, *ml_phase, *coh;
+  int n_strips;
+  gint next_strip;
+} igram_block;
+
+// Per-thread running sums over the coherence window, one per column
+typedef struct {
+  igram_block *block;
+  double *sum_a, *sum_b, *sum_re, *sum_im;
+  int *count_a, *count_b;
+} igram_thread;
+
+static float igram_phase(double re, double im)
+{
+  if (FLOAT_EQUIVALENT(re, 0.0) || FLOAT_EQUIVALENT(im, 0.0))
+    return 0.0;
+  return atan2(im, re);
+}
+
+// Add (sign 1) or take away (sign -1) line y of the input from the
+// window sums of columns [c0, c1).  The counts of nonzero pixels let
+// sums that are empty again be set back to exactly zero, rather than
+// whatever rounding left over.
+static void window_line(igram_thread *t, const igram_input *in, int ns,
+                        int y, int c0, int c1, int sign)
+{
+  const complexFloat *m = in->master + (size_t)(y - in->first)*ns;
+  const complexFloat *s = in->slave + (size_t)(y - in->first)*ns;
+  int c;
+
+  for (c=c0; c<c1; c++) {
+    double a = (double)m[c].real*m[c].real + (double)m[c].imag*m[c].imag;
+    double b = (double)s[c].real*s[c].real + (double)s[c].imag*s[c].imag;
+    t->sum_re[c] += sign*((double)m[c].real*s[c].real +
+                          (double)m[c].imag*s[c].imag);
+    t->sum_im[c] += sign*((double)m[c].imag*s[c].real -
+                          (double)m[c].real*s[c].imag);
+    t->sum_a[c] += sign*a;
+    t->sum_b[c] += sign*b;
+    if (a != 0) t->count_a[c] += sign;
+    if (b != 0) t->count_b[c] += sign;
+    if (sign < 0 && (t->count_a[c] == 0 || t->count_b[c] == 0)) {
+      t->sum_re[c] = t->sum_im[c] = 0;
+      if (t->count_a[c] == 0) t->sum_a[c] = 0;
+      if (t->count_b[c] == 0) t->sum_b[c] = 0;
+    }
+  }
+}
+
+static void window_zero(igram_thread *t, int c0, int c1)
+{
+  int c;
+  for (c=c0; c<c1; c++) {
+    t->sum_a[c] = t->sum_b[c] = t->sum_re[c] = t->sum_im[c] = 0;
+    t->count_a[c] = t->count_b[c] = 0;
+  }
+}
+
+static void igram_strip(igram_thread *t, int strip)
+{
+  igram_block *b = t->block;
+  const igram_geometry *g = b->g;
+  const igram_input *in = b->in;
+  int ns = g->ns, sl = g->stepLine, ss = g->stepSample;
+  int oc0 = (int)((long long)strip*g->ml_ns/b->n_strips);
+  int oc1 = (int)((long long)(strip+1)*g->ml_ns/b->n_strips);
+  int c0 = oc0*ss;
+  int c1 = strip == b->n_strips-1 ? ns : oc1*ss;
+  int r, c, L, oc;
+
+  // Single-look amplitude and phase
+  if (b->amp) {
+    for (r=0; r<b->n_sl; r++) {
+      const complexFloat *m = in->master + (size_t)(b->first+r-in->first)*ns;
+      const complexFloat *s = in->slave + (size_t)(b->first+r-in->first)*ns;
+      float *amp = b->amp + (size_t)r*ns;
+      float *phase = b->phase + (size_t)r*ns;
+      for (c=c0; c<c1; c++) {
+        double re = m[c].real*s[c].real + m[c].imag*s[c].imag;
+        double im = m[c].imag*s[c].real - m[c].real*s[c].imag;
+        amp[c] = sqrt(re*re + im*im);
+        phase[c] = igram_phase(re, im);
+      }
+    }
+  }
+
+  // Multilooked interferogram, averaged over stepLine x stepSample
+  if (b->ml_amp) {
+    double ampScale = 1.0/(sl*ss);
+    for (L=0; L<b->n_ml; L++) {
+      int y0 = (b->ml_first+L)*sl;
+      for (oc=oc0; oc<oc1; oc++) {
+        double re = 0, im = 0;
+        int y;
+        for (y=y0; y<y0+sl; y++) {
+          const complexFloat *m = in->master + (size_t)(y-in->first)*ns;
+          const complexFloat *s = in->slave + (size_t)(y-in->first)*ns;
+          for (c=oc*ss; c<(oc+1)*ss; c++) {
+            re += m[c].real*s[c].real + m[c].imag*s[c].imag;
+            im += m[c].imag*s[c].real - m[c].real*s[c].imag;
+          }
+        }
+        b->ml_amp[(size_t)L*g->ml_ns + oc] = sqrt(re*re + im*im)*ampScale;
+        b->ml_phase[(size_t)L*g->ml_ns + oc] = igram_phase(re, im);
+      }
+    }
+  }
+
+  // Coherence over lookLine x lookSample, starting at each step.  The
+  // column sums follow the window down the block: lines leaving it are
+  // taken away and the new ones added.
+  if (b->coh) {
+    int cc1 = oc1 > oc0 ? MIN(ns, (oc1-1)*ss + g->lookSample) : c0;
+    int wa = 0, wb = 0, y;
+
+    for (L=0; L<b->n_ml; L++) {
+      int na = (b->ml_first+L)*sl;
+      int nb = MIN(na + g->lookLine, g->nl);
+      float *coh = b->coh + (size_t)L*g->ml_ns;
+
+      // Start afresh at the top of the block, and whenever the windows
+      // do not overlap (lookLine < stepLine)
+      if (L == 0 || na >= wb) {
+        window_zero(t, c0, cc1);
+        wa = wb = na;
+      }
+      for (y=wa; y<na; y++)
+        window_line(t, in, ns, y, c0, cc1, -1);
+      for (y=wb; y<nb; y++)
+        window_line(t, in, ns, y, c0, cc1, 1);
+      wa = na;
+      wb = nb;
+
+      for (oc=oc0; oc<oc1; oc++) {
+        int last = MIN(oc*ss + g->lookSample, ns);
+        double re = 0, im = 0, sum_a = 0, sum_b = 0;
+        for (c=oc*ss; c<last; c++) {
+          re += t->sum_re[c];
+          im += t->sum_im[c];
+          sum_a += t->sum_a[c];
+          sum_b += t->sum_b[c];
+        }
+        if (FLOAT_EQUIVALENT((sum_a*sum_b), 0.0))
+          coh[oc] = 0.0;
+        else {
+          coh[oc] = (float) sqrt(re*re + im*im) / sqrt(sum_a * sum_b);
+          if (coh[oc]>1.0001)
+            asfPrintError("Coherence of %f at line %d, sample %d -- "
+                          "this should not happen!\n", coh[oc],
+                          b->ml_first+L, oc);
+        }
+      }
+    }
+  }
+}
+
+static gpointer igram_thread_fn(gpointer data)
+{
+  igram_thread *t = data;
+  int strip;
+
+  while ((strip = g_atomic_int_add(&t->block->next_strip, 1)) <
+         t->block->n_strips)
+    igram_strip(t, strip);
+
+  return NULL;
+}
 
-#define AMP(cpx) sqrt((cpx).real*(cpx).real + (cpx).imag*(cpx).imag)
-#define MIN(a,b) (((a) < (b)) ? (a) : (b))
+static FILE *open_product(meta_parameters *meta, const char *outBase,
+                          const char *suffix, image_data_type_t type,
+                          char *name)
+{
+  create_name(name, outBase, suffix);
+  meta->general->image_data_type = type;
+  meta_write(meta, name);
+  return FOPEN(name, "wb");
+}
 
 int asf_igram_coh(int lookLine, int lookSample, int stepLine, int stepSample,
 		  char *masterFile, char *slaveFile, char *outBase,
 		  float *average)
 {
-  char ampFile[255], phaseFile[255]; //, igramFile[512];
-  char cohFile[512], ml_ampFile[255], ml_phaseFile[255]; //, ml_igramFile[512];
-  FILE *fpMaster, *fpSlave, *fpAmp, *fpPhase, *fpCoh, *fpAmp_ml, *fpPhase_ml;
-  int line, sample_count, line_count, count;
-  float	bin_high, bin_low, max=0.0, sum_a, sum_b, ampScale;
+  return asf_igram_coh_ext(lookLine, lookSample, stepLine, stepSample,
+                           masterFile, slaveFile, outBase, IGRAM_DEFAULT,
+                           average);
+}
+
+int asf_igram_coh_ext(int lookLine, int lookSample, int stepLine,
+                      int stepSample, char *masterFile, char *slaveFile,
+                      char *outBase, int products, float *average)
+{
+  char name[512];
+  FILE *fpMaster, *fpSlave;
+  FILE *fpAmp=NULL, *fpPhase=NULL, *fpIgram=NULL;
+  FILE *fpAmp_ml=NULL, *fpPhase_ml=NULL, *fpIgram_ml=NULL, *fpCoh=NULL;
+  int count, ii, tt, cur, first, margin, n_threads, max_lines;
+  int want_sl, want_ml;
+  float bin_high, bin_low, max=0.0;
   double hist_sum=0.0, percent, percent_sum;
   long long hist_val[HIST_SIZE], hist_cnt=0;
-  meta_parameters *inMeta,*outMeta, *ml_outMeta;
-  complexFloat *master, *slave, *sum_igram, *sum_ml_igram;
-  float *amp, *phase, *sum_cpx_a, *sum_cpx_b, *coh, *pCoh;
-  float *ml_amp, *ml_phase;
-
-  // FIXME: Processing flow with two-banded interferogram needed - backed out
-  //        for now
-  create_name(ampFile, outBase,"_igram_amp.img");
-  create_name(phaseFile, outBase,"_igram_phase.img");
-  create_name(ml_ampFile, outBase,"_igram_ml_amp.img");
-  create_name(ml_phaseFile, outBase,"_igram_ml_phase.img");
-  //create_name(igramFile, outBase,"_igram.img");
-  //create_name(ml_igramFile, outBase, "_igram_ml.img");
-  //sprintf(cohFile, "coherence.img");
-  create_name(cohFile, outBase, "_coh.img");
+  meta_parameters *inMeta, *outMeta, *ml_outMeta, *igramMeta, *ml_igramMeta;
+  igram_geometry g;
+  igram_input in[2];
+  igram_reader rd;
+  igram_block block;
+  igram_thread *workers;
+  GThread **threads, *reader=NULL;
+
+  want_sl = products & (IGRAM_AMP | IGRAM_PHASE | IGRAM_TWO_BAND);
+  want_ml = products & (IGRAM_ML_AMP | IGRAM_ML_PHASE | IGRAM_ML_TWO_BAND);
 
   // Read input meta file
   inMeta = meta_read(masterFile);
-  line_count = inMeta->general->line_count; 
-  sample_count = inMeta->general->sample_count;
-  ampScale = 1.0/(stepLine*stepSample);
-
-  // Generate metadata for single-look images 
-  outMeta = meta_read(masterFile);
+  g.lookLine = lookLine;
+  g.lookSample = lookSample;
+  g.stepLine = stepLine;
+  g.stepSample = stepSample;
+  g.nl = inMeta->general->line_count;
+  g.ns = inMeta->general->sample_count;
+  g.ml_nl = g.nl/stepLine;
+  g.ml_ns = g.ns/stepSample;
+
+  // Single-look products
+  outMeta = meta_copy(inMeta);
   outMeta->general->data_type = REAL32;
-
-  // Write metadata for interferometric amplitude
-  outMeta->general->image_data_type = AMPLITUDE_IMAGE;
-  meta_write(outMeta, ampFile);
-
-  // Write metadata for interferometric phase
-  outMeta->general->image_data_type = PHASE_IMAGE;
-  meta_write(outMeta, phaseFile);
-
-  /*
-  // Write metadata for interferogram
-  outMeta->general->image_data_type = INTERFEROGRAM;
-  outMeta->general->band_count = 2;
-  strcpy(outMeta->general->bands, "IGRAM-AMP,IGRAM-PHASE");
-  meta_write(outMeta, igramFile);
-  */	
-     
-  // Generate metadata for multilooked images
-  ml_outMeta = meta_read(masterFile);
+  if (products & IGRAM_AMP)
+    fpAmp = open_product(outMeta, outBase, "_igram_amp.img",
+                         AMPLITUDE_IMAGE, name);
+  if (products & IGRAM_PHASE)
+    fpPhase = open_product(outMeta, outBase, "_igram_phase.img",
+                           PHASE_IMAGE, name);
+  igramMeta = meta_copy(outMeta);
+  igramMeta->general->band_count = 2;
+  strcpy(igramMeta->general->bands, "IGRAM-AMP,IGRAM-PHASE");
+  if (products & IGRAM_TWO_BAND)
+    fpIgram = open_product(igramMeta, outBase, "_igram.img", INTERFEROGRAM,
+                           name);
+
+  // Multilooked products
+  ml_outMeta = meta_copy(inMeta);
   ml_outMeta->general->data_type = REAL32;
-  ml_outMeta->general->line_count = line_count/stepLine;
-  ml_outMeta->general->sample_count = sample_count/stepSample;
+  ml_outMeta->general->line_count = g.ml_nl;
+  ml_outMeta->general->sample_count = g.ml_ns;
   ml_outMeta->general->x_pixel_size *= stepSample;
   ml_outMeta->general->y_pixel_size *= stepLine;
   ml_outMeta->sar->multilook = 1;
@@ -73,191 +303,156 @@ int asf_igram_coh(int lookLine, int lookSample, int stepLine, int stepSample,
   //        better at the moment.
   //ml_outMeta->sar->line_increment = 1;
   //ml_outMeta->sar->sample_increment = 1;
-
-  // Write metadata for multilooked interferometric amplitude
-  ml_outMeta->general->image_data_type = AMPLITUDE_IMAGE;
-  meta_write(ml_outMeta, ml_ampFile);
-
-  // Write metadata for multilooked interferometric phase
-  ml_outMeta->general->image_data_type = PHASE_IMAGE;
-  meta_write(ml_outMeta, ml_phaseFile);
-
-  // Write metadata for coherence image
-  ml_outMeta->general->image_data_type = COHERENCE_IMAGE;
-  meta_write(ml_outMeta, cohFile);
-
-  /*
-  // Write metadata for multilooked interferogram
-  ml_outMeta->general->image_data_type = INTERFEROGRAM;
-  strcpy(ml_outMeta->general->bands, "IGRAM-AMP,IGRAM-PHASE");
-  ml_outMeta->general->band_count = 2;
-  meta_write(ml_outMeta, ml_igramFile);
-  */
-
-  // Allocate memory
-  master = (complexFloat *) MALLOC(sizeof(complexFloat)*sample_count*lookLine);
-  slave = (complexFloat *) MALLOC(sizeof(complexFloat)*sample_count*lookLine);
-  amp = (float *) MALLOC(sizeof(float)*sample_count*lookLine);
-  phase = (float *) MALLOC(sizeof(float)*sample_count*lookLine);
-  ml_amp = (float *) MALLOC(sizeof(float)*sample_count/stepSample);
-  ml_phase = (float *) MALLOC(sizeof(float)*sample_count/stepSample);
-  coh = (float *) MALLOC(sizeof(float)*sample_count/stepSample);
-  sum_cpx_a = (float *) MALLOC(sizeof(float)*sample_count);
-  sum_cpx_b = (float *) MALLOC(sizeof(float)*sample_count);
-  sum_igram = (complexFloat *) MALLOC(sizeof(complexFloat)*sample_count);
-  sum_ml_igram = (complexFloat *) MALLOC(sizeof(complexFloat)*sample_count);
+  if (products & IGRAM_ML_AMP)
+    fpAmp_ml = open_product(ml_outMeta, outBase, "_igram_ml_amp.img",
+                            AMPLITUDE_IMAGE, name);
+  if (products & IGRAM_ML_PHASE)
+    fpPhase_ml = open_product(ml_outMeta, outBase, "_igram_ml_phase.img",
+                              PHASE_IMAGE, name);
+  if (products & IGRAM_COH)
+    fpCoh = open_product(ml_outMeta, outBase, "_coh.img", COHERENCE_IMAGE,
+                         name);
+  ml_igramMeta = meta_copy(ml_outMeta);
+  ml_igramMeta->general->band_count = 2;
+  strcpy(ml_igramMeta->general->bands, "IGRAM-AMP,IGRAM-PHASE");
+  if (products & IGRAM_ML_TWO_BAND)
+    fpIgram_ml = open_product(ml_igramMeta, outBase, "_igram_ml.img",
+                              INTERFEROGRAM, name);
+
+  // Input blocks, with room for the lines the last coherence windows
+  // reach past the block
+  margin = MAX(0, lookLine - stepLine);
+  max_lines = IGRAM_BLOCK*stepLine + margin;
+  for (ii=0; ii<2; ii++) {
+    in[ii].master =
+      (complexFloat *) MALLOC(sizeof(complexFloat)*g.ns*max_lines);
+    in[ii].slave =
+      (complexFloat *) MALLOC(sizeof(complexFloat)*g.ns*max_lines);
+  }
+  block.g = &g;
+  block.amp = block.phase = NULL;
+  block.ml_amp = block.ml_phase = NULL;
+  if (want_sl) {
+    block.amp = (float *) MALLOC(sizeof(float)*g.ns*IGRAM_BLOCK*stepLine);
+    block.phase = (float *) MALLOC(sizeof(float)*g.ns*IGRAM_BLOCK*stepLine);
+  }
+  if (want_ml) {
+    block.ml_amp = (float *) MALLOC(sizeof(float)*g.ml_ns*IGRAM_BLOCK);
+    block.ml_phase = (float *) MALLOC(sizeof(float)*g.ml_ns*IGRAM_BLOCK);
+  }
+  block.coh = (float *) MALLOC(sizeof(float)*g.ml_ns*IGRAM_BLOCK);
+  block.n_strips = MAX(1, g.ml_ns/IGRAM_STRIP);
+
+  n_threads = MAX(1, MIN((int)g_get_num_processors(), block.n_strips));
+  workers = (igram_thread *) MALLOC(sizeof(igram_thread)*n_threads);
+  threads = (GThread **) MALLOC(sizeof(GThread *)*n_threads);
+  for (tt=0; tt<n_threads; tt++) {
+    workers[tt].block = &block;
+    workers[tt].sum_a = (double *) MALLOC(sizeof(double)*g.ns);
+    workers[tt].sum_b = (double *) MALLOC(sizeof(double)*g.ns);
+    workers[tt].sum_re = (double *) MALLOC(sizeof(double)*g.ns);
+    workers[tt].sum_im = (double *) MALLOC(sizeof(double)*g.ns);
+    workers[tt].count_a = (int *) MALLOC(sizeof(int)*g.ns);
+    workers[tt].count_b = (int *) MALLOC(sizeof(int)*g.ns);
+  }
 
   // Open files
   fpMaster = FOPEN(masterFile,"rb");
   fpSlave = FOPEN(slaveFile,"rb");
-  fpAmp = FOPEN(ampFile,"wb");
-  fpPhase = FOPEN(phaseFile,"wb");
-  fpAmp_ml = FOPEN(ml_ampFile,"wb");
-  fpPhase_ml = FOPEN(ml_phaseFile,"wb");
-  //FILE *fpIgram = FOPEN(igramFile, "wb");
-  //FILE *fpIgram_ml = FOPEN(ml_igramFile, "wb");
-  fpCoh = FOPEN(cohFile,"wb");
+  rd.fpMaster = fpMaster;
+  rd.fpSlave = fpSlave;
+  rd.meta = inMeta;
 
   // Initialize histogram
   for (count=0; count<HIST_SIZE; count++) hist_val[count] = 0;
 
   asfPrintStatus("   Calculating interferogram and coherence ...\n\n");
 
-  for (line=0; line<line_count; line+=stepLine)
-  {
-    register int offset, row, column, limitLine;
-    double igram_real, igram_imag;
-    int inCol;
-    limitLine=MIN(lookLine, line_count-line);
-
-    printf("Percent completed %3.0f\r",(float)line/line_count*100.0);
-
-    pCoh = coh;
-
-    // Read in the next lines of data
-    get_complexFloat_lines(fpMaster, inMeta, line, limitLine, master);
-    get_complexFloat_lines(fpSlave, inMeta, line, limitLine, slave);
+  in[0].first = 0;
+  in[0].n_lines = MIN(max_lines, g.nl);
+  rd.in = &in[0];
+  read_block_thread(&rd);
 
-    // Add the remaining rows into sum vectors
-    offset = sample_count;
-    for (column=0; column<sample_count; column++)
-    {
-      offset = column;
-      sum_cpx_a[column] = 0.0;
-      sum_cpx_b[column] = 0.0;
-      sum_igram[column].real = 0.0;
-      sum_igram[column].imag = 0.0;
-      sum_ml_igram[column].real = 0.0;
-      sum_ml_igram[column].imag = 0.0;
-      igram_real = 0.0;
-      igram_imag = 0.0;
-
-      for (row=0; row<limitLine; row++)
-      {
-	// Complex multiplication for interferogram generation
-	igram_real = master[offset].real*slave[offset].real + 
-	  master[offset].imag*slave[offset].imag;
-        igram_imag = master[offset].imag*slave[offset].real - 
-	  master[offset].real*slave[offset].imag;
-        amp[offset] = sqrt(igram_real*igram_real + igram_imag*igram_imag);
-        if (FLOAT_EQUIVALENT(igram_real, 0.0) || 
-	    FLOAT_EQUIVALENT(igram_imag, 0.0))
-	  phase[offset]=0.0;
-        else
-	  phase[offset] = atan2(igram_imag, igram_real);
-
-       	sum_cpx_a[column] += AMP(master[offset])*AMP(master[offset]);
-      	sum_cpx_b[column] += AMP(slave[offset])*AMP(slave[offset]);
-       	sum_igram[column].real += igram_real;
-	sum_igram[column].imag += igram_imag;
-	if (line % stepLine == 0 && row < stepLine) {
-	  sum_ml_igram[column].real += igram_real;
-	  sum_ml_igram[column].imag += igram_imag;
-	}
-
-	offset += sample_count;
-      }
-
-      ml_amp[column] = 
-	sqrt(sum_ml_igram[column].real*sum_ml_igram[column].real + 
-	     sum_ml_igram[column].imag*sum_ml_igram[column].imag)*ampScale;
-      if (FLOAT_EQUIVALENT(sum_ml_igram[column].real, 0.0) || 
-	  FLOAT_EQUIVALENT(sum_ml_igram[column].imag, 0.0))
-	ml_phase[column] = 0.0;
-      else
-	ml_phase[column] = atan2(sum_ml_igram[column].imag, 
-				 sum_ml_igram[column].real);
+  for (first=0, cur=0; first<g.nl; first+=IGRAM_BLOCK*stepLine, cur=1-cur)
+  {
+    int next = first + IGRAM_BLOCK*stepLine;
+
+    printf("Percent completed %3.0f\r",(float)first/g.nl*100.0);
+
+    // Start reading the next block
+    if (reader) g_thread_join(reader);
+    reader = NULL;
+    if (next < g.nl) {
+      in[1-cur].first = next;
+      in[1-cur].n_lines = MIN(max_lines, g.nl - next);
+      rd.in = &in[1-cur];
+      reader = g_thread_new("asf_igram_coh", read_block_thread, &rd);
     }
 
-    // Write single-look and multilooked amplitude and phase
-    put_float_lines(fpAmp, outMeta, line, stepLine, amp);
-    put_float_lines(fpPhase, outMeta, line, stepLine, phase);
-    put_float_line(fpAmp_ml, ml_outMeta, line/stepLine, ml_amp);
-    put_float_line(fpPhase_ml, ml_outMeta, line/stepLine, ml_phase);
-    //put_band_float_lines(fpIgram, outMeta, 0, line, stepLine, amp);
-    //put_band_float_lines(fpIgram, outMeta, 1, line, stepLine, phase);
-    //put_band_float_line(fpIgram_ml, ml_outMeta, 0, line/stepLine, ml_amp);
-    //put_band_float_line(fpIgram_ml, ml_outMeta, 1, line/stepLine, ml_phase);
-
-    // Calculate the coherence by adding from sum vectors
-    for (inCol=0; inCol<sample_count; inCol+=stepSample)
-    {
-      register int limitSample = MIN(lookSample,sample_count-inCol);
-      sum_a = 0.0;
-      sum_b = 0.0;
-      igram_real = 0.0;
-      igram_imag = 0.0;
-
-      // Step over multilook area and sum output columns
-      for (column=0; column<limitSample; column++)
-      {
-	igram_real += sum_igram[inCol+column].real;
-	igram_imag += sum_igram[inCol+column].imag;				
-	sum_a += sum_cpx_a[inCol+column];
-	sum_b += sum_cpx_b[inCol+column];
-      }
-
-      if (FLOAT_EQUIVALENT((sum_a*sum_b), 0.0))
-	*pCoh = 0.0;
-      else 
-      {
-	*pCoh = (float) sqrt(igram_real*igram_real + igram_imag*igram_imag) /
-	  sqrt(sum_a * sum_b);
-	if (*pCoh>1.0001)
-	{ 
-	  printf("   coh = %f -- setting to 1.0\n",*pCoh);
-	  printf("   You shouldn't have seen this!\n");
-	  printf("   Exiting.\n");
-          exit(EXIT_FAILURE);
-	  *pCoh=1.0;
-	}
-      }
-     pCoh++;
-    } 
-
-    // Write out values for coherence
-    put_float_line(fpCoh, ml_outMeta, line/stepLine, coh);
+    block.in = &in[cur];
+    block.first = first;
+    block.n_sl = MIN(IGRAM_BLOCK*stepLine, g.nl - first);
+    block.ml_first = first/stepLine;
+    block.n_ml = MAX(0, MIN(IGRAM_BLOCK, g.ml_nl - block.ml_first));
+    block.next_strip = 0;
+    for (tt=1; tt<n_threads; tt++)
+      threads[tt] = g_thread_new("asf_igram_coh", igram_thread_fn,
+                                 &workers[tt]);
+    igram_thread_fn(&workers[0]);
+    for (tt=1; tt<n_threads; tt++)
+      g_thread_join(threads[tt]);
+
+    // Write out the requested products
+    if (fpAmp)
+      put_float_lines(fpAmp, outMeta, first, block.n_sl, block.amp);
+    if (fpPhase)
+      put_float_lines(fpPhase, outMeta, first, block.n_sl, block.phase);
+    if (fpIgram) {
+      put_band_float_lines(fpIgram, igramMeta, 0, first, block.n_sl,
+                           block.amp);
+      put_band_float_lines(fpIgram, igramMeta, 1, first, block.n_sl,
+                           block.phase);
+    }
+    if (block.n_ml == 0)
+      continue;
+    if (fpAmp_ml)
+      put_float_lines(fpAmp_ml, ml_outMeta, block.ml_first, block.n_ml,
+                      block.ml_amp);
+    if (fpPhase_ml)
+      put_float_lines(fpPhase_ml, ml_outMeta, block.ml_first, block.n_ml,
+                      block.ml_phase);
+    if (fpIgram_ml) {
+      put_band_float_lines(fpIgram_ml, ml_igramMeta, 0, block.ml_first,
+                           block.n_ml, block.ml_amp);
+      put_band_float_lines(fpIgram_ml, ml_igramMeta, 1, block.ml_first,
+                           block.n_ml, block.ml_phase);
+    }
+    if (fpCoh)
+      put_float_lines(fpCoh, ml_outMeta, block.ml_first, block.n_ml,
+                      block.coh);
 
     // Keep filling coherence histogram
-    for (count=0; count<sample_count/stepSample; count++)
+    for (count=0; count<block.n_ml*g.ml_ns; count++)
     {
       register int tmp;
-      tmp = (int) (coh[count]*HIST_SIZE); /* Figure out which bin this value is in */
+      float coh = block.coh[count];
+      tmp = (int) (coh*HIST_SIZE); /* Figure out which bin this value is in */
       /* This shouldn't happen */
       if(tmp >= HIST_SIZE)
 	tmp = HIST_SIZE-1;
       if(tmp < 0)
 	tmp = 0;
-      
+
       hist_val[tmp]++;        // Increment that bin for the histogram
-      hist_sum += coh[count];   // Add up the values for the sum
+      hist_sum += coh;        // Add up the values for the sum
       hist_cnt++;             // Keep track of the total number of values
-      if (coh[count]>max) 
-	max = coh[count];  // Calculate maximum coherence
+      if (coh>max)
+	max = coh;            // Calculate maximum coherence
     }
   } // End for line
+  if (reader) g_thread_join(reader);
 
-  printf("Percent completed %3.0f\n",(float)line/line_count*100.0);
+  printf("Percent completed %3.0f\n",100.0);
 
   // Sum and print the statistics
   percent_sum = 0.0;
@@ -274,29 +469,46 @@ int asf_igram_coh(int lookLine, int lookSample, int stepLine, int stepSample,
   *average = (float)hist_sum/(float)hist_cnt;
   printf("   ---------------------------------------\n");
   printf("   Maximum Coherence: %.3f\n", max);
-  printf("   Average Coherence: %.3f  (%.1f / %lld) %f\n", 
+  printf("   Average Coherence: %.3f  (%.1f / %lld) %f\n",
 		 *average,hist_sum, hist_cnt, percent_sum);
 
   // Free and exit
-  FREE(master); 
-  FREE(slave);
-  FREE(amp); 
-  FREE(phase);
-  FREE(ml_amp); 
-  FREE(ml_phase); 
-  FREE(coh); 
-  FCLOSE(fpMaster); 
+  for (tt=0; tt<n_threads; tt++) {
+    FREE(workers[tt].sum_a);
+    FREE(workers[tt].sum_b);
+    FREE(workers[tt].sum_re);
+    FREE(workers[tt].sum_im);
+    FREE(workers[tt].count_a);
+    FREE(workers[tt].count_b);
+  }
+  FREE(workers);
+  FREE(threads);
+  for (ii=0; ii<2; ii++) {
+    FREE(in[ii].master);
+    FREE(in[ii].slave);
+  }
+  if (block.amp) {
+    FREE(block.amp);
+    FREE(block.phase);
+  }
+  if (block.ml_amp) {
+    FREE(block.ml_amp);
+    FREE(block.ml_phase);
+  }
+  FREE(block.coh);
+  FCLOSE(fpMaster);
   FCLOSE(fpSlave);
-  FCLOSE(fpAmp); 
-  FCLOSE(fpPhase);
-  FCLOSE(fpAmp_ml); 
-  FCLOSE(fpPhase_ml);
-  //FCLOSE(fpIgram);
-  //FCLOSE(fpIgram_ml);
-  FCLOSE(fpCoh); 
+  if (fpAmp) FCLOSE(fpAmp);
+  if (fpPhase) FCLOSE(fpPhase);
+  if (fpIgram) FCLOSE(fpIgram);
+  if (fpAmp_ml) FCLOSE(fpAmp_ml);
+  if (fpPhase_ml) FCLOSE(fpPhase_ml);
+  if (fpIgram_ml) FCLOSE(fpIgram_ml);
+  if (fpCoh) FCLOSE(fpCoh);
   meta_free(inMeta);
   meta_free(outMeta);
   meta_free(ml_outMeta);
+  meta_free(igramMeta);
+  meta_free(ml_igramMeta);
   return(0);
 }
-
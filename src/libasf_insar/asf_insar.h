@@ -49,9 +49,22 @@ int asf_coregister(int datatype, char *coregType, char *baseName, int deskew,
 		   char *masterFile, char *slaveFile);
 
 // Prototypes from asf_igram_coh.c
+// Products of asf_igram_coh_ext, or'ed together
+#define IGRAM_AMP          0x01  // <outBase>_igram_amp.img
+#define IGRAM_PHASE        0x02  // <outBase>_igram_phase.img
+#define IGRAM_ML_AMP       0x04  // <outBase>_igram_ml_amp.img
+#define IGRAM_ML_PHASE     0x08  // <outBase>_igram_ml_phase.img
+#define IGRAM_COH          0x10  // <outBase>_coh.img
+#define IGRAM_TWO_BAND     0x20  // <outBase>_igram.img, amplitude and phase
+#define IGRAM_ML_TWO_BAND  0x40  // <outBase>_igram_ml.img, the same multilooked
+#define IGRAM_DEFAULT      (IGRAM_AMP | IGRAM_PHASE | IGRAM_ML_AMP | \
+                            IGRAM_ML_PHASE | IGRAM_COH)
 int asf_igram_coh(int lookLine, int lookSample, int stepLine, int stepSample,
 		  char *masterFile, char *slaveFile, char *outBase,
 		  float *average);
+int asf_igram_coh_ext(int lookLine, int lookSample, int stepLine,
+                      int stepSample, char *masterFile, char *slaveFile,
+                      char *outBase, int products, float *average);
 
 // Prototypes from asf_phase_unwrap.c
 int dem2phase(char *demFile, char *baseFile, char *phaseFile);
@@ -81,6 +94,10 @@ int zeroify(char *inFile, char *testFile, char *outFile);
 
 // Prototypes from escher.c
 int escher(char *inFile, char *outFile);
+/* Unwrap in tiles of tileSize pixels on a side, cut and integrated in
+   parallel, for images too big to unwrap whole; 0 unwraps the whole
+   image as escher() does. */
+int escher_ext(char *inFile, char *outFile, int tileSize);
 
 // Prototypes from refine_baseline.c
 int refine_baseline(char *phaseFile, char *seeds, char *oldBase, 
@@ -3,15 +3,25 @@
 #include "asf_meta.h"
 #include "asf_endian.h"
 #include "asf_insar.h"
+#include <glib.h>
+#include <unistd.h>
 
 // General constants
 #define MAXNAME         256
 #define DO_DEBUG_CHECKS 0
 
+// Images are unwrapped whole, as a single tile, unless the caller asks
+// escher_ext() for tiles.  Tiles are for images that don't fit in memory
+// (about 6 bytes a pixel); the cuts near tile seams can differ from the
+// whole-image ones.
+
+// Memory for the tile masks kept in core; the rest go to a scratch file
+#define ESCHER_CACHE_BYTES (256*1024*1024)
+
 /*
  * bits are number from 0 (lsb) to 7 (msb)
  *
- * status array 'mask' uses 5 bits:
+ * status array 'mask' uses 7 bits:
  *
  * bit 0 TRUE => +residue
  * bit 1 TRUE => -residue
@@ -19,6 +29,7 @@
  * bit 3 TRUE => grounded
  * bit 4 TRUE => in current search tree
  * bit 5 TRUE => integrated
+ * bit 6 TRUE => in the frame around a tile
  *
  * Note IICG means INTEGRTED | IN_CUT | GROUNDED
  *
@@ -50,6 +61,7 @@
 #define IICG                  (0x1c)        /* 0 0 0 1  1 1 0 0 */
 #define NOT_IN_TREE           (0xdf)        /* 1 1 0 1  1 1 1 1 */
 #define IN_TREE               (0x20)        /* 0 0 1 0  0 0 0 0 */
+#define TILE_EDGE             (0x40)        /* 0 1 0 0  0 0 0 0 */
 #define NO_TRIES              (0x00)        /* 0 0 0 0  0 0 0 0 */
 #define TRIED_U               (0x01)        /* 0 0 0 0  0 0 0 1 */
 #define TRIED_R               (0x02)        /* 0 0 0 0  0 0 1 0 */
@@ -77,71 +89,336 @@ typedef struct _PList {
   int c[1048576];
 } PList;
 
-// Globals
-PList list;
-Uchar *mask;     /* phase-state mask  */
-Uchar *im;       /* integration mask  */
-float *phase;   /* input phase       */
-float *coh;     /* coherence 'rho'   */
-int wid;
-int len;
-int size;
+// A residue left without a branch cut after the pass across the tile
+// boundaries
+typedef struct {
+  int x, y;
+  int charge;
+} residue;
+
+// One tile of the image, with a frame of one pixel all round that
+// neither the branch cuts nor the integration go past; its phase holds
+// the row and column past the tile that the residues on the tile's last
+// row and column need.  A tree that reaches the frame before a ground
+// or enough charge is undone, and left for a pass over tiles straddling
+// the boundaries.  wid and len are the framed size, and the tile's
+// first pixel is at (1,1).
+typedef struct {
+  int x0, y0;      // image position of the tile's first pixel
+  int w, h;        // tile size
+  int wid, len;    // w+2, h+2
+  float *phase;    // wrapped, then unwrapped phase
+  Uchar *mask;     // phase-state mask
+  Uchar *im;       // integration mask
+  int *region;     // region each pixel was integrated in, from 1; or NULL
+  int id;          // region being integrated
+  int verbose;     // report on the integration
+  PList *list;     // current branch cut tree
+  int *undo;       // mask pixels changed by the tree, and their values
+  Uchar *undo_val;
+  int n_undo, max_undo;
+  residue *left;   // residues without a cut
+  int n_left, max_left;
+} escher_tile;
+
+typedef struct {
+  long long total, zero, plus, minus, ground, cut, integ, in_tree;
+} escher_stats;
+
+// The masks of all the tiles, W by H bytes each.  At most max_cached
+// are held in memory; the least recently used one is written to a
+// scratch file (opened the first time it is needed) to make room.
+typedef struct {
+  int n;
+  size_t slot;     // bytes per tile in the scratch file
+  Uchar **data;
+  int *pins;
+  int *dirty, *on_disk;
+  guint64 *used, clock;
+  int n_cached, max_cached;
+  FILE *fp;
+  GMutex lock;
+} mask_store;
+
+// Unwrapped phase of the pixels along the border of a tile, with the
+// region they were integrated in
+typedef struct {
+  int region;
+  float uw;
+} edge_px;
+
+enum { PASS_CUT, PASS_SEAMS, PASS_REGIONS, PASS_OUTPUT };
+
+typedef struct {
+  int wid, len;                 // image size
+  int tile, n_tx, n_ty;
+  int offset;                   // of the tile grid in the current pass
+  int n_cols, n_rows;           // tiles in the current pass
+  mask_store store;
+  float *band;                  // lines band_y0.. of the current tile row
+  int band_y0;
+  int seedX, seedY;
+  int have_cordon, n_cordon;
+  Point *cordon;
+  int pass, ty;
+  gint next;
+  int *n_regions;               // per tile
+  edge_px **edges;              // per tile: top, bottom, left, right
+  int *base;                    // per tile: node of its region 1
+  int *cycles;                  // per node: offset in cycles of 2pi
+  Uchar *reached;               // per node: connected to the seed
+  float *out;                   // unwrapped tile row
+  Uchar *out_mask;
+} escher_run;
+
+typedef struct {
+  escher_run *run;
+  escher_tile t;
+  escher_stats mask_st, cordon_st, cut_st, final_st;
+} escher_worker;
 
 // Function declarations
-void loadWrappedPhase(char *phaseName);
-void groundBorder(void);
-void makeMask(void);
-void verifyCuts(void);
-Uchar chargeCalc(float ul, float ll, float lr, float ur);
-float phaseRemap(float in);
-void installCordon(char *cordonName);
-void cutMask(void);
-void generateCut(int x, int y);
-void makeBranchCut(int x1, int y1, int x2, int y2, Uchar orBy);
-void saveMask(Uchar *mask, char *maskName);
-void readMask(Uchar *mask, char *maskName);
-void finishUwp(void);
-void checkSeed(int *new_seedX, int *new_seedY);
-void integratePhase(int x, int y);
-void saveUwp(char *uwpName);
-void doStats();
-
-void loadWrappedPhase(char *f)
+static float phaseRemap(float in);
+static Uchar chargeCalc(float ul, float ll, float lr, float ur);
+static void generateCut(escher_tile *t, int x, int y);
+static void makeBranchCut(escher_tile *t, int x1, int y1, int x2, int y2,
+                          Uchar orBy);
+static void integratePhase(escher_tile *t, int x, int y);
+
+static void mask_store_init(mask_store *s, int n, size_t slot)
 {
-  FILE * fd;
-  meta_parameters *meta;
+  s->n = n;
+  s->slot = slot;
+  s->data = CALLOC(n, sizeof(Uchar *));
+  s->pins = CALLOC(n, sizeof(int));
+  s->dirty = CALLOC(n, sizeof(int));
+  s->on_disk = CALLOC(n, sizeof(int));
+  s->used = CALLOC(n, sizeof(guint64));
+  s->clock = 0;
+  s->n_cached = 0;
+  s->max_cached = MAX(1, (int)(ESCHER_CACHE_BYTES/slot));
+  s->fp = NULL;
+  g_mutex_init(&s->lock);
+}
+
+static void mask_store_free(mask_store *s)
+{
+  int ii;
+  for (ii=0; ii<s->n; ii++)
+    FREE(s->data[ii]);
+  FREE(s->data);
+  FREE(s->pins);
+  FREE(s->dirty);
+  FREE(s->on_disk);
+  FREE(s->used);
+  if (s->fp)
+    FCLOSE(s->fp);
+  g_mutex_clear(&s->lock);
+}
 
-  fd = FOPEN(f, "rb");
-  meta = meta_read(f);
-  get_float_lines(fd, meta, 0, len, phase);
-  FCLOSE(fd);
+static FILE *open_scratch_file(void)
+{
+  char name[64];
+  FILE *fp;
 
-  return;
+  sprintf(name, ".escher_mask_%ld", (long)getpid());
+  fp = fopen_tmp_file(name, "w+b");
+  if (fp)
+    unlink_tmp_file(name);
+  else
+    fp = tmpfile();
+  if (!fp)
+    asfPrintError("Could not open a scratch file for the phase unwrapping "
+                  "mask\n");
+  return fp;
 }
 
-void groundBorder()
+// Write out the least recently used tile that is not in use, if any.
+// Called with the lock held.
+static int mask_store_evict(mask_store *s, Uchar **buf)
 {
-  int i, j;
+  int ii, lru = -1;
+
+  for (ii=0; ii<s->n; ii++)
+    if (s->data[ii] && !s->pins[ii] && (lru < 0 || s->used[ii] < s->used[lru]))
+      lru = ii;
+  if (lru < 0)
+    return FALSE;
+
+  if (s->dirty[lru]) {
+    if (!s->fp)
+      s->fp = open_scratch_file();
+    FSEEK64(s->fp, (long long)lru*s->slot, SEEK_SET);
+    ASF_FWRITE(s->data[lru], 1, s->slot, s->fp);
+    s->on_disk[lru] = TRUE;
+    s->dirty[lru] = FALSE;
+  }
+  *buf = s->data[lru];
+  s->data[lru] = NULL;
+  s->n_cached--;
+  return TRUE;
+}
 
-  /* ground the left edge once and ground the right edge twice */
-  for (j = 0; j < len; j++) {
-    mask[j*wid+0]     |= GROUNDED;
-    mask[j*wid+wid-2] |= GROUNDED;
-    mask[j*wid+wid-1] |= GROUNDED;
+// The mask of tile 'tt', which stays in memory until mask_store_put.
+// A tile that has never been stored comes back zeroed.
+static Uchar *mask_store_get(mask_store *s, int tt)
+{
+  Uchar *p;
+
+  g_mutex_lock(&s->lock);
+  if (!s->data[tt]) {
+    Uchar *buf = NULL;
+    if (s->n_cached >= s->max_cached)
+      mask_store_evict(s, &buf);
+    if (!buf)
+      buf = MALLOC(s->slot);
+    if (s->on_disk[tt]) {
+      FSEEK64(s->fp, (long long)tt*s->slot, SEEK_SET);
+      ASF_FREAD(buf, 1, s->slot, s->fp);
+    }
+    else
+      memset(buf, 0, s->slot);
+    s->data[tt] = buf;
+    s->n_cached++;
   }
+  s->pins[tt]++;
+  s->used[tt] = ++s->clock;
+  p = s->data[tt];
+  g_mutex_unlock(&s->lock);
 
-  /* ground the top edge once and ground the bottom edge twice */
-  for (i = 0; i < wid; i++) {
-    mask[(0)*wid+i]     |= GROUNDED;
-    mask[(len-2)*wid+i] |= GROUNDED;
-    mask[(len-1)*wid+i] |= GROUNDED;
+  return p;
+}
+
+static void mask_store_put(mask_store *s, int tt, int modified)
+{
+  g_mutex_lock(&s->lock);
+  if (modified)
+    s->dirty[tt] = TRUE;
+  s->pins[tt]--;
+  g_mutex_unlock(&s->lock);
+}
+
+static void tile_extent(const escher_run *run, int tx, int ty,
+                        int *x0, int *y0, int *w, int *h)
+{
+  *x0 = tx*run->tile;
+  *y0 = ty*run->tile;
+  *w = MIN(run->tile, run->wid - *x0);
+  *h = MIN(run->tile, run->len - *y0);
+}
+
+// Tiles of a grid moved up and left by 'offset', clipped to the image
+static void window_extent(const escher_run *run, int offset, int tx, int ty,
+                          int *x0, int *y0, int *w, int *h)
+{
+  int x1 = MIN(run->wid, (tx+1)*run->tile - offset);
+  int y1 = MIN(run->len, (ty+1)*run->tile - offset);
+  *x0 = MAX(0, tx*run->tile - offset);
+  *y0 = MAX(0, ty*run->tile - offset);
+  *w = x1 - *x0;
+  *h = y1 - *y0;
+}
+
+// Copy a rectangle of the image's mask to (or from, if 'write') buf
+static void store_region(escher_run *run, int x, int y, int w, int h,
+                         Uchar *buf, int write)
+{
+  int tx, ty, j;
+
+  for (ty=y/run->tile; ty<=(y+h-1)/run->tile; ty++) {
+    for (tx=x/run->tile; tx<=(x+w-1)/run->tile; tx++) {
+      int tt = ty*run->n_tx + tx;
+      int x0, y0, tw, th, xa, xb, ya, yb;
+      Uchar *p;
+
+      tile_extent(run, tx, ty, &x0, &y0, &tw, &th);
+      xa = MAX(x, x0);
+      xb = MIN(x+w, x0+tw);
+      ya = MAX(y, y0);
+      yb = MIN(y+h, y0+th);
+      p = mask_store_get(&run->store, tt);
+      for (j=ya; j<yb; j++) {
+        Uchar *tp = p + (size_t)(j-y0)*tw + (xa-x0);
+        Uchar *bp = buf + (size_t)(j-y)*w + (xa-x);
+        if (write)
+          memcpy(tp, bp, xb-xa);
+        else
+          memcpy(bp, tp, xb-xa);
+      }
+      mask_store_put(&run->store, tt, write);
+    }
   }
+}
 
-  return;
+static Uchar mask_at(escher_run *run, int x, int y)
+{
+  Uchar m;
+  store_region(run, x, y, 1, 1, &m, FALSE);
+  return m;
+}
+
+static void count_stats(escher_stats *st, const Uchar *m, int n)
+{
+  int i, k;
+
+  st->total += n;
+  for (i = 0; i < n; i++) {
+    k = (int)m[i];
+
+    if (!k)                  { st->zero++;    }
+    if (k & POSITIVE_CHARGE) { st->plus++;    }
+    if (k & NEGATIVE_CHARGE) { st->minus++;   }
+    if (k & IN_CUT)          { st->cut++;     }
+    if (k & GROUNDED)        { st->ground++;  }
+    if (k & INTEGRATED)      { st->integ++;   }
+    if (k & IN_TREE)         { st->in_tree++; }
+  }
 }
 
+static void add_stats(escher_stats *a, const escher_stats *b)
+{
+  a->total += b->total;
+  a->zero += b->zero;
+  a->plus += b->plus;
+  a->minus += b->minus;
+  a->ground += b->ground;
+  a->cut += b->cut;
+  a->integ += b->integ;
+  a->in_tree += b->in_tree;
+}
 
-float phaseRemap(float p)
+static void doStats(const escher_stats *st)
+{
+  float total = (float)st->total;
+
+  asfPrintStatus ("   %9lld pixels                         \n", st->total);
+  asfPrintStatus ("   %9lld unknown     %7.3f %%\n",
+		  st->zero, 100.0*(float)(st->zero)/total);
+  asfPrintStatus ("   %9lld unwrapped   %7.3f %%\n",
+		  st->integ, 100.0*(float)(st->integ)/total);
+  asfPrintStatus ("   %9lld residues    %7.3f %%\n",
+		  st->plus + st->minus,
+		  100.0*(float)(st->plus + st->minus)/total);
+  asfPrintStatus ("->  %9lld +residues   %7.3f %%\n",
+		  st->plus, 100.0*(float)(st->plus)/total);
+  asfPrintStatus ("->  %9lld -residues   %7.3f %%\n",
+		  st->minus, 100.0*(float)(st->minus)/total);
+  asfPrintStatus ("    %9lld grounds     %7.3f %%\n",
+		  st->ground, 100.0*(float)(st->ground)/total);
+  asfPrintStatus ("    %9lld in tree     %7.3f %%\n",
+		  st->in_tree, 100.0*(float)(st->in_tree)/total);
+  asfPrintStatus ("    %9lld cuts        %7.3f %%\n",
+		  st->cut, 100.0*(float)(st->cut)/total);
+  asfPrintStatus ("\n");
+
+  if (st->in_tree) {
+    asfPrintStatus ("\n\nnote that number in tree != 0.\n\n");
+  }
+
+  return;
+}
+
+static float phaseRemap(float p)
 {
   p = (double)fmod((double)p,(double)TWOPI);
   if (p>PI) p-=TWOPI;
@@ -149,98 +426,40 @@ float phaseRemap(float p)
   return p;
 }
 
-
-int isGoodSeed(int x,int y)
+static int isGoodSeed(escher_run *run, int x, int y)
 {
 #define check_span 10 /*Make sure no cuts occur within this many pixels of seed*/
   int dx,dy;
-  if ((x<check_span)||(x>=wid-check_span)||
-      (y<check_span)||(y>=len-check_span))
+  if ((x<check_span)||(x>=run->wid-check_span)||
+      (y<check_span)||(y>=run->len-check_span))
     return 0;/*out-of-bounds*/
   dy=0;
   for (dx=-check_span;dx<=check_span;dx++)
-    if (mask[(y+dy)*wid+(x+dx)]!=0)
+    if (mask_at(run, x+dx, y+dy)!=0)
       return 0;/*Some cut is near this point*/
   dx=0;
   for (dy=-check_span;dy<=check_span;dy++)
-    if (mask[(y+dy)*wid+(x+dx)]!=0)
+    if (mask_at(run, x+dx, y+dy)!=0)
       return 0;/*Some cut is near this point*/
   return 1;/*If no cut is nearby, this is a good point*/
 }
 
-void checkSeed(int *x, int *y)
+static void checkSeed(escher_run *run, int *x, int *y)
 {
   /* adjust seed point to reside on a usable (mask == ZERO) pixel */
-  while (!isGoodSeed(*x,*y))
+  while (!isGoodSeed(run,*x,*y))
   {
     asfPrintStatus("\n   seed point (%d, %d) is not ZERO.\n", *x, *y);
     /*Pick a new, random seed point.*/
-    *x=(rand()&0x7fff)*wid/0x7fff;
-    *y=(rand()&0x7fff)*len/0x7fff;
+    *x=(rand()&0x7fff)*run->wid/0x7fff;
+    *y=(rand()&0x7fff)*run->len/0x7fff;
     asfPrintStatus("\n   auto-adjusted seed point to (%d, %d).\n", *x, *y);
   }
   asfPrintStatus("\n   checkSeed() finished\n\n");
   return;
 }
 
-/*
- * This function is a cursory test to check for 'residual' residues.
- *   If 'escher' is working properly it should give a null result.
- */
-void verifyCuts(void)
-{
-  int i, j, nSites = 0, nResidues = 0;
-  float p0, p1, p2, p3;
-
-  asfPrintStatus("\nStarting the verification ...\n\n");
-
-  for (j = 1; j < len - 2; j++) {
-    for (i = 1; i < wid - 2; i++) {
-      /* check only mask points which have 0-valued local loops */
-      if (!mask[j*wid+i] && !mask[j*wid+i+1] &&
-          !mask[(j+1)*wid+i+1] && !mask[(j+1)*wid+i]) {
-        p0 = phase[wid*(j  )+i  ];
-        p1 = phase[wid*(j+1)+i  ];
-        p2 = phase[wid*(j+1)+i+1];
-        p3 = phase[wid*(j  )+i+1];
-        nSites++;
-
-        /*
-         * This if() is a quick way of utilizing the fact that a return
-         *   charge value is nonzero, whereas no charge returs zero.
-         */
-        if (chargeCalc(p0, p1, p2, p3)) nResidues++;
-
-      }
-    }
-  }
-
-  asfPrintStatus("  Found %d add'l residues out of %d sites, %f percent\n",
-    nResidues, nSites, 100.0*(float)(nResidues)/(float)(nSites));
-  return;
-}
-
-void makeMask()
-{
-  int i, j;
-  float p0, p1, p2, p3;
-
-  for (j = 1; j < len - 2; j++) {
-    for (i = 1; i < wid - 2; i++) {
-      if (0.0==phase[wid*(j  )+i])
-        /*Ground out zero-phases (e.g., layover regions)*/
-	mask[j*wid+i] |= GROUNDED;
-      p0 = phase[wid*(j  )+i  ];
-      p1 = phase[wid*(j+1)+i  ];
-      p2 = phase[wid*(j+1)+i+1];
-      p3 = phase[wid*(j  )+i+1];
-      mask[j*wid+i] |= chargeCalc(p0,p1,p2,p3);
-    }
-  }
-  return;
-}
-
-Uchar chargeCalc(float p0, float p1, float p2, float p3)
+static Uchar chargeCalc(float p0, float p1, float p2, float p3)
 {
   register float d0, d1, d2, d3, od0, od1, od2, od3, sum;
 
@@ -292,143 +511,128 @@ Uchar chargeCalc(float p0, float p1, float p2, float p3)
 #endif
 }
 
-void installCordon(char *cordonFnm)
+static void readCordon(escher_run *run, char *cordonFnm)
 {
-  int i, n, x, y;
+  int i, n;
   FILE *fp;
 
+  run->have_cordon = FALSE;
+  run->n_cordon = 0;
+  run->cordon = NULL;
+
   if (fileExist(cordonFnm)) {
     n = fileNumLines(cordonFnm);
+    run->cordon = MALLOC(sizeof(Point)*(n > 0 ? n : 1));
     fp = FOPEN(cordonFnm,"r");
     for (i = 0; i < n; i++) {
-      fscanf(fp,"%d", &x);
-      fscanf(fp,"%d", &y);
-      mask[ y*wid + x] |= GROUNDED;
+      fscanf(fp,"%d", &run->cordon[i].i);
+      fscanf(fp,"%d", &run->cordon[i].j);
     }
     fclose(fp);
-    //printf("\ngrounded out %d points from cordon file '%s'\n\n",
-    //  n, cordonFnm);
-    doStats();
-  }
-  else {
-    /*The "cordon" file almost never exists; so this shouldn't be an error!
-    fprintf(stderr,
-            " ** cordon file '%s' does not exist; skipped installation **\n",
-            cordonFnm);*/
+    run->have_cordon = TRUE;
+    run->n_cordon = n;
   }
+  /*The "cordon" file almost never exists; so this shouldn't be an error!*/
 
   return;
 }
 
-void saveMask(unsigned char *m, char *f)
+// Wrapped phase of the framed tile from the current band of lines, with
+// zeros past the edges of the image
+static void loadTilePhase(escher_run *run, escher_tile *t)
 {
-  char fnm[256];
+  int i, j;
 
-  create_name(fnm,f,"_mask.img");
-  writeVector(m, fnm, CHAR, size);
-  return;
+  for (j = 0; j < t->len; j++) {
+    float *dst = t->phase + (size_t)j*t->wid;
+    int y = t->y0 - 1 + j;
+    if (y < 0 || y >= run->len) {
+      memset(dst, 0, sizeof(float)*t->wid);
+      continue;
+    }
+    const float *src = run->band + (size_t)(y - run->band_y0)*run->wid;
+    for (i = 0; i < t->wid; i++) {
+      int x = t->x0 - 1 + i;
+      dst[i] = (x < 0 || x >= run->wid) ? 0.0 : src[x];
+    }
+  }
 }
 
-void readMask(unsigned char *m, char *fnm)
+static void groundFrame(escher_tile *t)
 {
-  if (!size)
-    Exit("   escher:  readMask():  zero mask size");
-  readVector(m, fnm, CHAR, size);
-  return;
+  int i, j, wid = t->wid, len = t->len;
+  Uchar *mask = t->mask;
+
+  for (j = 0; j < len; j++) {
+    mask[j*wid+0]     = GROUNDED | TILE_EDGE;
+    mask[j*wid+wid-1] = GROUNDED | TILE_EDGE;
+  }
+  for (i = 0; i < wid; i++) {
+    mask[(0)*wid+i]     = GROUNDED | TILE_EDGE;
+    mask[(len-1)*wid+i] = GROUNDED | TILE_EDGE;
+  }
 }
 
-void cutMask(void)
+// The residues of the tile, with the image border grounded: the left and
+// top edges once, the right and bottom edges twice
+static void makeMask(escher_run *run, escher_tile *t)
 {
-  int i, j;
-
-  /*
-   * This function contains two loops over (wid-3)x(len-3) potential
-   *   residue sites.
-   * The first loop is a 'pre-processor' binary clobber.
-   * The second loop leads to a Goldstein style cutting function if a
-   *   site contains a residue.
-   */
+  int i, j, wid = t->wid;
+  float *phase = t->phase;
+  float p0, p1, p2, p3;
 
-#if 0
-  for (j = 1; j < len-2; j++) {
-
-    if (!(j%(len/6))) 
-      asfPrintStatus ("    ...binary clobber at %d of %d\n", j, len);
-
-    for (i = 1; i < wid-2; i++) {
-
-      if (mask[j*wid+i) & POSITIVE_CHARGE) {
-        if      (mask[(j-1)*wid+i-1] & NEGATIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j-1)*wid+i-1] |= IN_CUT; 
-	}
-        else if (mask[(j-1)*wid+i  ] & NEGATIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j-1)*wid+i  ] |= IN_CUT; 
-	}
-        else if (mask[(j-1)*wid+i+1] & NEGATIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j-1)*wid+i+1] |= IN_CUT; 
-	}
-        else if (mask[(j  )*wid+i-1] & NEGATIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j  )*wid+i-1] |= IN_CUT; 
-	}
-        else if (mask[(j  )*wid+i+1] & NEGATIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j  )*wid+i+1] |= IN_CUT; 
-	}
-        else if (mask[(j+1)*wid+i-1] & NEGATIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j+1)*wid+i-1] |= IN_CUT; 
-	}
-        else if (mask[(j+1)*wid+i  ] & NEGATIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j+1)*wid+i  ] |= IN_CUT; 
-	}
-        else if (mask[(j+1)*wid+i+1] & NEGATIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j+1)*wid+i+1] |= IN_CUT; 
-	}
-      }
-      else if (mask[j*wid+i) & NEGATIVE_CHARGE) {
-        if      (mask[(j-1)*wid+i-1] & POSITIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j-1)*wid+i-1] |= IN_CUT; 
-	}
-        else if (mask[(j-1)*wid+i  ] & POSITIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j-1)*wid+i  ] |= IN_CUT; 
-	}
-        else if (mask[(j-1)*wid+i+1] & POSITIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j-1)*wid+i+1] |= IN_CUT; 
-	}
-        else if (mask[(j  )*wid+i-1] & POSITIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j  )*wid+i-1] |= IN_CUT; 
-	}
-        else if (mask[(j  )*wid+i+1] & POSITIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j  )*wid+i+1] |= IN_CUT; 
-	}
-        else if (mask[(j+1)*wid+i-1] & POSITIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j+1)*wid+i-1] |= IN_CUT; 
-	}
-        else if (mask[(j+1)*wid+i  ] & POSITIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j+1)*wid+i  ] |= IN_CUT; 
-	}
-        else if (mask[(j+1)*wid+i+1] & POSITIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j+1)*wid+i+1] |= IN_CUT; 
-	}
+  for (j = 1; j <= t->h; j++) {
+    int y = t->y0 + j - 1;
+    for (i = 1; i <= t->w; i++) {
+      int x = t->x0 + i - 1;
+      Uchar m = ZERO;
+      if (x == 0 || x >= run->wid-2 || y == 0 || y >= run->len-2)
+        m |= GROUNDED;
+      if (x >= 1 && x < run->wid-2 && y >= 1 && y < run->len-2) {
+        if (0.0==phase[wid*(j  )+i])
+          /*Ground out zero-phases (e.g., layover regions)*/
+          m |= GROUNDED;
+        p0 = phase[wid*(j  )+i  ];
+        p1 = phase[wid*(j+1)+i  ];
+        p2 = phase[wid*(j+1)+i+1];
+        p3 = phase[wid*(j  )+i+1];
+        m |= chargeCalc(p0,p1,p2,p3);
       }
-
+      t->mask[j*wid+i] = m;
     }
-  }     /* end of sites loop */
-#endif
+  }
+  return;
+}
+
+static void installCordon(escher_run *run, escher_tile *t)
+{
+  int n;
+
+  for (n = 0; n < run->n_cordon; n++) {
+    int i = run->cordon[n].i - t->x0 + 1;
+    int j = run->cordon[n].j - t->y0 + 1;
+    if (i >= 1 && i <= t->w && j >= 1 && j <= t->h)
+      t->mask[j*t->wid+i] |= GROUNDED;
+  }
+}
+
+static void cutMask(escher_tile *t)
+{
+  int i, j;
 
   /* initialize the number of points in 'list' to zero */
-  list.n = 0;
-
-  /* loop over (wid-3)x(len-3) residue sites */
-  for (j = 1; j < len-2; j++) {
-    register Uchar *maskLineStart=mask+wid*j;
-    if (!(j%(len/8)))  
-      asfPrintStatus("     ...at %d of %d\n", j, len);
-    for (i = 1; i < wid-2; i++) {
+  t->list->n = 0;
+
+  /* loop over the residue sites */
+  for (j = 1; j <= t->h; j++) {
+    register Uchar *maskLineStart=t->mask+t->wid*j;
+    for (i = 1; i <= t->w; i++) {
       /*
        * this will be a point to cut if it has some charge
        * and is not already in a cut
        */
       if (*(maskLineStart+i) & SOME_CHARGE && !(*(maskLineStart+i) & IN_CUT)) {
-        generateCut(i, j);
+        generateCut(t, i, j);
       }
     }
   }
@@ -436,6 +640,26 @@ void cutMask(void)
   return;
 }
 
+static void orMask(escher_tile *t, int idx, Uchar orVal)
+{
+  if (t->n_undo == t->max_undo) {
+    t->max_undo = t->max_undo ? 2*t->max_undo : 1024;
+    t->undo = realloc(t->undo, sizeof(int)*t->max_undo);
+    t->undo_val = realloc(t->undo_val, t->max_undo);
+  }
+  t->undo[t->n_undo] = idx;
+  t->undo_val[t->n_undo++] = t->mask[idx];
+  t->mask[idx] |= orVal;
+}
+
+static void undoCut(escher_tile *t)
+{
+  while (t->n_undo > 0) {
+    t->n_undo--;
+    t->mask[t->undo[t->n_undo]] = t->undo_val[t->n_undo];
+  }
+}
+
 /*
  * generateCut(int i, int j) is passed a coordinate within the image
  * which contains a charge, either + or -.  The job of generateCut() is to
@@ -443,8 +667,11 @@ void cutMask(void)
  * and which has a total charge of zero. Furthermore, we want the
  * number of points involved in the branch cut to be minimized.
  */
-void generateCut(int i, int j)
+static void generateCut(escher_tile *t, int i, int j)
 {
+  Uchar *mask = t->mask;
+  PList *list = t->list;
+  int wid = t->wid, len = t->len;
   Uchar tV;                        /* test value */
   int point, point_i, point_j;
   int subR, subRmo;
@@ -453,7 +680,6 @@ void generateCut(int i, int j)
   int rmo;                       /* r minus one */
   int maxR;
   int tC=0;                        /* total charge */
-  /*int count;*/                     /* debug test */
   int scram;
 
   /* calculate the total charge of the tree */
@@ -470,13 +696,14 @@ void generateCut(int i, int j)
   maxR = min(maxR, len - j);
 
   /* set the number of points in the list to 1, and point 0 to (i, j) */
-  list.n      = 1;
-  list.p[0].i = i;
-  list.p[0].j = j;
-  list.c[0]   = 0;   /* point 0 connects to itself */
+  list->n      = 1;
+  list->p[0].i = i;
+  list->p[0].j = j;
+  list->c[0]   = 0;   /* point 0 connects to itself */
 
   /* set this point in the mask to IN_TREE */
   mask[ j*wid + i] |= IN_TREE;
+  t->n_undo = 0;
 
   /* set initial radius r = 2 and also set rmo = r - 1, a utility variable */
   r   = 2;
@@ -490,10 +717,10 @@ void generateCut(int i, int j)
 
     /* loop over the charge points in the current tree      */
     /*   (These may include cut charges from earlier trees) */
-    for (point = 0; point < list.n; point++) {
+    for (point = 0; point < list->n; point++) {
 
-      point_i = list.p[point].i;
-      point_j = list.p[point].j;
+      point_i = list->p[point].i;
+      point_j = list->p[point].j;
 
       /* loop over ALL the pixels in the box of radius r around this point */
       /* do this by starting with a box of radius 2 and working out */
@@ -525,14 +752,24 @@ void generateCut(int i, int j)
             l = point_j - n + 7*subRmo;
           }
 
-          /* make sure (k, l) is within the image boundary */
+          /* make sure (k, l) is within the tile boundary */
           if (k >= 0 && k < wid && l >= 0 && l < len) {
 
             /* establish a test value 'tV', the value of the mask at (k, l) */
             tV = mask[l*wid+k];
 
+            /*
+             * the frame of the tile is nearer than a ground or the
+             * charge to balance the tree; undo the tree, and leave it
+             * for the pass across the tile boundaries
+             */
+            if (tV & TILE_EDGE) {
+              undoCut(t);
+              scram = TRUE;
+            }
+
             /* test to see if the test value is grounded */
-            if (tV & GROUNDED) {
+            else if (tV & GROUNDED) {
               /* logical error check */
               if (tV & IN_TREE) Exit("tV is both GROUNDED && IN_TREE");
               /* new total charge is zero automatically */
@@ -544,13 +781,13 @@ void generateCut(int i, int j)
               scram = TRUE;
 
               /* increment number of points in the list, set last location */
-              list.n++;
-              if (list.n > 1000000)
+              list->n++;
+              if (list->n > 1000000)
                  Exit("list exceeded 1 million points");
-              list.p[(list.n)-1].i = k;
-              list.p[(list.n)-1].j = l;
+              list->p[(list->n)-1].i = k;
+              list->p[(list->n)-1].j = l;
               /* connect this guy to point number 'point' */
-              list.c[(list.n)-1]   = point;
+              list->c[(list->n)-1]   = point;
 
               /*
                * connect all points with GROUNDED lines
@@ -558,15 +795,15 @@ void generateCut(int i, int j)
                */
               /* start at the second point on the list */
               /* loop to the last point on the list    */
-              for (p = 1; p <= (list.n)-1; p++) {
+              for (p = 1; p <= (list->n)-1; p++) {
                 /* set (p_i, p_j) to 'p-th' point in the list */
-                p_i  = list.p[p].i;
-                p_j  = list.p[p].j;
+                p_i  = list->p[p].i;
+                p_j  = list->p[p].j;
                 /* connection index is carried in c[] array   */
-                cIdx = list.c[p];
-                p_ii = list.p[cIdx].i;
-                p_jj = list.p[cIdx].j;
-                makeBranchCut(p_i, p_j, p_ii, p_jj, (IN_CUT | GROUNDED));
+                cIdx = list->c[p];
+                p_ii = list->p[cIdx].i;
+                p_jj = list->p[cIdx].j;
+                makeBranchCut(t, p_i, p_j, p_ii, p_jj, (IN_CUT | GROUNDED));
               }
 
             }  /* end if test value tV is GROUNDED */
@@ -582,14 +819,14 @@ void generateCut(int i, int j)
                * is not already part of a cut */
               if (!(tV & IN_CUT)) { tC += 3 - 2*((int)(tV & SOME_CHARGE)); }
               /* label all points from (point_i, _j) to (k, l) as IN_CUT */
-              makeBranchCut(point_i, point_j, k, l, IN_CUT);
+              makeBranchCut(t, point_i, point_j, k, l, IN_CUT);
               /* increment number of points in the list, set last location */
-              list.n++;
-              if (list.n > 1000000) Exit("list exceeded 1 million points");
-              list.p[(list.n)-1].i = k;
-              list.p[(list.n)-1].j = l;
+              list->n++;
+              if (list->n > 1000000) Exit("list exceeded 1 million points");
+              list->p[(list->n)-1].i = k;
+              list->p[(list->n)-1].j = l;
               /* connect this guy to point number 'point' */
-              list.c[(list.n)-1]   = point;
+              list->c[(list->n)-1]   = point;
 
               /* mark this point as being on the current tree */
               mask[ l*wid + k] |= IN_TREE;
@@ -603,7 +840,7 @@ void generateCut(int i, int j)
              * in the current tree
              */
           } /* end if (k, l) in box around a point
-             * in the tree is within image boundary
+             * in the tree is within tile boundary
              */
 
           /* get out of everything if either total charge = 0
@@ -633,56 +870,26 @@ void generateCut(int i, int j)
 
 #if DO_DEBUG_CHECKS
   /* a logic check; scram should be TRUE */
-  /* I think we can just about take this out pretty soon */
   if (!scram) {
     asfPrintStatus("(%d, %d), maxR = %d, r = %d, rmo = %d, list.n = %d\n",
-      i, j, maxR, r, rmo, list.n);
+      i, j, maxR, r, rmo, list->n);
     asfPrintError("Error in generateCut()");
   }
 #endif
 
-
   /*
    * Having escaped from this do-while loop,
    * there is a list of points on the current
    * tree which should be marked 'NOT_IN_TREE'.
    */
-  for (point = 0; point < list.n; point++) {
-    point_i = list.p[point].i;
-    point_j = list.p[point].j;
+  for (point = 0; point < list->n; point++) {
+    point_i = list->p[point].i;
+    point_j = list->p[point].j;
     mask[ point_j*wid + point_i] &= NOT_IN_TREE;
   }
 
-#if DEBUG_TEST
-  /* debug test... */
-  /* I think we can just about take this out pretty soon */
-  count = 0;
-  for (point = 0; point < list.n; point++) {
-    point_i = list.p[point].i;
-    point_j = list.p[point].j;
-    if (!(mask[ point_j*wid + point_i] & IN_CUT)) { count++; }
-  }
-  if (count) {
-    asfPrintStatus("   at point (%d, %d), the debug test for IN_CUT returned:"
-		   "\n",i,j);
-    asfPrintStatus("   \t%d bad of %d in the list\n", count, list.n);
-    for (point = 0; point < list.n; point++) {
-      point_i = list.p[point].i;
-      point_j = list.p[point].j;
-      if (!(mask[ point_j*wid + point_i] & IN_CUT)) { count++; }
-      asfPrintStatus("   %d: (%d, %d)\n\tmask %d\n\tmask & IN_CUT %d\n",
-        point, point_i, point_j, (int)(mask[point_j*wid+point_i)),
-        (int)(mask[point_j*wid+point_i] & IN_CUT));
-      asfPrintStatus("   \tmask & GROUNDED %d\n\tmask & SOME_CHARGE %d\n",
-        (int)(mask[point_j*wid+point_i] & GROUNDED),
-        (int)(mask[point_j*wid+point_i] & SOME_CHARGE));
-    }
-    Exit("   generateCut() failed logical test");
-  }
-#endif
-
   /* reset number of points on list to zero */
-  list.n = 0;
+  list->n = 0;
 
   return;
 }
@@ -692,8 +899,10 @@ void generateCut(int i, int j)
  * The purpose of this function is to do a logical or of 'orVal' with every
  *   pixel in the mask array from (i, j) to (ii, jj) inclusive.
  */
-void makeBranchCut(int i, int j, int ii, int jj, Uchar orVal)
+static void makeBranchCut(escher_tile *t, int i, int j, int ii, int jj,
+                          Uchar orVal)
 {
+  int   wid = t->wid;
   int   dx, dy;        /* differences in coord values               */
   int   adx, ady;      /* absolute values of diffs                  */
   int   lc, sc;        /* int and short coords                     */
@@ -736,54 +945,109 @@ void makeBranchCut(int i, int j, int ii, int jj, Uchar orVal)
   if (order) {
     for (c1 = lc; c1 != lc - lcd + dc1; c1 += dc1) {
       c2 = sc + (int)(slope*(float)(c1 - lc));
-      mask[c2*wid+c1] |= orVal;
+      orMask(t, c2*wid+c1, orVal);
     }
   }
   else {
     for (c1 = lc; c1 != lc - lcd + dc1; c1 += dc1) {
       c2 = sc + (int)(slope*(float)(c1 - lc));
-      mask[c1*wid+c2] |= orVal;
+      orMask(t, c1*wid+c2, orVal);
     }
   }
 
   /* also label the last point as IN_CUT */
-  mask[ jj*wid + ii] |= orVal;
+  orMask(t, jj*wid + ii, orVal);
 
   return;
 }
 
-void finishUwp(void)
+// makeBranchCut on the image's mask, for cuts that cross tiles
+static void cutImage(escher_run *run, int x1, int y1, int x2, int y2,
+                     Uchar orVal)
 {
-  int i, j;
-
-  for (j = 0; j < len; j++) {
-    register float *lineStart=&phase[wid*j];
-    for (i = 0; i < wid; i++)
-      if (!(mask[j*wid+i]&INTEGRATED))
-       *(lineStart+i) = 0.0;/*Set non-integrated phases to zero*/
-  }
-
-  return;
+  escher_tile r;
+  int x = MIN(x1, x2), y = MIN(y1, y2);
+
+  memset(&r, 0, sizeof(r));
+  r.wid = abs(x1 - x2) + 1;
+  r.len = abs(y1 - y2) + 1;
+  r.mask = MALLOC((size_t)r.wid*r.len);
+  store_region(run, x, y, r.wid, r.len, r.mask, FALSE);
+  if (x1 == x2 && y1 == y2)
+    r.mask[0] |= orVal;
+  else
+    makeBranchCut(&r, x1-x, y1-y, x2-x, y2-y, orVal);
+  store_region(run, x, y, r.wid, r.len, r.mask, TRUE);
+  FREE(r.mask);
+  free(r.undo);
+  free(r.undo_val);
 }
 
-void saveUwp(char *f)
+static int borderDistance(const escher_run *run, const residue *r)
 {
-  meta_parameters *meta;
-
-  FILE *fd = FOPEN(f, "wb");
-  meta = meta_read(f);
-  put_float_lines(fd, meta, 0, len, phase);
-  FCLOSE(fd);
+  return MIN(MIN(r->x, run->wid-1 - r->x), MIN(r->y, run->len-1 - r->y));
+}
 
-  return;
+static int cmpResidue(const void *a, const void *b)
+{
+  const residue *p = a, *q = b;
+  if (p->y != q->y) return p->y - q->y;
+  return p->x - q->x;
 }
 
+/*
+ * Residues that found neither a ground nor a balancing charge within
+ * the tiles straddling the boundaries are too far apart for them.
+ * Join each to the nearest one of opposite charge left, or cut it to
+ * the edge of the image if that is nearer.
+ */
+static void cutLeftovers(escher_run *run, residue *left, int n)
+{
+  int ii, jj;
+
+  qsort(left, n, sizeof(residue), cmpResidue);
+  for (ii = 0; ii < n; ii++) {
+    residue *r = &left[ii];
+    int best = -1, best_d = 2*borderDistance(run, r);
+    if (!r->charge)
+      continue;
+    for (jj = ii+1; jj < n; jj++) {
+      residue *q = &left[jj];
+      int d = MAX(abs(r->x - q->x), abs(r->y - q->y));
+      if (q->charge == -r->charge && d < best_d &&
+          d <= borderDistance(run, r) + borderDistance(run, q)) {
+        best = jj;
+        best_d = d;
+      }
+    }
+    if (best >= 0) {
+      cutImage(run, r->x, r->y, left[best].x, left[best].y, IN_CUT);
+      left[best].charge = 0;
+    }
+    else {
+      int d = borderDistance(run, r);
+      if (d == r->x)
+        cutImage(run, r->x, r->y, 0, r->y, IN_CUT | GROUNDED);
+      else if (d == run->wid-1 - r->x)
+        cutImage(run, r->x, r->y, run->wid-1, r->y, IN_CUT | GROUNDED);
+      else if (d == r->y)
+        cutImage(run, r->x, r->y, r->x, 0, IN_CUT | GROUNDED);
+      else
+        cutImage(run, r->x, r->y, r->x, run->len-1, IN_CUT | GROUNDED);
+    }
+    r->charge = 0;
+  }
+}
 
-void integratePhase(int i, int j)
+static void integratePhase(escher_tile *t, int i, int j)
 {
+  Uchar  *mask = t->mask, *im = t->im;
+  float  *phase = t->phase;
+  int    *region = t->region, id = t->id;
+  int    wid = t->wid;
   int    u, v;      /* starting point coordinates                         */
   Uchar  s;         /* temp status value                                  */
-  int    t = 0;     /* total number of pixels integrated for this region  */
+  int    n = 0;     /* total number of pixels integrated for this region  */
   int    madeJump;  /* indicates an integration jump has been made        */
 
   /* initialize things */
@@ -795,9 +1059,10 @@ void integratePhase(int i, int j)
 
   /* label seed point as integrated                            */
   mask[j*wid+i] |= INTEGRATED;
+  if (region) region[j*wid+i] = id;
 
   /* increment integration counter                             */
-  t++;
+  n++;
 
   /* start out (u, v) = (i, j), a fall-through the while loop condition */
   u = i; v = j;
@@ -808,50 +1073,58 @@ void integratePhase(int i, int j)
 
   /* try 1:  go up one pixel to (i, j-1) */
   if (!(mask[(j-1)*wid+i] & IICG)){
-    v--; t++;
+    v--; n++;
     im[ j*wid + i] |= TRIED_U;
     im[ v*wid + u] |= SOURCE_B;
     mask[ v*wid + u] |= INTEGRATED;
+    if (region) region[v*wid+u] = id;
     phase[v*wid + u]  = phase[j*wid+i] +
                            phaseRemap((phase[v*wid+u]) -
                            (phase[j*wid+i]));
-    asfPrintStatus("   from seed point, started out by going up...");
+    if (t->verbose)
+      asfPrintStatus("   from seed point, started out by going up...");
   }
 
   /* try 2:  go right one pixel to (i + 1, j) */
   else if (!(mask[j*wid+(i+1)] & IICG)){
-    u++; t++;
+    u++; n++;
     im[ j*wid + i] |= TRIED_UR;
     im[ v*wid + u] |= SOURCE_L;
     mask[ v*wid + u] |= INTEGRATED;
+    if (region) region[v*wid+u] = id;
     phase[ v*wid + u]  = phase[j*wid+i] +
                            phaseRemap((phase[v*wid+u]) -
                            (phase[j*wid+i]));
-    asfPrintStatus("   from seed point, started out by going right...\n");
+    if (t->verbose)
+      asfPrintStatus("   from seed point, started out by going right...\n");
   }
 
   /* try 3:  go down one pixel to (i, j + 1) */
   else if (!(mask[(j+1)*wid+i] & IICG)){
-    v++; t++;
+    v++; n++;
     im[ j*wid + i] |= TRIED_URD;
     im[ v*wid + u] |= SOURCE_A;
     mask[ v*wid + u] |= INTEGRATED;
+    if (region) region[v*wid+u] = id;
     phase[ v*wid + u]  = phase[j*wid+i] +
                            phaseRemap((phase[v*wid+u]) -
                            (phase[j*wid+i]));
-    asfPrintStatus("   from seed point, started out by going down...\n");
+    if (t->verbose)
+      asfPrintStatus("   from seed point, started out by going down...\n");
   }
 
   /* try 4:  go left one pixel to (i - 1, j) */
   else if (!(mask[j*wid+(i-1)] & IICG)){
-    u--; t++;
+    u--; n++;
     im[ j*wid + i] |= TRIED_URDL;
     im[ v*wid + u] |= SOURCE_R;
     mask[ v*wid + u] |= INTEGRATED;
+    if (region) region[v*wid+u] = id;
     phase[ v*wid + u]  = phase[j*wid+i] +
                            phaseRemap((phase[v*wid+u]) -
                            (phase[j*wid+i]));
-    asfPrintStatus("\n   from seed point, started out by going left...\n");
+    if (t->verbose)
+      asfPrintStatus("\n   from seed point, started out by going left...\n");
   }
 
   /* fall through:  No good 4-nbrs found */
@@ -870,7 +1143,8 @@ void integratePhase(int i, int j)
    */
   while (u != i || v != j || !(im[j*wid+i] & TRIED_L)){
 
-    if (!(t%100000)) asfPrintStatus ("\r   total integrated = %d", t);
+    if (t->verbose && !(n%100000))
+      asfPrintStatus ("\r   total integrated = %d", n);
 
     /* s = temp value of 'im' at pixel (u, v) */
     s        = im[v*wid + u];
@@ -892,10 +1166,11 @@ void integratePhase(int i, int j)
       im[ v*wid + u] |= TRIED_U;
 
       if (!(mask[(v-1)*wid+u] & IICG)) {
-        v--; t++;
+        v--; n++;
         madeJump = TRUE;
         im[ v*wid + u] |= SOURCE_B;
         mask[ v*wid + u] |= INTEGRATED;
+        if (region) region[v*wid+u] = id;
         phase[ v*wid + u]  = phase[(v+1)*wid + u] +
                                phaseRemap(phase[v*wid+u] -
                                phase[(v+1)*wid+u]);
@@ -913,10 +1188,11 @@ void integratePhase(int i, int j)
       /* check if potential destination is not integrated,
          not cut, and not grounded */
       if (!(mask[v*wid+(u+1)] & IICG)) {
-        u++; t++;
+        u++; n++;
         madeJump = TRUE;
         im[ v*wid + u] |= SOURCE_L;
         mask[ v*wid + u] |= INTEGRATED;
+        if (region) region[v*wid+u] = id;
         phase[ v*wid + u]  = phase[ v*wid + (u-1)] +
                                phaseRemap(phase[v*wid+u] -
                                  phase[v*wid+(u-1)]);
@@ -934,10 +1210,11 @@ void integratePhase(int i, int j)
       /* check if potential destination is
          not integrated, not cut, and not grounded */
       if (!(mask[(v+1)*wid+u] & IICG)) {
-        v++; t++;
+        v++; n++;
         madeJump = TRUE;
         im[ v*wid + u] |= SOURCE_A;
         mask[ v*wid + u] |= INTEGRATED;
+        if (region) region[v*wid+u] = id;
         phase[ v*wid + u]  = phase[ (v-1)*wid + u] +
                                phaseRemap(phase[v*wid+u] -
                                  phase[(v-1)*wid+u]);
@@ -955,10 +1232,11 @@ void integratePhase(int i, int j)
       /* check if potential destination is
          not integrated, not cut, and not grounded */
       if (!(mask[v*wid+(u-1)] & IICG)) {
-        u--; t++;
+        u--; n++;
         madeJump = TRUE;
         im[ v*wid + u] |= SOURCE_R;
         mask[ v*wid + u] |= INTEGRATED;
+        if (region) region[v*wid+u] = id;
         phase[ v*wid + u]  = phase[v*wid + (u+1)] +
                                phaseRemap(phase[v*wid+u] -
                                  phase[v*wid+(u+1)]);
@@ -984,121 +1262,562 @@ void integratePhase(int i, int j)
 
   }  /* end of the big 'while-not-done' loop */
 
-  asfPrintStatus("\nUnwrapped %d pixels...\n", t);
+  if (t->verbose)
+    asfPrintStatus("\nUnwrapped %d pixels...\n", n);
   return;
 }
 
+static void setupTile(escher_run *run, escher_tile *t, int tx)
+{
+  tile_extent(run, tx, run->ty, &t->x0, &t->y0, &t->w, &t->h);
+  t->wid = t->w + 2;
+  t->len = t->h + 2;
+}
 
-void doStats()
+// Step one: residues and branch cuts of a tile, which go to the store
+static void cutTile(escher_worker *wk, int tx)
 {
-  int    i, j, k;
-  int    nZero     = 0;
-  int    nPlus     = 0;
-  int    nMinus    = 0;
-  int    nGround   = 0;
-  int    nCut      = 0;
-  int    nInteg    = 0;
-  int    nInTree   = 0;
-  float total     = (float)(len*wid);
+  escher_run *run = wk->run;
+  escher_tile *t = &wk->t;
+  int tt = run->ty*run->n_tx + tx;
+  Uchar *p;
+  int j;
 
-  for (j = 0; j < len; j++) {
-    register Uchar *lineStart=mask+wid*j;
-    for (i = 0; i < wid; i++) {
+  setupTile(run, t, tx);
+  loadTilePhase(run, t);
+  groundFrame(t);
+  makeMask(run, t);
+  for (j = 1; j <= t->h; j++)
+    count_stats(&wk->mask_st, t->mask + j*t->wid + 1, t->w);
+  if (run->have_cordon) {
+    installCordon(run, t);
+    for (j = 1; j <= t->h; j++)
+      count_stats(&wk->cordon_st, t->mask + j*t->wid + 1, t->w);
+  }
+  cutMask(t);
 
-      k = (int)(*(lineStart+i));
+  p = mask_store_get(&run->store, tt);
+  for (j = 1; j <= t->h; j++)
+    memcpy(p + (size_t)(j-1)*t->w, t->mask + j*t->wid + 1, t->w);
+  mask_store_put(&run->store, tt, TRUE);
+}
 
-      if (!k)                  { nZero++;   }
-      if (k & POSITIVE_CHARGE) { nPlus++;   }
-      if (k & NEGATIVE_CHARGE) { nMinus++;  }
-      if (k & IN_CUT)          { nCut++;   }
-      if (k & GROUNDED)        { nGround++; }
-      if (k & INTEGRATED)      { nInteg++; }
-      if (k & IN_TREE)         { nInTree++; }
+// Step two: the same over a grid of tiles moved by half a tile, so the
+// residues left at the boundaries of the first are well inside these
+static void seamTile(escher_worker *wk, int tx)
+{
+  escher_run *run = wk->run;
+  escher_tile *t = &wk->t;
+  int i, j;
 
+  window_extent(run, run->offset, tx, run->ty, &t->x0, &t->y0, &t->w, &t->h);
+  t->wid = t->w + 2;
+  t->len = t->h + 2;
+  groundFrame(t);
+  store_region(run, t->x0, t->y0, t->w, t->h, t->im, FALSE);
+  for (j = 1; j <= t->h; j++)
+    memcpy(t->mask + j*t->wid + 1, t->im + (size_t)(j-1)*t->w, t->w);
+
+  cutMask(t);
+
+  for (j = 1; j <= t->h; j++) {
+    Uchar *m = t->mask + j*t->wid;
+    memcpy(t->im + (size_t)(j-1)*t->w, m + 1, t->w);
+    for (i = 1; i <= t->w; i++) {
+      if (m[i] & SOME_CHARGE && !(m[i] & IN_CUT)) {
+        residue *r;
+        if (t->n_left == t->max_left) {
+          t->max_left = t->max_left ? 2*t->max_left : 64;
+          t->left = realloc(t->left, sizeof(residue)*t->max_left);
+        }
+        r = &t->left[t->n_left++];
+        r->x = t->x0 + i - 1;
+        r->y = t->y0 + j - 1;
+        r->charge = m[i] & POSITIVE_CHARGE ? 1 : -1;
+      }
     }
   }
+  store_region(run, t->x0, t->y0, t->w, t->h, t->im, TRUE);
+}
 
-  asfPrintStatus ("   %9d pixels                         \n", (int)(total));
-  asfPrintStatus ("   %9d unknown     %7.3f %%\n", 
-		  nZero, 100.0*(float)(nZero)/total);
-  asfPrintStatus ("   %9d unwrapped   %7.3f %%\n", 
-		  nInteg, 100.0*(float)(nInteg)/total);
-  asfPrintStatus ("   %9d residues    %7.3f %%\n", 
-		  nPlus + nMinus, 100.0*(float)(nPlus + nMinus)/total);
-  asfPrintStatus ("->  %9d +residues   %7.3f %%\n", 
-		  nPlus, 100.0*(float)(nPlus)/total);
-  asfPrintStatus ("->  %9d -residues   %7.3f %%\n", 
-		  nMinus, 100.0*(float)(nMinus)/total);
-  asfPrintStatus ("    %9d grounds     %7.3f %%\n", 
-		  nGround, 100.0*(float)(nGround)/total);
-  asfPrintStatus ("    %9d in tree     %7.3f %%\n", 
-		  nInTree, 100.0*(float)(nInTree)/total);
-  asfPrintStatus ("    %9d cuts        %7.3f %%\n", 
-		  nCut, 100.0*(float)(nCut)/total);
-  asfPrintStatus ("\n");
+// Integrate the tile from the seed, if it is in this tile, and then
+// (when there are several tiles) every other region left, in order.
+// The first time round this only records the regions along the tile's
+// border; once reconcileTiles has their offsets, the second writes out
+// the result.
+static void integrateTile(escher_worker *wk, int tx)
+{
+  escher_run *run = wk->run;
+  escher_tile *t = &wk->t;
+  int tt = run->ty*run->n_tx + tx;
+  int single = run->n_tx*run->n_ty == 1;
+  int wid, i, j;
+  Uchar *p;
+
+  setupTile(run, t, tx);
+  wid = t->wid;
+  loadTilePhase(run, t);
+  groundFrame(t);
+  p = mask_store_get(&run->store, tt);
+  for (j = 1; j <= t->h; j++)
+    memcpy(t->mask + j*wid + 1, p + (size_t)(j-1)*t->w, t->w);
+  mask_store_put(&run->store, tt, FALSE);
+  memset(t->im, 0, (size_t)wid*t->len);
+  if (t->region)
+    memset(t->region, 0, sizeof(int)*wid*t->len);
+
+  t->id = 0;
+  if (run->seedX >= t->x0 && run->seedX < t->x0 + t->w &&
+      run->seedY >= t->y0 && run->seedY < t->y0 + t->h) {
+    t->id = 1;
+    t->verbose = single;
+    integratePhase(t, run->seedX - t->x0 + 1, run->seedY - t->y0 + 1);
+    t->verbose = FALSE;
+  }
+  if (!single)
+    for (j = 1; j <= t->h; j++)
+      for (i = 1; i <= t->w; i++)
+        if (!(t->mask[j*wid+i] & IICG)) {
+          t->id++;
+          integratePhase(t, i, j);
+        }
+
+  if (run->pass == PASS_REGIONS) {
+    edge_px *e = MALLOC(sizeof(edge_px)*2*(t->w + t->h));
+    edge_px *top = e, *bottom = e + t->w;
+    edge_px *left = e + 2*t->w, *right = left + t->h;
+    for (i = 1; i <= t->w; i++) {
+      top[i-1].region = t->region[wid+i];
+      top[i-1].uw = t->phase[wid+i];
+      bottom[i-1].region = t->region[t->h*wid+i];
+      bottom[i-1].uw = t->phase[t->h*wid+i];
+    }
+    for (j = 1; j <= t->h; j++) {
+      left[j-1].region = t->region[j*wid+1];
+      left[j-1].uw = t->phase[j*wid+1];
+      right[j-1].region = t->region[j*wid+t->w];
+      right[j-1].uw = t->phase[j*wid+t->w];
+    }
+    run->n_regions[tt] = t->id;
+    run->edges[tt] = e;
+    return;
+  }
 
-  if (nInTree) { 
-    asfPrintStatus ("\n\nnote that number in tree != 0.\n\n"); 
+  // PASS_OUTPUT: pixels not connected to the seed are set to zero
+  for (j = 1; j <= t->h; j++) {
+    float *out = run->out + (size_t)(j-1)*run->wid + t->x0;
+    Uchar *out_mask = run->out_mask + (size_t)(j-1)*run->wid + t->x0;
+    for (i = 1; i <= t->w; i++) {
+      Uchar m = t->mask[j*wid+i];
+      float uw = t->phase[j*wid+i];
+      if (single) {
+        if (!(m & INTEGRATED))
+          uw = 0.0;
+      }
+      else {
+        int r = t->region[j*wid+i];
+        int node = r > 0 ? run->base[tt] + r - 1 : -1;
+        if (node >= 0 && run->reached[node]) {
+          if (run->cycles[node])
+            uw += TWOPI*run->cycles[node];
+        }
+        else {
+          uw = 0.0;
+          m &= NOT_INTEGRATED;
+        }
+      }
+      out[i-1] = uw;
+      out_mask[i-1] = m;
+    }
+    count_stats(&wk->final_st, out_mask, t->w);
   }
+}
 
-  return;
+static gpointer tile_thread(gpointer data)
+{
+  escher_worker *wk = (escher_worker *)data;
+  escher_run *run = wk->run;
+  int tx;
+
+  while ((tx = g_atomic_int_add(&run->next, 1)) < run->n_cols) {
+    if (run->pass == PASS_CUT)
+      cutTile(wk, tx);
+    else if (run->pass == PASS_SEAMS)
+      seamTile(wk, tx);
+    else
+      integrateTile(wk, tx);
+  }
+
+  return NULL;
+}
+
+// Run one pass over the tiles, a row of tiles at a time, reading the
+// wrapped phase for each row and writing out the unwrapped one
+static void runPass(escher_run *run, int pass, escher_worker *workers,
+                    int n_threads, FILE *fpIn, meta_parameters *meta,
+                    FILE *fpOut, FILE *fpMask)
+{
+  GThread **threads = MALLOC(sizeof(GThread *)*n_threads);
+  int tt, ty;
+
+  run->pass = pass;
+  run->offset = pass == PASS_SEAMS ? run->tile/2 : 0;
+  run->n_cols = (run->wid + run->offset + run->tile - 1)/run->tile;
+  run->n_rows = (run->len + run->offset + run->tile - 1)/run->tile;
+  for (ty = 0; ty < run->n_rows; ty++) {
+    int y0 = ty*run->tile;
+    int h = MIN(run->tile, run->len - y0);
+    int first = MAX(0, y0-1);
+    int last = MIN(run->len-1, y0+h);
+
+    run->ty = ty;
+    if (pass != PASS_SEAMS) {
+      run->band_y0 = first;
+      get_float_lines(fpIn, meta, first, last-first+1, run->band);
+    }
+
+    run->next = 0;
+    for (tt = 1; tt < n_threads; tt++)
+      threads[tt] = g_thread_new("escher", tile_thread, &workers[tt]);
+    tile_thread(&workers[0]);
+    for (tt = 1; tt < n_threads; tt++)
+      g_thread_join(threads[tt]);
+
+    if (pass == PASS_OUTPUT) {
+      put_float_lines(fpOut, meta, y0, h, run->out);
+      ASF_FWRITE(run->out_mask, 1, (size_t)h*run->wid, fpMask);
+    }
+    if (run->n_rows > 1)
+      asfPercentMeter((double)(ty+1)/run->n_rows);
+  }
+
+  FREE(threads);
+}
+
+typedef struct {
+  int a, b, delta, count;
+} seam_vote;
+
+static int cmpVote(const void *p, const void *q)
+{
+  const seam_vote *u = p, *v = q;
+  if (u->a != v->a) return u->a < v->a ? -1 : 1;
+  if (u->b != v->b) return u->b < v->b ? -1 : 1;
+  return u->delta - v->delta;
+}
+
+static int cmpVoteCount(const void *p, const void *q)
+{
+  const seam_vote *u = p, *v = q;
+  if (u->count != v->count) return v->count - u->count;
+  return cmpVote(p, q);
+}
+
+static void addVotes(escher_run *run, int ta, const edge_px *a, int tb,
+                     const edge_px *b, int n, seam_vote *votes, int *n_votes)
+{
+  int ii;
+
+  for (ii = 0; ii < n; ii++) {
+    if (a[ii].region && b[ii].region) {
+      float d = b[ii].uw - a[ii].uw;
+      seam_vote *v = &votes[(*n_votes)++];
+      v->a = run->base[ta] + a[ii].region - 1;
+      v->b = run->base[tb] + b[ii].region - 1;
+      v->delta = (int)floor((phaseRemap(d) - d)/TWOPI + 0.5);
+      v->count = 1;
+    }
+  }
+}
+
+static int findRoot(int *parent, int a)
+{
+  while (parent[a] != a) {
+    parent[a] = parent[parent[a]];
+    a = parent[a];
+  }
+  return a;
+}
+
+/*
+ * Each region of each tile was unwrapped on its own.  Neighbouring
+ * pixels across a tile boundary vote on the number of cycles between
+ * their regions; the regions are joined by the best supported of these,
+ * most votes first, into a spanning forest, and the offsets are taken
+ * along it from the seed's region.  Regions not joined to it are left
+ * out, as the original code leaves out what it cannot reach.
+ */
+static void reconcileTiles(escher_run *run)
+{
+  int n_tiles = run->n_tx*run->n_ty;
+  int n_nodes = 0, n_votes = 0, n_edges = 0, max_votes = 0;
+  int tx, ty, tt, ii, jj, seed;
+  seam_vote *votes;
+  int *parent, *deg, *adj_start, *adj, *adj_delta, *queue;
+
+  run->base = MALLOC(sizeof(int)*n_tiles);
+  for (tt = 0; tt < n_tiles; tt++) {
+    run->base[tt] = n_nodes;
+    n_nodes += run->n_regions[tt];
+  }
+  run->cycles = CALLOC(n_nodes > 0 ? n_nodes : 1, sizeof(int));
+  run->reached = CALLOC(n_nodes > 0 ? n_nodes : 1, sizeof(Uchar));
+
+  max_votes = (run->n_tx-1)*run->len + (run->n_ty-1)*run->wid;
+  votes = MALLOC(sizeof(seam_vote)*(max_votes > 0 ? max_votes : 1));
+  for (ty = 0; ty < run->n_ty; ty++) {
+    for (tx = 0; tx < run->n_tx; tx++) {
+      int x0, y0, w, h;
+      tt = ty*run->n_tx + tx;
+      tile_extent(run, tx, ty, &x0, &y0, &w, &h);
+      if (tx+1 < run->n_tx) {
+        int w1, h1;
+        tile_extent(run, tx+1, ty, &x0, &y0, &w1, &h1);
+        // right column of this tile against the left one of the next
+        addVotes(run, tt, run->edges[tt] + 2*w + h, tt+1,
+                 run->edges[tt+1] + 2*w1, h, votes, &n_votes);
+      }
+      if (ty+1 < run->n_ty)
+        // bottom row against the top row of the tile below
+        addVotes(run, tt, run->edges[tt] + w, tt + run->n_tx,
+                 run->edges[tt + run->n_tx], w, votes, &n_votes);
+    }
+  }
+
+  // Majority number of cycles for each pair of regions
+  qsort(votes, n_votes, sizeof(seam_vote), cmpVote);
+  for (ii = 0; ii < n_votes; ) {
+    int best = ii, best_count = 0;
+    for (jj = ii; jj < n_votes && votes[jj].a == votes[ii].a &&
+           votes[jj].b == votes[ii].b; ) {
+      int kk = jj;
+      while (kk < n_votes && cmpVote(&votes[kk], &votes[jj]) == 0)
+        kk++;
+      if (kk - jj > best_count) {
+        best = jj;
+        best_count = kk - jj;
+      }
+      jj = kk;
+    }
+    votes[n_edges] = votes[best];
+    votes[n_edges].count = best_count;
+    n_edges++;
+    ii = jj;
+  }
+
+  // Maximum spanning forest
+  qsort(votes, n_edges, sizeof(seam_vote), cmpVoteCount);
+  parent = MALLOC(sizeof(int)*(n_nodes > 0 ? n_nodes : 1));
+  deg = CALLOC(n_nodes + 1, sizeof(int));
+  for (ii = 0; ii < n_nodes; ii++)
+    parent[ii] = ii;
+  for (ii = 0, jj = 0; ii < n_edges; ii++) {
+    int ra = findRoot(parent, votes[ii].a), rb = findRoot(parent, votes[ii].b);
+    if (ra != rb) {
+      parent[ra] = rb;
+      votes[jj++] = votes[ii];
+      deg[votes[ii].a]++;
+      deg[votes[ii].b]++;
+    }
+  }
+  n_edges = jj;
+
+  adj_start = MALLOC(sizeof(int)*(n_nodes + 1));
+  adj_start[0] = 0;
+  for (ii = 0; ii < n_nodes; ii++)
+    adj_start[ii+1] = adj_start[ii] + deg[ii];
+  adj = MALLOC(sizeof(int)*(2*n_edges + 1));
+  adj_delta = MALLOC(sizeof(int)*(2*n_edges + 1));
+  memset(deg, 0, sizeof(int)*(n_nodes + 1));
+  for (ii = 0; ii < n_edges; ii++) {
+    int a = votes[ii].a, b = votes[ii].b;
+    adj[adj_start[a] + deg[a]] = b;
+    adj_delta[adj_start[a] + deg[a]++] = votes[ii].delta;
+    adj[adj_start[b] + deg[b]] = a;
+    adj_delta[adj_start[b] + deg[b]++] = -votes[ii].delta;
+  }
+
+  // Offsets from the seed's region, which is region 1 of its tile
+  tt = (run->seedY/run->tile)*run->n_tx + run->seedX/run->tile;
+  seed = run->base[tt];
+  queue = MALLOC(sizeof(int)*(n_nodes > 0 ? n_nodes : 1));
+  queue[0] = seed;
+  run->reached[seed] = TRUE;
+  for (ii = 0, jj = 1; ii < jj; ii++) {
+    int a = queue[ii], kk;
+    for (kk = adj_start[a]; kk < adj_start[a+1]; kk++) {
+      int b = adj[kk];
+      if (!run->reached[b]) {
+        run->reached[b] = TRUE;
+        run->cycles[b] = run->cycles[a] + adj_delta[kk];
+        queue[jj++] = b;
+      }
+    }
+  }
+  asfPrintStatus("   joined %d of %d regions to the seed's\n", jj, n_nodes);
+
+  FREE(queue);
+  FREE(adj_delta);
+  FREE(adj);
+  FREE(adj_start);
+  FREE(deg);
+  FREE(parent);
+  FREE(votes);
 }
 
 int escher(char *inFile, char *outFile)
 {
-  int seedX=-1,seedY=-1; 
-  char szWrap[MAXNAME], szUnwrap[MAXNAME];
+  return escher_ext(inFile, outFile, 0);
+}
+
+int escher_ext(char *inFile, char *outFile, int tileSize)
+{
+  char szWrap[MAXNAME], szUnwrap[MAXNAME], szMask[MAXNAME];
   meta_parameters *meta;
+  escher_run run;
+  escher_worker *workers;
+  escher_stats st;
+  residue *left = NULL;
+  FILE *fpIn, *fpOut, *fpMask;
+  int ii, n_threads, n_tiles, n_left = 0, tw, th;
 
   create_name(szWrap, inFile, ".img");
   create_name(szUnwrap, outFile, ".img");
+  create_name(szMask, szUnwrap, "_mask.img");
 
   meta = meta_read(szWrap);
-  wid = meta->general->sample_count;
-  len = meta->general->line_count;
-  if ((seedX == -1)&&(seedY == -1))
-  {
-    seedX = wid/2;
-    seedY = len/2;
-  }
-  
+  memset(&run, 0, sizeof(run));
+  run.wid = meta->general->sample_count;
+  run.len = meta->general->line_count;
+  run.seedX = run.wid/2;
+  run.seedY = run.len/2;
+
+  if (tileSize <= 0)
+    tileSize = MAX(run.wid, run.len);
+  run.tile = tileSize;
+  run.n_tx = (run.wid + tileSize - 1)/tileSize;
+  run.n_ty = (run.len + tileSize - 1)/tileSize;
+  n_tiles = run.n_tx*run.n_ty;
+  tw = MIN(tileSize, run.wid);
+  th = MIN(tileSize, run.len);
+  mask_store_init(&run.store, n_tiles, (size_t)tw*th);
+
   meta_write(meta, szUnwrap);
 
-  size = wid*len;
-  mask = (Uchar *)calloc(size, sizeof(Uchar));
-  im = (Uchar *)calloc(size, sizeof(Uchar));
-  phase = (float *)MALLOC(sizeof(float)*size);
+  n_threads = MAX(1, MIN((int)g_get_num_processors(), run.n_tx));
+  workers = CALLOC(n_threads, sizeof(escher_worker));
+  for (ii = 0; ii < n_threads; ii++) {
+    escher_tile *t = &workers[ii].t;
+    size_t framed = (size_t)(tw+2)*(th+2);
+    workers[ii].run = &run;
+    t->phase = MALLOC(sizeof(float)*framed);
+    t->mask = MALLOC(framed);
+    t->im = MALLOC(framed);
+    t->region = n_tiles > 1 ? MALLOC(sizeof(int)*framed) : NULL;
+    t->list = MALLOC(sizeof(PList));
+  }
+  run.band = MALLOC(sizeof(float)*(th+2)*run.wid);
+  run.out = MALLOC(sizeof(float)*th*run.wid);
+  run.out_mask = MALLOC(th*run.wid);
+  if (n_tiles > 1)
+    asfPrintStatus("\nUnwrapping in %d tiles of %dx%d pixels\n",
+                   n_tiles, tileSize, tileSize);
+
+  fpIn = FOPEN(szWrap, "rb");
 
   /* perform steps*/
   asfPrintStatus("\nGenerating phase unwrapping mask ...\n\n");
-  loadWrappedPhase(szWrap);
-  groundBorder();
-  makeMask();
-  doStats();
+  readCordon(&run, "cordon");
+  runPass(&run, PASS_CUT, workers, n_threads, fpIn, meta, NULL, NULL);
+  memset(&st, 0, sizeof(st));
+  for (ii = 0; ii < n_threads; ii++)
+    add_stats(&st, &workers[ii].mask_st);
+  doStats(&st);
   asfPrintStatus("\n\nGrounding remaining residues ...\n\n");
-  installCordon("cordon");
+  if (run.have_cordon) {
+    memset(&st, 0, sizeof(st));
+    for (ii = 0; ii < n_threads; ii++)
+      add_stats(&st, &workers[ii].cordon_st);
+    doStats(&st);
+  }
   asfPrintStatus("\n\nDefining branch cuts ...\n\n");
-  cutMask();
-  doStats();
 
-#if DO_DEBUG_CHECKS
-  saveMask((char *)mask, "test");
+  if (n_tiles > 1) {
+    runPass(&run, PASS_SEAMS, workers, n_threads, fpIn, meta, NULL, NULL);
+    for (ii = 0; ii < n_threads; ii++) {
+      escher_tile *t = &workers[ii].t;
+      left = realloc(left, sizeof(residue)*(n_left + t->n_left + 1));
+      if (t->n_left)
+        memcpy(left + n_left, t->left, sizeof(residue)*t->n_left);
+      n_left += t->n_left;
+    }
+    if (n_left > 0) {
+      asfPrintStatus("   %d residues left across tile boundaries\n", n_left);
+      cutLeftovers(&run, left, n_left);
+    }
+    free(left);
+  }
 
-  verifyCuts();                                           
-#endif
+  memset(&st, 0, sizeof(st));
+  for (ii = 0; ii < n_tiles; ii++) {
+    Uchar *p = mask_store_get(&run.store, ii);
+    int x0, y0, w, h;
+    tile_extent(&run, ii % run.n_tx, ii / run.n_tx, &x0, &y0, &w, &h);
+    count_stats(&st, p, w*h);
+    mask_store_put(&run.store, ii, FALSE);
+  }
+  doStats(&st);
 
   asfPrintStatus("\n\nIntegrating the phase ...\n\n");
-  checkSeed(&seedX, &seedY);
-  integratePhase(seedX, seedY);
-  doStats();
-  finishUwp();
-  saveMask(mask, szUnwrap);
-  saveUwp(szUnwrap);
-  
+  checkSeed(&run, &run.seedX, &run.seedY);
+  if (n_tiles > 1) {
+    run.n_regions = CALLOC(n_tiles, sizeof(int));
+    run.edges = CALLOC(n_tiles, sizeof(edge_px *));
+    runPass(&run, PASS_REGIONS, workers, n_threads, fpIn, meta, NULL, NULL);
+    reconcileTiles(&run);
+  }
+
+  fpOut = FOPEN(szUnwrap, "wb");
+  fpMask = FOPEN(szMask, "wb");
+  runPass(&run, PASS_OUTPUT, workers, n_threads, fpIn, meta, fpOut, fpMask);
+  FCLOSE(fpMask);
+  FCLOSE(fpOut);
+  FCLOSE(fpIn);
+
+  memset(&st, 0, sizeof(st));
+  for (ii = 0; ii < n_threads; ii++)
+    add_stats(&st, &workers[ii].final_st);
+  if (n_tiles > 1)
+    asfPrintStatus("\nUnwrapped %lld pixels...\n", st.integ);
+  doStats(&st);
+
   // Clean up
-  FREE(mask);
-  FREE(im);
-  FREE(phase);
+  for (ii = 0; ii < n_threads; ii++) {
+    escher_tile *t = &workers[ii].t;
+    FREE(t->phase);
+    FREE(t->mask);
+    FREE(t->im);
+    FREE(t->region);
+    FREE(t->list);
+    free(t->undo);
+    free(t->undo_val);
+    free(t->left);
+  }
+  FREE(workers);
+  if (run.edges)
+    for (ii = 0; ii < n_tiles; ii++)
+      FREE(run.edges[ii]);
+  FREE(run.edges);
+  FREE(run.n_regions);
+  FREE(run.base);
+  FREE(run.cycles);
+  FREE(run.reached);
+  FREE(run.cordon);
+  FREE(run.band);
+  FREE(run.out);
+  FREE(run.out_mask);
+  mask_store_free(&run.store);
+  meta_free(meta);
 
   return(0);
 }
@@ -147,26 +147,6 @@ int snaphu(char *snaphu_version, char *phaseFile, char *ampFile, char *pwrFile1,
   return ret;
 }
 
-int phase_filter(char *inFile, double strength, char *outFile)
-{
-  char options[255]="", command[255];
-  int ret;
-  
-  sprintf(options, "-log %s", logFile);
-  sprintf(command, "phase_filter %s %s %.1f %s", 
-	  options, inFile, strength, outFile);
-  
-  printf("\nCommand line: %s\n", command);
-  //fLog = FOPEN(logFile, "a");
-  sprintf(logbuf,"\nCommand line: %s\n", command);
-  printLog(logbuf);
-  FCLOSE(fLog);
-  ret = system(command);
-  fLog = FOPEN(logFile, "a");
-  
-  return ret;
-}
-
 int zeroify(char *phaseFile1, char *phaseFile2, char *outFile)
 {
   char options[255]="", command[255];
@@ -187,23 +167,4 @@ int zeroify(char *phaseFile1, char *phaseFile2, char *outFile)
   return ret;
 }
 
-int escher(char *inFile, char *outFile)
-{       
-  char options[255]="", command[255];
-  int ret;
-  
-  sprintf(options, "-log %s", logFile);
-  sprintf(command, "escher %s %s %s", options, inFile, outFile);
-  
-  printf("\nCommand line: %s\n", command);
-  //fLog = FOPEN(logFile, "a");
-  sprintf(logbuf,"\nCommand line: %s\n", command);
-  printLog(logbuf);
-  FCLOSE(fLog);
-  ret = system(command);
-  fLog = FOPEN(logFile, "a");
-  
-  return ret;
-}
-
 #endif
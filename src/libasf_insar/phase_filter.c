@@ -1,430 +1,329 @@
 #include "asf.h"
 #include "asf_meta.h"
-#include "fft.h"
-#include "fft2d.h"
+#include "asf_insar.h"
+#include "fft_plan.h"
+#include <glib.h>
 
-/* complex number def'n */
-typedef struct {
-        float r;
-        float i;
-} complex;
-
-/************************
-Filter sizes:
-        These are expressed as powers of 2--
-        dMx=3 -> filter 8-pixel chunk; write 4-pixel chunk;
-        dMx=4 -> filter 16-pixel chunk; write 8-pixel chunk;
-        dMx=5 -> filter 32-pixel chunk; write 16-pixel chunk;
-        dMx=6 -> filter 64-pixel chunk; write 32-pixel chunk;
-        dMx=7 -> filter 128-pixel chunk; write 64-pixel chunk;
+/************************************************************
+Goldstein phase filtering.
+
+	The filter works best on small pieces of the image, so
+the image is cut into PATCH x PATCH patches, each overlapping
+its neighbours by half in both directions.  Every patch is
+filtered (fft; multiply the spectrum by its amplitude to the
+power strength-1; ifft), weighted by a sin^2 window and added
+into place.  With half overlap the windows of the four patches
+covering any pixel add up to exactly one, so there are no seams
+and no special cases at the image edges -- the patches start
+half a patch before the image, whose outside is zero.
+
+	The image goes through in blocks of PF_BLOCK rows of
+patches.  While one block is filtered, the phase of the next
+one is read in by another thread; the patches of the block are
+filtered in parallel, and then its output lines are put
+together, also in parallel.
 */
 
-#define dMx 5
-#define dMy 5
+/* Size of a patch (a power of 2) and the step between patches */
+#define PATCH 32
+#define STEP (PATCH/2)
 
-/*Size of filtered chunk.*/
-#define dx (1<<dMx)
-#define dy (1<<dMy)
+/* Rows of patches in each block */
+#define PF_BLOCK 8
 
-/*Size of output chunk (requires 4 filtered chunks).*/
-#define ox (1<<(dMx-1))
-#define oy (1<<(dMy-1))
+typedef struct {
+  int ns, nl;                 // image size
+  int width;                  // padded line length: image starts at STEP
+  int n_cols, n_rows;         // number of patches across and down
+  float strength;
+  float window[PATCH];        // 1d overlap-add window
+  const fft_plan *forward, *inverse;
+} pf_geometry;
 
-void blendData(complex **chunks,complex **last_chunks,
-        float *weight,float *outBuf);
+// Phase lines [first, first+n_lines) as unit complex numbers, padded
+// with zeros to pf_geometry.width and to lines outside the image.
+typedef struct {
+  complexFloat *cpx;
+  float *phase;               // one line, for reading
+  int first, n_lines;
+} pf_input;
+
+typedef struct {
+  FILE *fp;
+  meta_parameters *meta;
+  const pf_geometry *g;
+  pf_input *in;
+} pf_reader;
 
-int nl,ns;
+// Filtered patch rows.  Patch (r,c) covers lines (r-1)*STEP..(r+1)*STEP-1
+// and, padded, columns c*STEP..c*STEP+PATCH-1.  Patches of the same
+// column parity do not overlap, so each row is kept as two
+// PATCH x width arrays, one for even and one for odd columns.
+typedef struct {
+  complexFloat *half[2];
+} pf_row;
 
-/***********************************************
-blendHoriz, blendVert:
-        These blend the complex numbers stored in
-the given arrays either vertically or horizontally by
-the given weighting array.
+typedef struct {
+  const pf_geometry *g;
+  const pf_input *in;
+  pf_row *rows;               // ring of PF_BLOCK+1, row r in rows[r%(PF_BLOCK+1)]
+  int first_row, n_rows;      // patch rows to filter
+  int first_band, n_bands;    // output bands of STEP lines to put together
+  float *out;                 // n_bands*STEP lines of filtered phase
+  int n_items;
+  gint next_item;
+} pf_block;
 
-left,right,top, and bottom are [dx,dy] complex input arrays.
-weight is [ox,oy] float input weighting array.
-outBuf is [ns,oy] float output phase array.
-*/
+typedef struct {
+  pf_block *block;
+  complexFloat *patch;
+} pf_thread;
 
-void blendHoriz(complex *left, complex *right, float *weight, float *outBuf)
+static gpointer read_block_thread(gpointer data)
 {
-  register int x,y;
-  register float blend_r,blend_i;
-  register float *out,*wL,*wR;
-  register complex *cL,*cR;
-  for (y=0; y<oy; y++) {
-    cL = &left [y*dx];
-    cR = &right[y*dx];
-    
-    wL = &weight[(oy-1)*ox+ox-1];
-    wR = &weight[(oy-1)*ox+0   ];
-    
-    out = &outBuf[y*ns];
-    for (x=0; x<ox; x++) {
-      blend_r = (*wL  ) * cL->r + (*wR  ) * cR->r;
-      blend_i = (*wL--) * cL->i + (*wR++) * cR->i;
-      *out++ = atan2(blend_i,blend_r);
-      cL++,cR++;
+  pf_reader *rd = data;
+  const pf_geometry *g = rd->g;
+  pf_input *in = rd->in;
+  int ii, x;
+
+  memset(in->cpx, 0, sizeof(complexFloat)*g->width*in->n_lines);
+  for (ii=0; ii<in->n_lines; ii++) {
+    int y = in->first + ii;
+    complexFloat *line = in->cpx + (size_t)ii*g->width + STEP;
+    if (y < 0 || y >= g->nl)
+      continue;
+    get_float_line(rd->fp, rd->meta, y, in->phase);
+    for (x=0; x<g->ns; x++) {
+      line[x].real = cos(in->phase[x]);
+      line[x].imag = sin(in->phase[x]);
     }
   }
+  return NULL;
 }
 
-void blendVert(complex *top, complex *bottom, float *weight, float *outBuf)
+static void filter_patch(pf_thread *t, int r, int c)
 {
-  register int x,y;
-  register float blend_r,blend_i;
-  register float *out,*wT,*wB;
-  register complex *cT,*cB;
-  for (y=0; y<oy; y++) {
-    cT = &top   [(y+oy)*dx];
-    cB = &bottom[     y*dx];
-    
-    wT = &weight[(oy-1-y)*ox +ox-1];
-    wB = &weight[       y*ox +ox-1];
-    
-    out = &outBuf[y*ns];
-    for (x=0; x<ox; x++) {
-      blend_r = (*wT) * cT->r + (*wB) * cB->r;
-      blend_i = (*wT) * cT->i + (*wB) * cB->i;
-      *out++ = atan2(blend_i,blend_r);
-      cT++,cB++;
+  const pf_geometry *g = t->block->g;
+  const pf_input *in = t->block->in;
+  complexFloat *p = t->patch;
+  complexFloat *dest;
+  int y0 = (r-1)*STEP - in->first;
+  int x, y;
+
+  // We operate on the square of the amplitude, hence the /2:
+  // fft *= pow(|fft|^2, (strength-1)/2) is fft *= |fft|^(strength-1)
+  float adjStrength = (g->strength - 1)/2;
+
+  for (y=0; y<PATCH; y++)
+    memcpy(p + y*PATCH, in->cpx + (size_t)(y0+y)*g->width + c*STEP,
+           sizeof(complexFloat)*PATCH);
+
+  fft_execute(g->forward, (float *) p);
+  for (x=0; x<PATCH*PATCH; x++) {
+    float pwr = p[x].real*p[x].real + p[x].imag*p[x].imag;
+    if (pwr > 0) {
+      float mul = pow(pwr, adjStrength);
+      p[x].real *= mul;
+      p[x].imag *= mul;
+    }
+  }
+  fft_execute(g->inverse, (float *) p);
+
+  dest = t->block->rows[r%(PF_BLOCK+1)].half[c%2] + c*STEP;
+  for (y=0; y<PATCH; y++) {
+    const complexFloat *src = p + y*PATCH;
+    complexFloat *d = dest + (size_t)y*g->width;
+    for (x=0; x<PATCH; x++) {
+      float w = g->window[y]*g->window[x];
+      d[x].real = w*src[x].real;
+      d[x].imag = w*src[x].imag;
     }
   }
 }
 
-/*******************************************************
-blendData:
-        A routine internal to las_filter.  Given two rows
-of chunks of data, blendData weights the two, converts
-to polar form, and fills the given output buffer.
+// Line i of band b: the lower halves of patch row b, the upper halves of
+// row b+1, both column parities.
+static void blend_line(pf_block *block, int line)
+{
+  const pf_geometry *g = block->g;
+  int b = block->first_band + line/STEP;
+  int i = line%STEP;
+  const pf_row *top = &block->rows[b%(PF_BLOCK+1)];
+  const pf_row *bottom = &block->rows[(b+1)%(PF_BLOCK+1)];
+  const complexFloat *t0 = top->half[0] + (size_t)(i+STEP)*g->width + STEP;
+  const complexFloat *t1 = top->half[1] + (size_t)(i+STEP)*g->width + STEP;
+  const complexFloat *b0 = bottom->half[0] + (size_t)i*g->width + STEP;
+  const complexFloat *b1 = bottom->half[1] + (size_t)i*g->width + STEP;
+  float *out = block->out + (size_t)line*g->ns;
+  int x;
 
-If last_chunks is NULL, this is the first line in the file.
-If chunks is NULL, this is the last line in the file.
+  for (x=0; x<g->ns; x++) {
+    float re = t0[x].real + t1[x].real + b0[x].real + b1[x].real;
+    float im = t0[x].imag + t1[x].imag + b0[x].imag + b1[x].imag;
+    out[x] = atan2(im, re);
+  }
+}
 
-Chunks,last_chunks: a [ns/ox] array of [dx,dy] complex chunks.
-weight: a [ox,oy] array of bilinear blending weights.  Strongest weight is at 0,0.
-outBuf: a [ns,oy] array of output floats.
-*/
-void blendData(complex **chunks,complex **last_chunks,
-	       float *weight,float *outBuf)
+static gpointer filter_thread_fn(gpointer data)
 {
-  int nChunkX=ns/ox-1;
-  int chunkX,x,y;
-  register float *wTL,*wTR,
-    *wBL,*wBR;
-  register complex *cTL,*cTR,
-    *cBL,*cBR;
-  register float *out,blend_r,blend_i;
-  /*Figure out the possibility we're dealing with:*/
-  if (chunks!=NULL && last_chunks!=NULL) {
-    /*Left border:top-to-bottom 2-way blend*/
-    chunkX=0;
-    blendVert(&last_chunks[chunkX][0], &chunks[chunkX][0],
-	      weight, &outBuf[chunkX*ox]);
-    
-    /*Interior lines: 4-way blend.*/
-    /*Blending:
-      last_chunks[chunkX-1] last_chunks[chunkX]
-      chunks[chunkX-1] chunks[chunkX]
-    */
-    for (chunkX=1; chunkX<nChunkX; chunkX++)
-      for (y=0; y<oy; y++) {
-	cTL = &last_chunks[chunkX-1][(y+oy)*dx    +ox];
-	cTR = &last_chunks[chunkX]  [(y+oy)*dx    +0];
-	cBL = &chunks[chunkX-1][y*dx+ox];
-	cBR = &chunks[chunkX]  [y*dx+0];
-	
-	wTL = &weight[(oy-1-y)*ox +ox-1];
-	wTR = &weight[(oy-1-y)*ox +0];
-	wBL = &weight[y*ox+ox-1];
-	wBR = &weight[y*ox+0];
-	
-	out = &outBuf[y*ns+chunkX*ox];
-	for (x=0; x<ox; x++) {
-	  blend_r = (*wTL  ) * cTL->r + (*wTR  ) * cTR->r +
-	    (*wBL  ) * cBL->r + (*wBR  ) * cBR->r;
-	  blend_i = (*wTL--) * cTL->i + (*wTR++) * cTR->i +
-	    (*wBL--) * cBL->i + (*wBR++) * cBR->i;
-	  *out++ = atan2(blend_i,blend_r);
-	  cTL++,cTR++,cBL++,cBR++;
-	}
-      }
-    
-    /*Right border: top-to-bottom 2-way blend*/
-    blendVert(&last_chunks[chunkX-1][ox], &chunks[chunkX-1][ox],
-	      weight, &outBuf[chunkX*ox]);
-  } 
-  else {
-    
-    if (chunks != NULL)
-      /*Top Border: left-to-right 2-way blend*/
-      for (chunkX=1; chunkX<nChunkX; chunkX++)
-	blendHoriz(&chunks[chunkX-1][ox], &chunks[chunkX][0],
-		   weight, &outBuf[chunkX*ox]);
-    
-    else if (last_chunks != NULL)
-      /*Bottom Border: left-to-right 2-way blend*/
-      for (chunkX=1; chunkX<nChunkX; chunkX++)
-	blendHoriz(&last_chunks[chunkX-1][oy*dx+ox], &last_chunks[chunkX][oy*dx+0],
-		   weight, &outBuf[chunkX*ox]);
-    
-    /*Now just copy over image corners.*/
-    for (y=0; y<oy; y++) {
-      if (chunks != NULL)/*Top line*/
-	cBL = &chunks[chunkX-1][y*dx+ox],
-	  cBR = &chunks[0]  [y*dx+0];
-      else /*Bottom line.*/
-	cBL = &last_chunks[chunkX-1][(y+oy)*dx    +ox],
-	  cBR = &last_chunks[0]  [(y+oy)*dx    +0];
-      out = &outBuf[y*ns+0*ox];
-      for (x=0; x<ox; x++) {
-	*out++ = atan2(cBR->i, cBR->r);
-	cBR++;
-      }
-      out = &outBuf[y*ns+nChunkX*ox];
-      for (x=0; x<ox; x++) {
-	*out++ = atan2(cBL->i, cBL->r);
-	cBL++;
-      }
-    }  
-  }
+  pf_thread *t = data;
+  pf_block *block = t->block;
+  int item;
+
+  while ((item = g_atomic_int_add(&block->next_item, 1)) < block->n_items)
+    filter_patch(t, block->first_row + item/block->g->n_cols,
+                 item%block->g->n_cols);
+  return NULL;
 }
 
-void image_filter(FILE *in, meta_parameters *meta,
-		  FILE *out, double strength);
+static gpointer blend_thread_fn(gpointer data)
+{
+  pf_thread *t = data;
+  pf_block *block = t->block;
+  int item;
+
+  while ((item = g_atomic_int_add(&block->next_item, 1)) < block->n_items)
+    blend_line(block, item);
+  return NULL;
+}
+
+static void run_threads(GThreadFunc func, pf_thread *workers, GThread **threads,
+                        int n_threads, int n_items)
+{
+  int tt;
+
+  workers[0].block->n_items = n_items;
+  workers[0].block->next_item = 0;
+  for (tt=1; tt<n_threads; tt++)
+    threads[tt] = g_thread_new("phase_filter", func, &workers[tt]);
+  func(&workers[0]);
+  for (tt=1; tt<n_threads; tt++)
+    g_thread_join(threads[tt]);
+}
 
-/* FIXME: result comes in short - calling the command line tool for the moment
 int phase_filter(char *inFile, double strength, char *outFile)
 {
   FILE *fpIn, *fpOut;
   meta_parameters *meta;
+  pf_geometry g;
+  pf_reader rd;
+  pf_input in[2];
+  pf_block block;
+  pf_thread *workers;
+  GThread **threads, *reader = NULL;
+  int ii, tt, n_threads, cur, max_lines, done;
 
-  // Open input files
-  fpIn = fopenImage(inFile, "rb");
-  fpOut = fopenImage(outFile, "wb");
   meta = meta_read(inFile);
-  
-  // Round up to find image size which is an even number of output chunks..
-  ns = (meta->general->sample_count+ox-1)/ox*ox;
-  nl = (meta->general->line_count+oy-1)/oy*oy;
-  asfPrintStatus("Output Size: %d samples by %d lines\n\n", ns, nl);
-  
-  // Set up output file
-  meta_write(meta, outFile);
-  
-  // Perform the filtering, write out
-  fft2dInit(dMy, dMx);
-  image_filter(fpIn, meta, fpOut, strength);
-  
-  return (0);
-}
-*/
+  if (meta->general->band_count != 1)
+    asfPrintError("Phase filtering needs a single band phase image, "
+                  "%s has %d bands\n", inFile, meta->general->band_count);
 
-/**************************************************
- read_image: reads the image file given by in & ddr
-into the (delX x delY) float array dest.  Reads pixels 
-into topleft corner of dest, starting
-at (startY , startX) in the input file.
-*/
-void read_image(FILE *in,meta_parameters *meta, float *dest, 
-		int startX,int startY,int delX,int delY)
-{
-  register int x,y,l;
-  int stopY=delY, stopX=delX;
-  if ((stopY+startY) > meta->general->line_count)
-    stopY = meta->general->line_count - startY;
-  if ((stopX+startX) > meta->general->sample_count)
-    stopX = meta->general->sample_count - startX;
-  /*Read portion of input image into topleft of dest array.*/
-  for (y=0; y<stopY; y++) {
-    l = ns*y;
-    get_float_line(in, meta, startY+y, &dest[l]);
-    for (x=stopX; x<delX; x++)
-      dest[l+x] = 0.0; /*Fill rest of line with zeros.*/
+  g.ns = meta->general->sample_count;
+  g.nl = meta->general->line_count;
+  g.n_cols = (g.ns + STEP-1)/STEP + 1;
+  g.n_rows = (g.nl + STEP-1)/STEP + 1;
+  g.width = (g.n_cols + 1)*STEP;
+  g.strength = strength;
+  for (ii=0; ii<PATCH; ii++) {
+    double s = sin(PI*(ii+0.5)/PATCH);
+    g.window[ii] = s*s;
   }
-  /*Fill remainder of array (bottom portion) with zero lines.*/
-  for (y=stopY; y<delY; y++) {
-    l = ns*y;
-    for (x=0; x<ns; x++)
-      dest[l+x] = 0.0; /*Fill rest of in2 with zeros.*/
-  }
-}
+  g.forward = fft_plan_2d(FFT_COMPLEX, FFT_FORWARD, PATCH, PATCH);
+  g.inverse = fft_plan_2d(FFT_COMPLEX, FFT_INVERSE, PATCH, PATCH);
 
-/*******************************************
-Phase_filter:
-	Performs goldstein phase filtering on the given
-dx x dy buffer of complex data.
-
-Goldstein phase filtering consists of:
-fft; exponentiate amplitude of fft'd data; ifft
-Where the exponential applied (strength) is typically
-between 1.2 and 1.7.  Larger strengths filter noise
-better, but eliminate more good information, too.
-Huge scalings, like 2.0 or 3.0, result in very geometric-
-looking phase.
-*/
+  // A block of patch rows needs one more STEP of lines than it has rows
+  max_lines = (PF_BLOCK+1)*STEP;
+  for (ii=0; ii<2; ii++) {
+    in[ii].cpx =
+      (complexFloat *) MALLOC(sizeof(complexFloat)*g.width*max_lines);
+    in[ii].phase = (float *) MALLOC(sizeof(float)*g.ns);
+  }
+  block.g = &g;
+  block.rows = (pf_row *) MALLOC(sizeof(pf_row)*(PF_BLOCK+1));
+  for (ii=0; ii<PF_BLOCK+1; ii++) {
+    block.rows[ii].half[0] =
+      (complexFloat *) CALLOC(g.width*PATCH, sizeof(complexFloat));
+    block.rows[ii].half[1] =
+      (complexFloat *) CALLOC(g.width*PATCH, sizeof(complexFloat));
+  }
+  block.out = (float *) MALLOC(sizeof(float)*g.ns*PF_BLOCK*STEP);
 
-void phase_filter_func(complex *buf,float strength)
-{
-  register int x,y;
-  
-  /*We must adjust the scaling for two reasons:
-    -The complex buffer is not normalized (strength-1)
-    -We operate on the square of the amplitude (/2)
-    Hence,
-    fft*=pow(fft.r^2+fft.i^2,adjScale);
-    is equivalent to
-    amp=sqrt(fft.r^2+fft.i^2);fft/=amp;fft*=pow(amp,strength);
-  */
-  float adjStrength=(strength-1)/2;
-  
-  /*fft buf*/
-  fft2d((float *)buf,dMy,dMx);	
-  
-  /*Manipulate power spectrum.*/
-  for (y=0; y<dy; y++) {
-    register complex *fft = &buf[y*dx];
-    for (x=0; x<dx; x++) {
-      float mul = pow(fft->r*fft->r+fft->i*fft->i, adjStrength);
-      fft->r *= mul;
-      fft->i *= mul;
-      fft++;
-    }
+  n_threads = MAX(1, MIN((int)g_get_num_processors(), PF_BLOCK*g.n_cols));
+  workers = (pf_thread *) MALLOC(sizeof(pf_thread)*n_threads);
+  threads = (GThread **) MALLOC(sizeof(GThread *)*n_threads);
+  for (tt=0; tt<n_threads; tt++) {
+    workers[tt].block = &block;
+    workers[tt].patch =
+      (complexFloat *) MALLOC(sizeof(complexFloat)*PATCH*PATCH);
   }
-	
-  /*ifft buf*/
-  ifft2d((float *)buf, dMy, dMx);
-}
 
-/************************************************************
-image_filter: 
-	Applies the goldstein phase filter across an entire
-image, and writes the result to another image.
-
-	The goldstein phase filter works best when applied
-to little pieces of the image.  But processing the image as
-a bunch of little pieces results in a segmented phase image.
-Hence we do a bilinear weighting of 4 overlapping filters 
-to "feather" the edges.
-*/
+  fpIn = fopenImage(inFile, "rb");
+  meta_write(meta, outFile);
+  fpOut = fopenImage(outFile, "wb");
+  rd.fp = fpIn;
+  rd.meta = meta;
+  rd.g = &g;
 
-void image_filter(FILE *in, meta_parameters *meta,
-		  FILE *out, double strength)
-{
-  int chunkX,chunkY,nChunkX,nChunkY;
-  int i,x,y;
-  float *inBuf, *outBuf, *weight;
-  complex **chunks, **last_chunks=NULL;
-  
-  /*Allocate polar to complex conversion array*/
-#define NUM_PHASE 512
-#define phase2cpx(ph) p2c[(int)((ph)*polarCvrt)&(NUM_PHASE-1)]
-  complex *p2c;
-  float polarCvrt = NUM_PHASE/(2*PI);
-  p2c = (complex *) MALLOC(sizeof(complex)*NUM_PHASE);
-  for (i=0; i<NUM_PHASE; i++) {
-      float phase = i*2*PI/NUM_PHASE;
-      p2c[i].r = cos(phase);
-      p2c[i].i = sin(phase);
-  }
-  
-  /*Allocate bilinear weighting array.*/
-  weight = (float *)MALLOC(sizeof(float)*ox*oy);
-  for (y=0; y<oy; y++)
-    for (x=0;x<ox;x++)
-      weight[y*ox+x] = (float)x/(ox-1)*(float)y/(oy-1);
-  
-  /*Allocate storage arrays.*/
-  nChunkX = ns/ox-1;
-  nChunkY = nl/oy-1;
-  outBuf = inBuf = (float *)MALLOC(sizeof(float)*ns*dy);
-#define newChunkArray(name) name=(complex **)MALLOC(sizeof(complex **)*nChunkX); \
-			for (chunkX=0;chunkX<nChunkX;chunkX++) \
-				name[chunkX]=(complex *)MALLOC(sizeof(complex)*dx*dy);
-  newChunkArray(chunks);
-  
-  /*Loop across each chunk in file.
-    printf("Filtering phase in %d x %d blocks...\n",dx,dy);
-    printf("Output phase in %d x %d blocks...\n",ox,oy);*/
-  for (chunkY=0; chunkY<nChunkY; chunkY++) {
-
-    asfLineMeter(chunkY, nChunkY);
-    
-    /*Read next chunk of input.*/
-    read_image(in, meta, inBuf, 0, chunkY*ox, ns, dy);
-    
-    /*Convert polar image to complex chunk.*/
-    for (chunkX=0; chunkX<nChunkX; chunkX++) {
-	register float *in;
-	register complex *out;
-	for (y=0; y<dy; y++) {
-	  in = &inBuf[y*ns+chunkX*ox];
-	  out = &chunks[chunkX][y*dx];
-	  for (x=0;x<dx;x++)
-	    *out++=phase2cpx(*in++);
-	}
+  asfPrintStatus("   Goldstein phase filter, strength %.2f, %dx%d patches\n\n",
+                 strength, PATCH, PATCH);
+
+  in[0].first = -STEP;
+  in[0].n_lines = MIN(max_lines, (g.n_rows+1)*STEP);
+  rd.in = &in[0];
+  read_block_thread(&rd);
+
+  // Patch rows [first_row, first_row+n_rows) are filtered in each block;
+  // band b (lines b*STEP..b*STEP+STEP-1) is done once rows b and b+1 are.
+  done = 0;
+  for (block.first_row=0, cur=0; block.first_row<g.n_rows;
+       block.first_row+=PF_BLOCK, cur=1-cur)
+  {
+    int next = block.first_row + PF_BLOCK;
+
+    if (reader) g_thread_join(reader);
+    reader = NULL;
+    if (next < g.n_rows) {
+      in[1-cur].first = (next-1)*STEP;
+      in[1-cur].n_lines = MIN(max_lines, (g.n_rows-next+1)*STEP);
+      rd.in = &in[1-cur];
+      reader = g_thread_new("phase_filter", read_block_thread, &rd);
     }
-    
-    /*Filter each newly-read chunk.*/
-    for (chunkX=0; chunkX<nChunkX; chunkX++)
-      phase_filter_func(chunks[chunkX], strength);
-	
-    /*Blend and write out filtered data.*/
-    blendData(chunks, last_chunks, weight, outBuf);
-    for (y=0; y<oy; y++) {
-      if (chunkY*oy+y < meta->general->line_count)
-	put_float_line(out, meta, chunkY*oy+y, &outBuf[y*ns]);
+
+    block.in = &in[cur];
+    block.n_rows = MIN(PF_BLOCK, g.n_rows - block.first_row);
+    run_threads(filter_thread_fn, workers, threads, n_threads,
+                block.n_rows*g.n_cols);
+
+    block.first_band = done;
+    block.n_bands = block.first_row + block.n_rows - 1 - done;
+    if (block.n_bands > 0) {
+      int first_line = block.first_band*STEP;
+      int n_lines = MIN(block.n_bands*STEP, g.nl - first_line);
+      run_threads(blend_thread_fn, workers, threads, n_threads, n_lines);
+      put_float_lines(fpOut, meta, first_line, n_lines, block.out);
+      done += block.n_bands;
+      asfPercentMeter((double)(first_line + n_lines)/g.nl);
     }
-		
-    /*Swap chunks and last_chunks.*/
-    {complex **tmp=last_chunks;last_chunks=chunks;chunks=tmp;}
-    if (chunks == NULL) { newChunkArray(chunks); }
   }
-  
-  /*Write very last line of phase.*/
-  blendData(NULL, last_chunks, weight, outBuf);
-  for (y=0; y<oy; y++)
-    if (chunkY*oy+y < meta->general->line_count)
-      put_float_line(out, meta, chunkY*oy+y, &outBuf[y*ns]);
-  
-}
+  if (reader) g_thread_join(reader);
 
-/* FIXME: does not perform properly - call command line and clean up after
-          course.
-int zeroify(char *inFile, char *testFile, char *outFile)
-{
-  float *buf, *testbuf;
-  FILE *fpOut, *fpIn, *fpTest;
-  meta_parameters *metaIn, *metaTest;
-  int x, y;
-  int line_count, sample_count;
-    
-  // Open output files
-  fpIn = fopenImage(inFile, "rb");
-  fpTest = fopenImage(testFile, "rb");
-  fpOut = fopenImage(outFile, "wb");
-  
-  // Read and copy over DDR
-  metaIn = meta_read(inFile);
-  metaTest = meta_read(testFile);
-  meta_write(metaIn, outFile);
-  
-  // Allocate buffers
-  buf = (float *) MALLOC(sizeof(float)*metaIn->general->sample_count);
-  testbuf = (float *) MALLOC(sizeof(float)*metaTest->general->sample_count);
-  
-  // Copy over each line of input to the output
-  line_count = metaIn->general->line_count;
-  sample_count = metaIn->general->sample_count;
-  for (y=0; y<line_count; y++) {
-    get_float_line(fpIn, metaIn, y, buf);
-    get_float_line(fpTest, metaTest, y, testbuf);
-    for (x=0; x<sample_count; x++)
-      if (testbuf[x] == 0)
-	buf[x] = 0;
-    put_float_line(fpOut, metaIn, y ,buf);
+  FCLOSE(fpIn);
+  FCLOSE(fpOut);
+  for (ii=0; ii<2; ii++) {
+    FREE(in[ii].cpx);
+    FREE(in[ii].phase);
+  }
+  for (ii=0; ii<PF_BLOCK+1; ii++) {
+    FREE(block.rows[ii].half[0]);
+    FREE(block.rows[ii].half[1]);
   }
+  FREE(block.rows);
+  FREE(block.out);
+  for (tt=0; tt<n_threads; tt++)
+    FREE(workers[tt].patch);
+  FREE(workers);
+  FREE(threads);
+  meta_free(meta);
 
-  return 0;
+  return (0);
 }
-*/
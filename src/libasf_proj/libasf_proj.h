@@ -651,6 +651,41 @@ int project_pseudo_arr_inv (project_parameters_t *pps, double *x, double *y,
                             double *z, double **lat, double **lon,
                             double **height, long length, datum_type_t datum);
 
+/****************************************************************************
+  Projection contexts
+
+  A projection context holds the libproj setup for one map projection,
+  so that many batches of points can be transformed to and from it
+  without parsing the projection description each time.  The project_*
+  functions above keep the same setup in a cache behind the scenes,
+  but still have to format and look up the description on every call,
+  so code which transforms points one row at a time should use a
+  context instead.
+
+  lat, lon are in radians, as for the project_* functions.  height
+  (or z) may be NULL, in which case the average height is used (see
+  project_set_avg_height), and NULL may be passed for z (or height) if
+  the output heights aren't wanted.  The output arrays must be
+  allocated by the caller and may not overlap the inputs.
+
+  Returns TRUE if all the points were transformed ok.  Like libproj
+  itself, contexts are not thread safe.
+****************************************************************************/
+typedef struct proj_context proj_context_t;
+
+proj_context_t *proj_context_new(projection_type_t projection_type,
+                                 project_parameters_t *pps,
+                                 datum_type_t datum);
+void proj_context_free(proj_context_t *ctx);
+
+int proj_context_forward(proj_context_t *ctx, long length,
+                         const double *lat, const double *lon,
+                         const double *height,
+                         double *x, double *y, double *z);
+int proj_context_inverse(proj_context_t *ctx, long length,
+                         const double *x, const double *y, const double *z,
+                         double *lat, double *lon, double *height);
+
 int utm_zone(double lon);
 int test_nad27(double lat, double lon);
 
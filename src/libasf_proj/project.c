@@ -6,6 +6,8 @@
 #include <assert.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 
 #include "proj_api.h"
 #include "spheroids.h"
@@ -84,18 +86,130 @@ static const char * datum_str(datum_type_t datum)
     }
 }
 
+/****************************************************************************
+ libproj handle cache
+
+ Setting up a libproj handle means parsing the projection description
+ and looking up the ellipsoid, datum and (for NAD27) grid shift files,
+ which costs far more than transforming a point.  The handles are kept
+ here keyed by their description, which includes the datum, so each
+ distinct projection is only set up once while it stays in use.
+ Every get_projection is matched by a release_projection, and entries
+ that are in use (by a projection context, say) are never evicted.
+ When the cache is full, the least recently used entry that is not in
+ use makes room; if every entry is in use the caller gets a handle of
+ its own which is freed after use, as before.
+
+ The cache is shared by all threads and guarded by pj_cache_lock.  It
+ doesn't make libproj itself any safer: pj_errno is still a global.
+****************************************************************************/
+
+#define PJ_CACHE_SIZE 16
+
+static struct {
+  char *description;
+  projPJ pj;
+  int users;                  // gets not yet released
+  unsigned long last_used;    // pj_cache_clock at the last get
+} pj_cache[PJ_CACHE_SIZE];
+static int pj_cache_count = 0;
+static unsigned long pj_cache_clock = 0;
+static pthread_mutex_t pj_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Return a handle for projection_description, or NULL if libproj
+// can't make sense of it.  The handle must be given back with
+// release_projection, passing the *cached flag along.
+static projPJ get_projection(const char *projection_description,
+                             int *cached)
+{
+  int i, victim = -1;
+  projPJ pj;
+
+  pthread_mutex_lock(&pj_cache_lock);
+  for (i = 0; i < pj_cache_count; ++i) {
+    if (strcmp(pj_cache[i].description, projection_description) == 0) {
+      ++pj_cache[i].users;
+      pj_cache[i].last_used = ++pj_cache_clock;
+      pthread_mutex_unlock(&pj_cache_lock);
+      *cached = TRUE;
+      return pj_cache[i].pj;
+    }
+  }
+
+  // Set up the new handle under the lock too, so that two threads
+  // asking for the same projection don't both add it.
+  pj = pj_init_plus(projection_description);
+  if (pj == NULL) {
+    pthread_mutex_unlock(&pj_cache_lock);
+    *cached = FALSE;
+    return NULL;
+  }
+
+  if (pj_cache_count < PJ_CACHE_SIZE) {
+    victim = pj_cache_count++;
+  }
+  else {
+    for (i = 0; i < PJ_CACHE_SIZE; ++i)
+      if (pj_cache[i].users == 0 &&
+          (victim < 0 || pj_cache[i].last_used < pj_cache[victim].last_used))
+        victim = i;
+    if (victim >= 0) {
+      pj_free(pj_cache[victim].pj);
+      FREE(pj_cache[victim].description);
+    }
+  }
+
+  if (victim >= 0) {
+    pj_cache[victim].description = STRDUP(projection_description);
+    pj_cache[victim].pj = pj;
+    pj_cache[victim].users = 1;
+    pj_cache[victim].last_used = ++pj_cache_clock;
+    *cached = TRUE;
+  }
+  else {
+    *cached = FALSE;
+  }
+  pthread_mutex_unlock(&pj_cache_lock);
+
+  return pj;
+}
+
+static void release_projection(projPJ pj, int cached)
+{
+  int i;
+
+  if (!pj)
+    return;
+  if (!cached) {
+    pj_free(pj);
+    return;
+  }
+
+  pthread_mutex_lock(&pj_cache_lock);
+  for (i = 0; i < pj_cache_count; ++i) {
+    if (pj_cache[i].pj == pj) {
+      assert(pj_cache[i].users > 0);
+      --pj_cache[i].users;
+      break;
+    }
+  }
+  assert(i < pj_cache_count);
+  pthread_mutex_unlock(&pj_cache_lock);
+}
+
 // Returns TRUE if we have grid shift files available for the given point,
 // and returns FALSE if not.  If this returns FALSE for any point in a
 // scene, the NAD27 datum shouldn't be used.
 int test_nad27(double lat, double lon)
 {
     projPJ ll_proj, utm_proj;
-    ll_proj = pj_init_plus(latlon_description);
+    int ll_cached, utm_cached;
+    ll_proj = get_projection(latlon_description, &ll_cached);
 
     char desc[255];
     int zone = utm_zone(lon);
     sprintf(desc, "+proj=utm +zone=%d +datum=NAD27", zone);
-    utm_proj = pj_init_plus(desc);
+    utm_proj = get_projection(desc, &utm_cached);
 /*
     double *px, *py, *pz;
     px = MALLOC(sizeof(double));
@@ -107,21 +221,21 @@ int test_nad27(double lat, double lon)
     px[0] = lon*D2R;
     pz[0] = 0;
 
-    pj_transform (ll_proj, utm_proj, 1, 1, px, py, pz);
+    int err = pj_transform (ll_proj, utm_proj, 1, 1, px, py, pz);
 
     int ret = TRUE;
-    if (pj_errno == -38) // -38 indicates error with the grid shift files
+    if (err == -38) // -38 indicates error with the grid shift files
     {
         ret = FALSE;
     }
-    else if (pj_errno != 0) // some other error (pj errors are negative,
-    {                       // system errors are positive)
+    else if (err != 0) // some other error (pj errors are negative,
+    {                  // system errors are positive)
         asfPrintError("libproj Error: %s (test_nad27)\n", 
-		      pj_strerrno(pj_errno));
+		      pj_strerrno(err));
     }
 
-    pj_free(ll_proj);
-    pj_free(utm_proj);
+    release_projection(ll_proj, ll_cached);
+    release_projection(utm_proj, utm_cached);
 
     return ret;
 }
@@ -151,6 +265,7 @@ static int project_worker_arr(const char * projection_description,
                               double **projected_z, long length)
 {
   projPJ geographic_projection, output_projection;
+  int geographic_cached, output_cached;
   int i, ok = TRUE;
 
   // This section is a bit confusing.  The interfaces to the single
@@ -246,9 +361,10 @@ static int project_worker_arr(const char * projection_description,
   //printf("proj: +from %s +to %s\n",
   //       latlon_description, projection_description);
 
-  geographic_projection = pj_init_plus (latlon_description);
+  geographic_projection = get_projection (latlon_description,
+                                          &geographic_cached);
 
-  if (pj_errno != 0)
+  if (geographic_projection == NULL)
   {
       asfPrintError("libproj Error: %s (initializing geographic projection)\n",
 		    pj_strerrno(pj_errno));
@@ -257,11 +373,10 @@ static int project_worker_arr(const char * projection_description,
 
   if (ok)
   {
-      assert (geographic_projection != NULL);
-
-      output_projection = pj_init_plus (projection_description);
+      output_projection = get_projection (projection_description,
+                                          &output_cached);
 
-      if (pj_errno != 0)
+      if (output_projection == NULL)
       {
 	printf("proj: %s\n", projection_description);
     asfPrintError("libproj Error: %s (initializing output projection)\n", 
@@ -271,22 +386,20 @@ static int project_worker_arr(const char * projection_description,
 
       if (ok)
       {
-    assert (output_projection != NULL);
+    int err = pj_transform (geographic_projection, output_projection,
+                            length, 1, px, py, pz);
 
-    pj_transform (geographic_projection, output_projection, length, 1,
-      px, py, pz);
-
-    if (pj_errno != 0)
+    if (err != 0)
     {
         asfPrintWarning("libproj error: %s (projection transformation)\n", 
-			pj_strerrno(pj_errno));
+			pj_strerrno(err));
         ok = FALSE;
     }
 
-    pj_free(output_projection);
+    release_projection(output_projection, output_cached);
       }
 
-      pj_free(geographic_projection);
+      release_projection(geographic_projection, geographic_cached);
   }
 
   // Free memory temporarily allocated for height values that we don't
@@ -308,6 +421,7 @@ project_worker_arr_inv(const char * projection_description,
                        long length)
 {
   projPJ geographic_projection, output_projection;
+  int geographic_cached, output_cached;
   int i, ok = TRUE;
 
   // Same issue here as above.  Because both single and array
@@ -396,9 +510,10 @@ project_worker_arr_inv(const char * projection_description,
   //printf("proj: +from %s +to %s\n",
   //       projection_description, latlon_description);
 
-  geographic_projection = pj_init_plus ( latlon_description );
+  geographic_projection = get_projection (latlon_description,
+                                          &geographic_cached);
 
-  if (pj_errno != 0)
+  if (geographic_projection == NULL)
   {
       asfPrintError("libproj Error: %s (initializing inverse geographic "
 		    "projection)\n", pj_strerrno(pj_errno));
@@ -407,11 +522,10 @@ project_worker_arr_inv(const char * projection_description,
 
   if (ok)
   {
-      assert (geographic_projection != NULL);
-
-      output_projection = pj_init_plus (projection_description);
+      output_projection = get_projection (projection_description,
+                                          &output_cached);
 
-      if (pj_errno != 0)
+      if (output_projection == NULL)
       {
     asfPrintError("libproj Error: %s\n (initializing inverse output "
 		  "projection)\n", pj_strerrno(pj_errno));
@@ -420,22 +534,20 @@ project_worker_arr_inv(const char * projection_description,
 
       if (ok)
       {
-    assert (output_projection != NULL);
+    int err = pj_transform (output_projection, geographic_projection,
+                            length, 1, plon, plat, pheight);
 
-    pj_transform (output_projection, geographic_projection, length, 1,
-      plon, plat, pheight);
-
-    if (pj_errno != 0)
+    if (err != 0)
     {
         asfPrintWarning("libproj error: %s (inverse projection transformation)"
-			"\n", pj_strerrno(pj_errno));
+			"\n", pj_strerrno(err));
         ok = FALSE;
     }
 
-    pj_free(output_projection);
+    release_projection(output_projection, output_cached);
       }
 
-      pj_free(geographic_projection);
+      release_projection(geographic_projection, geographic_cached);
   }
 
   // Free memory temporarily allocated for height values that we don't
@@ -1294,6 +1406,146 @@ int project_pseudo_arr_inv (project_parameters_t *pps, double *x, double *y,
         x, y, z, lat, lon, height, length);
 }
 
+/******************************************************************************
+  Projection contexts
+******************************************************************************/
+
+struct proj_context {
+  projPJ geographic_projection;
+  projPJ output_projection;
+  int geographic_cached;
+  int output_cached;
+};
+
+// Description of projection type with parameters pps and datum, or
+// NULL if libproj doesn't do that type for us.
+static const char *projection_description(projection_type_t projection_type,
+                                          project_parameters_t *pps,
+                                          datum_type_t datum)
+{
+  switch (projection_type) {
+    case UNIVERSAL_TRANSVERSE_MERCATOR:
+      return utm_projection_description(pps, datum);
+    case POLAR_STEREOGRAPHIC:
+      return ps_projection_desc(pps, datum);
+    case ALBERS_EQUAL_AREA:
+      return albers_projection_desc(pps, datum);
+    case LAMBERT_CONFORMAL_CONIC:
+      return lamcc_projection_desc(pps, datum);
+    case LAMBERT_AZIMUTHAL_EQUAL_AREA:
+      return lamaz_projection_desc(pps, datum);
+    case MERCATOR:
+      return mer_projection_desc(pps, datum);
+    case EQUI_RECTANGULAR:
+      return eqr_projection_desc(pps, datum);
+    case EQUIDISTANT:
+      return eqc_projection_desc(pps, datum);
+    case SINUSOIDAL:
+      return sin_projection_desc(pps);
+    case EASE_GRID_GLOBAL:
+      return ease_global_projection_desc(pps);
+    case LAT_LONG_PSEUDO_PROJECTION:
+      return pseudo_projection_description(datum);
+    default:
+      return NULL;
+  }
+}
+
+proj_context_t *proj_context_new(projection_type_t projection_type,
+                                 project_parameters_t *pps,
+                                 datum_type_t datum)
+{
+  const char *description =
+    projection_description(projection_type, pps, datum);
+  if (!description)
+    asfPrintError("Projection type %s is not supported by "
+                  "proj_context_new.\n", proj2str(projection_type));
+
+  proj_context_t *ctx = (proj_context_t *) MALLOC(sizeof(proj_context_t));
+
+  ctx->geographic_projection =
+    get_projection(latlon_description, &ctx->geographic_cached);
+  if (!ctx->geographic_projection)
+    asfPrintError("libproj Error: %s (initializing geographic projection)\n",
+                  pj_strerrno(pj_errno));
+
+  ctx->output_projection =
+    get_projection(description, &ctx->output_cached);
+  if (!ctx->output_projection)
+    asfPrintError("libproj Error: %s (initializing output projection %s)\n",
+                  pj_strerrno(pj_errno), description);
+
+  return ctx;
+}
+
+void proj_context_free(proj_context_t *ctx)
+{
+  if (ctx) {
+    release_projection(ctx->output_projection, ctx->output_cached);
+    release_projection(ctx->geographic_projection, ctx->geographic_cached);
+    FREE(ctx);
+  }
+}
+
+// Transform length points from src to dst.  The inputs are copied to
+// the outputs, which libproj then transforms in place.  When no
+// heights are wanted the average height is used, in scratch space.
+static int context_transform(projPJ src, projPJ dst, long length,
+                             const double *a, const double *b,
+                             const double *c, double *pa, double *pb,
+                             double *pc)
+{
+  double scratch[64];
+  double *heights = pc;
+  long i;
+
+  if (!heights) {
+    if (length <= (long) (sizeof(scratch) / sizeof(scratch[0])))
+      heights = scratch;
+    else
+      heights = (double *) MALLOC(sizeof(double) * length);
+  }
+
+  double default_height = height_was_set() ? get_avg_height() : 0.0;
+  for (i = 0; i < length; ++i) {
+    pa[i] = a[i];
+    pb[i] = b[i];
+    heights[i] = c ? c[i] : default_height;
+  }
+
+  int err = pj_transform(src, dst, length, 1, pa, pb, heights);
+
+  if (heights != pc && heights != scratch)
+    FREE(heights);
+
+  if (err != 0) {
+    asfPrintWarning("libproj error: %s (projection transformation)\n",
+                    pj_strerrno(err));
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+int proj_context_forward(proj_context_t *ctx, long length,
+                         const double *lat, const double *lon,
+                         const double *height,
+                         double *x, double *y, double *z)
+{
+  return context_transform(ctx->geographic_projection,
+                           ctx->output_projection, length,
+                           lon, lat, height, x, y, z);
+}
+
+int proj_context_inverse(proj_context_t *ctx, long length,
+                         const double *x, const double *y, const double *z,
+                         double *lat, double *lon, double *height)
+{
+  return context_transform(ctx->output_projection,
+                           ctx->geographic_projection, length,
+                           x, y, z, lon, lat, height);
+}
+
 // a generally useful function
 int utm_zone(double lon)
 {
@@ -7,6 +7,7 @@
 #include <sys/time.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define DEG_TO_RAD 0.0174532925199432958
 
@@ -972,6 +973,79 @@ void perf_test_ps()
     free(x);
 }
 
+/******************************************************* libproj handle cache */
+#define CACHE_TEST_ZONES 40
+#define CACHE_TEST_CONTEXTS 20
+
+static void utm_at_zone(int zone, double *x, double *y)
+{
+    project_parameters_t pps;
+    double z;
+
+    memset(&pps, 0, sizeof(pps));
+    pps.utm.zone = zone;
+    pps.utm.lon0 = (zone*6 - 183) * DEG_TO_RAD;
+    project_utm(&pps, 45*DEG_TO_RAD, pps.utm.lon0 + DEG_TO_RAD, 0,
+                x, y, &z, datum);
+}
+
+/* There are more zones here than the handle cache has room for, so
+   handles get evicted and set up again; while the contexts are open
+   the cache is full of handles in use, and project_utm gets handles
+   that aren't cached at all.  It must make no difference. */
+void test_proj_cache()
+{
+    double x0[CACHE_TEST_ZONES], y0[CACHE_TEST_ZONES];
+    double cx[CACHE_TEST_CONTEXTS], cy[CACHE_TEST_CONTEXTS];
+    proj_context_t *ctx[CACHE_TEST_CONTEXTS];
+    char name[256];
+    double x, y;
+    int i, pass;
+
+    for (i = 0; i < CACHE_TEST_ZONES; ++i)
+        utm_at_zone(i+1, &x0[i], &y0[i]);
+
+    for (pass = 0; pass < 2; ++pass)
+    {
+        if (pass == 1)
+        {
+            for (i = 0; i < CACHE_TEST_CONTEXTS; ++i)
+            {
+                project_parameters_t pps;
+                double lat = 45*DEG_TO_RAD, lon;
+
+                memset(&pps, 0, sizeof(pps));
+                pps.utm.zone = CACHE_TEST_ZONES + 1 + i;
+                pps.utm.lon0 = (pps.utm.zone*6 - 183) * DEG_TO_RAD;
+                lon = pps.utm.lon0 + DEG_TO_RAD;
+                ctx[i] = proj_context_new(UNIVERSAL_TRANSVERSE_MERCATOR,
+                                          &pps, datum);
+                proj_context_forward(ctx[i], 1, &lat, &lon, NULL,
+                                     &cx[i], &cy[i], NULL);
+            }
+        }
+
+        for (i = CACHE_TEST_ZONES-1; i >= 0; --i)
+        {
+            utm_at_zone(i+1, &x, &y);
+            sprintf(name, "project_utm, zone %d, %s", i+1,
+                    pass == 0 ? "cache reused" : "cache full");
+            CU_ASSERT(x == x0[i] && y == y0[i]);
+            check(name, x, y, x0[i], y0[i]);
+        }
+    }
+
+    for (i = 0; i < CACHE_TEST_CONTEXTS; ++i)
+    {
+        proj_context_free(ctx[i]);
+        utm_at_zone(CACHE_TEST_ZONES + 1 + i, &x, &y);
+        sprintf(name, "proj_context_forward, zone %d",
+                CACHE_TEST_ZONES + 1 + i);
+        CU_ASSERT(x == cx[i] && y == cy[i]);
+        check(name, cx[i], cy[i], x, y);
+    }
+}
+
 void test_project()
 {
     test_poly();
@@ -985,6 +1059,8 @@ void test_project()
 
     test_random_all();
 
+    test_proj_cache();
+
     if (nfail > 0)
 	printf("%d ok, %d failures.\n", nok, nfail);
 }
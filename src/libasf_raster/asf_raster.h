@@ -145,6 +145,13 @@ float kernel(filter_type_t filter_type, float *inbuf, int nLines, int nSamples,
 	     int nLooks);
 void kernel_filter(char *inFile, char *outFile, filter_type_t filter, 
 		   int kernel_size, float damping, int nLooks);
+/* Filter nLines lines held in memory.  inbuf has nLines+kernel_size-1
+   lines of nSamples, from kernel_size/2 lines above the first output
+   line; the first and last kernel_size/2 samples of each output line
+   are set to 0, as kernel_filter does. */
+void kernel_filter_lines(filter_type_t filter, const float *inbuf,
+                         int nLines, int nSamples, float *outbuf,
+                         int kernel_size, float damping, int nLooks);
 
 /* Prototypes from interpolate.c *********************************************/
 float interpolate(interpolate_type_t interpolation, FloatImage *inbuf, float yLine,
@@ -167,9 +174,31 @@ void subset_by_map(char *infile, char *outfile, double minX, double maxX,
 void clip_to_polygon(char *inFile, char *outFile, double *lat, double *lon, 
   int *start, int nParts, int nVertices);
 
+// Prototypes from image_buffer.c
+typedef struct {
+  int ns, nl, nb;
+  float *data;        // all bands, or NULL when spilled to disk
+  FILE *spill;
+  char *spill_file;
+} image_buffer;
+image_buffer *image_buffer_new(int ns, int nl, int nb);
+void image_buffer_free(image_buffer *b);
+int image_buffer_in_memory(const image_buffer *b);
+void image_buffer_put_line(image_buffer *b, int band, int line,
+                           const float *buf);
+void image_buffer_get_line(image_buffer *b, int band, int line, float *buf);
+void image_buffer_data_extent(image_buffer *b, int band, int *startX,
+                              int *endX);
+void image_buffer_store(image_buffer *b, int startX, meta_parameters *meta,
+                        const char *outFile);
+
 // Prototypes from raster_calc.c
 int raster_calc(char *outFile, char *expression, int input_count, 
 		char **inFiles);
+// Pixels where any input used is "nodata" are nodata in the output too;
+// NAN for no mask, as raster_calc() does.
+int raster_calc_ext(char *outFile, char *expression, int input_count,
+                    char **inFiles, double nodata);
 
 /* Prototypes from fftMatch.c ************************************************/
 int fftMatch(char *inFile1, char *inFile2, char *corrFile,
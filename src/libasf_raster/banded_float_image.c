@@ -89,6 +89,24 @@ banded_float_image_set_pixel(BandedFloatImage *self, int nband,
     float_image_set_pixel(self->images[nband], x, y, value);
 }
 
+void
+banded_float_image_get_row(BandedFloatImage *self, int nband,
+                           size_t row, float *buffer)
+{
+    assert(nband < self->nbands);
+    banded_image_self_test(self);
+    float_image_get_row(self->images[nband], row, buffer);
+}
+
+void
+banded_float_image_set_row(BandedFloatImage *self, int nband,
+                           size_t row, float *buffer)
+{
+    assert(nband < self->nbands);
+    banded_image_self_test(self);
+    float_image_set_row(self->images[nband], row, buffer);
+}
+
 FloatImage *
 banded_float_image_get_band(BandedFloatImage *self, int nband)
 {
@@ -38,6 +38,14 @@ void
 banded_float_image_set_pixel(BandedFloatImage *self, int nband, 
                              ssize_t x, ssize_t y, float value);
 
+void
+banded_float_image_get_row(BandedFloatImage *self, int nband,
+                           size_t row, float *buffer);
+
+void
+banded_float_image_set_row(BandedFloatImage *self, int nband,
+                           size_t row, float *buffer);
+
 FloatImage *
 banded_float_image_get_band(BandedFloatImage *self, int nband);
 
@@ -0,0 +1,372 @@
+#include "asf.h"
+#include "asf_nan.h"
+#include "asf_raster.h"
+#include "expression.h"
+#include <assert.h>
+
+// Compiled expressions.  The postfix cookie from expression2cookie is
+// turned into a tree, constant subtrees are folded, and what is left is
+// laid out as a short list of instructions over registers of
+// EXPR_BLOCK floats.  Evaluating runs each instruction over a whole
+// block of pixels, so the per-pixel work is one tight loop per
+// operator instead of a function pointer call per token.
+
+typedef enum {
+  EXPR_CONST, EXPR_VAR, EXPR_X, EXPR_Y,
+  EXPR_ADD, EXPR_SUB, EXPR_MUL, EXPR_DIV, EXPR_MOD, EXPR_POW
+} expr_op;
+
+typedef struct expr_node {
+  expr_op op;
+  double val;                 // EXPR_CONST
+  int var;                    // EXPR_VAR
+  struct expr_node *a, *b;    // operators
+} expr_node;
+
+// Where an instruction finds an operand
+typedef enum { ARG_REG, ARG_VAR, ARG_CONST, ARG_Y } arg_kind;
+
+typedef struct {
+  arg_kind kind;
+  int index;                  // register or variable
+  float val;                  // ARG_CONST
+} expr_arg;
+
+typedef struct {
+  expr_op op;                 // an operator, or EXPR_X to fill in x
+  int dst;
+  expr_arg a, b;
+} expr_insn;
+
+struct expr_program {
+  int n_insns, n_regs;
+  expr_insn *insns;
+  expr_arg result;
+  int nvars;
+  int *uses;                  // uses[i] != 0 if variable i is read
+};
+
+static expr_node *node_new(expr_op op)
+{
+  expr_node *n = CALLOC(1, sizeof(expr_node));
+  n->op = op;
+  return n;
+}
+
+static void node_free(expr_node *n)
+{
+  if (n) {
+    node_free(n->a);
+    node_free(n->b);
+    FREE(n);
+  }
+}
+
+// Same arithmetic as the evaluation functions in raster_calc.c
+static double apply_double(expr_op op, double a, double b)
+{
+  double mod;
+  switch (op) {
+    case EXPR_ADD: return a+b;
+    case EXPR_SUB: return a-b;
+    case EXPR_MUL: return a*b;
+    case EXPR_DIV: return b == 0 ? a : a/b;
+    case EXPR_MOD:
+      if (b == 0)
+        return a;
+      mod = fmod(a,b);
+      if (mod < 0)
+        mod += b;
+      return mod;
+    case EXPR_POW: return pow(a,b);
+    default:
+      assert(0);
+      return 0;
+  }
+}
+
+static expr_op token_op(char c)
+{
+  switch (c) {
+    case '+': return EXPR_ADD;
+    case '-': return EXPR_SUB;
+    case '*': return EXPR_MUL;
+    case '/': return EXPR_DIV;
+    case '%': return EXPR_MOD;
+    case '^': return EXPR_POW;
+    default:
+      asfPrintError("Unexpected operator '%c' in expression\n", c);
+      return EXPR_ADD;
+  }
+}
+
+// Rebuild the tree from the postfix cookie, folding constants on the
+// way.  The stack starts out with two zeros under it, as evaluate()'s
+// does, which is what makes a leading "-a" come out as 0-a.
+static expr_node *cookie2tree(char *cookie, int nvars)
+{
+  token **tok = (token **) cookie;
+  expr_node **stack;
+  expr_node *result;
+  int n = 0, sp = 2, ii;
+
+  while (tok[n])
+    ++n;
+  stack = MALLOC(sizeof(expr_node *)*(n+2));
+  stack[0] = node_new(EXPR_CONST);
+  stack[1] = node_new(EXPR_CONST);
+
+  for (ii=0; ii<n; ++ii) {
+    token *t = tok[ii];
+    expr_node *node;
+    if (t->type == tokConstant) {
+      node = node_new(EXPR_CONST);
+      node->val = t->val;
+    }
+    else if (t->type == tokVariable) {
+      if (t->index < nvars) {
+        node = node_new(EXPR_VAR);
+        node->var = t->index;
+      }
+      else if (t->index == 'x'-'a')
+        node = node_new(EXPR_X);
+      else
+        node = node_new(EXPR_Y);
+    }
+    else {
+      if (sp < 2) {
+        printf("Not enough operands for '%c'.\n", t->op);
+        for (--sp; sp>=0; --sp)
+          node_free(stack[sp]);
+        FREE(stack);
+        return NULL;
+      }
+      node = node_new(token_op(t->op));
+      node->a = stack[sp-2];
+      node->b = stack[sp-1];
+      sp -= 2;
+      if (node->a->op == EXPR_CONST && node->b->op == EXPR_CONST) {
+        double val = apply_double(node->op, node->a->val, node->b->val);
+        node_free(node->a);
+        node_free(node->b);
+        node->a = node->b = NULL;
+        node->op = EXPR_CONST;
+        node->val = val;
+      }
+    }
+    stack[sp++] = node;
+  }
+
+  result = stack[--sp];
+  for (--sp; sp>=0; --sp)
+    node_free(stack[sp]);
+  FREE(stack);
+  return result;
+}
+
+static void free_cookie(char *cookie)
+{
+  token **tok = (token **) cookie;
+  while (*tok)
+    FREE(*tok++);
+  FREE(cookie);
+}
+
+static void emit(expr_program *p, expr_insn insn)
+{
+  p->insns = realloc(p->insns, sizeof(expr_insn)*(p->n_insns+1));
+  p->insns[p->n_insns++] = insn;
+}
+
+// Code for the subtree, using registers from "reg" up; returns where
+// its value ends up.
+static expr_arg gen(expr_program *p, const expr_node *n, int reg)
+{
+  expr_arg arg;
+  expr_insn insn;
+
+  switch (n->op) {
+    case EXPR_CONST:
+      arg.kind = ARG_CONST;
+      arg.index = -1;
+      arg.val = n->val;
+      return arg;
+    case EXPR_VAR:
+      arg.kind = ARG_VAR;
+      arg.index = n->var;
+      p->uses[n->var] = TRUE;
+      return arg;
+    case EXPR_Y:
+      arg.kind = ARG_Y;
+      arg.index = -1;
+      return arg;
+    case EXPR_X:
+      insn.op = EXPR_X;
+      insn.dst = reg;
+      break;
+    default:
+      insn.op = n->op;
+      insn.dst = reg;
+      insn.a = gen(p, n->a, reg);
+      insn.b = gen(p, n->b, reg+1);
+      break;
+  }
+
+  emit(p, insn);
+  if (reg+1 > p->n_regs)
+    p->n_regs = reg+1;
+  arg.kind = ARG_REG;
+  arg.index = reg;
+  return arg;
+}
+
+expr_program *expression_compile(const char *expr, int nvars)
+{
+  char *cookie = expression2cookie(expr, nvars);
+  expr_program *p;
+  expr_node *tree;
+
+  if (!cookie)
+    return NULL;
+  tree = cookie2tree(cookie, nvars);
+  free_cookie(cookie);
+  if (!tree)
+    return NULL;
+
+  p = MALLOC(sizeof(expr_program));
+  p->n_insns = 0;
+  p->n_regs = 0;
+  p->insns = NULL;
+  p->nvars = nvars;
+  p->uses = CALLOC(nvars > 0 ? nvars : 1, sizeof(int));
+  p->result = gen(p, tree, 0);
+  node_free(tree);
+
+  return p;
+}
+
+void expression_free(expr_program *p)
+{
+  if (p) {
+    free(p->insns);
+    FREE(p->uses);
+    FREE(p);
+  }
+}
+
+int expression_uses_variable(const expr_program *p, int var)
+{
+  return var >= 0 && var < p->nvars && p->uses[var];
+}
+
+float *expression_workspace(const expr_program *p)
+{
+  return MALLOC(sizeof(float)*EXPR_BLOCK*(p->n_regs > 0 ? p->n_regs : 1));
+}
+
+static float div_f(float a, float b) { return b == 0 ? a : a/b; }
+
+static float mod_f(float a, float b)
+{
+  float mod;
+  if (b == 0)
+    return a;
+  mod = fmodf(a,b);
+  if (mod < 0)
+    mod += b;
+  return mod;
+}
+
+// One loop per operator and operand layout: vector-vector,
+// vector-scalar and scalar-vector.
+#define BINARY_LOOPS(EXPR) \
+  if (va && vb) \
+    for (k=0; k<n; ++k) { float a = va[k], b = vb[k]; d[k] = EXPR; } \
+  else if (va) \
+    for (k=0; k<n; ++k) { float a = va[k], b = sb; d[k] = EXPR; } \
+  else \
+    for (k=0; k<n; ++k) { float a = sa, b = vb[k]; d[k] = EXPR; }
+
+static const float *resolve(const expr_arg *arg, const float *const *vars,
+                            float *work, int x0, float y, float *scalar)
+{
+  switch (arg->kind) {
+    case ARG_REG: return work + (size_t)arg->index*EXPR_BLOCK;
+    case ARG_VAR: return vars[arg->index] + x0;
+    case ARG_CONST: *scalar = arg->val; return NULL;
+    case ARG_Y: *scalar = y; return NULL;
+  }
+  return NULL;
+}
+
+static void run_block(const expr_program *p, const float *const *vars,
+                      int x0, int n, float y, float *work, float *out)
+{
+  int ii, k;
+
+  for (ii=0; ii<p->n_insns; ++ii) {
+    const expr_insn *insn = &p->insns[ii];
+    float *d = work + (size_t)insn->dst*EXPR_BLOCK;
+    float sa = 0, sb = 0;
+    const float *va, *vb;
+
+    if (insn->op == EXPR_X) {
+      for (k=0; k<n; ++k)
+        d[k] = x0 + k;
+      continue;
+    }
+
+    va = resolve(&insn->a, vars, work, x0, y, &sa);
+    vb = resolve(&insn->b, vars, work, x0, y, &sb);
+    // both scalar only happens with y, which is not folded
+    if (!va && !vb) {
+      float v = apply_double(insn->op, sa, sb);
+      for (k=0; k<n; ++k)
+        d[k] = v;
+      continue;
+    }
+
+    switch (insn->op) {
+      case EXPR_ADD: BINARY_LOOPS(a+b); break;
+      case EXPR_SUB: BINARY_LOOPS(a-b); break;
+      case EXPR_MUL: BINARY_LOOPS(a*b); break;
+      case EXPR_DIV: BINARY_LOOPS(div_f(a,b)); break;
+      case EXPR_MOD: BINARY_LOOPS(mod_f(a,b)); break;
+      case EXPR_POW: BINARY_LOOPS(powf(a,b)); break;
+      default: assert(0);
+    }
+  }
+
+  {
+    float s = 0;
+    const float *v = resolve(&p->result, vars, work, x0, y, &s);
+    if (v)
+      memcpy(out, v, sizeof(float)*n);
+    else
+      for (k=0; k<n; ++k)
+        out[k] = s;
+  }
+}
+
+void expression_evaluate_line(const expr_program *p, const float *const *vars,
+                              int ns, int line, double nodata, float *work,
+                              float *out)
+{
+  int x0, ii, k;
+
+  for (x0=0; x0<ns; x0+=EXPR_BLOCK) {
+    int n = MIN(EXPR_BLOCK, ns-x0);
+    run_block(p, vars, x0, n, (float)line, work, out + x0);
+  }
+
+  if (!ISNAN(nodata)) {
+    for (ii=0; ii<p->nvars; ++ii) {
+      if (p->uses[ii]) {
+        const float *v = vars[ii];
+        for (k=0; k<ns; ++k)
+          if (FLOAT_EQUIVALENT(v[k], nodata))
+            out[k] = nodata;
+      }
+    }
+  }
+}
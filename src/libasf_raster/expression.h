@@ -23,6 +23,26 @@ typedef struct token {
 } token;
 
 
+/* Compiled expressions (expression.c): the same language, compiled once
+   into a register program that is run EXPR_BLOCK pixels at a time, in
+   single precision.  A program may be shared between threads as long
+   as each one has its own workspace. */
+#define EXPR_BLOCK 256
+
+typedef struct expr_program expr_program;
+
+expr_program *expression_compile(const char *expr, int nvars);
+void expression_free(expr_program *p);
+int expression_uses_variable(const expr_program *p, int var);
+/* Scratch registers for expression_evaluate_line; FREE when done. */
+float *expression_workspace(const expr_program *p);
+/* Evaluate a line of ns pixels.  vars[i] is the line of variable i
+   (unused ones may be NULL), x runs from 0 and y is "line".  Unless
+   nodata is NAN, pixels where any variable used is nodata are nodata. */
+void expression_evaluate_line(const expr_program *p, const float *const *vars,
+                              int ns, int line, double nodata, float *work,
+                              float *out);
+
 /*Tokenizer functions.*/
 int expressionMalformed(const char *expr,int nvars);
 void setTokenExpression(const char *expr);
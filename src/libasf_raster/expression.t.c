@@ -0,0 +1,127 @@
+#include "asf_raster.h"
+#include "asf.h"
+#include "expression.h"
+
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+
+// Checks compiled expressions, and the interpreter they came from,
+// against the same arithmetic written out in C.
+
+#define NS 300    // more than one EXPR_BLOCK
+#define LINE 17
+
+static const double tol = 1e-5;
+
+static int same(double a, double b)
+{
+  return fabs(a-b) <= tol*MAX(1.0, MAX(fabs(a), fabs(b)));
+}
+
+// Division and mod by zero leave the left operand alone
+static double div_d(double a, double b) { return b == 0 ? a : a/b; }
+static double mod_d(double a, double b)
+{
+  double mod;
+  if (b == 0)
+    return a;
+  mod = fmod(a,b);
+  return mod < 0 ? mod + b : mod;
+}
+
+#define V const double *v
+static double e_prec(V)      { return v[0] - v[1]*v[2] + v[3]; }
+static double e_prec2(V)     { return v[0] + v[1]*v[2] - v[3]/v[2]; }
+static double e_left(V)      { return (v[0] - v[1]) - v[2]; }
+static double e_parens(V)    { return (v[0] - v[1]) * (v[2] + v[3]); }
+static double e_neg(V)       { return -v[0] + v[1]; }
+static double e_neg_mul(V)   { return -(v[0]*v[1]); }
+static double e_div(V)       { return div_d(v[0], v[1]); }
+static double e_div_left(V)  { return div_d(div_d(v[3], v[2]), v[1]); }
+static double e_mod(V)       { return mod_d(v[0], v[2]); }
+static double e_pow(V)       { return 2*pow(v[2], 2) - v[0]; }
+static double e_consts(V)    { return 2*3.5 + v[0]/4; }
+static double e_xy(V)        { return v['x'-'a']*2 - v['y'-'a'] + v[3]; }
+#undef V
+
+static const struct {
+  const char *expr;
+  double (*expected)(const double *v);
+} cases[] = {
+  { "a-b*c+d", e_prec },
+  { "a+b*c-d/c", e_prec2 },
+  { "a-b-c", e_left },
+  { "(a-b)*(c+d)", e_parens },
+  { "-a+b", e_neg },
+  { "-a*b", e_neg_mul },
+  { "a/b", e_div },
+  { "d/c/b", e_div_left },
+  { "a%c", e_mod },
+  { "2*c^2-a", e_pow },
+  { "2*3.5+a/4", e_consts },
+  { "x*2-y+d", e_xy },
+};
+
+int main(int argc, char * argv [])
+{
+  int n_cases = sizeof(cases)/sizeof(cases[0]);
+  float *vars[4], out[NS];
+  int ii, jj, kk, failed = 0;
+
+  for (jj=0; jj<4; jj++)
+    vars[jj] = MALLOC(sizeof(float)*NS);
+  for (kk=0; kk<NS; kk++) {
+    vars[0][kk] = kk*0.5 - 40;
+    vars[1][kk] = kk%7 - 3;        // includes zeros
+    vars[2][kk] = 1.5 + kk%5;
+    vars[3][kk] = 100 - kk;
+  }
+
+  for (ii=0; ii<n_cases; ii++) {
+    expr_program *p = expression_compile(cases[ii].expr, 4);
+    char *cookie = expression2cookie(cases[ii].expr, 4);
+    int bad = 0;
+
+    if (!p || !cookie) {
+      printf("%s: did not compile\n", cases[ii].expr);
+      failed++;
+      continue;
+    }
+
+    float *work = expression_workspace(p);
+    expression_evaluate_line(p, (const float *const *) vars, NS, LINE,
+                             NAN, work, out);
+    for (kk=0; kk<NS && !bad; kk++) {
+      // x and y are variables 'x' and 'y' to evaluate()
+      double v[26];
+      for (jj=0; jj<4; jj++)
+        v[jj] = vars[jj][kk];
+      v['x'-'a'] = kk;
+      v['y'-'a'] = LINE;
+      double expected = cases[ii].expected(v);
+      double interpreted = evaluate(cookie, v);
+      if (!same(out[kk], expected) || !same(interpreted, expected)) {
+        printf("%s, sample %d: expected %g, compiled %g, evaluate() %g\n",
+               cases[ii].expr, kk, expected, out[kk], interpreted);
+        bad = 1;
+      }
+    }
+    failed += bad;
+
+    token **tok = (token **) cookie;
+    for (jj=0; tok[jj]; jj++)
+      FREE(tok[jj]);
+    FREE(cookie);
+    FREE(work);
+    expression_free(p);
+  }
+
+  for (jj=0; jj<4; jj++)
+    FREE(vars[jj]);
+  if (failed)
+    printf("expression: %d checks FAILED\n", failed);
+  else
+    printf("expression: all checks passed\n");
+  return failed ? 1 : 0;
+}
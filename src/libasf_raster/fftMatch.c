@@ -1,8 +1,11 @@
 #include "asf.h"
+#include <glib.h>
+#include <string.h>
 #include "asf_meta.h"
 #include <math.h>
 #include "fft.h"
 #include "fft2d.h"
+#include "fft_plan.h"
 #include "asf_raster.h"
 
 #if defined(mingw) // MAXFLOAT not available on mingw
@@ -156,22 +159,69 @@ static void findPeak(float *corrImage,float *dx,float *dy,float *doubt,
 }
 
 
+/* fftCorrelate: correlates the image in in1 with the mean-removed, scaled
+chip in in2, leaving the correlation image in in2.  Both arrays are
+(nl x ns) and are destroyed.  The transforms are planned ones (see
+fft_plan.h), so separate calls with separate arrays can run at the same
+time.*/
+static void fftCorrelate(float *in1, float *in2, int ns, int nl)
+{
+  register float *out=in2;
+  register int x,y,l;
+  const fft_plan *forward=fft_plan_2d(FFT_REAL,FFT_FORWARD,nl,ns);
+
+  /*FFT image 2 */
+  //asfPrintStatus("FFT Image 2\n");
+  fft_execute(forward,in2);
+
+  /*FFT Image 1 */
+  //asfPrintStatus("FFT Image 1\n");
+  fft_execute(forward,in1);
+
+  /*Conjugate in2.*/
+  //asfPrintStatus("Conjugate Image 2\n");
+  for (y=0;y<nl;y++) {
+    l=ns*y;
+    x = (y < 2) ? 1 : 0;
+    //if (y<2) x=1; else x=0;
+    for (;x<ns/2;x++) {
+      in2[l+2*x+1]*=-1.0;
+    }
+  }
+
+  /*Take complex product of in1 and in2 into out.*/
+  //asfPrintStatus("Complex Product\n");
+  rspect2dprod(in1,in2,out,nl,ns);
+
+  /*Zero out the low frequencies of the correlation image.*/
+  //asfPrintStatus("Zero low frequencies.\n");
+  for (y=0;y<4;y++) {
+    l=ns*y;
+    for (x=0;x<8;x++) out[l+x]=0;
+    l=ns*(nl-1-y);
+    for (x=0;x<8;x++) out[l+x]=0;
+  }
+
+  /*Inverse-fft the product*/
+  //asfPrintStatus("I-FFT\n");
+  fft_execute(fft_plan_2d(FFT_REAL,FFT_INVERSE,nl,ns),out);
+}
+
 /* las_fftProd: reads both given files, and correlates them into the
 created outReal (nl x ns) float array.*/
 static void fftProd(FILE *in1F,meta_parameters *metaMaster,
             FILE *in2F,meta_parameters *metaSlave,float *outReal[],
-            int ns, int nl, int mX, int mY,
+            int ns, int nl,
             int chipX, int chipY, int chipDX, int chipDY,
             int searchX, int searchY)
 {
   float scaleFact=1.0/(chipDX*chipDY);
-  register float *in1,*in2,*out;
+  register float *in1,*in2;
   register int x,y,l;
   float aveChip;
 
   in1=(float *)MALLOC(sizeof(float)*ns*nl);
   in2=(float *)MALLOC(sizeof(float)*ns*nl);
-  out=in2;
   *outReal=in2;
 
   /*Read image 2 (chip)*/
@@ -191,10 +241,6 @@ static void fftProd(FILE *in1F,meta_parameters *metaMaster,
     }
   }
 
-  /*FFT image 2 */
-  //asfPrintStatus("FFT Image 2\n");
-  rfft2d(in2,mY,mX);
-
   /*Read image 1: Much easier, now that we know the average brightness. */
   //asfPrintStatus("Reading Image 1\n");
   readImage(in1F,metaMaster,
@@ -202,37 +248,7 @@ static void fftProd(FILE *in1F,meta_parameters *metaMaster,
             MINI(metaMaster->general->line_count,nl),
             aveChip,NULL,in1,nl,ns);
 
-  /*FFT Image 1 */
-  //asfPrintStatus("FFT Image 1\n");
-  rfft2d(in1,mY,mX);
-
-  /*Conjugate in2.*/
-  //asfPrintStatus("Conjugate Image 2\n");
-  for (y=0;y<nl;y++) {
-    l=ns*y;
-    x = (y < 2) ? 1 : 0;
-    //if (y<2) x=1; else x=0;
-    for (;x<ns/2;x++) {
-      in2[l+2*x+1]*=-1.0;
-    }
-  }
-
-  /*Take complex product of in1 and in2 into out.*/
-  //asfPrintStatus("Complex Product\n");
-  rspect2dprod(in1,in2,out,nl,ns);
-
-  /*Zero out the low frequencies of the correlation image.*/
-  //asfPrintStatus("Zero low frequencies.\n");
-  for (y=0;y<4;y++) {
-    l=ns*y;
-    for (x=0;x<8;x++) out[l+x]=0;
-    l=ns*(nl-1-y);
-    for (x=0;x<8;x++) out[l+x]=0;
-  }
-
-  /*Inverse-fft the product*/
-  //asfPrintStatus("I-FFT\n");
-  rifft2d(out,mY,mX);
+  fftCorrelate(in1,in2,ns,nl);
 
   FREE(in1);/*Note: in2 shouldn't be freed, because we return it.*/
 }
@@ -242,41 +258,6 @@ static int mini(int a, int b)
   return a<b ? a : b;
 }
 
-static int fftMatchBF(char *file1, char *file2, float *dx, float *dy, float *cert, double tol)
-{
-  int qf_saved = quietflag;
-  quietflag = TRUE;
-  int ok = FALSE;
-
-  float dx1=0, dx2=0, dy1=0, dy2=0, cert1=0, cert2=0;
-  fftMatch(file1, file2, NULL, &dx1, &dy1, &cert1);
-  if (!meta_is_valid_double(dx1) || !meta_is_valid_double(dy1) || cert1<tol) {
-    *dx = *dy = *cert = 0;
-  }
-  else {
-    fftMatch(file2, file1, NULL, &dx2, &dy2, &cert2);
-    if (!meta_is_valid_double(dx2) || !meta_is_valid_double(dy2) || cert2<tol) {
-      *dx = *dy = *cert = 0;
-    }
-    else if (fabs(dx1 + dx2) > .25 || fabs(dy1 + dy2) > .25) {
-      *dx = *dy = *cert = 0;
-    }
-    else {
-      *dx = (dx1 - dx2) * 0.5;
-      *dy = (dy1 - dy2) * 0.5;
-      *cert = cert1 < cert2 ? cert1 : cert2; 
-      ok = TRUE;
-    }
-  }
-
-  quietflag = qf_saved;
-  //asfPrintStatus("Result %s:\n"
-  //               "dx1=%8.2f dy1=%8.2f cert=%f\n"
-  //               "dx2=%8.2f dy2=%8.2f cert=%f\n", ok?"Yes":"No", dx1, dy1, cert1, dx2, dy2, cert2);
-
-  return ok; 
-}
-
 typedef struct offset_point {
   int x_pos;
   int y_pos;
@@ -415,6 +396,196 @@ static void print_matches(offset_point_t *matches, int num_x, int num_y, FILE *f
   fprintf(fp, "Total Average Offset: %8.3f\n", avg);
 }
 
+// Gridded matching correlates chips straight out of memory.  A band of
+// lines as tall as one row of chips is kept for each image, and every
+// chip in the row is matched from it, forward and backward, the way
+// fftMatch() would match the pair of size x size chip files.
+
+// FFT size and search geometry, the same for every chip in the grid.
+struct chip_geometry {
+  int mX, mY, ns, nl;
+  int chipX, chipY, chipDX, chipDY;
+  int searchX, searchY;
+  int imageDX, imageDY;
+};
+
+static void chip_geometry_init(struct chip_geometry *g, int size)
+{
+  /*Round to find nearest power of 2 for FFT size, as fftMatch does.*/
+  g->mX = (int)(log((float)size)/log(2.0)+0.5);
+  g->mY = g->mX;
+  if (g->mX > 13) g->mX = 13;
+  if (g->mY > 15) g->mY = 15;
+  g->ns = 1<<g->mX;
+  g->nl = 1<<g->mY;
+
+  g->chipDX=MINI(size,g->ns)*3/4;
+  g->chipDY=MINI(size,g->nl)*3/4;
+  g->chipX=MINI(size,g->ns)/8;
+  g->chipY=MINI(size,g->nl)/8;
+  g->searchX=MINI(size,g->ns)*3/8;
+  g->searchY=MINI(size,g->nl)*3/8;
+  g->imageDX=MINI(size,g->ns);
+  g->imageDY=MINI(size,g->nl);
+}
+
+// Make band hold lines [y, y+size) of the image, keeping whatever lines
+// it already holds from the previous row of chips.
+static void read_band(FILE *fp, meta_parameters *meta, float *band,
+                      int size, int *band_y, int y)
+{
+  int width = meta->general->sample_count;
+  int keep = 0;
+
+  if (*band_y >= 0 && y >= *band_y && y < *band_y + size) {
+    keep = *band_y + size - y;
+    memmove(band, band + (size_t)(y - *band_y)*width,
+            sizeof(float)*keep*width);
+  }
+  if (keep < size)
+    get_float_lines(fp, meta, y + keep, size - keep,
+                    band + (size_t)keep*width);
+  *band_y = y;
+}
+
+// Copy a (dy x dx) window at (x0,y0) in a band into the top left of the
+// (nl x ns) array dest, adding add and zero filling the rest.  Like
+// readImage, NaN and absurdly large pixels are left out; here they are
+// zeroed.  Returns the sum of the pixels copied.
+static double load_window(const float *band, int width, int x0, int y0,
+                          int dx, int dy, float add, float *dest,
+                          int nl, int ns)
+{
+  const double maxval = ((double)MAXFLOAT) / ((double)ns*nl);
+  double sum = 0;
+  int x, y;
+
+  for (y=0; y<dy; y++) {
+    const float *in = band + (size_t)(y0+y)*width + x0;
+    float *out = dest + (size_t)ns*y;
+    for (x=0; x<dx; x++) {
+      if (fabs(in[x]) < maxval && meta_is_valid_double(in[x])) {
+        sum += in[x];
+        out[x] = in[x] + add;
+      }
+      else {
+        out[x] = 0.0;
+      }
+    }
+    for (x=dx; x<ns; x++)
+      out[x] = 0.0;
+  }
+  for (y=dy; y<nl; y++)
+    memset(dest + (size_t)ns*y, 0, sizeof(float)*ns);
+
+  return sum;
+}
+
+// Per thread FFT buffers, reused from chip to chip.
+struct chip_workspace {
+  float *in1, *in2;
+};
+
+// Match the chip at tile_x of the chip band against the same tile of
+// the image band, like fftMatch(image, chip).
+static void correlate_chip(const struct chip_geometry *g,
+                           const float *image, int image_width,
+                           const float *chip, int chip_width, int tile_x,
+                           struct chip_workspace *ws,
+                           float *dx, float *dy, float *cert)
+{
+  float scaleFact = 1.0/(g->chipDX*g->chipDY);
+  float aveChip, doubt;
+  int x, y;
+
+  aveChip = load_window(chip, chip_width, tile_x + g->chipX, g->chipY,
+                        g->chipDX, g->chipDY, 0.0, ws->in2, g->nl, g->ns);
+  aveChip /= -(float)g->chipDY*g->chipDX;
+  for (y=0; y<g->chipDY; y++) {
+    float *l = ws->in2 + (size_t)g->ns*y;
+    for (x=0; x<g->chipDX; x++)
+      l[x] = (l[x]+aveChip)*scaleFact;
+  }
+
+  load_window(image, image_width, tile_x, 0, g->imageDX, g->imageDY,
+              aveChip, ws->in1, g->nl, g->ns);
+
+  fftCorrelate(ws->in1, ws->in2, g->ns, g->nl);
+
+  findPeak(ws->in2, dx, dy, &doubt, g->nl, g->ns,
+           g->chipX, g->chipY, g->searchX, g->searchY);
+  *cert = 1-doubt;
+}
+
+// Match one tile both ways; the match only counts if the two agree.
+static int match_chip(const struct chip_geometry *g,
+                      const float *band1, int width1,
+                      const float *band2, int width2, int tile_x,
+                      double tol, struct chip_workspace *ws,
+                      float *dx, float *dy, float *cert)
+{
+  float dx1=0, dx2=0, dy1=0, dy2=0, cert1=0, cert2=0;
+
+  correlate_chip(g, band1, width1, band2, width2, tile_x, ws,
+                 &dx1, &dy1, &cert1);
+  if (!meta_is_valid_double(dx1) || !meta_is_valid_double(dy1) || cert1<tol) {
+    *dx = *dy = *cert = 0;
+    return FALSE;
+  }
+
+  correlate_chip(g, band2, width2, band1, width1, tile_x, ws,
+                 &dx2, &dy2, &cert2);
+  if (!meta_is_valid_double(dx2) || !meta_is_valid_double(dy2) || cert2<tol) {
+    *dx = *dy = *cert = 0;
+    return FALSE;
+  }
+  if (fabs(dx1 + dx2) > .25 || fabs(dy1 + dy2) > .25) {
+    *dx = *dy = *cert = 0;
+    return FALSE;
+  }
+
+  *dx = (dx1 - dx2) * 0.5;
+  *dy = (dy1 - dy2) * 0.5;
+  *cert = cert1 < cert2 ? cert1 : cert2;
+  return TRUE;
+}
+
+// One row of chips, shared by the threads matching it.  Chips are
+// handed out one at a time through next_chip.
+struct chip_row {
+  const struct chip_geometry *geometry;
+  const float *band1, *band2;
+  int width1, width2;
+  const int *tile_x;
+  int num_x;
+  double tol;
+  offset_point_t *matches;
+  gint next_chip;
+};
+
+struct chip_thread {
+  struct chip_row *row;
+  struct chip_workspace ws;
+};
+
+static gpointer chip_row_thread(gpointer data)
+{
+  struct chip_thread *t = data;
+  struct chip_row *row = t->row;
+  int jj;
+
+  while ((jj = g_atomic_int_add(&row->next_chip, 1)) < row->num_x) {
+    offset_point_t *m = &row->matches[jj];
+    int ok = match_chip(row->geometry, row->band1, row->width1,
+                        row->band2, row->width2, row->tile_x[jj],
+                        row->tol, &t->ws, &m->x_offset, &m->y_offset,
+                        &m->cert);
+    m->valid = ok && m->cert>row->tol;
+  }
+
+  return NULL;
+}
+
 int fftMatch_gridded(char *inFile1, char *inFile2, char *gridFile,
                      float *avgLocX, float *avgLocY, float *certainty,
                      int size, double tol, int overlap)
@@ -443,7 +614,38 @@ int fftMatch_gridded(char *inFile1, char *inFile2, char *gridFile,
 
   offset_point_t *matches = MALLOC(sizeof(offset_point_t)*len); 
 
+  int *tile_xs = MALLOC(sizeof(int)*(num_x > 0 ? num_x : 1));
   int ii, jj, kk=0, nvalid=0;
+  for (jj=0; jj<num_x; ++jj) {
+    int tile_x = jj*(size - overlap);
+    if (tile_x + size > ns) {
+      if (jj != num_x - 1)
+        asfPrintError("Bad tile_x: %d %d %d %d %d\n", jj, num_x, tile_x, size, ns);
+      tile_x = ns - size;
+    }
+    tile_xs[jj] = tile_x;
+  }
+
+  struct chip_geometry geometry;
+  chip_geometry_init(&geometry, size);
+
+  FILE *fp1 = fopenImage(inFile1, "rb");
+  FILE *fp2 = fopenImage(inFile2, "rb");
+  int width1 = meta1->general->sample_count;
+  int width2 = meta2->general->sample_count;
+  float *band1 = MALLOC(sizeof(float)*lsz*width1);
+  float *band2 = MALLOC(sizeof(float)*lsz*width2);
+  int band_y1 = -1, band_y2 = -1;
+
+  int thread_count = MAX(1, MIN((int)g_get_num_processors(), num_x));
+  struct chip_thread *workers = MALLOC(sizeof(struct chip_thread)*thread_count);
+  GThread **threads = MALLOC(sizeof(GThread *)*thread_count);
+  int tt;
+  for (tt=0; tt<thread_count; ++tt) {
+    workers[tt].ws.in1 = MALLOC(sizeof(float)*geometry.ns*geometry.nl);
+    workers[tt].ws.in2 = MALLOC(sizeof(float)*geometry.ns*geometry.nl);
+  }
+
   for (ii=0; ii<num_y; ++ii) {
     int tile_y = ii*(size - overlap);
     if (tile_y + size > nl) {
@@ -451,47 +653,57 @@ int fftMatch_gridded(char *inFile1, char *inFile2, char *gridFile,
         asfPrintError("Bad tile_y: %d %d %d %d %d\n", ii, num_y, tile_y, size, nl);
       tile_y = nl - size;
     }
+    read_band(fp1, meta1, band1, size, &band_y1, tile_y);
+    read_band(fp2, meta2, band2, size, &band_y2, tile_y);
+
+    struct chip_row row;
+    row.geometry = &geometry;
+    row.band1 = band1;
+    row.band2 = band2;
+    row.width1 = width1;
+    row.width2 = width2;
+    row.tile_x = tile_xs;
+    row.num_x = num_x;
+    row.tol = tol;
+    row.matches = &matches[kk];
+    row.next_chip = 0;
+
+    for (tt=0; tt<thread_count; ++tt)
+      workers[tt].row = &row;
+    if (thread_count == 1) {
+      chip_row_thread(&workers[0]);
+    }
+    else {
+      for (tt=0; tt<thread_count; ++tt)
+        threads[tt] = g_thread_new("fftMatch", chip_row_thread, &workers[tt]);
+      for (tt=0; tt<thread_count; ++tt)
+        g_thread_join(threads[tt]);
+    }
+
     for (jj=0; jj<num_x; ++jj) {
-      int tile_x = jj*(size - overlap);
-      if (tile_x + size > ns) {
-        if (jj != num_x - 1)
-          asfPrintError("Bad tile_x: %d %d %d %d %d\n", jj, num_x, tile_x, size, ns);
-        tile_x = ns - size;
-      }
-      //asfPrintStatus("Matching tile starting at (L,S) (%d,%d)\n", tile_y, tile_x);
-      char trim_append[64];
-      sprintf(trim_append, "_chip_%05d_%05d", tile_y, tile_x);
-      char *trim_chip1 = appendToBasename(inFile1, trim_append);
-      char *trim_chip2 = appendToBasename(inFile2, trim_append);
-      trim(inFile1, trim_chip1, (long long)tile_x, (long long)tile_y, lsz, lsz);
-      trim(inFile2, trim_chip2, (long long)tile_x, (long long)tile_y, lsz, lsz);
-      //char smooth_append[64];
-      //sprintf(smooth_append, "_smooth_chip_%05d_%05d", tile_x, tile_y);
-      //char *smooth_chip1 = appendToBasename(inFile1, smooth_append);
-      //smooth(trim_chip1, smooth_chip1, 3, EDGE_TRUNCATE);
-      float dx, dy, cert;
-      int ok = fftMatchBF(trim_chip1, trim_chip2, &dx, &dy, &cert, tol);
-      matches[kk].x_pos = tile_x;
+      matches[kk].x_pos = tile_xs[jj];
       matches[kk].y_pos = tile_y;
-      matches[kk].cert = cert;
-      matches[kk].x_offset = dx;
-      matches[kk].y_offset = dy;
-      matches[kk].valid = ok && cert>tol;
       asfPrintStatus("%s: %5d %5d dx=%7.3f, dy=%7.3f, cert=%5.3f\n",
-                     matches[kk].valid?"GOOD":"BAD ", tile_y, tile_x, dx, dy, cert);
+                     matches[kk].valid?"GOOD":"BAD ", tile_y, tile_xs[jj],
+                     matches[kk].x_offset, matches[kk].y_offset,
+                     matches[kk].cert);
       if (matches[kk].valid) ++nvalid;
       ++kk;
-      //printf("%4.1f ", dx);
-      removeImgAndMeta(trim_chip1);
-      FREE(trim_chip1);
-      removeImgAndMeta(trim_chip2);
-      FREE(trim_chip2);
-      //unlink(smooth_chip1);
-      //FREE(smooth_chip1);
     }
-    //printf("\n");
   }
 
+  for (tt=0; tt<thread_count; ++tt) {
+    FREE(workers[tt].ws.in1);
+    FREE(workers[tt].ws.in2);
+  }
+  FREE(workers);
+  FREE(threads);
+  FREE(band1);
+  FREE(band2);
+  FREE(tile_xs);
+  FCLOSE(fp1);
+  FCLOSE(fp2);
+
   //print_matches(matches, num_x, num_y, stdout);
 
   asfPrintStatus("Removing grid offset outliers.\n");
@@ -881,8 +1093,6 @@ int fftMatch(char *inFile1, char *inFile2, char *corrFile,
   searchX=MINI(metaSlave->general->sample_count,ns)*3/8;
   searchY=MINI(metaSlave->general->line_count,nl)*3/8;
 
-  fft2dInit(mY, mX);
-
   if (!quietflag && ns*nl*2*sizeof(float)>20*1024*1024) {
     asfPrintStatus(
             "   These images will take %d megabytes of memory to match.\n\n",
@@ -899,7 +1109,7 @@ int fftMatch(char *inFile1, char *inFile2, char *corrFile,
   }
 
   /*Perform the correlation.*/
-  fftProd(in1F,metaMaster,in2F,metaSlave,&corrImage,ns,nl,mX,mY,
+  fftProd(in1F,metaMaster,in2F,metaSlave,&corrImage,ns,nl,
           chipX,chipY,chipDX,chipDY,searchX,searchY);
 
   /*Optionally write out correlation image.*/
@@ -12,12 +12,15 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <setjmp.h>
+#ifndef win32
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#endif
 
 #include <glib.h>
 #if GLIB_CHECK_VERSION (2, 6, 0)
 #  include <glib/gstdio.h>
 #endif
-#include <gsl/gsl_spline.h>
 #include <gsl/gsl_histogram.h>
 #include <gsl/gsl_math.h>
 
@@ -26,8 +29,6 @@
 #include "asf_jpeg.h"
 #include "float_image.h"
 
-double gsl_spline_eval_check(gsl_spline *, double, gsl_interp_accel *);
-
 #ifndef linux
 #ifndef darwin
 #ifndef win32
@@ -147,11 +148,71 @@ initialize_tile_cache_file (GString **tile_file_name)
   return tile_file;
 }
 
+// Split the memory cache up into shard_count shards, dividing the
+// cache slots between them as evenly as possible.
+static void
+initialize_tile_cache_shards (FloatImage *self, size_t shard_count)
+{
+  g_assert (shard_count > 0 && shard_count <= self->cache_size_in_tiles);
+
+  self->shard_count = shard_count;
+  self->shards = g_new0 (FloatImageCacheShard, shard_count);
+
+  size_t ii, first_slot = 0;
+  for ( ii = 0 ; ii < shard_count ; ii++ ) {
+    FloatImageCacheShard *shard = &(self->shards[ii]);
+    g_mutex_init (&(shard->lock));
+    shard->slots = self->cache + first_slot * self->tile_area;
+    shard->slot_count = self->cache_size_in_tiles / shard_count;
+    if ( ii < self->cache_size_in_tiles % shard_count ) {
+      shard->slot_count++;
+    }
+    // Slots are filled in order, so only the first loaded_count
+    // entries of slot_tiles mean anything.
+    shard->slot_tiles = g_new (gint, shard->slot_count);
+    shard->loaded_count = 0;
+    shard->clock_hand = 0;
+    first_slot += shard->slot_count;
+  }
+  g_assert (first_slot == self->cache_size_in_tiles);
+}
+
+// Add the statistics gathered by shard to the instance totals.
+static void
+retire_shard_statistics (FloatImage *self, FloatImageCacheShard *shard)
+{
+  self->cache_hits += shard->hits + (guint) shard->concurrent_hits;
+  self->cache_misses += shard->misses;
+  self->cache_writebacks += shard->writebacks;
+  self->cache_clean_evictions += shard->clean_evictions;
+  shard->hits = shard->misses = shard->writebacks = 0;
+  shard->clean_evictions = 0;
+  shard->concurrent_hits = 0;
+}
+
+// Release the cache shards set up by initialize_tile_cache_shards.
+static void
+free_tile_cache_shards (FloatImage *self)
+{
+  size_t ii;
+  for ( ii = 0 ; ii < self->shard_count ; ii++ ) {
+    retire_shard_statistics (self, &(self->shards[ii]));
+    g_free (self->shards[ii].slot_tiles);
+    g_mutex_clear (&(self->shards[ii].lock));
+  }
+  g_free (self->shards);
+  self->shards = NULL;
+  self->shard_count = 0;
+}
+
 // This routine does the work common to several of the differenct
 // creation routines.  Basicly, it does everything but fill in the
-// contents of the disk tile store.
+// contents of the disk tile store.  The tiling is worked out for a
+// memory cache of cache_space bytes.
 static FloatImage *
-initialize_float_image_structure (ssize_t size_x, ssize_t size_y)
+initialize_float_image_structure_with_cache_space (ssize_t size_x,
+                                                   ssize_t size_y,
+                                                   size_t cache_space)
 {
   // Allocate instance memory.
   FloatImage *self = g_new0 (FloatImage, 1);
@@ -171,7 +232,7 @@ initialize_float_image_structure (ssize_t size_x, ssize_t size_y)
   // and specially handle the case where we have long narrow images
   // that can fit in a single stip of tiles in the cache.
   if ( largest_dimension * largest_dimension * sizeof (float)
-       <= default_cache_size ) {
+       <= cache_space ) {
     self->cache_space = largest_dimension * largest_dimension * sizeof (float);
     self->cache_area = self->cache_space / sizeof (float);
     self->tile_size = largest_dimension;
@@ -183,8 +244,12 @@ initialize_float_image_structure (ssize_t size_x, ssize_t size_y)
     self->cache = g_new (float, self->cache_area);
     self->tile_addresses = g_new0 (float *, self->tile_count);
     g_assert (NULL == 0x0);     // Ensure g_new0 effectively sets to NULL.
-    // The tile queue shouldn't ever be needed in this case.
-    self->tile_queue = NULL;
+    self->tile_states = g_new0 (FloatImageTileState, self->tile_count);
+    // The cache shards shouldn't ever be needed in this case.
+    self->shard_count = 0;
+    self->shards = NULL;
+    self->concurrent = FALSE;
+    g_mutex_init (&(self->tile_file_lock));
     // The tile file shouldn't ever be needed, so we set it to NULL to
     // indicate this to a few other methods that use it directly, and
     // to hopefully ensure that it triggers an exception if it is
@@ -197,8 +262,8 @@ initialize_float_image_structure (ssize_t size_x, ssize_t size_y)
     return self;
   }
 
-  // The default cache size compiled into the class.
-  self->cache_space = default_cache_size;
+  // The cache size we were asked to use.
+  self->cache_space = cache_space;
 
   // Memory cache space, in pixels.
   g_assert (self->cache_space % sizeof (float) == 0);
@@ -273,9 +338,15 @@ initialize_float_image_structure (ssize_t size_x, ssize_t size_y)
   self->tile_addresses = g_new0 (float *, self->tile_count);
   g_assert (NULL == 0x0);       // Ensure g_new0 effectively sets to NULL.
 
-  // Create a queue in order to keep track of which tile was loaded
+  // All tiles start out unpinned, unreferenced and clean.
+  self->tile_states = g_new0 (FloatImageTileState, self->tile_count);
+
+  // Until concurrent access is requested, the whole cache is a single
+  // shard, with a queue to keep track of which tile was loaded
   // longest ago.
-  self->tile_queue = g_queue_new ();
+  self->concurrent = FALSE;
+  initialize_tile_cache_shards (self, 1);
+  g_mutex_init (&(self->tile_file_lock));
 
   // Get a new empty tile cache file pointer.
   self->tile_file_name = NULL;
@@ -287,6 +358,14 @@ initialize_float_image_structure (ssize_t size_x, ssize_t size_y)
   return self;
 }
 
+// Set up an instance using the default cache size.
+static FloatImage *
+initialize_float_image_structure (ssize_t size_x, ssize_t size_y)
+{
+  return initialize_float_image_structure_with_cache_space (size_x, size_y,
+                                                            default_cache_size);
+}
+
 FloatImage *
 float_image_thaw (FILE *file_pointer)
 {
@@ -331,16 +410,20 @@ float_image_thaw (FILE *file_pointer)
   self->cache = g_new (float, self->cache_area);
 
   self->tile_addresses = g_new0 (float *, self->tile_count);
-
-  // We don't actually keep the tile queue in the serialized instance,
-  // but if the serialized pointer to it is NULL, we know we aren't
-  // using a tile cache file (i.e. the whole image fits in the memory
-  // cache).
-  read_count = fread (&(self->tile_queue), sizeof (GQueue *), 1, fp);
+  self->tile_states = g_new0 (FloatImageTileState, self->tile_count);
+  self->concurrent = FALSE;
+  g_mutex_init (&(self->tile_file_lock));
+
+  // We don't actually keep the cache state in the serialized
+  // instance, but if the serialized marker pointer is NULL, we know
+  // we aren't using a tile cache file (i.e. the whole image fits in
+  // the memory cache).
+  gpointer tile_file_marker;
+  read_count = fread (&tile_file_marker, sizeof (gpointer), 1, fp);
   g_assert (read_count == 1);
 
   // If there was no cache file...
-  if ( self->tile_queue == NULL ) {
+  if ( tile_file_marker == NULL ) {
     // The tile_file structure field should also be NULL.
     self->tile_file = NULL;
     // we restore the file directly into the first and only tile (see
@@ -350,10 +433,10 @@ float_image_thaw (FILE *file_pointer)
       self->tile_area, fp);
     g_assert (read_count == self->tile_area);
   }
-  // otherwise, an empty tile queue needs to be initialized, and the
+  // otherwise, an empty cache shard needs to be initialized, and the
   // remainder of the serialized version is the tile block cache.
   else {
-    self->tile_queue = g_queue_new ();
+    initialize_tile_cache_shards (self, 1);
     self->tile_file_name = NULL;
     self->tile_file = initialize_tile_cache_file (&(self->tile_file_name));
     float *buffer = g_new (float, self->tile_area);
@@ -540,16 +623,9 @@ float_image_new_from_memory (ssize_t size_x, ssize_t size_y, float *buffer)
 {
   g_assert (size_x > 0 && size_y > 0);
 
-  // FIXME: this is an inefficient implementation.
-
   FloatImage *self = float_image_new (size_x, size_y);
 
-  ssize_t ii, jj;
-  for ( ii = 0 ; ii < size_x ; ii++ ) {
-    for ( jj = 0 ; jj < size_y ; jj++ ) {
-      float_image_set_pixel (self, ii, jj, buffer[jj * size_x + ii]);
-    }
-  }
+  float_image_set_region (self, 0, 0, size_x, size_y, buffer);
 
   return self;
 }
@@ -717,6 +793,229 @@ non_native_byte_order (float_image_byte_order_t byte_order)
               && byte_order == FLOAT_IMAGE_BYTE_ORDER_LITTLE_ENDIAN));
 }
 
+#ifndef win32
+// Pass the expected access pattern for a memory mapped image on to
+// the kernel.  This is only a hint, so failure doesn't matter.
+static void
+advise_mapping (FloatImage *self, float_image_access_pattern_t access_pattern)
+{
+  int advice;
+  switch ( access_pattern ) {
+  case FLOAT_IMAGE_ACCESS_PATTERN_SEQUENTIAL:
+    advice = MADV_SEQUENTIAL;
+    break;
+  case FLOAT_IMAGE_ACCESS_PATTERN_RANDOM:
+    advice = MADV_RANDOM;
+    break;
+  default:
+    advice = MADV_NORMAL;
+    break;
+  }
+  madvise (self->mapping, self->mapping_length, advice);
+}
+#endif
+
+FloatImage *
+float_image_new_from_file_mapped (ssize_t size_x, ssize_t size_y,
+                                  const char *file, off_t offset,
+                                  float_image_byte_order_t byte_order,
+                                  float_image_access_pattern_t access_pattern)
+{
+  g_assert (size_x > 0 && size_y > 0);
+
+#ifdef win32
+  // No mmap() here, so the data has to be copied the usual way.
+  (void) access_pattern;
+  return float_image_new_from_file (size_x, size_y, file, offset, byte_order);
+#else
+  // Pixels which aren't aligned can't be used in place everywhere.
+  if ( offset % sizeof (float) != 0 ) {
+    return float_image_new_from_file (size_x, size_y, file, offset,
+                                      byte_order);
+  }
+
+  int fd = open (file, O_RDONLY);
+  if ( fd == -1 ) {
+    g_error ("Couldn't open file %s: %s", file, strerror (errno));
+  }
+
+  struct stat stat_buffer;
+  int return_code = fstat (fd, &stat_buffer);
+  g_assert (return_code == 0);
+
+  size_t image_bytes = (size_t) size_x * size_y * sizeof (float);
+  if ( stat_buffer.st_size < offset + (off_t) image_bytes ) {
+    asfPrintError ("File %s is too small to hold a %dx%d pixel float image "
+                   "at offset %lld\n", file, (int) size_x, (int) size_y,
+                   (long long) offset);
+  }
+
+  FloatImage *self = g_new0 (FloatImage, 1);
+  self->size_x = size_x;
+  self->size_y = size_y;
+
+  // Mappings have to start on a page boundary, so we may have to map
+  // a bit of whatever precedes the image data as well.
+  off_t page_size = sysconf (_SC_PAGESIZE);
+  off_t map_offset = offset - offset % page_size;
+  self->mapping_length = image_bytes + (size_t) (offset - map_offset);
+
+  // The mapping is private, so pixels which get set end up in
+  // anonymous copies of their pages and the file is left alone.
+  self->mapping = mmap (NULL, self->mapping_length, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE, fd, map_offset);
+  if ( self->mapping == MAP_FAILED ) {
+    g_error ("Couldn't mmap file %s: %s", file, strerror (errno));
+  }
+  self->mapped_pixels
+    = (float *) ((char *) self->mapping + (offset - map_offset));
+  self->mapped_swap = non_native_byte_order (byte_order);
+  self->mapped_device = stat_buffer.st_dev;
+  self->mapped_inode = stat_buffer.st_ino;
+  advise_mapping (self, access_pattern);
+
+  // The mapping keeps the file alive without the descriptor.
+  return_code = close (fd);
+  g_assert (return_code == 0);
+
+  // There is no tiling or tile cache, but we remember the cache size
+  // to use if the image ever gets one (see float_image_set_cache_size).
+  self->cache_space = default_cache_size;
+  self->tile_file = NULL;
+  self->concurrent = FALSE;
+  g_mutex_init (&(self->tile_file_lock));
+
+  // Objects are born with one reference.
+  self->reference_count = 1;
+
+  return self;
+#endif
+}
+
+// Get rid of the mapping of a memory mapped image.
+static void
+release_mapping (FloatImage *self)
+{
+#ifndef win32
+  int return_code = munmap (self->mapping, self->mapping_length);
+  g_assert (return_code == 0);
+#endif
+  self->mapping = NULL;
+  self->mapping_length = 0;
+  self->mapped_pixels = NULL;
+}
+
+// Return true iff self is memory mapped from file.
+static gboolean
+is_mapped_from (FloatImage *self, const char *file)
+{
+  if ( self->mapping == NULL ) {
+    return FALSE;
+  }
+  struct stat stat_buffer;
+#if GLIB_CHECK_VERSION(2, 6, 0)
+  int return_code = g_stat (file, &stat_buffer);
+#else
+  int return_code = stat (file, &stat_buffer);
+#endif
+  return (return_code == 0 && stat_buffer.st_dev == self->mapped_device
+          && stat_buffer.st_ino == self->mapped_inode);
+}
+
+// The "effective_height" of strip of tiles ii is the portion of the
+// strip for which data actually exists.  If the effective height is
+// less than self->tile>size, we will have to add some junk to fill up
+// the extra part of the tile (which should never be accessed).
+static size_t
+strip_effective_height (FloatImage *self, size_t ii)
+{
+  if ( ii < self->tile_count_y - 1 || self->size_y % self->tile_size == 0 ) {
+    return self->tile_size;
+  }
+  else {
+    return self->size_y % self->tile_size;
+  }
+}
+
+// Write strip of tiles ii to the tile file at the current position,
+// taking the data from buffer, which holds the image rows of the
+// strip one after the other.  The parts of the tiles which hang off
+// the image edges are filled from zero_line, which must be at least
+// max (self->size_x, self->tile_size) pixels long.
+static void
+store_tile_strip (FloatImage *self, size_t ii, const float *buffer,
+                  const float *zero_line)
+{
+  size_t effective_height = strip_effective_height (self, ii);
+
+  size_t jj;
+  for ( jj = 0 ; jj < self->tile_count_x ; jj++ ) {
+    // This is roughly analogous to effective_height.
+    size_t effective_width;
+    if ( jj < self->tile_count_x - 1
+         || self->size_x % self->tile_size == 0) {
+      effective_width = self->tile_size;
+    }
+    else {
+      effective_width = self->size_x % self->tile_size;
+    }
+    size_t write_count;     // For return of fwrite() calls.
+    size_t kk;
+    for ( kk = 0 ; kk < effective_height ; kk++ ) {
+      write_count
+        = fwrite (buffer + kk * self->size_x + jj * self->tile_size,
+                  sizeof (float), effective_width, self->tile_file);
+      // If we wrote less than expected,
+      if ( write_count < effective_width ) {
+        // it must have been a write error (probably no space left),
+        g_assert (ferror (self->tile_file));
+        // so print an error message,
+        fprintf (stderr,
+                 "Error writing tile cache file for FloatImage instance: "
+                 "%s\n", strerror (errno));
+        // and exit.
+        exit (EXIT_FAILURE);
+      }
+      if ( effective_width < self->tile_size ) {
+        // Amount we have left to write to fill out the last tile.
+        size_t edge_width = self->tile_size - effective_width;
+        write_count = fwrite (zero_line, sizeof (float), edge_width,
+                              self->tile_file);
+        // If we wrote less than expected,
+        if ( write_count < edge_width ) {
+          // it must have been a write error (probably no space left),
+          g_assert (ferror (self->tile_file));
+          // so print an error message,
+          fprintf (stderr,
+                   "Error writing tile cache file for FloatImage "
+                   "instance: %s\n", strerror (errno));
+          // and exit.
+          exit (EXIT_FAILURE);
+        }
+      }
+    }
+    // Finish writing the bottom of the tile for which there is no
+    // image data (should only happen if we are on the last strip of
+    // tiles).
+    for ( ; kk < self->tile_size ; kk++ ) {
+      g_assert (ii == self->tile_count_y - 1);
+      write_count = fwrite (zero_line, sizeof (float), self->tile_size,
+                            self->tile_file);
+      // If we wrote less than expected,
+      if ( write_count < self->tile_size ) {
+        // it must have been a write error (probably no space left),
+        g_assert (ferror (self->tile_file));
+        // so print an error message,
+        fprintf (stderr,
+                 "Error writing tile cache file for FloatImage instance: "
+                 "%s\n", strerror (errno));
+        // and exit.
+        exit (EXIT_FAILURE);
+      }
+    }
+  }
+}
+
 FloatImage *
 float_image_new_from_file_pointer (ssize_t size_x, ssize_t size_y,
                                    FILE *file_pointer, off_t offset,
@@ -760,18 +1059,8 @@ float_image_new_from_file_pointer (ssize_t size_x, ssize_t size_y,
       asfPercentMeter((float)ii/(self->tile_count_y-1));
 
       // The "effective_height" of the strip is the portion of the
-      // strip for which data actually exists.  If the effective
-      // height is less than self->tile>size, we will have to add some
-      // junk to fill up the extra part of the tile (which should
-      // never be accessed).
-      size_t effective_height;
-      if ( ii < self->tile_count_y - 1
-           || self->size_y % self->tile_size == 0 ) {
-        effective_height = self->tile_size;
-      }
-      else {
-        effective_height = self->size_y % self->tile_size;
-      }
+      // strip for which data actually exists.
+      size_t effective_height = strip_effective_height (self, ii);
       // Total area of the current strip.
       size_t strip_area = effective_height * self->size_x;
 
@@ -795,72 +1084,7 @@ float_image_new_from_file_pointer (ssize_t size_x, ssize_t size_y,
       }
 
       // Write data from the strip into the tile store.
-      size_t jj;
-      for ( jj = 0 ; jj < self->tile_count_x ; jj++ ) {
-        // This is roughly analogous to effective_height.
-        size_t effective_width;
-        if ( jj < self->tile_count_x - 1
-             || self->size_x % self->tile_size == 0) {
-          effective_width = self->tile_size;
-        }
-        else {
-          effective_width = self->size_x % self->tile_size;
-        }
-        size_t write_count;     // For return of fwrite() calls.
-        size_t kk;
-        for ( kk = 0 ; kk < effective_height ; kk++ ) {
-          write_count
-            = fwrite (buffer + kk * self->size_x + jj * self->tile_size,
-                      sizeof (float), effective_width, self->tile_file);
-          // If we wrote less than expected,
-          if ( write_count < effective_width ) {
-            // it must have been a write error (probably no space left),
-            g_assert (ferror (self->tile_file));
-            // so print an error message,
-            fprintf (stderr,
-                     "Error writing tile cache file for FloatImage instance: "
-                     "%s\n", strerror (errno));
-            // and exit.
-            exit (EXIT_FAILURE);
-          }
-          if ( effective_width < self->tile_size ) {
-            // Amount we have left to write to fill out the last tile.
-            size_t edge_width = self->tile_size - effective_width;
-            write_count = fwrite (zero_line, sizeof (float), edge_width,
-                                  self->tile_file);
-            // If we wrote less than expected,
-            if ( write_count < edge_width ) {
-              // it must have been a write error (probably no space left),
-              g_assert (ferror (self->tile_file));
-              // so print an error message,
-              fprintf (stderr,
-                       "Error writing tile cache file for FloatImage "
-                       "instance: %s\n", strerror (errno));
-              // and exit.
-              exit (EXIT_FAILURE);
-            }
-          }
-        }
-        // Finish writing the bottom of the tile for which there is no
-        // image data (should only happen if we are on the last strip of
-        // tiles).
-        for ( ; kk < self->tile_size ; kk++ ) {
-          g_assert (ii == self->tile_count_y - 1);
-          write_count = fwrite (zero_line, sizeof (float), self->tile_size,
-                                self->tile_file);
-          // If we wrote less than expected,
-          if ( write_count < self->tile_size ) {
-            // it must have been a write error (probably no space left),
-            g_assert (ferror (self->tile_file));
-            // so print an error message,
-            fprintf (stderr,
-                     "Error writing tile cache file for FloatImage instance: "
-                     "%s\n", strerror (errno));
-            // and exit.
-            exit (EXIT_FAILURE);
-          }
-        }
-      }
+      store_tile_strip (self, ii, buffer, zero_line);
     }
 
     // Did we write the correct total amount of data?
@@ -1141,11 +1365,36 @@ float_image_band_new_from_metadata(meta_parameters *meta,
     return fi;
 }
 
+// Returns a new FloatImage, for the image band corresponding to the
+// given metadata, mapped straight from the file where it can be.
+FloatImage *
+float_image_band_new_from_metadata_mapped(meta_parameters *meta,
+           int band, const char *file)
+{
+    int nl = meta->general->line_count;
+    int ns = meta->general->sample_count;
+
+    // Single precision data that doesn't need converting from dB can
+    // be used straight from the file.
+    if (meta->general->data_type == REAL32 &&
+        !(meta->general->radiometry >= r_SIGMA_DB &&
+          meta->general->radiometry <= r_GAMMA_DB))
+      return float_image_new_from_file_mapped(ns, nl, file,
+                 (off_t)band * nl * ns * sizeof(float),
+                 meta->general->byte_order == LITTLE_ENDIAN_DATA ?
+                   FLOAT_IMAGE_BYTE_ORDER_LITTLE_ENDIAN :
+                   FLOAT_IMAGE_BYTE_ORDER_BIG_ENDIAN,
+                 FLOAT_IMAGE_ACCESS_PATTERN_NORMAL);
+
+    return float_image_band_new_from_metadata(meta, band, file);
+}
+
 // Copy the contents of tile with flattened offset tile_offset from
-// the memory cache to the disk file.  Its probably easiest to
-// understand this function by looking at how its used.
+// the memory cache at tile_address to the disk file.  Its probably
+// easiest to understand this function by looking at how its used.
 static void
-cached_tile_to_disk (FloatImage *self, size_t tile_offset)
+cached_tile_to_disk (FloatImage *self, size_t tile_offset,
+                     const float *tile_address)
 {
   // If we aren't using a tile file, this operation doesn't make
   // sense.
@@ -1154,79 +1403,70 @@ cached_tile_to_disk (FloatImage *self, size_t tile_offset)
   // We must have a legitimate tile_offset.
   g_assert (tile_offset < self->tile_count);
 
-  // The tile we are trying to copy from cache to disk must be loaded
-  // in the cache for this operation to make sense.
-  g_assert (self->tile_addresses[tile_offset] != NULL);
+  off_t file_offset = (off_t) tile_offset * self->tile_area * sizeof (float);
 
-  int return_code
-    = FSEEK64 (self->tile_file,
-        (off_t) tile_offset * self->tile_area * sizeof (float),
-        SEEK_SET);
-  g_assert (return_code == 0);
-  size_t write_count = fwrite (self->tile_addresses[tile_offset],
-             sizeof (float), self->tile_area,
-             self->tile_file);
-  g_assert (write_count == self->tile_area);
-}
+#ifndef win32
+  // In concurrent access mode several threads may be writing tiles at
+  // once, so we use positioned writes on the underlying descriptor
+  // instead of sharing the stream position.
+  if ( self->concurrent ) {
+    size_t byte_count = self->tile_area * sizeof (float);
+    ssize_t write_count = pwrite (fileno (self->tile_file), tile_address,
+                                  byte_count, file_offset);
+    if ( write_count < 0 ) {
+      perror ("error writing tile cache file");
+      g_assert_not_reached ();
+    }
+    g_assert ((size_t) write_count == byte_count);
+    return;
+  }
+#endif
 
-// Return true iff tile (x, y) is already loaded into the memory cache.
-static gboolean
-tile_is_loaded (FloatImage *self, ssize_t x, ssize_t y)
-{
-  g_assert (    x >= 0 && (size_t) x < self->tile_count_x
-             && y >= 0 && (size_t) y < self->tile_count_y );
+  if ( self->concurrent ) {
+    g_mutex_lock (&(self->tile_file_lock));
+  }
 
-  size_t tile_offset = self->tile_count_x * y + x;
+  int return_code = FSEEK64 (self->tile_file, file_offset, SEEK_SET);
+  g_assert (return_code == 0);
+  size_t write_count = fwrite (tile_address, sizeof (float), self->tile_area,
+                               self->tile_file);
+  g_assert (write_count == self->tile_area);
 
-  return self->tile_addresses[tile_offset] != NULL;
+  if ( self->concurrent ) {
+    g_mutex_unlock (&(self->tile_file_lock));
+  }
 }
 
-// Load (currently unloaded) tile (x, y) from disk cache into memory
-// cache, possibly displacing the oldest tile already loaded, updating
-// the load order queue, and returning the address of the tile loaded.
-static float *
-load_tile (FloatImage *self, ssize_t x, ssize_t y)
+// Read the contents of tile with flattened offset tile_offset from
+// the disk file into the memory cache at tile_address.
+static void
+disk_tile_to_cache (FloatImage *self, size_t tile_offset, float *tile_address)
 {
-  // Make sure we haven't screwed up somehow and not created a tile
-  // file when in fact we should have.
   g_assert (self->tile_file != NULL);
+  g_assert (tile_offset < self->tile_count);
 
-  g_assert (!tile_is_loaded (self, x, y));
-
-  // Address into which tile gets loaded (to be returned).
-  float *tile_address;
-
-  // Offset of tile in flattened array.
-  size_t tile_offset = self->tile_count_x * y + x;
+  off_t file_offset = (off_t) tile_offset * self->tile_area * sizeof (float);
 
-  // We have to check and see if we have to displace an already loaded
-  // tile or not.
-  if ( self->tile_queue->length == self->cache_size_in_tiles ) {
-    // Displace tile loaded longest ago.
-    size_t oldest_tile
-      = GPOINTER_TO_INT (g_queue_pop_tail (self->tile_queue));
-    cached_tile_to_disk (self, oldest_tile);
-    tile_address = self->tile_addresses[oldest_tile];
-    self->tile_addresses[oldest_tile] = NULL;
-  }
-  else {
-    // Load tile into first free slot.
-    tile_address = self->cache + self->tile_queue->length * self->tile_area;
+#ifndef win32
+  // See the comment in cached_tile_to_disk.
+  if ( self->concurrent ) {
+    size_t byte_count = self->tile_area * sizeof (float);
+    ssize_t read_count = pread (fileno (self->tile_file), tile_address,
+                                byte_count, file_offset);
+    if ( read_count < 0 ) {
+      perror ("error reading tile cache file");
+      g_assert_not_reached ();
+    }
+    g_assert ((size_t) read_count == byte_count);
+    return;
   }
+#endif
 
-  // Put the new tile address into the index, and put the index into
-  // the load order queue.
-  self->tile_addresses[tile_offset] = tile_address;
-  // Stash in queue by converting to a pointer (so it must fit in an int).
-  g_assert (tile_offset < INT_MAX);
-  g_queue_push_head (self->tile_queue,
-                     GINT_TO_POINTER ((int) tile_offset));
+  if ( self->concurrent ) {
+    g_mutex_lock (&(self->tile_file_lock));
+  }
 
-  // Load the tile data.
-  int return_code
-    = FSEEK64 (self->tile_file,
-              (off_t) tile_offset * self->tile_area * sizeof (float),
-              SEEK_SET);
+  int return_code = FSEEK64 (self->tile_file, file_offset, SEEK_SET);
   g_assert (return_code == 0);
   clearerr (self->tile_file);
   size_t read_count = fread (tile_address, sizeof (float), self->tile_area,
@@ -1245,9 +1485,242 @@ load_tile (FloatImage *self, ssize_t x, ssize_t y)
   }
   g_assert (read_count == self->tile_area);
 
+  if ( self->concurrent ) {
+    g_mutex_unlock (&(self->tile_file_lock));
+  }
+}
+
+// The cache shard responsible for tile with flattened offset tile_offset.
+static FloatImageCacheShard *
+tile_shard (FloatImage *self, size_t tile_offset)
+{
+  return &(self->shards[tile_offset % self->shard_count]);
+}
+
+// Choose a tile in shard to displace using the CLOCK algorithm,
+// writing it back to the disk cache if it is dirty, and return the
+// index of the cache slot it occupied.  In concurrent access mode the
+// caller must hold the shard lock.
+static size_t
+evict_tile (FloatImage *self, FloatImageCacheShard *shard)
+{
+  // The hand sweeps round the slots of the shard.  Tiles which have
+  // been accessed since the hand last passed get their reference bit
+  // cleared and a second chance, the first unreferenced tile which
+  // isn't pinned goes.
+  size_t examined = 0;
+  for ( ; ; ) {
+    size_t slot = shard->clock_hand;
+    shard->clock_hand = (shard->clock_hand + 1) % shard->slot_count;
+    size_t tile_offset = shard->slot_tiles[slot];
+    FloatImageTileState *state = &(self->tile_states[tile_offset]);
+    float *tile_address = shard->slots + slot * self->tile_area;
+
+    if ( g_atomic_int_get (&(state->referenced)) ) {
+      g_atomic_int_set (&(state->referenced), FALSE);
+    }
+    else {
+      // Unpublish the tile, then make sure nobody has pinned it.
+      // Readers pin a tile before they look at its address, so
+      // either we see their pin here, or they see the NULL address
+      // and queue up behind the shard lock we are holding.
+      g_atomic_pointer_set (&(self->tile_addresses[tile_offset]), NULL);
+      if ( g_atomic_int_get (&(state->pins)) == 0 ) {
+        // Tiles which have only been read are already on disk.
+        if ( g_atomic_int_get (&(state->dirty)) ) {
+          cached_tile_to_disk (self, tile_offset, tile_address);
+          state->dirty = FALSE;
+          shard->writebacks++;
+        }
+        else {
+          shard->clean_evictions++;
+        }
+        return slot;
+      }
+      g_atomic_pointer_set (&(self->tile_addresses[tile_offset]),
+                            tile_address);
+    }
+
+    // Two full turns of the hand clear every reference bit, so if we
+    // still haven't found anything every tile in the shard is pinned.
+    // That can only happen when other threads are in the middle of
+    // using them, so wait for one of them to let go.
+    if ( ++examined % (2 * shard->slot_count) == 0 ) {
+      g_assert (self->concurrent);
+      g_thread_yield ();
+    }
+  }
+}
+
+// Load (currently unloaded) tile with flattened offset tile_offset
+// from disk cache into its shard of the memory cache, possibly
+// displacing a tile already loaded in the shard, and returning the
+// address of the tile loaded.  In concurrent access mode the caller
+// must hold the shard lock.
+static float *
+load_tile (FloatImage *self, size_t tile_offset)
+{
+  // Make sure we haven't screwed up somehow and not created a tile
+  // file when in fact we should have.
+  g_assert (self->tile_file != NULL);
+
+  g_assert (tile_offset < self->tile_count);
+  g_assert (self->tile_addresses[tile_offset] == NULL);
+
+  FloatImageCacheShard *shard = tile_shard (self, tile_offset);
+
+  // We have to check and see if we have to displace an already loaded
+  // tile or not.
+  size_t slot;
+  if ( shard->loaded_count == shard->slot_count ) {
+    slot = evict_tile (self, shard);
+  }
+  else {
+    // Load tile into first free slot.
+    slot = shard->loaded_count++;
+  }
+
+  // Address into which tile gets loaded (to be returned).
+  float *tile_address = shard->slots + slot * self->tile_area;
+
+  // Load the tile data.
+  disk_tile_to_cache (self, tile_offset, tile_address);
+  shard->misses++;
+
+  // Remember which tile is in the slot (the tile number must fit in
+  // an int), and count it as just referenced.
+  g_assert (tile_offset < INT_MAX);
+  shard->slot_tiles[slot] = (gint) tile_offset;
+  FloatImageTileState *state = &(self->tile_states[tile_offset]);
+  g_atomic_int_set (&(state->referenced), TRUE);
+  g_assert (!state->dirty);
+
+  // Put the new tile address into the index.  This is done last since
+  // in concurrent access mode other threads may pick it up at any
+  // time without locking.
+  g_atomic_pointer_set (&(self->tile_addresses[tile_offset]), tile_address);
+
   return tile_address;
 }
 
+// Pin the tile with flattened offset tile_offset, loading it first if
+// necessary, and return its address.  Pinned tiles aren't evicted
+// until they are unpinned again.  This is the concurrent access mode
+// equivalent of looking the address up in self->tile_addresses.
+static float *
+pin_tile (FloatImage *self, size_t tile_offset)
+{
+  FloatImageTileState *state = &(self->tile_states[tile_offset]);
+
+  // The pin must be in place before we look at the address (see the
+  // comment in evict_tile).
+  g_atomic_int_inc (&(state->pins));
+  float *tile_address
+    = g_atomic_pointer_get (&(self->tile_addresses[tile_offset]));
+  if ( G_LIKELY (tile_address != NULL) ) {
+    // Counting hits in the shard rather than the instance spreads the
+    // atomic traffic out a bit.  Images without a tile file have no
+    // shards, and their hits aren't counted.
+    if ( self->shard_count > 0 ) {
+      g_atomic_int_inc (&(tile_shard (self, tile_offset)->concurrent_hits));
+    }
+    if ( !g_atomic_int_get (&(state->referenced)) ) {
+      g_atomic_int_set (&(state->referenced), TRUE);
+    }
+    return tile_address;
+  }
+
+  // Not resident, so we have to load it, which only involves the lock
+  // of the shard the tile belongs to.  Some other thread may have
+  // beaten us to it while we waited for the lock.
+  FloatImageCacheShard *shard = tile_shard (self, tile_offset);
+  g_mutex_lock (&(shard->lock));
+  tile_address = self->tile_addresses[tile_offset];
+  if ( tile_address == NULL ) {
+    tile_address = load_tile (self, tile_offset);
+    // Fold the lock free hit count into the 64 bit total while we
+    // hold the lock anyway.  The running count is treated as
+    // unsigned, so it only has to be folded every four billion hits.
+    gint new_hits = g_atomic_int_get (&(shard->concurrent_hits));
+    g_atomic_int_add (&(shard->concurrent_hits), -new_hits);
+    shard->hits += (guint) new_hits;
+  }
+  g_mutex_unlock (&(shard->lock));
+
+  return tile_address;
+}
+
+// Release a pin taken with pin_tile.
+static void
+unpin_tile (FloatImage *self, size_t tile_offset)
+{
+  g_atomic_int_add (&(self->tile_states[tile_offset].pins), -1);
+}
+
+// Get the address of the tile with flattened offset tile_offset,
+// loading it first if necessary.  In concurrent access mode the tile
+// is pinned, so the caller must hand it back with release_tile when
+// done with it.
+static float *
+acquire_tile (FloatImage *self, size_t tile_offset)
+{
+  if ( G_UNLIKELY (self->concurrent) ) {
+    return pin_tile (self, tile_offset);
+  }
+
+  float *tile_address = self->tile_addresses[tile_offset];
+  if ( G_UNLIKELY (tile_address == NULL) ) {
+    tile_address = load_tile (self, tile_offset);
+  }
+  else {
+    self->cache_hits++;
+    self->tile_states[tile_offset].referenced = TRUE;
+  }
+
+  return tile_address;
+}
+
+// Hand back a tile obtained with acquire_tile, marking it dirty if
+// the caller has set any of its pixels.
+static void
+release_tile (FloatImage *self, size_t tile_offset, gboolean dirtied)
+{
+  FloatImageTileState *state = &(self->tile_states[tile_offset]);
+
+  // In concurrent access mode the tile must be marked dirty before
+  // the pin is released, or it could be evicted without being written.
+  if ( G_UNLIKELY (self->concurrent) ) {
+    if ( dirtied && !g_atomic_int_get (&(state->dirty)) ) {
+      g_atomic_int_set (&(state->dirty), TRUE);
+    }
+    unpin_tile (self, tile_offset);
+  }
+  else if ( dirtied ) {
+    state->dirty = TRUE;
+  }
+}
+
+// Pixel access for memory mapped images, where pixels are stored in
+// the byte order of the source file.
+static float
+get_mapped_pixel (FloatImage *self, size_t x, size_t y)
+{
+  float value = self->mapped_pixels[y * self->size_x + x];
+  if ( self->mapped_swap ) {
+    swap_bytes_32 ((unsigned char *) &value);
+  }
+  return value;
+}
+
+static void
+set_mapped_pixel (FloatImage *self, size_t x, size_t y, float value)
+{
+  if ( self->mapped_swap ) {
+    swap_bytes_32 ((unsigned char *) &value);
+  }
+  self->mapped_pixels[y * self->size_x + x] = value;
+}
+
 float
 float_image_get_pixel (FloatImage *self, ssize_t x, ssize_t y)
 {
@@ -1261,6 +1734,11 @@ float_image_get_pixel (FloatImage *self, ssize_t x, ssize_t y)
               "Invalid pixel index in the y dimension\n",
               (int)y, (int)y, (int)(self->size_y));
 
+  // Mapped images don't have tiles.
+  if ( self->mapping != NULL ) {
+    return get_mapped_pixel (self, x, y);
+  }
+
   // Get the pixel coordinates, including tile and pixel-in-tile.
   g_assert (sizeof (long int) >= sizeof (size_t));
   ldiv_t pc_x = ldiv (x, self->tile_size), pc_y = ldiv (y, self->tile_size);
@@ -1268,17 +1746,15 @@ float_image_get_pixel (FloatImage *self, ssize_t x, ssize_t y)
   // Offset of tile x, y, where tiles are viewed as pixels normally are.
   size_t tile_offset = self->tile_count_x * pc_y.quot + pc_x.quot;
 
-  // Address of data for tile containing pixel of interest (may still
-  // have to be loaded from disk cache).
-  float *tile_address = self->tile_addresses[tile_offset];
-
-  // Load the tile containing the pixel of interest if necessary.
-  if ( G_UNLIKELY (tile_address == NULL) ) {
-    tile_address = load_tile (self, pc_x.quot, pc_y.quot);
-  }
+  // Address of data for tile containing pixel of interest (loaded
+  // from the disk cache if necessary).
+  float *tile_address = acquire_tile (self, tile_offset);
 
   // Return pixel of interest.
-  return tile_address[self->tile_size * pc_y.rem + pc_x.rem];
+  float value = tile_address[self->tile_size * pc_y.rem + pc_x.rem];
+  release_tile (self, tile_offset, FALSE);
+
+  return value;
 }
 
 void
@@ -1288,6 +1764,12 @@ float_image_set_pixel (FloatImage *self, ssize_t x, ssize_t y, float value)
   g_assert (x >= 0 && (size_t) x <= self->size_x);
   g_assert (y >= 0 && (size_t) y <= self->size_y);
 
+  // Mapped images don't have tiles.
+  if ( self->mapping != NULL ) {
+    set_mapped_pixel (self, x, y, value);
+    return;
+  }
+
   // Get the pixel coordinates, including tile and pixel-in-tile.
   g_assert (sizeof (long int) >= sizeof (size_t));
   ldiv_t pc_x = ldiv (x, self->tile_size), pc_y = ldiv (y, self->tile_size);
@@ -1295,17 +1777,78 @@ float_image_set_pixel (FloatImage *self, ssize_t x, ssize_t y, float value)
   // Offset of tile x, y, where tiles are viewed as pixels normally are.
   size_t tile_offset = self->tile_count_x * pc_y.quot + pc_x.quot;
 
-  // Address of data for tile containing pixel of interest (may still
-  // have to be loaded from disk cache).
-  float *tile_address = self->tile_addresses[tile_offset];
+  // Address of data for tile containing pixel of interest (loaded
+  // from the disk cache if necessary).
+  float *tile_address = acquire_tile (self, tile_offset);
 
-  // Load the tile containing the pixel of interest if necessary.
-  if ( G_UNLIKELY (tile_address == NULL) ) {
-    tile_address = load_tile (self, pc_x.quot, pc_y.quot);
+  // Set pixel of interest, remembering that the tile will need to be
+  // written back.
+  tile_address[self->tile_size * pc_y.rem + pc_x.rem] = value;
+  release_tile (self, tile_offset, TRUE);
+}
+
+// Copy the size_x by size_y region with upper left corner at x, y
+// between the image and buffer, which holds the rows of the region
+// one after the other.  If store is true the pixels go into the
+// image, otherwise they come out of it.  The work is done a tile at
+// a time, with one memcpy for each row of the region in the tile.
+static void
+transfer_region (FloatImage *self, size_t x, size_t y, size_t size_x,
+                 size_t size_y, float *buffer, gboolean store)
+{
+  if ( size_x == 0 || size_y == 0 ) {
+    return;
   }
 
-  // Set pixel of interest.
-  tile_address[self->tile_size * pc_y.rem + pc_x.rem] = value;
+  size_t ii;
+
+  // Mapped images are stored just like the buffer, except for maybe
+  // the byte order.
+  if ( self->mapping != NULL ) {
+    for ( ii = 0 ; ii < size_y ; ii++ ) {
+      float *image_row = self->mapped_pixels + (y + ii) * self->size_x + x;
+      float *buffer_row = buffer + ii * size_x;
+      float *destination = store ? image_row : buffer_row;
+      memcpy (destination, store ? buffer_row : image_row,
+              size_x * sizeof (float));
+      if ( self->mapped_swap ) {
+        size_t jj;
+        for ( jj = 0 ; jj < size_x ; jj++ ) {
+          swap_bytes_32 ((unsigned char *) &(destination[jj]));
+        }
+      }
+    }
+    return;
+  }
+
+  size_t ts = self->tile_size;   // Convenience alias.
+  size_t tx, ty;                 // Tile indicies.
+  for ( ty = y / ts ; ty * ts < y + size_y ; ty++ ) {
+    // Image rows of the region which lie in this strip of tiles.
+    size_t row_start = MAX (y, ty * ts);
+    size_t row_end = MIN (y + size_y, (ty + 1) * ts);
+    for ( tx = x / ts ; tx * ts < x + size_x ; tx++ ) {
+      // Image columns of the region which lie in this tile.
+      size_t column_start = MAX (x, tx * ts);
+      size_t column_end = MIN (x + size_x, (tx + 1) * ts);
+      size_t row_bytes = (column_end - column_start) * sizeof (float);
+
+      size_t tile_offset = ty * self->tile_count_x + tx;
+      float *tile_address = acquire_tile (self, tile_offset);
+      for ( ii = row_start ; ii < row_end ; ii++ ) {
+        float *tile_row = (tile_address + (ii - ty * ts) * ts
+                           + (column_start - tx * ts));
+        float *buffer_row = buffer + (ii - y) * size_x + (column_start - x);
+        if ( store ) {
+          memcpy (tile_row, buffer_row, row_bytes);
+        }
+        else {
+          memcpy (buffer_row, tile_row, row_bytes);
+        }
+      }
+      release_tile (self, tile_offset, store);
+    }
+  }
 }
 
 void
@@ -1321,24 +1864,19 @@ float_image_get_region (FloatImage *self, ssize_t x, ssize_t y, ssize_t size_x,
   g_assert (y >= 0);
   g_assert ((size_t) y + (size_t) size_y - 1 < self->size_y);
 
-  ssize_t ii, jj;               // Index variables.
-  for ( ii = 0 ; ii < size_y ; ii++ ) {
-    for ( jj = 0 ; jj < size_x ; jj++ ) {
-      // We are essentially returning a subimage from the big image.
-      // These are the indicies in the big image (self) of the current
-      // pixel.
-      size_t ix = x + jj, iy = y + ii;
-      buffer[ii * size_x + jj] = float_image_get_pixel (self, ix, iy);
-    }
-  }
+  transfer_region (self, x, y, size_x, size_y, buffer, FALSE);
 }
 
 void
-float_image_set_region (FloatImage* UNUSED(self),
-                        size_t UNUSED(x), size_t UNUSED(y), size_t UNUSED(size_x),
-                        size_t UNUSED(size_y), float *UNUSED(buffer))
+float_image_set_region (FloatImage *self, size_t x, size_t y, size_t size_x,
+                        size_t size_y, float *buffer)
 {
-  g_assert_not_reached ();      // Stubbed out for now.
+  g_assert (self->reference_count > 0); // Harden against missed ref=1 in new
+
+  g_assert (x + size_x <= self->size_x);
+  g_assert (y + size_y <= self->size_y);
+
+  transfer_region (self, x, y, size_x, size_y, buffer, TRUE);
 }
 
 void
@@ -1347,6 +1885,58 @@ float_image_get_row (FloatImage *self, size_t row, float *buffer)
   float_image_get_region (self, 0, row, self->size_x, 1, buffer);
 }
 
+void
+float_image_set_row (FloatImage *self, size_t row, float *buffer)
+{
+  float_image_set_region (self, 0, row, self->size_x, 1, buffer);
+}
+
+const float *
+float_image_borrow_block (FloatImage *self, ssize_t x, ssize_t y,
+                          ssize_t size_x, ssize_t size_y, size_t *stride)
+{
+  g_assert (self->reference_count > 0); // Harden against missed ref=1 in new
+
+  g_assert (x >= 0 && size_x > 0 && (size_t) (x + size_x) <= self->size_x);
+  g_assert (y >= 0 && size_y > 0 && (size_t) (y + size_y) <= self->size_y);
+
+  // Mapped images can lend out anything, so long as the pixels don't
+  // need their bytes swapping.
+  if ( self->mapping != NULL ) {
+    if ( self->mapped_swap ) {
+      return NULL;
+    }
+    *stride = self->size_x;
+    return self->mapped_pixels + y * self->size_x + x;
+  }
+
+  // Otherwise the block has to lie within a single tile.
+  size_t ts = self->tile_size;   // Convenience alias.
+  size_t tx = x / ts, ty = y / ts;
+  if ( (x + size_x - 1) / ts != tx || (y + size_y - 1) / ts != ty ) {
+    return NULL;
+  }
+
+  // The tile stays pinned until the block is returned, whether or not
+  // we are in concurrent access mode.
+  size_t tile_offset = ty * self->tile_count_x + tx;
+  float *tile_address = pin_tile (self, tile_offset);
+
+  *stride = ts;
+  return tile_address + (y - ty * ts) * ts + (x - tx * ts);
+}
+
+void
+float_image_return_block (FloatImage *self, ssize_t x, ssize_t y)
+{
+  if ( self->mapping != NULL ) {
+    return;
+  }
+
+  size_t ts = self->tile_size;   // Convenience alias.
+  unpin_tile (self, (y / ts) * self->tile_count_x + x / ts);
+}
+
 float
 float_image_get_pixel_with_reflection (FloatImage *self, ssize_t x, ssize_t y)
 {
@@ -1672,6 +2262,90 @@ float_image_apply_kernel (FloatImage *self, ssize_t x, ssize_t y,
   return sum;
 }
 
+// Free parameters of the cubic convolution kernels used by the
+// bicubic sample methods.  Keys showed that -0.5 (which gives the
+// Catmull-Rom spline) is the most accurate choice, -0.75 gives a
+// sharper result with a bit more overshoot.
+static const double catmull_rom_parameter = -0.5;
+static const double sharp_cubic_parameter = -0.75;
+
+// Compute the weights of the four pixels around a point at fractional
+// offset t (0 <= t < 1) from the pixel below it, for the cubic
+// convolution kernel with parameter a.
+static void
+cubic_convolution_weights (double a, double t, double weights[4])
+{
+  // Distances 1 + t and 2 - t fall in the outer lobe of the kernel,
+  // t and 1 - t in the inner lobe.
+  double s = 1.0 + t;
+  weights[0] = ((a * s - 5.0 * a) * s + 8.0 * a) * s - 4.0 * a;
+  s = t;
+  weights[1] = ((a + 2.0) * s - (a + 3.0)) * s * s + 1.0;
+  s = 1.0 - t;
+  weights[2] = ((a + 2.0) * s - (a + 3.0)) * s * s + 1.0;
+  s = 2.0 - t;
+  weights[3] = ((a * s - 5.0 * a) * s + 8.0 * a) * s - 4.0 * a;
+}
+
+// Fetch the four by four neighbourhood of pixels with upper left
+// corner at x, y into neighbourhood, using odd reflection for pixels
+// which lie outside the image.
+static void
+get_neighbourhood (FloatImage *self, ssize_t x, ssize_t y,
+                   float neighbourhood[16])
+{
+  if ( G_LIKELY (x >= 0 && (size_t) x + 4 <= self->size_x
+                 && y >= 0 && (size_t) y + 4 <= self->size_y) ) {
+    transfer_region (self, x, y, 4, 4, neighbourhood, FALSE);
+  }
+  else {
+    ssize_t ii, jj;
+    for ( ii = 0 ; ii < 4 ; ii++ ) {
+      for ( jj = 0 ; jj < 4 ; jj++ ) {
+        neighbourhood[ii * 4 + jj]
+          = float_image_get_pixel_with_reflection (self, x + jj, y + ii);
+      }
+    }
+  }
+}
+
+// Convolve a neighbourhood fetched with get_neighbourhood with the
+// separable cubic kernel with parameter a, centered at fractional
+// offsets tx, ty from the second pixel of the second row.
+static float
+cubic_convolution (const float neighbourhood[16], double a, double tx,
+                   double ty)
+{
+  double x_weights[4], y_weights[4];
+  cubic_convolution_weights (a, tx, x_weights);
+  cubic_convolution_weights (a, ty, y_weights);
+
+  double result = 0.0;
+  int ii;
+  for ( ii = 0 ; ii < 4 ; ii++ ) {
+    const float *row = neighbourhood + ii * 4;
+    result += y_weights[ii] * (x_weights[0] * row[0] + x_weights[1] * row[1]
+                               + x_weights[2] * row[2]
+                               + x_weights[3] * row[3]);
+  }
+
+  return (float) result;
+}
+
+// Sample self at x, y by cubic convolution with parameter a.
+// Everything is on the stack, so this is safe to use from several
+// threads at once.
+static float
+sample_cubic_convolution (FloatImage *self, float x, float y, double a)
+{
+  double xf = floor (x), yf = floor (y);
+
+  float neighbourhood[16];
+  get_neighbourhood (self, (ssize_t) xf - 1, (ssize_t) yf - 1, neighbourhood);
+
+  return cubic_convolution (neighbourhood, a, x - xf, y - yf);
+}
+
 float
 float_image_sample (FloatImage *self, float x, float y,
                     float_image_sample_method_t sample_method)
@@ -1691,37 +2365,45 @@ float_image_sample (FloatImage *self, float x, float y,
       // below, etc., where below is interpreted in the numerical
       // sense, not the image orientation sense.).
       size_t xb = floor (x), yb = floor (y), xa = ceil (x), ya = ceil (y);
-      size_t ts = self->tile_size;   // Convenience alias.
-      // Offset of xb, yb, etc. relative to tiles they lie in.
-      size_t xbto = xb % ts, ybto = yb % ts, xato = xa % ts, yato = ya % ts;
       // Values of points we are interpolating between.
       float ul, ur, ll, lr;
 
-      // If the points were are interpolating between don't span a
-      // tile edge, we load them straight from tile memory to save
-      // some time.
-      if ( G_LIKELY (   xbto != ts - 1 && xato != 0
-                     && ybto != ts - 1 && yato != 0) ) {
-        // The tile indicies.
-        size_t tx = xb / ts, ty = yb / ts;
-        // Tile offset in flattened list of tile addresses.
-        size_t tile_offset = ty * self->tile_count_x + tx;
-        float *tile_address = self->tile_addresses[tile_offset];
-        if ( G_UNLIKELY (tile_address == NULL) ) {
-          tile_address = load_tile (self, tx, ty);
-        }
-        ul = tile_address[ybto * self->tile_size + xbto];
-        ur = tile_address[ybto * self->tile_size + xato];
-        ll = tile_address[yato * self->tile_size + xbto];
-        lr = tile_address[yato * self->tile_size + xato];
+      // Mapped images can be read directly.
+      if ( self->mapping != NULL ) {
+        ul = get_mapped_pixel (self, xb, yb);
+        ur = get_mapped_pixel (self, xa, yb);
+        ll = get_mapped_pixel (self, xb, ya);
+        lr = get_mapped_pixel (self, xa, ya);
       }
       else {
-        // We are spanning a tile edge, so we just get the pixels
-        // using the inefficient but easy get_pixel method.
-        ul = float_image_get_pixel (self, floor (x), floor (y));
-        ur = float_image_get_pixel (self, ceil (x), floor (y));
-        ll = float_image_get_pixel (self, floor (x), ceil (y));
-        lr = float_image_get_pixel (self, ceil (x), ceil (y));
+        size_t ts = self->tile_size;   // Convenience alias.
+        // Offset of xb, yb, etc. relative to tiles they lie in.
+        size_t xbto = xb % ts, ybto = yb % ts, xato = xa % ts, yato = ya % ts;
+
+        // If the points were are interpolating between don't span a
+        // tile edge, we load them straight from tile memory to save
+        // some time.
+        if ( G_LIKELY (   xbto != ts - 1 && xato != 0
+                       && ybto != ts - 1 && yato != 0) ) {
+          // The tile indicies.
+          size_t tx = xb / ts, ty = yb / ts;
+          // Tile offset in flattened list of tile addresses.
+          size_t tile_offset = ty * self->tile_count_x + tx;
+          float *tile_address = acquire_tile (self, tile_offset);
+          ul = tile_address[ybto * self->tile_size + xbto];
+          ur = tile_address[ybto * self->tile_size + xato];
+          ll = tile_address[yato * self->tile_size + xbto];
+          lr = tile_address[yato * self->tile_size + xato];
+          release_tile (self, tile_offset, FALSE);
+        }
+        else {
+          // We are spanning a tile edge, so we just get the pixels
+          // using the inefficient but easy get_pixel method.
+          ul = float_image_get_pixel (self, floor (x), floor (y));
+          ur = float_image_get_pixel (self, ceil (x), floor (y));
+          ll = float_image_get_pixel (self, floor (x), ceil (y));
+          lr = float_image_get_pixel (self, ceil (x), ceil (y));
+        }
       }
 
       // Upper and lower values interpolated in the x direction.
@@ -1732,68 +2414,62 @@ float_image_sample (FloatImage *self, float x, float y,
     }
     break;
   case FLOAT_IMAGE_SAMPLE_METHOD_BICUBIC:
-    {
-      static gboolean first_time_through = TRUE;
-      // Splines in the x direction, and their lookup accelerators.
-      static double *x_indicies;
-      static double *values;
-      static gsl_spline **xss;
-      static gsl_interp_accel **xias;
-      // Spline between splines in the y direction, and lookup accelerator.
-      static double *y_spline_indicies;
-      static double *y_spline_values;
-      static gsl_spline *ys;
-      static gsl_interp_accel *yia;
-
-      // All these splines have size 4.
-      const size_t ss = 4;
-
-      size_t ii;                // Index variable.
-
-      if ( first_time_through ) {
-        // Allocate memory for the splines in the x direction.
-        x_indicies = g_new (double, ss);
-        values = g_new (double, ss);
-        xss = g_new (gsl_spline *, ss);
-        xias = g_new (gsl_interp_accel *, ss);
-        for ( ii = 0 ; ii < ss ; ii++ ) {
-          xss[ii] = gsl_spline_alloc (gsl_interp_cspline, ss);
-          xias[ii] = gsl_interp_accel_alloc ();
-        }
+    return sample_cubic_convolution (self, x, y, catmull_rom_parameter);
+    break;
+  case FLOAT_IMAGE_SAMPLE_METHOD_BICUBIC_SHARP:
+    return sample_cubic_convolution (self, x, y, sharp_cubic_parameter);
+    break;
+  default:
+    g_assert_not_reached ();
+    return -42;         // Reassure the compiler.
+  }
+}
 
-        // Allocate memory for the spline in the y direction.
-        y_spline_indicies = g_new (double, ss);
-        y_spline_values = g_new (double, ss);
-        ys = gsl_spline_alloc (gsl_interp_cspline, ss);
-        yia = gsl_interp_accel_alloc ();
-        first_time_through = FALSE;
-      }
+void
+float_image_sample_row (FloatImage *self, size_t count, const float *x,
+                        const float *y, float_image_sample_method_t sample_method,
+                        float *values)
+{
+  size_t ii;
 
-      // Get the values for the nearest 16 points.
-      size_t jj;                // Index variable.
-      for ( ii = 0 ; ii < ss ; ii++ ) {
-        for ( jj = 0 ; jj < ss ; jj++ ) {
-          x_indicies[jj] = floor (x) - 1 + jj;
-          values[jj]
-            = float_image_get_pixel_with_reflection (self, x_indicies[jj],
-                                                     floor (y) - 1 + ii);
+  switch ( sample_method ) {
+
+  case FLOAT_IMAGE_SAMPLE_METHOD_BICUBIC:
+  case FLOAT_IMAGE_SAMPLE_METHOD_BICUBIC_SHARP:
+    {
+      double a = (sample_method == FLOAT_IMAGE_SAMPLE_METHOD_BICUBIC
+                  ? catmull_rom_parameter : sharp_cubic_parameter);
+
+      // Consecutive points usually share their neighbourhood, or at
+      // least most of it, so we only fetch it when it moves.
+      float neighbourhood[16];
+      ssize_t nx = 0, ny = 0;   // Upper left corner of neighbourhood.
+      gboolean have_neighbourhood = FALSE;
+
+      for ( ii = 0 ; ii < count ; ii++ ) {
+        g_assert (x[ii] >= 0.0 && x[ii] <= (double) self->size_x - 1.0);
+        g_assert (y[ii] >= 0.0 && y[ii] <= (double) self->size_y - 1.0);
+
+        double xf = floor (x[ii]), yf = floor (y[ii]);
+        ssize_t cx = (ssize_t) xf - 1, cy = (ssize_t) yf - 1;
+        if ( !have_neighbourhood || cx != nx || cy != ny ) {
+          get_neighbourhood (self, cx, cy, neighbourhood);
+          nx = cx;
+          ny = cy;
+          have_neighbourhood = TRUE;
         }
-        gsl_spline_init (xss[ii], x_indicies, values, ss);
-      }
 
-      // Set up the spline that runs in the y direction.
-      for ( ii = 0 ; ii < ss ; ii++ ) {
-        y_spline_indicies[ii] = floor (y) - 1 + ii;
-        y_spline_values[ii] = gsl_spline_eval_check (xss[ii], x, xias[ii]);
+        values[ii] = cubic_convolution (neighbourhood, a, x[ii] - xf,
+                                        y[ii] - yf);
       }
-      gsl_spline_init (ys, y_spline_indicies, y_spline_values, ss);
-
-      return (float) gsl_spline_eval_check (ys, y, yia);
     }
     break;
+
   default:
-    g_assert_not_reached ();
-    return -42;         // Reassure the compiler.
+    for ( ii = 0 ; ii < count ; ii++ ) {
+      values[ii] = float_image_sample (self, x[ii], y[ii], sample_method);
+    }
+    break;
   }
 }
 
@@ -1875,11 +2551,20 @@ synchronize_tile_file_with_memory_cache (FloatImage *self)
   // sense.
   g_assert (self->tile_file != NULL);
 
-  guint ii;
-  for ( ii = 0 ; ii < self->tile_queue->length ; ii++ ) {
-    size_t tile_offset = GPOINTER_TO_INT (g_queue_peek_nth (self->tile_queue,
-                  ii));
-    cached_tile_to_disk (self, tile_offset);
+  // Only dirty tiles need to be written.
+  size_t ii;
+  for ( ii = 0 ; ii < self->shard_count ; ii++ ) {
+    FloatImageCacheShard *shard = &(self->shards[ii]);
+    size_t jj;
+    for ( jj = 0 ; jj < shard->loaded_count ; jj++ ) {
+      size_t tile_offset = shard->slot_tiles[jj];
+      if ( self->tile_states[tile_offset].dirty ) {
+        cached_tile_to_disk (self, tile_offset,
+                             self->tile_addresses[tile_offset]);
+        self->tile_states[tile_offset].dirty = FALSE;
+        shard->writebacks++;
+      }
+    }
   }
 }
 
@@ -1892,6 +2577,12 @@ float_image_freeze (FloatImage *self, FILE *file_pointer)
 
   g_assert (file_pointer != NULL);
 
+  // Frozen images are always tiled, so mapped images have to get a
+  // tile cache first.
+  if ( self->mapping != NULL ) {
+    float_image_set_cache_size (self, self->cache_space);
+  }
+
   size_t write_count = fwrite (&(self->size_x), sizeof (size_t), 1, fp);
   g_assert (write_count == 1);
 
@@ -1925,14 +2616,15 @@ float_image_freeze (FloatImage *self, FILE *file_pointer)
   // We don't bother serializing the cache -- its a pain to keep track
   // of and probably almost never worth it.
 
-  // We write the tile queue pointer away, so that when we later thaw
-  // the serialized version, we can tell if a cache file is in use or
-  // not (if it isn't tile_queue will be NULL).
-  write_count = fwrite (&(self->tile_queue), sizeof (GQueue *), 1, fp);
+  // We write a marker pointer away, so that when we later thaw the
+  // serialized version, we can tell if a cache file is in use or not
+  // (if it isn't the marker will be NULL).
+  gpointer tile_file_marker = self->tile_file;
+  write_count = fwrite (&tile_file_marker, sizeof (gpointer), 1, fp);
   g_assert (write_count == 1);
 
   // If there was no cache file...
-  if ( self->tile_queue == NULL ) {
+  if ( self->tile_file == NULL ) {
     // We store the contents of the first tile and are done.
     write_count = fwrite (self->tile_addresses[0], sizeof (float),
         self->tile_area, fp);
@@ -1988,6 +2680,11 @@ float_image_band_store(FloatImage *self, const char *file,
     byte_order = FLOAT_IMAGE_BYTE_ORDER_LITTLE_ENDIAN;
   */
 
+  // If we are being stored over the file we are mapped from, we need
+  // our own copy of the pixels before the file gets truncated.
+  if (is_mapped_from(self, file))
+    float_image_set_cache_size(self, self->cache_space);
+
   // Open the file to write to.
   FILE *fp = fopen (file, append_flag ? "ab" : "wb");
   // FIXME: we need some error handling and propagation here.
@@ -2677,16 +3374,192 @@ float_image_export_as_csv (FloatImage *self, const char * filename)
 }
 
 size_t
-float_image_get_cache_size (FloatImage * UNUSED(self))
+float_image_get_cache_size (FloatImage *self)
 {
-  g_assert_not_reached ();      // Stubbed out for now.
-  return 0;
+  g_assert (self->reference_count > 0); // Harden against missed ref=1 in new
+
+  return self->cache_space;
+}
+
+// Write every tile in the memory cache back to the disk cache, and
+// empty the memory cache.
+static void
+flush_tile_cache (FloatImage *self)
+{
+  synchronize_tile_file_with_memory_cache (self);
+
+  size_t ii;
+  for ( ii = 0 ; ii < self->shard_count ; ii++ ) {
+    FloatImageCacheShard *shard = &(self->shards[ii]);
+    size_t jj;
+    for ( jj = 0 ; jj < shard->loaded_count ; jj++ ) {
+      size_t tile_offset = shard->slot_tiles[jj];
+      g_assert (self->tile_states[tile_offset].pins == 0);
+      self->tile_states[tile_offset].referenced = FALSE;
+      self->tile_addresses[tile_offset] = NULL;
+    }
+    shard->loaded_count = 0;
+    shard->clock_hand = 0;
+  }
+}
+
+// Exchange the tilings, memory caches and tile files of a and b,
+// which must be images of the same size.
+static void
+swap_tile_caches (FloatImage *a, FloatImage *b)
+{
+  g_assert (a->size_x == b->size_x && a->size_y == b->size_y);
+
+  FloatImage tmp = *a;
+
+  a->cache_space = b->cache_space;
+  a->cache_area = b->cache_area;
+  a->tile_size = b->tile_size;
+  a->cache_size_in_tiles = b->cache_size_in_tiles;
+  a->tile_count_x = b->tile_count_x;
+  a->tile_count_y = b->tile_count_y;
+  a->tile_count = b->tile_count;
+  a->tile_area = b->tile_area;
+  a->cache = b->cache;
+  a->tile_addresses = b->tile_addresses;
+  a->tile_states = b->tile_states;
+  a->shard_count = b->shard_count;
+  a->shards = b->shards;
+  a->tile_file = b->tile_file;
+  a->tile_file_name = b->tile_file_name;
+
+  b->cache_space = tmp.cache_space;
+  b->cache_area = tmp.cache_area;
+  b->tile_size = tmp.tile_size;
+  b->cache_size_in_tiles = tmp.cache_size_in_tiles;
+  b->tile_count_x = tmp.tile_count_x;
+  b->tile_count_y = tmp.tile_count_y;
+  b->tile_count = tmp.tile_count;
+  b->tile_area = tmp.tile_area;
+  b->cache = tmp.cache;
+  b->tile_addresses = tmp.tile_addresses;
+  b->tile_states = tmp.tile_states;
+  b->shard_count = tmp.shard_count;
+  b->shards = tmp.shards;
+  b->tile_file = tmp.tile_file;
+  b->tile_file_name = tmp.tile_file_name;
+}
+
+void
+float_image_set_cache_size (FloatImage *self, size_t size)
+{
+  g_assert (self->reference_count > 0); // Harden against missed ref=1 in new
+
+  // The cache has to hold a whole number of pixels.
+  size -= size % sizeof (float);
+
+  // The tiling is worked out from scratch for the new cache size, so
+  // the easiest thing to do is to build a new instance with the new
+  // tiling, copy the pixels across a strip of tiles at a time, and
+  // then steal its cache.  This has to happen outside concurrent
+  // access mode, which we restore at the end.
+  gboolean concurrent = self->concurrent;
+  float_image_set_concurrent_access (self, FALSE);
+
+  FloatImage *copy
+    = initialize_float_image_structure_with_cache_space (self->size_x,
+                                                         self->size_y, size);
+
+  size_t ii;
+  if ( copy->tile_file != NULL ) {
+    float *zero_line = g_new0 (float, MAX (self->size_x, copy->tile_size));
+    float *buffer = g_new (float, copy->tile_size * self->size_x);
+    for ( ii = 0 ; ii < copy->tile_count_y ; ii++ ) {
+      size_t effective_height = strip_effective_height (copy, ii);
+      size_t jj;
+      for ( jj = 0 ; jj < effective_height ; jj++ ) {
+        float_image_get_row (self, ii * copy->tile_size + jj,
+                             buffer + jj * self->size_x);
+      }
+      store_tile_strip (copy, ii, buffer, zero_line);
+    }
+    g_free (buffer);
+    g_free (zero_line);
+  }
+  else {
+    copy->tile_addresses[0] = copy->cache;
+    for ( ii = 0 ; ii < self->size_y ; ii++ ) {
+      float_image_get_row (self, ii, copy->cache + ii * copy->tile_size);
+    }
+  }
+
+  // Swap the cache layouts of self and the copy, so that freeing the
+  // copy gets rid of the old one.  The statistics stay with self.
+  for ( ii = 0 ; ii < self->shard_count ; ii++ ) {
+    retire_shard_statistics (self, &(self->shards[ii]));
+  }
+  swap_tile_caches (self, copy);
+  float_image_free (copy);
+
+  // A mapped image now has its own tile cache, and doesn't need the
+  // file any more.
+  if ( self->mapping != NULL ) {
+    release_mapping (self);
+  }
+
+  float_image_set_concurrent_access (self, concurrent);
+}
+
+void
+float_image_get_cache_stats (FloatImage *self,
+                             float_image_cache_stats_t *stats)
+{
+  g_assert (self->reference_count > 0); // Harden against missed ref=1 in new
+
+  stats->hits = self->cache_hits;
+  stats->misses = self->cache_misses;
+  stats->writebacks = self->cache_writebacks;
+  stats->clean_evictions = self->cache_clean_evictions;
+
+  size_t ii;
+  for ( ii = 0 ; ii < self->shard_count ; ii++ ) {
+    FloatImageCacheShard *shard = &(self->shards[ii]);
+    stats->hits += (shard->hits
+                    + (guint) g_atomic_int_get (&(shard->concurrent_hits)));
+    stats->misses += shard->misses;
+    stats->writebacks += shard->writebacks;
+    stats->clean_evictions += shard->clean_evictions;
+  }
 }
 
 void
-float_image_set_cache_size (FloatImage * UNUSED(self), size_t UNUSED(size))
+float_image_set_concurrent_access (FloatImage *self, gboolean concurrent)
 {
-  g_assert_not_reached ();      // Stubbed out for now.
+  g_assert (self->reference_count > 0); // Harden against missed ref=1 in new
+
+  concurrent = (concurrent ? TRUE : FALSE);
+  if ( concurrent == self->concurrent ) {
+    return;
+  }
+
+  // Images which fit in a single tile never load or evict anything,
+  // so there is no cache to split up.
+  if ( self->tile_file != NULL ) {
+    flush_tile_cache (self);
+    free_tile_cache_shards (self);
+
+    size_t shard_count = 1;
+    if ( concurrent ) {
+      // A couple of shards per processor keeps lock contention low,
+      // but each shard needs a few slots of its own to be any use.
+      shard_count = MIN (2 * (size_t) g_get_num_processors (),
+                         self->cache_size_in_tiles / 4);
+      shard_count = MAX (shard_count, 1);
+    }
+    initialize_tile_cache_shards (self, shard_count);
+
+    // Concurrent mode does positioned I/O on the descriptor, which
+    // bypasses the stream buffer.
+    int return_code = fflush (self->tile_file);
+    g_assert (return_code == 0);
+  }
+
+  self->concurrent = concurrent;
 }
 
 FloatImage *
@@ -2722,14 +3595,18 @@ float_image_free (FloatImage *self)
   // Deallocate dynamic memory.
 
   g_free (self->tile_addresses);
+  g_free (self->tile_states);
 
-  // If we didn't need a tile file, we also won't have a tile queue.
-  if ( self->tile_queue != NULL ) {
-    g_queue_free (self->tile_queue);
-  }
+  // If we didn't need a tile file, we also won't have any shards.
+  free_tile_cache_shards (self);
+  g_mutex_clear (&(self->tile_file_lock));
 
   g_free (self->cache);
 
+  if ( self->mapping != NULL ) {
+    release_mapping (self);
+  }
+
   if (self->tile_file_name) {
 
       // On Windows (mingw), we delete the file now, since it isn't
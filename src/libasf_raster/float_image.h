@@ -5,8 +5,9 @@
 // accesses are spatially correlated.  A variety of useful methods are
 // implemented (filtering, subsetting, interpolating, etc.)
 //
-// Don't try to access the same instance concurrently.  Split your
-// images up into separate instances if you must parallelize things.
+// Don't try to access the same instance concurrently unless you have
+// first switched on concurrent access mode (see
+// float_image_set_concurrent_access below).
 //
 // For many methods, arguments of type ssize_t are used, but are not
 // allowed to be negative.  This is to help prevent people from
@@ -33,6 +34,28 @@
 #define SSIZE_MAX 32767
 #endif
 
+// Cache bookkeeping for a single tile.
+typedef struct {
+  gint pins;                // Pin count (pinned tiles stay put).
+  gint referenced;          // Accessed since the CLOCK hand last passed.
+  gint dirty;               // Cached copy differs from the tile file.
+} FloatImageTileState;
+
+// One independently locked part of the tile cache.  Tiles are
+// assigned to shards by flattened tile offset modulo the number of
+// shards, and each shard owns a fixed subset of the cache slots.  The
+// lock is only used in concurrent access mode.
+typedef struct {
+  GMutex lock;              // Guards the rest of the shard.
+  float *slots;             // First cache slot owned by this shard.
+  size_t slot_count;        // Number of cache slots owned by this shard.
+  gint *slot_tiles;         // Offset of tile held in each slot.
+  size_t loaded_count;      // Number of slots in use.
+  size_t clock_hand;        // Next slot for the CLOCK hand to examine.
+  gint concurrent_hits;     // Hits not yet added to hits (see .c file).
+  guint64 hits, misses, writebacks, clean_evictions; // Statistics.
+} FloatImageCacheShard;
+
 // Instance structure.  Everything here is private and need not be
 // used or understood by client code, except for the size_x and size_y
 // fields.
@@ -48,9 +71,23 @@ typedef struct {
   size_t tile_area;         // Area of a tile, in pixels.
   float *cache;             // Memory cache.
   float **tile_addresses;   // Addresss of individual tiles in the cache.
-  GQueue *tile_queue;       // Queue of tile offsets kept in load order.
+  FloatImageTileState *tile_states; // Per-tile cache bookkeeping.
+  size_t shard_count;       // Number of cache shards (0 if no tile file).
+  FloatImageCacheShard *shards; // The cache shards.
+  gboolean concurrent;      // True iff in concurrent access mode.
   FILE *tile_file;          // File with tiles stored contiguously.
+  GMutex tile_file_lock;    // Serializes tile file I/O where needed.
+  guint64 cache_hits;       // Statistics not kept in (or retired from)
+  guint64 cache_misses;     // the shards, see float_image_get_cache_stats.
+  guint64 cache_writebacks;
+  guint64 cache_clean_evictions;
   GString *tile_file_name;  // Name of the tile file
+  void *mapping;            // Mapped source file pages (NULL if not mapped).
+  size_t mapping_length;    // Length of mapping in bytes.
+  float *mapped_pixels;     // First pixel in mapping.
+  gboolean mapped_swap;     // True iff mapped pixels need byte swapping.
+  dev_t mapped_device;      // Identity of the mapped source file.
+  ino_t mapped_inode;
   int reference_count;      // For optional reference counting.
 } FloatImage;
 
@@ -125,6 +162,33 @@ FloatImage *
 float_image_new_from_file (ssize_t size_x, ssize_t size_y, const char *file,
                off_t offset, float_image_byte_order_t byte_order);
 
+// Expected pattern of pixel access, used to tune how the pages of
+// memory mapped images are read ahead.
+typedef enum {
+  FLOAT_IMAGE_ACCESS_PATTERN_NORMAL=1,
+  FLOAT_IMAGE_ACCESS_PATTERN_SEQUENTIAL,
+  FLOAT_IMAGE_ACCESS_PATTERN_RANDOM
+} float_image_access_pattern_t;
+
+// Like new_from_file, but instead of copying the data into a private
+// tile store, the file itself is memory mapped and the operating
+// system page cache does the caching, so creation takes no time at
+// all regardless of the image size.  The file is never modified:
+// pixels which are set are kept in private copies of the pages
+// involved, so images which are going to be mostly rewritten are
+// better created with new_from_file.  The file must not be truncated
+// or rewritten by anyone else while the instance exists (storing the
+// image back over its own source file is handled correctly though).
+// The access_pattern is passed on to the operating system as a hint.
+// Freezing a mapped image or changing its cache size gives it an
+// ordinary tile store first.  On platforms without mmap, this method
+// is the same as new_from_file.
+FloatImage *
+float_image_new_from_file_mapped (ssize_t size_x, ssize_t size_y,
+                                  const char *file, off_t offset,
+                                  float_image_byte_order_t byte_order,
+                                  float_image_access_pattern_t access_pattern);
+
 // The method is like new_from_file, but takes a file pointer instead
 // of a file name, and the offset argument is with respect to the
 // current position in the file_pointer stream.
@@ -157,6 +221,14 @@ FloatImage *
 float_image_band_new_from_metadata(meta_parameters *meta,
                    int band, const char *file);
 
+// Like band_new_from_metadata, but single precision data that doesn't
+// need converting is memory mapped (see new_from_file_mapped) instead
+// of being copied into a tile store.  Meant for images that are only
+// read; anything else comes out the same as from band_new_from_metadata.
+FloatImage *
+float_image_band_new_from_metadata_mapped(meta_parameters *meta,
+                   int band, const char *file);
+
 // Sample type of an image that is to be used to create a float_image
 // instance.  For example, floating point image can be created from
 // signed sixteen bit integer data.
@@ -208,9 +280,10 @@ void
 float_image_set_pixel (FloatImage *self, ssize_t x, ssize_t y, float value);
 
 // Get rectangular image region of size_x, size_y having upper left
-// corner at x, y and copy it into already allocated buffer.  There is
-// not necessarily any caching help for this method, i.e. it may
-// always involve disk access and always be slow.
+// corner at x, y and copy it into already allocated buffer.  The
+// region is copied a tile at a time, so this is much faster than
+// getting the pixels one by one, but it still goes through the cache
+// and may involve disk access for large regions.
 void
 float_image_get_region (FloatImage *self, ssize_t x, ssize_t y,
             ssize_t size_x, ssize_t size_y, float *buffer);
@@ -226,6 +299,30 @@ float_image_set_region (FloatImage *self, size_t x, size_t y, size_t size_x,
 void
 float_image_get_row (FloatImage *self, size_t row, float *buffer);
 
+// This method is analogous to float_image_get_row.
+void
+float_image_set_row (FloatImage *self, size_t row, float *buffer);
+
+// Borrow the size_x by size_y block of pixels with upper left corner
+// at x, y straight out of the memory cache, without copying it.
+// Pixel x + i, y + j of the image is at the returned address plus j *
+// (*stride) + i.  NULL is returned if the block can't be lent out in
+// one piece (usually because it straddles a tile edge), in which case
+// float_image_get_region should be used instead.  The block stays put
+// until it is handed back with float_image_return_block, but it must
+// be treated as read only, and pixels in it must not be set by anyone
+// in the meantime.  Only a few blocks should be borrowed at once, and
+// all of them must be returned before the cache setup is changed or
+// the image is frozen.
+const float *
+float_image_borrow_block (FloatImage *self, ssize_t x, ssize_t y,
+                          ssize_t size_x, ssize_t size_y, size_t *stride);
+
+// Return a block borrowed with float_image_borrow_block, which had its
+// upper left corner at x, y.
+void
+float_image_return_block (FloatImage *self, ssize_t x, ssize_t y);
+
 // Get a pixel, performing odd reflection at image edges if the pixel
 // indicies fall outside the image.  See the description of the
 // apply_kernel method for an explanation of reflection.
@@ -318,14 +415,34 @@ typedef enum {
   FLOAT_IMAGE_SAMPLE_METHOD_NEAREST_NEIGHBOR,
   // Linearly weited average of four nearest pixels
   FLOAT_IMAGE_SAMPLE_METHOD_BILINEAR,
-  // Bicubic spline interpolation (which consideres the nearest 16 pixels).
-  FLOAT_IMAGE_SAMPLE_METHOD_BICUBIC
+  // Bicubic interpolation (which consideres the nearest 16 pixels),
+  // using Keys cubic convolution with the Catmull-Rom kernel.
+  FLOAT_IMAGE_SAMPLE_METHOD_BICUBIC,
+  // Like FLOAT_IMAGE_SAMPLE_METHOD_BICUBIC, but using the Keys kernel
+  // with parameter -0.75, which gives a sharper result with a bit
+  // more overshoot.
+  FLOAT_IMAGE_SAMPLE_METHOD_BICUBIC_SHARP
 } float_image_sample_method_t;
 
+// Sample the image at the possibly fractional position x, y.  The
+// bicubic methods use odd reflection (see apply_kernel) for
+// neighbouring pixels which lie outside the image.  All the methods
+// keep their working storage on the stack, so they can be used from
+// several threads at once in concurrent access mode.
 float
 float_image_sample (FloatImage *self, float x, float y,
             float_image_sample_method_t sample_method);
 
+// Sample the image at count positions x[i], y[i], putting the results
+// in values.  This gives the same results as calling
+// float_image_sample for each position, but is faster for the
+// bicubic methods when neighbouring positions are close together, as
+// they are when resampling a row of output pixels.
+void
+float_image_sample_row (FloatImage *self, size_t count, const float *x,
+                        const float *y, float_image_sample_method_t sample_method,
+                        float *values);
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 // Comparing Images
@@ -478,9 +595,13 @@ float_image_export_as_csv (FloatImage *self, const char *file);
 //
 //      2. Otherwise, the tile containing the pixel is loaded,
 //         possibly displacing an already loaded tile, and then the
-//         pixel is fetched or set.  The tile displaced is the one
-//         loaded longest ago (there is no most-recently-accessed
-//         heuristic, as this would make pixel access too slow).
+//         pixel is fetched or set.  The tile displaced is chosen
+//         using the CLOCK approximation of least-recently-used: each
+//         access just sets a reference bit on the tile, and the
+//         eviction hand sweeps round the cache giving tiles with the
+//         bit set a second chance.  Only tiles which have been set
+//         since they were loaded are written back to the disk file,
+//         tiles which have only been read are simply dropped.
 //
 // Thus, using a larger memory cache will result in larger tiles being
 // used, and fewer tile loads being needed.  In general, the default
@@ -488,6 +609,10 @@ float_image_export_as_csv (FloatImage *self, const char *file);
 // widely (but not too widely) scattered accesses, you might want to
 // make it bigger.
 //
+// Memory mapped images (see float_image_new_from_file_mapped) don't
+// have a tile cache at all until they are given one by a call to
+// float_image_set_cache_size.
+//
 ///////////////////////////////////////////////////////////////////////////////
 
 // Get the image memory cache size setting, in bytes.  Note that this
@@ -500,9 +625,55 @@ float_image_get_cache_size (FloatImage *self);
 // Set the image memory cache to size bytes.  Changing the cache size
 // requires the tiling to be recomputed, the on-disk tile cache to be
 // regenerated, and the in memory cache to be flushed, so its slow.
+// The cache must be large enough to hold two full rows of tiles at
+// least four pixels on a side.
+// Memory mapped images are given an ordinary tile store of this size
+// and stop using their source file.
 void
 float_image_set_cache_size (FloatImage *self, size_t size);
 
+// Tile cache statistics, as returned by float_image_get_cache_stats.
+typedef struct {
+  guint64 hits;             // Pixel accesses served from the memory cache.
+  guint64 misses;           // Tiles loaded from the tile file.
+  guint64 writebacks;       // Dirty tiles written back to the tile file.
+  guint64 clean_evictions;  // Tiles evicted without needing a write.
+} float_image_cache_stats_t;
+
+// Get the cache statistics accumulated since the instance was
+// created.  Images which fit in a single tile never touch the disk,
+// and in concurrent access mode hits on them aren't counted.  Nothing
+// is counted for memory mapped images.
+void
+float_image_get_cache_stats (FloatImage *self,
+                             float_image_cache_stats_t *stats);
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Concurrent Access
+//
+// By default an instance may only be used by one thread at a time.
+// In concurrent access mode any number of threads may call the pixel,
+// region and sampling methods on the same instance at once.  The
+// memory cache is then split into several shards, each with its own
+// lock and its own share of the cache slots, so threads which miss in
+// different shards load tiles in parallel.  Tiles which are resident
+// are found without taking any lock at all.  A tile is pinned while a
+// thread is using it, and pinned tiles are never evicted.
+//
+// Threads writing the same pixel must still coordinate among
+// themselves, and the methods which create, store, freeze or free
+// instances, or which change the cache setup, must not be called
+// while other threads are using the instance.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Switch concurrent access mode on or off.  Switching flushes the
+// memory cache back to the tile file, so do it before the threads are
+// started, not while they are running.
+void
+float_image_set_concurrent_access (FloatImage *self, gboolean concurrent);
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 // Reference Counting or Freeing Instances
@@ -0,0 +1,194 @@
+#include "asf.h"
+#include "asf_meta.h"
+#include "asf_raster.h"
+#include <assert.h>
+#include <glib.h>
+#include <string.h>
+#ifndef win32
+#include <unistd.h>
+#endif
+
+// Images handed from one processing stage to the next.  They are kept
+// in memory as long as all of the live buffers together stay within
+// half of the physical memory, anything beyond that goes to a scratch
+// file in the asf tmp directory instead.  Every pixel is a float and
+// bands are stored one after the other, as in an ASF .img file.
+
+#ifdef win32
+#define FALLBACK_BUDGET (512*1024*1024LL)
+#endif
+
+G_LOCK_DEFINE_STATIC(image_buffer);
+static long long bytes_in_memory = 0;
+
+static long long memory_budget(void)
+{
+#ifdef win32
+  return FALLBACK_BUDGET;
+#else
+  return (long long)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE) / 2;
+#endif
+}
+
+static long long image_bytes(const image_buffer *b)
+{
+  return (long long)b->ns * b->nl * b->nb * sizeof(float);
+}
+
+static FILE *open_spill_file(char **name)
+{
+  static int count = 0;
+  const char *tmpdir = get_asf_tmp_dir();
+  int n = g_atomic_int_add(&count, 1);
+
+  *name = MALLOC(sizeof(char)*(strlen(tmpdir)+64));
+  sprintf(*name, "%s%cimage_buffer_%d_%d.img", tmpdir, DIR_SEPARATOR,
+          (int)getpid(), n);
+  return FOPEN(*name, "w+b");
+}
+
+image_buffer *image_buffer_new(int ns, int nl, int nb)
+{
+  image_buffer *b = MALLOC(sizeof(image_buffer));
+  long long bytes;
+  int reserved = FALSE;
+
+  b->ns = ns;
+  b->nl = nl;
+  b->nb = nb;
+  b->data = NULL;
+  b->spill = NULL;
+  b->spill_file = NULL;
+
+  bytes = image_bytes(b);
+  G_LOCK(image_buffer);
+  if (bytes_in_memory + bytes <= memory_budget()) {
+    bytes_in_memory += bytes;
+    reserved = TRUE;
+  }
+  G_UNLOCK(image_buffer);
+
+  if (reserved) {
+    b->data = g_try_malloc0(bytes);
+    if (!b->data) {
+      G_LOCK(image_buffer);
+      bytes_in_memory -= bytes;
+      G_UNLOCK(image_buffer);
+    }
+  }
+
+  if (!b->data) {
+    asfPrintStatus("Not enough memory for a %dx%d %d band image, "
+                   "using a scratch file instead.\n", nl, ns, nb);
+    b->spill = open_spill_file(&b->spill_file);
+  }
+
+  return b;
+}
+
+void image_buffer_free(image_buffer *b)
+{
+  if (!b)
+    return;
+  if (b->data) {
+    G_LOCK(image_buffer);
+    bytes_in_memory -= image_bytes(b);
+    G_UNLOCK(image_buffer);
+    g_free(b->data);
+  }
+  if (b->spill) {
+    FCLOSE(b->spill);
+    remove_file(b->spill_file);
+    FREE(b->spill_file);
+  }
+  FREE(b);
+}
+
+int image_buffer_in_memory(const image_buffer *b)
+{
+  return b->data != NULL;
+}
+
+static long long line_offset(const image_buffer *b, int band, int line)
+{
+  assert(band >= 0 && band < b->nb && line >= 0 && line < b->nl);
+  return ((long long)band*b->nl + line) * b->ns;
+}
+
+void image_buffer_put_line(image_buffer *b, int band, int line,
+                           const float *buf)
+{
+  long long off = line_offset(b, band, line);
+
+  if (b->data) {
+    memcpy(b->data + off, buf, sizeof(float)*b->ns);
+  }
+  else {
+    FSEEK64(b->spill, off*sizeof(float), SEEK_SET);
+    ASF_FWRITE(buf, sizeof(float), b->ns, b->spill);
+  }
+}
+
+void image_buffer_get_line(image_buffer *b, int band, int line, float *buf)
+{
+  long long off = line_offset(b, band, line);
+
+  if (b->data) {
+    memcpy(buf, b->data + off, sizeof(float)*b->ns);
+  }
+  else {
+    // Lines that were never written read back as zeros, the scratch
+    // file is not filled in ahead of time.
+    size_t n;
+    FSEEK64(b->spill, off*sizeof(float), SEEK_SET);
+    n = fread(buf, sizeof(float), b->ns, b->spill);
+    if (n < (size_t)b->ns)
+      memset(buf + n, 0, sizeof(float)*(b->ns - n));
+  }
+}
+
+void image_buffer_data_extent(image_buffer *b, int band, int *startX,
+                              int *endX)
+{
+  float *buf = MALLOC(sizeof(float)*b->ns);
+  int ii, ns = b->ns;
+
+  // Same scan as trim_zeros()
+  *startX = ns-1;
+  *endX = 0;
+  for (ii=0; ii<b->nl; ++ii) {
+    int left = 0, right = ns-1;
+    image_buffer_get_line(b, band, ii, buf);
+    while (buf[left] == 0.0 && left<ns-1) ++left;
+    while (buf[right] == 0.0 && right>0) --right;
+    if (left < *startX) *startX = left;
+    if (right > *endX) *endX = right;
+  }
+
+  FREE(buf);
+}
+
+void image_buffer_store(image_buffer *b, int startX, meta_parameters *meta,
+                        const char *outFile)
+{
+  int ns = meta->general->sample_count;
+  int nl = meta->general->line_count;
+  int nb = meta->general->band_count;
+  float *buf = MALLOC(sizeof(float)*b->ns);
+  FILE *fp;
+  int ii, kk;
+
+  assert(startX >= 0 && startX + ns <= b->ns);
+  assert(nl == b->nl && nb == b->nb);
+
+  meta_write(meta, outFile);
+  fp = fopenImage(outFile, "wb");
+  for (kk=0; kk<nb; ++kk) {
+    for (ii=0; ii<nl; ++ii) {
+      image_buffer_get_line(b, kk, ii, buf);
+      put_band_float_line(fp, meta, kk, ii, buf + startX);
+    }
+  }
+  FCLOSE(fp);
+  FREE(buf);
+}
@@ -15,9 +15,19 @@ INPUT: inbuf          - input image buffer
 
 #include "asf.h"
 #include "asf_raster.h"
+#include <glib.h>
 
 #define SQR(X) ((X)*(X))
 
+// Output lines filtered per block.  Their input lines, plus the
+// kernel_size-1 lines of margin, are read once into one buffer and the
+// block is split into bands of lines for the threads.
+#define FILTER_BLOCK_LINES 256
+
+// Variances this small next to the squared mean are rounding error in
+// the running sums, and are taken as 0 as the two-pass sums gave.
+#define VARIANCE_EPS 1e-12
+
 int compare_values(const float *valueA, const float *valueB)
 {
   if (*valueA <  *valueB) return -1;
@@ -28,6 +38,34 @@ int compare_values(const float *valueA, const float *valueB)
   return 0;
 }
 
+// k-th smallest (counting from 0) of the n values, which are reordered
+static float select_kth(float *a, int n, int k)
+{
+  int lo = 0, hi = n-1;
+
+  while (lo < hi) {
+    float x = a[k], t;
+    int i = lo, j = hi;
+    do {
+      while (a[i] < x) i++;
+      while (x < a[j]) j--;
+      if (i <= j) {
+        t = a[i]; a[i] = a[j]; a[j] = t;
+        i++; j--;
+      }
+    } while (i <= j);
+    if (j < k) lo = i;
+    if (k < i) hi = j;
+  }
+  return a[k];
+}
+
+// Index of the value the median filter picks from n sorted values
+static int median_index(int n)
+{
+  return MIN(n/2 + 1, n-1);
+}
+
 double calc_sum(float *inbuf, int nSamples, int xSample, int kernel_size)
 {
   register int i,j;
@@ -74,6 +112,7 @@ float kernel(filter_type_t filter_type, float *inbuf, int nLines, int nSamples,
   int total = 0;
   double ci, cu, cmax, center, a, b, d, rf = 0.0, x, y, m;
   float *pix;
+  int shift;
   register int i, j;
   
   switch(filter_type)
@@ -208,8 +247,7 @@ float kernel(filter_type_t filter_type, float *inbuf, int nLines, int nSamples,
         base += nSamples;
         base -= kernel_size;
       }
-      qsort(pix, kernel_size*kernel_size, sizeof(float), (void*)compare_values);
-      value = pix[kernel_size*kernel_size/2 + 1];
+      value = select_kth(pix, total, median_index(total));
       FREE(pix);
       break;
 
@@ -240,14 +278,18 @@ float kernel(filter_type_t filter_type, float *inbuf, int nLines, int nSamples,
       break;
 
     case FROST:
+      // Weighted by column, as exp(-a*|column-half|).  Dividing those by
+      // the largest one in the window (exp(-a*shift)) doesn't change the
+      // result, and keeps them from underflowing far from the left edge.
       mean = calc_mean(inbuf, nSamples, xSample, kernel_size);
       standard_deviation = 
 	calc_std_dev(inbuf, nSamples, xSample, kernel_size, mean);
       ci = standard_deviation/mean;
       a = damping_factor * SQR(ci);
+      shift = MAX(0, xSample - 2*half);
       for (i=yLine-half; i<=yLine+half; i++) {
 	for (j=xSample-half; j<=xSample+half; j++) {
-          m = exp(-a * abs(j-half));
+          m = exp(-a * (abs(j-half) - shift));
           rf += m * inbuf[base];
           sum += m;
           base++;
@@ -259,36 +301,36 @@ float kernel(filter_type_t filter_type, float *inbuf, int nLines, int nSamples,
       break;
 
     case ENHANCED_FROST:
-      for (i=yLine-half; i<=yLine+half; i++) {
-        for (j=xSample-half; j<=xSample+half; j++) {
-          inbuf[base] = SQR(inbuf[base]);
-          base++;
-        }
-        base += nSamples;
-        base -= kernel_size;
+      // Works on intensities, weighted by column as FROST is
+      for (i=0; i<kernel_size; i++) {
+        for (j=xSample-half; j<=xSample+half; j++)
+          sum += SQR(inbuf[j+i*nSamples]);
       }
-      base = xSample- half;
-      center = inbuf[base + half + half*nSamples];
-      mean = calc_mean(inbuf, nSamples, xSample, kernel_size);
-      standard_deviation = 
-	calc_std_dev(inbuf, nSamples, xSample, kernel_size, mean);
+      mean = sum/SQR(kernel_size);
+      for (i=0; i<kernel_size; i++) {
+        for (j=xSample-half; j<=xSample+half; j++)
+          rf += SQR(SQR(inbuf[j+i*nSamples]) - mean);
+      }
+      standard_deviation = sqrt(rf/(SQR(kernel_size)-1));
+      center = SQR(inbuf[base + half + half*nSamples]);
+      ci = standard_deviation/mean;
       cu = sqrt(1/(double)nLooks);
       cmax = sqrt(1+2.0/(double)nLooks);
-      for (i=0; i<nLines; i++) {
-	for (j=xSample-half; j<=xSample+half; j++) {
-          ci = sqrt(SQR(inbuf[base]-mean))/mean;
-          m = exp(-damping_factor * (ci-cu) / (cmax-ci) * abs(j-half));
-          rf += m * inbuf[base];
-          sum += m;
-          base++;
-        }
-	base += nSamples;
-	base -= kernel_size;
-      }
-      rf /= sum;
       if (ci < cu) value = sqrt(mean);
-      else if ((cu <= ci) && (ci <= cmax)) value = sqrt(rf);
       else if (ci > cmax) value = sqrt(center);
+      else {
+        rf = sum = 0.0;
+        shift = MAX(0, xSample - 2*half);
+        for (i=0; i<kernel_size; i++) {
+          for (j=xSample-half; j<=xSample+half; j++) {
+            m = exp(-damping_factor * (ci-cu) / (cmax-ci) *
+                    (abs(j-half) - shift));
+            rf += m * SQR(inbuf[j+i*nSamples]);
+            sum += m;
+          }
+        }
+        value = sqrt(rf/sum);
+      }
       break;
 
     case GAMMA_MAP:
@@ -323,6 +365,325 @@ float kernel(filter_type_t filter_type, float *inbuf, int nLines, int nSamples,
   return value;
 }
 
+// One block of lines being filtered.  "in" starts kernel_size/2 lines
+// above the block's first output line, so output line r of the block
+// has its kernel_size lines of input from in + r*ns on.
+typedef struct {
+  filter_type_t filter;
+  int kernel_size;
+  float damping;
+  int nLooks;
+  int ns;
+  const float *in;
+  float *out;
+  int first_line;             // image line of the block's first line
+  int n_lines;
+  int band_lines;             // lines per band handed to a thread
+  int next_band;
+} filter_block;
+
+// Per thread buffers
+typedef struct {
+  double *s1, *s2, *s4;       // column sums of x, x^2, x^4 over the window
+  int *bad;                   // non-finite values in each column, which
+                              //   are left out of the sums
+  double *weight;
+  float *pix;
+} filter_work;
+
+static int uses_window_sums(filter_type_t filter)
+{
+  switch (filter) {
+    case AVERAGE: case GAUSSIAN: case EDGE: case LEE: case ENHANCED_LEE:
+    case FROST: case ENHANCED_FROST: case GAMMA_MAP: case KUAN:
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+static filter_work *filter_work_new(int ns, int kernel_size)
+{
+  filter_work *w = MALLOC(sizeof(filter_work));
+  w->s1 = MALLOC(sizeof(double)*ns);
+  w->s2 = MALLOC(sizeof(double)*ns);
+  w->s4 = MALLOC(sizeof(double)*ns);
+  w->bad = MALLOC(sizeof(int)*ns);
+  w->weight = MALLOC(sizeof(double)*(2*kernel_size+1));
+  w->pix = MALLOC(sizeof(float)*kernel_size*kernel_size);
+  return w;
+}
+
+static void filter_work_free(filter_work *w)
+{
+  FREE(w->s1);
+  FREE(w->s2);
+  FREE(w->s4);
+  FREE(w->bad);
+  FREE(w->weight);
+  FREE(w->pix);
+  FREE(w);
+}
+
+// Add (sign 1) or remove (sign -1) a line from the column sums.  A NaN
+// or Inf would stay in a running sum for good, so those are only counted.
+static void column_sums_update(filter_work *w, const float *line, int ns,
+                               int sign)
+{
+  int jj;
+  for (jj=0; jj<ns; jj++) {
+    double v = line[jj], v2 = v*v;
+    if (!meta_is_valid_double(v)) {
+      w->bad[jj] += sign;
+      continue;
+    }
+    w->s1[jj] += sign*v;
+    w->s2[jj] += sign*v2;
+    w->s4[jj] += sign*v2*v2;
+  }
+}
+
+static void filter_line(const filter_block *b, filter_work *w, int r)
+{
+  int k = b->kernel_size, half = (k-1)/2, ns = b->ns;
+  int N = k*k;
+  const float *win = b->in + (size_t)r*ns;
+  float *out = b->out + (size_t)r*ns;
+  double cu = sqrt(1/(double)b->nLooks);
+  double w1 = 0, w2 = 0, w4 = 0;
+  int wbad = 0;
+  int ii, jj, xx;
+
+  for (jj=0; jj<half; jj++) out[jj] = 0.0;
+  for (jj=ns-half; jj<ns; jj++) out[jj] = 0.0;
+
+  if (uses_window_sums(b->filter))
+    for (jj=0; jj<k-1 && jj<ns; jj++) {
+      w1 += w->s1[jj];
+      w2 += w->s2[jj];
+      w4 += w->s4[jj];
+      wbad += w->bad[jj];
+    }
+
+  for (xx=half; xx<ns-half; xx++) {
+    double mean = 0, var = 0, std = 0, center, ci, cmax, a, sum, rf;
+    double value = 0;
+
+    center = win[xx + half*ns];
+    if (uses_window_sums(b->filter)) {
+      // running sums across the line
+      w1 += w->s1[xx+half];
+      w2 += w->s2[xx+half];
+      w4 += w->s4[xx+half];
+      wbad += w->bad[xx+half];
+      mean = w1/N;
+      var = (w2 - w1*mean)/(N-1);
+      if (var < VARIANCE_EPS*mean*mean) var = 0;
+      std = sqrt(var);
+    }
+
+    // Windows with a NaN or Inf in them come out as kernel() has them
+    if (wbad > 0) {
+      value = kernel(b->filter, (float *) win, k, ns, b->first_line + r,
+                     xx, k, b->damping, b->nLooks);
+    }
+    else switch (b->filter) {
+      case AVERAGE:
+        value = mean;
+        break;
+
+      case GAUSSIAN:
+        // The "variance" of the weights is the local standard deviation
+        // as it always was here, so the weights differ from pixel to
+        // pixel, but they still factor into rows and columns.
+        for (ii=0; ii<=half; ii++)
+          w->weight[ii] = exp(-(double)SQR(ii) / (2*std));
+        for (ii=0; ii<k; ii++) {
+          const float *row = win + (size_t)ii*ns + xx - half;
+          double rs = 0;
+          for (jj=0; jj<k; jj++)
+            rs += w->weight[abs(jj-half)] * row[jj];
+          value += w->weight[abs(ii-half)] * rs;
+        }
+        value /= w1;
+        break;
+
+      case EDGE:
+        value = center - mean;
+        break;
+
+      case MEDIAN:
+        for (ii=0; ii<k; ii++)
+          memcpy(w->pix + ii*k, win + (size_t)ii*ns + xx - half,
+                 sizeof(float)*k);
+        value = select_kth(w->pix, N, median_index(N));
+        break;
+
+      case LEE:
+        ci = std/mean;
+        a = 1 - SQR(cu)/SQR(ci);
+        value = center*a + mean*(1-a);
+        break;
+
+      case ENHANCED_LEE:
+        ci = std/mean;
+        cmax = sqrt(1+2.0/(double)b->nLooks);
+        a = exp(-b->damping*(ci-cu)/(cmax-ci));
+        rf = center*a + center*(1-a);
+        if (ci <= cu) value = mean;
+        else if ((cu < ci) && (ci < cmax)) value = rf;
+        else if (ci >= cmax) value = center;
+        break;
+
+      case FROST:
+        // Weighted by column, as exp(-a*|column-half|) for the image
+        // column; scaling those by the largest one in the window does
+        // not change the result, and keeps them from underflowing.
+        ci = std/mean;
+        a = b->damping * SQR(ci);
+        {
+          int shift = MAX(0, xx - 2*half);
+          sum = rf = 0;
+          for (jj=xx-half; jj<=xx+half; jj++) {
+            double m = exp(-a * (abs(jj-half) - shift));
+            rf += m * w->s1[jj];
+            sum += m;
+          }
+          value = rf / (k*sum);
+        }
+        break;
+
+      case ENHANCED_FROST:
+        // on intensities: their sums are s2 and s4
+        mean = w2/N;
+        var = (w4 - w2*mean)/(N-1);
+        if (var < VARIANCE_EPS*mean*mean) var = 0;
+        ci = sqrt(var)/mean;
+        cmax = sqrt(1+2.0/(double)b->nLooks);
+        if (ci < cu) value = sqrt(mean);
+        else if (ci > cmax) value = fabs(center);
+        else {
+          int shift = MAX(0, xx - 2*half);
+          sum = rf = 0;
+          for (jj=xx-half; jj<=xx+half; jj++) {
+            double m = exp(-b->damping * (ci-cu) / (cmax-ci) *
+                           (abs(jj-half) - shift));
+            rf += m * w->s2[jj];
+            sum += m;
+          }
+          value = sqrt(rf / (k*sum));
+        }
+        break;
+
+      case GAMMA_MAP:
+        ci = std/mean;
+        cmax = sqrt(2.0)*cu;
+        a = (1+SQR(cu)) / (SQR(ci)-SQR(cu));
+        {
+          double bb = a - b->nLooks - 1;
+          double d = SQR(mean)*SQR(bb) + 4*a*b->nLooks*mean*center;
+          rf = (bb*mean + sqrt(d)) / (2*a);
+        }
+        if (ci <= cu) value = mean;
+        else if ((cu < ci) && (ci < cmax)) value = rf;
+        else if (ci >= cmax) value = center;
+        break;
+
+      case KUAN:
+        ci = std/mean;
+        a = (1 - SQR(cu)/SQR(ci))/(1 + SQR(cu));
+        value = center*a + mean*(1-a);
+        break;
+
+      default:
+        // the 3x3 operators
+        value = kernel(b->filter, (float *) win, k, ns, b->first_line + r,
+                       xx, k, b->damping, b->nLooks);
+        break;
+    }
+    out[xx] = value;
+
+    if (uses_window_sums(b->filter)) {
+      w1 -= w->s1[xx-half];
+      w2 -= w->s2[xx-half];
+      w4 -= w->s4[xx-half];
+      wbad -= w->bad[xx-half];
+    }
+  }
+}
+
+static gpointer filter_thread(gpointer data)
+{
+  filter_block *b = data;
+  filter_work *w = filter_work_new(b->ns, b->kernel_size);
+  int band, ii, r, k = b->kernel_size, ns = b->ns;
+
+  while ((band = g_atomic_int_add(&b->next_band, 1)) * b->band_lines
+         < b->n_lines) {
+    int r0 = band*b->band_lines;
+    int r1 = MIN(r0 + b->band_lines, b->n_lines);
+
+    // Column sums for the band's first window, then one line in and
+    // one line out for each line after that
+    if (uses_window_sums(b->filter)) {
+      memset(w->s1, 0, sizeof(double)*ns);
+      memset(w->s2, 0, sizeof(double)*ns);
+      memset(w->s4, 0, sizeof(double)*ns);
+      memset(w->bad, 0, sizeof(int)*ns);
+      for (ii=0; ii<k; ii++)
+        column_sums_update(w, b->in + (size_t)(r0+ii)*ns, ns, 1);
+    }
+    for (r=r0; r<r1; r++) {
+      if (r > r0 && uses_window_sums(b->filter)) {
+        column_sums_update(w, b->in + (size_t)(r-1)*ns, ns, -1);
+        column_sums_update(w, b->in + (size_t)(r+k-1)*ns, ns, 1);
+      }
+      filter_line(b, w, r);
+    }
+  }
+
+  filter_work_free(w);
+  return NULL;
+}
+
+static void filter_block_lines(filter_block *b, int nThreads)
+{
+  int n_bands, tt;
+  GThread **threads;
+
+  // Bands of at least a kernel's worth of lines, since each one starts
+  // by summing that many
+  b->band_lines = MAX((b->n_lines + nThreads - 1)/nThreads, b->kernel_size);
+  b->next_band = 0;
+  n_bands = (b->n_lines + b->band_lines - 1)/b->band_lines;
+  if (nThreads > n_bands) nThreads = n_bands;
+
+  threads = MALLOC(sizeof(GThread *)*nThreads);
+  for (tt=1; tt<nThreads; tt++)
+    threads[tt] = g_thread_new("kernel_filter", filter_thread, b);
+  filter_thread(b);
+  for (tt=1; tt<nThreads; tt++)
+    g_thread_join(threads[tt]);
+  FREE(threads);
+}
+
+void kernel_filter_lines(filter_type_t filter, const float *inbuf,
+                         int nLines, int nSamples, float *outbuf,
+                         int kernel_size, float damping, int nLooks)
+{
+  filter_block block;
+  block.filter = filter;
+  block.kernel_size = kernel_size;
+  block.damping = damping;
+  block.nLooks = nLooks;
+  block.ns = nSamples;
+  block.in = inbuf;
+  block.out = outbuf;
+  block.first_line = (kernel_size-1)/2;
+  block.n_lines = nLines;
+  filter_block_lines(&block, MAX(1, (int)g_get_num_processors()));
+}
+
 void kernel_filter(char *inFile, char *outFile, filter_type_t filter, 
 		   int kernel_size, float damping, int nLooks)
 {
@@ -337,15 +698,15 @@ void kernel_filter(char *inFile, char *outFile, filter_type_t filter,
   int inLines = inMeta->general->line_count;
   int inSamples = inMeta->general->sample_count;
   int half = (kernel_size - 1) / 2;
-  int numLines = kernel_size;
   
   // Open output files
   FILE *fpIn = fopenImage(inFile,"rb");
   FILE *fpOut = fopenImage(outFile,"wb");
     
   // Allocate memory for input and output file
-  float *inbuf= (float*) MALLOC (kernel_size*inSamples*sizeof(float));
-  float *outbuf = (float*) MALLOC (inSamples*sizeof(float));
+  int bufLines = FILTER_BLOCK_LINES + kernel_size - 1;
+  float *inbuf= (float*) MALLOC (bufLines*inSamples*sizeof(float));
+  float *outbuf = (float*) MALLOC (FILTER_BLOCK_LINES*inSamples*sizeof(float));
 
   // Go through all bands
   int band_count = inMeta->general->band_count;
@@ -355,39 +716,42 @@ void kernel_filter(char *inFile, char *outFile, filter_type_t filter,
     asfPrintStatus("\nFiltering %s ...\n", band_names[kk]);
 
     // Set upper margin of image to input pixel values
-    for (ii=0; ii<half; ii++) {
-      for (jj=0; jj<inSamples; jj++) outbuf[jj] = 0.0;
+    for (jj=0; jj<inSamples; jj++) outbuf[jj] = 0.0;
+    for (ii=0; ii<half && ii<inLines; ii++) {
       put_band_float_line(fpOut, outMeta, kk, ii, outbuf);
       asfLineMeter(ii, inLines);
     }
   
-    int startLine;
-    
-    // Filtering the 'regular' lines
-    for (ii=half; ii<inLines-half; ii++) {
-      
-      // Read next set of lines for kernel
-      startLine = ii - half;
-      if (startLine<0) startLine = 0;
-      if (inLines < (kernel_size+startLine)) numLines = inLines - startLine;
-      get_band_float_lines(fpIn, inMeta, kk, startLine, numLines, inbuf); 
-      
-      // Calculate the usual output line
-      for (jj=0; jj<half; jj++) outbuf[jj] = 0.0;
-      for (jj=half; jj<inSamples-half; jj++) {
-	outbuf[jj] = kernel(filter, inbuf, numLines, inSamples, ii, jj,
-			    kernel_size, damping, nLooks);
+    // Filtering the 'regular' lines, a block at a time.  Each input
+    // line is read once: the margin below one block is kept as the
+    // margin above the next.
+    int have = 0;
+    for (ii=half; ii<inLines-half; ii+=FILTER_BLOCK_LINES) {
+      int n = MIN(FILTER_BLOCK_LINES, inLines-half-ii);
+      int need = n + kernel_size - 1;
+      if (have > 0) {
+        memmove(inbuf, inbuf + (size_t)(have-(kernel_size-1))*inSamples,
+                sizeof(float)*(kernel_size-1)*inSamples);
+        have = kernel_size - 1;
+      }
+      get_band_float_lines(fpIn, inMeta, kk, ii-half+have, need-have,
+                           inbuf + (size_t)have*inSamples);
+      have = need;
+
+      kernel_filter_lines(filter, inbuf, n, inSamples, outbuf,
+                          kernel_size, damping, nLooks);
+
+      // Write lines to disk
+      for (jj=0; jj<n; jj++) {
+        put_band_float_line(fpOut, outMeta, kk, ii+jj,
+                            outbuf + (size_t)jj*inSamples);
+        asfLineMeter(ii+jj, inLines);
       }
-      for (jj=inSamples-half; jj<inSamples; jj++) outbuf[jj] = 0.0;
-      
-      // Write line to disk
-      put_band_float_line(fpOut, outMeta, kk, ii, outbuf);
-      asfLineMeter(ii, inLines);
     }
     
     // Set lower margin of image to input pixel values
-    for (ii=inLines-half; ii<inLines; ii++) {
-      for (jj=0; jj<inSamples; jj++) outbuf[jj] = 0.0;
+    for (jj=0; jj<inSamples; jj++) outbuf[jj] = 0.0;
+    for (ii=MAX(inLines-half, half); ii<inLines; ii++) {
       put_band_float_line(fpOut, outMeta, kk, ii, outbuf);
       asfLineMeter(ii, inLines);
     }  
@@ -0,0 +1,115 @@
+#include "asf_raster.h"
+#include "asf.h"
+
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+
+// Checks kernel_filter_lines, which keeps running sums over the window,
+// against calling kernel() for every pixel, with and without NaN and
+// Inf in the input.
+
+#define NL 29
+#define NS 47
+
+static const double tol = 1e-4;
+
+static int same(float a, float b)
+{
+  if (isnan(a) || isnan(b))
+    return isnan(a) && isnan(b);
+  if (a == b)
+    return TRUE;
+  return fabs(a-b) <= tol*MAX(1.0, MAX(fabs(a), fabs(b)));
+}
+
+// Speckled data: exponentially distributed intensity over a slow ramp
+static void speckle(float *buf, int n)
+{
+  int ii;
+  for (ii=0; ii<n; ii++) {
+    double u = (rand() + 1.0)/(RAND_MAX + 2.0);
+    buf[ii] = (float) ((20.0 + ii%NS) * -log(u));
+  }
+}
+
+static int check(const char *name, filter_type_t filter, int k,
+                 const float *in, int nlines)
+{
+  int half = (k-1)/2, ii, jj, bad = 0;
+  float *out = MALLOC(sizeof(float)*nlines*NS);
+
+  kernel_filter_lines(filter, in, nlines, NS, out, k, 2.0, 3);
+  for (ii=0; ii<nlines; ii++) {
+    for (jj=0; jj<NS; jj++) {
+      float expected = 0.0;
+      if (jj >= half && jj < NS-half)
+        expected = kernel(filter, (float *) in + ii*NS, k, NS, ii+half, jj,
+                          k, 2.0, 3);
+      if (!same(out[ii*NS+jj], expected)) {
+        if (bad == 0)
+          printf("  %s, %dx%d: line %d, sample %d: %g, kernel() %g\n",
+                 name, k, k, ii, jj, out[ii*NS+jj], expected);
+        bad++;
+      }
+    }
+  }
+
+  FREE(out);
+  return bad;
+}
+
+int main(int argc, char * argv [])
+{
+  static const struct { filter_type_t filter; const char *name; } filters[] = {
+    { AVERAGE, "AVERAGE" }, { GAUSSIAN, "GAUSSIAN" },
+    { LAPLACE1, "LAPLACE1" }, { LAPLACE2, "LAPLACE2" },
+    { LAPLACE3, "LAPLACE3" }, { SOBEL, "SOBEL" }, { SOBEL_X, "SOBEL_X" },
+    { SOBEL_Y, "SOBEL_Y" }, { PREWITT, "PREWITT" },
+    { PREWITT_X, "PREWITT_X" }, { PREWITT_Y, "PREWITT_Y" },
+    { EDGE, "EDGE" }, { MEDIAN, "MEDIAN" }, { LEE, "LEE" },
+    { ENHANCED_LEE, "ENHANCED_LEE" }, { FROST, "FROST" },
+    { ENHANCED_FROST, "ENHANCED_FROST" }, { GAMMA_MAP, "GAMMA_MAP" },
+    { KUAN, "KUAN" }
+  };
+  int n_filters = sizeof(filters)/sizeof(filters[0]);
+  int sizes[] = { 3, 5, 7 };
+  float *in = MALLOC(sizeof(float)*(NL+6)*NS);
+  int ii, kk, failed = 0;
+
+  srand(1);
+  for (ii=0; ii<n_filters; ii++) {
+    for (kk=0; kk<3; kk++) {
+      int k = sizes[kk], nlines = NL - (k-1);
+      // The 3x3 operators only come in 3x3
+      if (k > 3 && filters[ii].filter >= LAPLACE1 &&
+          filters[ii].filter <= PREWITT_Y)
+        continue;
+
+      speckle(in, NL*NS);
+      if (check(filters[ii].name, filters[ii].filter, k, in, nlines)) {
+        printf("%s, %dx%d: FAILED\n", filters[ii].name, k, k);
+        failed++;
+      }
+
+      // A NaN and an Inf must only spoil the windows they are in.
+      // (kernel() gives up on the whole run if SOBEL sees either.)
+      if (filters[ii].filter == SOBEL)
+        continue;
+      in[7*NS + 11] = NAN;
+      in[15*NS + 30] = INFINITY;
+      if (check(filters[ii].name, filters[ii].filter, k, in, nlines)) {
+        printf("%s, %dx%d, with NaN and Inf: FAILED\n",
+               filters[ii].name, k, k);
+        failed++;
+      }
+    }
+  }
+
+  FREE(in);
+  if (failed)
+    printf("kernel_filter_lines: %d checks FAILED\n", failed);
+  else
+    printf("kernel_filter_lines: all checks passed\n");
+  return failed ? 1 : 0;
+}
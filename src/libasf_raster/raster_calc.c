@@ -1,35 +1,60 @@
 #include "asf.h"
 #include "asf_meta.h"
 #include "asf_raster.h"
+#include "asf_nan.h"
 #include "expression.h"
 #include <ctype.h>
+#include <glib.h>
 
 #define VERSION 2.0
 #define MAXIMGS 20
 
-char *expression2cookie(const char *expr, int nvars)
+// Lines read from each input before they are handed to the threads
+#define LINES_PER_BLOCK 64
+
+// Callers sometimes pass the expression with the shell quotes still on
+// it, "'(a-b)%6.2831853'": drop those before parsing.
+static char *strip_quotes(const char *expr)
+{
+  char *s = MALLOC(sizeof(char)*(strlen(expr)+1));
+  int ii, jj;
+
+  for (ii=0, jj=0; expr[ii]; ++ii)
+    if (expr[ii] != '\'' && expr[ii] != '"')
+      s[jj++] = expr[ii];
+  s[jj] = '\0';
+  return s;
+}
+
+char *expression2cookie(const char *expression, int nvars)
 {
   token **outputStack = (token **) MALLOC(200*sizeof(token));
   int outputPtr = 0;
   token **operandStack = (token **)MALLOC(200*sizeof(token));
   int operandPtr = 0;
+  char *expr = strip_quotes(expression);
   
   token *next;
-  if (expressionMalformed(expr,nvars))
+  if (expressionMalformed(expr,nvars)) {
+    FREE(expr);
+    FREE(outputStack);
+    FREE(operandStack);
     return NULL;
+  }
   setTokenExpression(expr);
   while (NULL != (next = nextToken())) {
     if (next->type == tokOperator) {
       if (next->op == ')') {
 	while (operandStack[operandPtr-1]->op != '(')
 	  outputStack[outputPtr++] = operandStack[--operandPtr];
-	operandPtr--; // Pop off (
+	FREE(operandStack[--operandPtr]); // Pop off (
+	FREE(next);
       }
       else {
-	int precedence=0;
-	if (operandPtr-1 >= 0 && operandStack[operandPtr-1]->op != '(')
-	  precedence = operandStack[operandPtr-1]->precedence;
-	if (next->precedence <= precedence)
+	// Pop everything that binds at least as tightly, so that
+	// a-b*c+d is (a-(b*c))+d
+	while (operandPtr-1 >= 0 && operandStack[operandPtr-1]->op != '(' &&
+	       next->precedence <= operandStack[operandPtr-1]->precedence)
 	  outputStack[outputPtr++] = operandStack[--operandPtr]; 
 	operandStack[operandPtr++] = next;
       }
@@ -40,6 +65,8 @@ char *expression2cookie(const char *expr, int nvars)
   while (operandPtr != 0)
     outputStack[outputPtr++] = operandStack[--operandPtr];
   outputStack[outputPtr++] = NULL;
+  FREE(operandStack);
+  FREE(expr);
   return (char *) outputStack;
 }
 
@@ -157,6 +184,8 @@ int expressionIndex,expressionLength;
 void setTokenExpression(const char *expr)
 {
   expressionLength = strlen(expr);
+  if (currExpression)
+    FREE(currExpression);
   currExpression = (char *) CALLOC(expressionLength+1, sizeof(char));
   strcpy(currExpression,expr);
   expressionIndex = 0;
@@ -232,15 +261,79 @@ token *nextToken(void)
   return t;
 }
 
+// A block of lines from every input, and the output lines computed
+// from them.  Threads take lines from the block one at a time.
+struct calc_block {
+  const expr_program *prog;
+  int input_count;
+  int ns, first_line, n_lines;
+  float **inBuf;              // per input, n_lines lines of in_ns[ii]
+  int *in_ns;
+  float *outBuf;              // n_lines lines of ns
+  double nodata;
+  int next_line;
+};
+
+static void calc_line(struct calc_block *b, int ll, float *work)
+{
+  const float *vars[MAXIMGS];
+  int ii;
+
+  for (ii=0; ii<b->input_count; ++ii)
+    vars[ii] = b->inBuf[ii] + (size_t)ll*b->in_ns[ii];
+  expression_evaluate_line(b->prog, vars, b->ns, b->first_line + ll,
+                           b->nodata, work, b->outBuf + (size_t)ll*b->ns);
+}
+
+static gpointer calc_thread(gpointer data)
+{
+  struct calc_block *b = data;
+  float *work = expression_workspace(b->prog);
+  int ll;
+
+  while ((ll = g_atomic_int_add(&b->next_line, 1)) < b->n_lines)
+    calc_line(b, ll, work);
+
+  FREE(work);
+  return NULL;
+}
+
+static void calc_block_lines(struct calc_block *b, int nThreads)
+{
+  GThread **threads;
+  int tt;
+
+  b->next_line = 0;
+  if (nThreads > b->n_lines) nThreads = b->n_lines;
+  threads = MALLOC(sizeof(GThread *)*nThreads);
+  for (tt=1; tt<nThreads; tt++)
+    threads[tt] = g_thread_new("raster_calc", calc_thread, b);
+  calc_thread(b);
+  for (tt=1; tt<nThreads; tt++)
+    g_thread_join(threads[tt]);
+  FREE(threads);
+}
+
 int raster_calc(char *outFile, char *expression, int input_count, 
 		char **inFiles)
 {
-  int ii, xx, yy;
+  return raster_calc_ext(outFile, expression, input_count, inFiles, NAN);
+}
+
+int raster_calc_ext(char *outFile, char *expression, int input_count,
+                    char **inFiles, double nodata)
+{
+  int ii, yy, ll;
   meta_parameters *inMeta, *outMeta;
   meta_parameters *metas[MAXIMGS];
-  char *cookie;
+  expr_program *prog;
   float *inBuf[MAXIMGS], *outBuf;
+  int in_ns[MAXIMGS];
   FILE *fpIn[MAXIMGS], *fpOut;
+  struct calc_block block;
+
+  if (input_count > MAXIMGS)
+    asfPrintError("raster_calc: at most %d input images\n", MAXIMGS);
 
   inMeta = meta_read(inFiles[0]);
   int ns = inMeta->general->sample_count;
@@ -255,35 +348,49 @@ int raster_calc(char *outFile, char *expression, int input_count,
       if (tmpMeta->general->sample_count < inMeta->general->sample_count)
         ns = tmpMeta->general->sample_count;
     }
-    inBuf[ii] = (float*) MALLOC( sizeof(float)*tmpMeta->general->sample_count);
+    in_ns[ii] = tmpMeta->general->sample_count;
+    inBuf[ii] = (float*) MALLOC(sizeof(float)*in_ns[ii]*LINES_PER_BLOCK);
     metas[ii] = tmpMeta;
   }
   fpOut = fopenImage(outFile, "wb");
   outMeta = meta_copy(inMeta);
   outMeta->general->line_count = nl;
   outMeta->general->sample_count = ns;
+  if (!ISNAN(nodata))
+    outMeta->general->no_data = nodata;
   meta_write(outMeta, outFile);
 
-  outBuf = (float *) MALLOC(sizeof(float)*outMeta->general->sample_count);
-  cookie = expression2cookie(expression, input_count);
-  if (NULL == cookie)
+  outBuf = (float *) MALLOC(sizeof(float)*ns*LINES_PER_BLOCK);
+  prog = expression_compile(expression, input_count);
+  if (NULL == prog)
     exit(EXIT_FAILURE);
-  for (yy=0; yy<outMeta->general->line_count; yy++) {
-    double variables[26];
 
-    variables['y'-'a'] = yy;
+  block.prog = prog;
+  block.input_count = input_count;
+  block.ns = ns;
+  block.inBuf = inBuf;
+  block.in_ns = in_ns;
+  block.outBuf = outBuf;
+  block.nodata = nodata;
+
+  int nThreads = MAX(1, (int)g_get_num_processors());
+  for (yy=0; yy<nl; yy+=LINES_PER_BLOCK) {
+    block.first_line = yy;
+    block.n_lines = MIN(LINES_PER_BLOCK, nl-yy);
 
+    // Inputs the expression does not use are not read
     for (ii=0; ii<input_count; ii++)
-      get_float_line(fpIn[ii], metas[ii], yy, inBuf[ii]);
+      if (expression_uses_variable(prog, ii))
+        for (ll=0; ll<block.n_lines; ll++)
+          get_float_line(fpIn[ii], metas[ii], yy+ll,
+                         inBuf[ii] + (size_t)ll*in_ns[ii]);
+
+    calc_block_lines(&block, nThreads);
 
-    for (xx=0; xx<outMeta->general->sample_count; xx++) {
-      variables['x'-'a'] = xx;
-      for (ii=0; ii<input_count; ii++)
-        variables[ii] = inBuf[ii][xx];
-      outBuf[xx] = evaluate(cookie,variables);
+    for (ll=0; ll<block.n_lines; ll++) {
+      put_float_line(fpOut, outMeta, yy+ll, outBuf + (size_t)ll*ns);
+      asfLineMeter(yy+ll, nl);
     }
-    put_float_line(fpOut, outMeta, yy, outBuf);
-    asfLineMeter(yy, outMeta->general->line_count);
   }
 
   for (ii=0; ii<input_count; ++ii) { 
@@ -292,7 +399,9 @@ int raster_calc(char *outFile, char *expression, int input_count,
     FCLOSE(fpIn[ii]);
   }
 
+  expression_free(prog);
   FREE(outBuf);
+  meta_free(inMeta);
   meta_free(outMeta);
   FCLOSE(fpOut);
   return (0);
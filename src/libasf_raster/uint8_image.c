@@ -143,6 +143,45 @@ initialize_tile_cache_file (GString **tile_file_name)
   return tile_file;
 }
 
+// Split the memory cache up into shard_count shards, dividing the
+// cache slots between them as evenly as possible.
+static void
+initialize_tile_cache_shards (UInt8Image *self, size_t shard_count)
+{
+  g_assert (shard_count > 0 && shard_count <= self->cache_size_in_tiles);
+
+  self->shard_count = shard_count;
+  self->shards = g_new0 (UInt8ImageCacheShard, shard_count);
+
+  size_t ii, first_slot = 0;
+  for ( ii = 0 ; ii < shard_count ; ii++ ) {
+    UInt8ImageCacheShard *shard = &(self->shards[ii]);
+    g_mutex_init (&(shard->lock));
+    shard->tile_queue = g_queue_new ();
+    shard->slots = self->cache + first_slot * self->tile_area;
+    shard->slot_count = self->cache_size_in_tiles / shard_count;
+    if ( ii < self->cache_size_in_tiles % shard_count ) {
+      shard->slot_count++;
+    }
+    first_slot += shard->slot_count;
+  }
+  g_assert (first_slot == self->cache_size_in_tiles);
+}
+
+// Release the cache shards set up by initialize_tile_cache_shards.
+static void
+free_tile_cache_shards (UInt8Image *self)
+{
+  size_t ii;
+  for ( ii = 0 ; ii < self->shard_count ; ii++ ) {
+    g_queue_free (self->shards[ii].tile_queue);
+    g_mutex_clear (&(self->shards[ii].lock));
+  }
+  g_free (self->shards);
+  self->shards = NULL;
+  self->shard_count = 0;
+}
+
 // This routine does the work common to several of the differenct
 // creation routines.  Basically, it does everything but fill in the
 // contents of the disk tile store.
@@ -180,8 +219,12 @@ initialize_uint8_image_structure (ssize_t size_x, ssize_t size_y)
     self->cache = g_new (uint8_t, self->cache_area);
     self->tile_addresses = g_new0 (uint8_t *, self->tile_count);
     g_assert (NULL == 0x0);     // Ensure g_new0 effectively sets to NULL.
-    // The tile queue shouldn't ever be needed in this case.
-    self->tile_queue = NULL;
+    self->tile_pins = g_new0 (gint, self->tile_count);
+    // The cache shards shouldn't ever be needed in this case.
+    self->shard_count = 0;
+    self->shards = NULL;
+    self->concurrent = FALSE;
+    g_mutex_init (&(self->tile_file_lock));
     // The tile file shouldn't ever be needed, so we set it to NULL to
     // indicate this to a few other methods that use it directly, and
     // to hopefully ensure that it triggers an exception if it is
@@ -258,9 +301,15 @@ initialize_uint8_image_structure (ssize_t size_x, ssize_t size_y)
   self->tile_addresses = g_new0 (uint8_t *, self->tile_count);
   g_assert (NULL == 0x0);       // Ensure g_new0 effectively sets to NULL.
 
-  // Create a queue in order to keep track of which tile was loaded
+  // Pin counts for each tile, all tiles start out unpinned.
+  self->tile_pins = g_new0 (gint, self->tile_count);
+
+  // Until concurrent access is requested, the whole cache is a single
+  // shard, with a queue to keep track of which tile was loaded
   // longest ago.
-  self->tile_queue = g_queue_new ();
+  self->concurrent = FALSE;
+  initialize_tile_cache_shards (self, 1);
+  g_mutex_init (&(self->tile_file_lock));
 
   // Get a new empty tile cache file pointer.
   self->tile_file_name = NULL;
@@ -276,7 +325,7 @@ uint8_image_thaw (FILE *file_pointer)
 
   g_assert (file_pointer != NULL);
 
-  UInt8Image *self = g_new (UInt8Image, 1);
+  UInt8Image *self = g_new0 (UInt8Image, 1);
 
   size_t read_count = fread (&(self->size_x), sizeof (size_t), 1, fp);
   g_assert (read_count == 1);
@@ -313,16 +362,20 @@ uint8_image_thaw (FILE *file_pointer)
   self->cache = g_new (uint8_t, self->cache_area);
 
   self->tile_addresses = g_new0 (uint8_t *, self->tile_count);
-
-  // We don't actually keep the tile queue in the serialized instance,
-  // but if the serialized pointer to it is NULL, we know we aren't
-  // using a tile cache file (i.e. the whole image fits in the memory
-  // cache).
-  read_count = fread (&(self->tile_queue), sizeof (GQueue *), 1, fp);
+  self->tile_pins = g_new0 (gint, self->tile_count);
+  self->concurrent = FALSE;
+  g_mutex_init (&(self->tile_file_lock));
+
+  // We don't actually keep the cache state in the serialized
+  // instance, but if the serialized marker pointer is NULL, we know
+  // we aren't using a tile cache file (i.e. the whole image fits in
+  // the memory cache).
+  gpointer tile_file_marker;
+  read_count = fread (&tile_file_marker, sizeof (gpointer), 1, fp);
   g_assert (read_count == 1);
 
   // If there was no cache file...
-  if ( self->tile_queue == NULL ) {
+  if ( tile_file_marker == NULL ) {
     // The tile_file structure field should also be NULL.
     self->tile_file = NULL;
     // we restore the file directly into the first and only tile (see
@@ -332,10 +385,10 @@ uint8_image_thaw (FILE *file_pointer)
       self->tile_area, fp);
     g_assert (read_count == self->tile_area);
   }
-  // otherwise, an empty tile queue needs to be initialized, and the
+  // otherwise, an empty cache shard needs to be initialized, and the
   // remainder of the serialized version is the tile block cache.
   else {
-    self->tile_queue = g_queue_new ();
+    initialize_tile_cache_shards (self, 1);
     self->tile_file_name = NULL;
     self->tile_file = initialize_tile_cache_file ( &(self->tile_file_name) );
     uint8_t *buffer = g_new (uint8_t, self->tile_area);
@@ -1022,10 +1075,11 @@ uint8_image_band_new_from_metadata(meta_parameters *meta,
 }
 
 // Copy the contents of tile with flattened offset tile_offset from
-// the memory cache to the disk file.  Its probably easiest to
-// understand this function by looking at how its used.
+// the memory cache at tile_address to the disk file.  Its probably
+// easiest to understand this function by looking at how its used.
 static void
-cached_tile_to_disk (UInt8Image *self, size_t tile_offset)
+cached_tile_to_disk (UInt8Image *self, size_t tile_offset,
+                     const uint8_t *tile_address)
 {
   // If we aren't using a tile file, this operation doesn't make
   // sense.
@@ -1034,79 +1088,70 @@ cached_tile_to_disk (UInt8Image *self, size_t tile_offset)
   // We must have a legitimate tile_offset.
   g_assert (tile_offset < self->tile_count);
 
-  // The tile we are trying to copy from cache to disk must be loaded
-  // in the cache for this operation to make sense.
-  g_assert (self->tile_addresses[tile_offset] != NULL);
+  off_t file_offset = (off_t) tile_offset * self->tile_area * sizeof (uint8_t);
 
-  int return_code
-    = FSEEK64 (self->tile_file,
-        (off_t) tile_offset * self->tile_area * sizeof (uint8_t),
-        SEEK_SET);
-  g_assert (return_code == 0);
-  size_t write_count = fwrite (self->tile_addresses[tile_offset],
-             sizeof (uint8_t), self->tile_area,
-             self->tile_file);
-  g_assert (write_count == self->tile_area);
-}
+#ifndef win32
+  // In concurrent access mode several threads may be writing tiles at
+  // once, so we use positioned writes on the underlying descriptor
+  // instead of sharing the stream position.
+  if ( self->concurrent ) {
+    size_t byte_count = self->tile_area * sizeof (uint8_t);
+    ssize_t write_count = pwrite (fileno (self->tile_file), tile_address,
+                                  byte_count, file_offset);
+    if ( write_count < 0 ) {
+      perror ("error writing tile cache file");
+      g_assert_not_reached ();
+    }
+    g_assert ((size_t) write_count == byte_count);
+    return;
+  }
+#endif
 
-// Return true iff tile (x, y) is already loaded into the memory cache.
-static gboolean
-tile_is_loaded (UInt8Image *self, ssize_t x, ssize_t y)
-{
-  g_assert (    x >= 0 && (size_t) x < self->tile_count_x
-             && y >= 0 && (size_t) y < self->tile_count_y );
+  if ( self->concurrent ) {
+    g_mutex_lock (&(self->tile_file_lock));
+  }
 
-  size_t tile_offset = self->tile_count_x * y + x;
+  int return_code = FSEEK64 (self->tile_file, file_offset, SEEK_SET);
+  g_assert (return_code == 0);
+  size_t write_count = fwrite (tile_address, sizeof (uint8_t), self->tile_area,
+                               self->tile_file);
+  g_assert (write_count == self->tile_area);
 
-  return self->tile_addresses[tile_offset] != NULL;
+  if ( self->concurrent ) {
+    g_mutex_unlock (&(self->tile_file_lock));
+  }
 }
 
-// Load (currently unloaded) tile (x, y) from disk cache into memory
-// cache, possibly displacing the oldest tile already loaded, updating
-// the load order queue, and returning the address of the tile loaded.
-static uint8_t *
-load_tile (UInt8Image *self, ssize_t x, ssize_t y)
+// Read the contents of tile with flattened offset tile_offset from
+// the disk file into the memory cache at tile_address.
+static void
+disk_tile_to_cache (UInt8Image *self, size_t tile_offset, uint8_t *tile_address)
 {
-  // Make sure we haven't screwed up somehow and not created a tile
-  // file when in fact we should have.
   g_assert (self->tile_file != NULL);
+  g_assert (tile_offset < self->tile_count);
 
-  g_assert (!tile_is_loaded (self, x, y));
-
-  // Address into which tile gets loaded (to be returned).
-  uint8_t *tile_address;
-
-  // Offset of tile in flattened array.
-  size_t tile_offset = self->tile_count_x * y + x;
+  off_t file_offset = (off_t) tile_offset * self->tile_area * sizeof (uint8_t);
 
-  // We have to check and see if we have to displace an already loaded
-  // tile or not.
-  if ( self->tile_queue->length == self->cache_size_in_tiles ) {
-    // Displace tile loaded longest ago.
-    size_t oldest_tile
-      = GPOINTER_TO_INT (g_queue_pop_tail (self->tile_queue));
-    cached_tile_to_disk (self, oldest_tile);
-    tile_address = self->tile_addresses[oldest_tile];
-    self->tile_addresses[oldest_tile] = NULL;
-  }
-  else {
-    // Load tile into first free slot.
-    tile_address = self->cache + self->tile_queue->length * self->tile_area;
+#ifndef win32
+  // See the comment in cached_tile_to_disk.
+  if ( self->concurrent ) {
+    size_t byte_count = self->tile_area * sizeof (uint8_t);
+    ssize_t read_count = pread (fileno (self->tile_file), tile_address,
+                                byte_count, file_offset);
+    if ( read_count < 0 ) {
+      perror ("error reading tile cache file");
+      g_assert_not_reached ();
+    }
+    g_assert ((size_t) read_count == byte_count);
+    return;
   }
+#endif
 
-  // Put the new tile address into the index, and put the index into
-  // the load order queue.
-  self->tile_addresses[tile_offset] = tile_address;
-  // Stash in queue by converting to a pointer (so it must fit in an int).
-  g_assert (tile_offset < INT_MAX);
-  g_queue_push_head (self->tile_queue,
-                     GINT_TO_POINTER ((int) tile_offset));
+  if ( self->concurrent ) {
+    g_mutex_lock (&(self->tile_file_lock));
+  }
 
-  // Load the tile data.
-  int return_code
-    = FSEEK64 (self->tile_file,
-              (off_t) tile_offset * self->tile_area * sizeof (uint8_t),
-              SEEK_SET);
+  int return_code = FSEEK64 (self->tile_file, file_offset, SEEK_SET);
   g_assert (return_code == 0);
   clearerr (self->tile_file);
   size_t read_count = fread (tile_address, sizeof (uint8_t), self->tile_area,
@@ -1125,9 +1170,135 @@ load_tile (UInt8Image *self, ssize_t x, ssize_t y)
   }
   g_assert (read_count == self->tile_area);
 
+  if ( self->concurrent ) {
+    g_mutex_unlock (&(self->tile_file_lock));
+  }
+}
+
+// The cache shard responsible for tile with flattened offset tile_offset.
+static UInt8ImageCacheShard *
+tile_shard (UInt8Image *self, size_t tile_offset)
+{
+  return &(self->shards[tile_offset % self->shard_count]);
+}
+
+// Displace the tile loaded longest ago in shard which isn't pinned,
+// writing it back to the disk cache, and return the address of the
+// cache slot it occupied.  In concurrent access mode the caller must
+// hold the shard lock.
+static uint8_t *
+evict_tile (UInt8Image *self, UInt8ImageCacheShard *shard)
+{
+  for ( ; ; ) {
+    GList *link;
+    for ( link = shard->tile_queue->tail ; link != NULL ; link = link->prev ) {
+      size_t tile_offset = GPOINTER_TO_INT (link->data);
+      uint8_t *tile_address = self->tile_addresses[tile_offset];
+      // Unpublish the tile, then make sure nobody has pinned it.
+      // Readers pin a tile before they look at its address, so
+      // either we see their pin here, or they see the NULL address
+      // and queue up behind the shard lock we are holding.
+      g_atomic_pointer_set (&(self->tile_addresses[tile_offset]), NULL);
+      if ( g_atomic_int_get (&(self->tile_pins[tile_offset])) == 0 ) {
+        cached_tile_to_disk (self, tile_offset, tile_address);
+        g_queue_delete_link (shard->tile_queue, link);
+        return tile_address;
+      }
+      g_atomic_pointer_set (&(self->tile_addresses[tile_offset]),
+                            tile_address);
+    }
+    // Every tile in the shard is pinned.  That can only happen when
+    // other threads are in the middle of using them, so wait for one
+    // of them to let go.
+    g_assert (self->concurrent);
+    g_thread_yield ();
+  }
+}
+
+// Load (currently unloaded) tile with flattened offset tile_offset
+// from disk cache into its shard of the memory cache, possibly
+// displacing the oldest unpinned tile already loaded in the shard,
+// updating the load order queue, and returning the address of the
+// tile loaded.  In concurrent access mode the caller must hold the
+// shard lock.
+static uint8_t *
+load_tile (UInt8Image *self, size_t tile_offset)
+{
+  // Make sure we haven't screwed up somehow and not created a tile
+  // file when in fact we should have.
+  g_assert (self->tile_file != NULL);
+
+  g_assert (tile_offset < self->tile_count);
+  g_assert (self->tile_addresses[tile_offset] == NULL);
+
+  UInt8ImageCacheShard *shard = tile_shard (self, tile_offset);
+
+  // Address into which tile gets loaded (to be returned).
+  uint8_t *tile_address;
+
+  // We have to check and see if we have to displace an already loaded
+  // tile or not.
+  if ( shard->tile_queue->length == shard->slot_count ) {
+    tile_address = evict_tile (self, shard);
+  }
+  else {
+    // Load tile into first free slot.
+    tile_address = shard->slots + shard->tile_queue->length * self->tile_area;
+  }
+
+  // Load the tile data.
+  disk_tile_to_cache (self, tile_offset, tile_address);
+
+  // Put the index into the load order queue by converting it to a
+  // pointer (so it must fit in an int).
+  g_assert (tile_offset < INT_MAX);
+  g_queue_push_head (shard->tile_queue, GINT_TO_POINTER ((int) tile_offset));
+
+  // Put the new tile address into the index.  This is done last since
+  // in concurrent access mode other threads may pick it up at any
+  // time without locking.
+  g_atomic_pointer_set (&(self->tile_addresses[tile_offset]), tile_address);
+
+  return tile_address;
+}
+
+// Pin the tile with flattened offset tile_offset, loading it first if
+// necessary, and return its address.  Pinned tiles aren't evicted
+// until they are unpinned again.  This is the concurrent access mode
+// equivalent of looking the address up in self->tile_addresses.
+static uint8_t *
+pin_tile (UInt8Image *self, size_t tile_offset)
+{
+  // The pin must be in place before we look at the address (see the
+  // comment in evict_tile).
+  g_atomic_int_inc (&(self->tile_pins[tile_offset]));
+  uint8_t *tile_address
+    = g_atomic_pointer_get (&(self->tile_addresses[tile_offset]));
+  if ( G_LIKELY (tile_address != NULL) ) {
+    return tile_address;
+  }
+
+  // Not resident, so we have to load it, which only involves the lock
+  // of the shard the tile belongs to.  Some other thread may have
+  // beaten us to it while we waited for the lock.
+  UInt8ImageCacheShard *shard = tile_shard (self, tile_offset);
+  g_mutex_lock (&(shard->lock));
+  tile_address = self->tile_addresses[tile_offset];
+  if ( tile_address == NULL ) {
+    tile_address = load_tile (self, tile_offset);
+  }
+  g_mutex_unlock (&(shard->lock));
+
   return tile_address;
 }
 
+// Release a pin taken with pin_tile.
+static void
+unpin_tile (UInt8Image *self, size_t tile_offset)
+{
+  g_atomic_int_add (&(self->tile_pins[tile_offset]), -1);
+}
+
 uint8_t
 uint8_image_get_pixel (UInt8Image *self, ssize_t x, ssize_t y)
 {
@@ -1142,13 +1313,22 @@ uint8_image_get_pixel (UInt8Image *self, ssize_t x, ssize_t y)
   // Offset of tile x, y, where tiles are viewed as pixels normally are.
   size_t tile_offset = self->tile_count_x * pc_y.quot + pc_x.quot;
 
+  // In concurrent access mode, the tile has to be pinned while we
+  // look at it.
+  if ( G_UNLIKELY (self->concurrent) ) {
+    uint8_t *tile_address = pin_tile (self, tile_offset);
+    uint8_t value = tile_address[self->tile_size * pc_y.rem + pc_x.rem];
+    unpin_tile (self, tile_offset);
+    return value;
+  }
+
   // Address of data for tile containing pixel of interest (may still
   // have to be loaded from disk cache).
   uint8_t *tile_address = self->tile_addresses[tile_offset];
 
   // Load the tile containing the pixel of interest if necessary.
   if ( G_UNLIKELY (tile_address == NULL) ) {
-    tile_address = load_tile (self, pc_x.quot, pc_y.quot);
+    tile_address = load_tile (self, tile_offset);
   }
 
   // Return pixel of interest.
@@ -1170,13 +1350,22 @@ uint8_image_set_pixel (UInt8Image *self, ssize_t x, ssize_t y, uint8_t value)
   // Offset of tile x, y, where tiles are viewed as pixels normally are.
   size_t tile_offset = self->tile_count_x * pc_y.quot + pc_x.quot;
 
+  // In concurrent access mode, the tile has to be pinned while we
+  // write to it.
+  if ( G_UNLIKELY (self->concurrent) ) {
+    uint8_t *tile_address = pin_tile (self, tile_offset);
+    tile_address[self->tile_size * pc_y.rem + pc_x.rem] = value;
+    unpin_tile (self, tile_offset);
+    return;
+  }
+
   // Address of data for tile containing pixel of interest (may still
   // have to be loaded from disk cache).
   uint8_t *tile_address = self->tile_addresses[tile_offset];
 
   // Load the tile containing the pixel of interest if necessary.
   if ( G_UNLIKELY (tile_address == NULL) ) {
-    tile_address = load_tile (self, pc_x.quot, pc_y.quot);
+    tile_address = load_tile (self, tile_offset);
   }
 
   // Set pixel of interest.
@@ -1642,14 +1831,23 @@ uint8_image_sample (UInt8Image *self, double x, double y,
         size_t tx = xb / ts, ty = yb / ts;
         // Tile offset in flattened list of tile addresses.
         size_t tile_offset = ty * self->tile_count_x + tx;
-        uint8_t *tile_address = self->tile_addresses[tile_offset];
-        if ( G_UNLIKELY (tile_address == NULL) ) {
-          tile_address = load_tile (self, tx, ty);
+        uint8_t *tile_address;
+        if ( G_UNLIKELY (self->concurrent) ) {
+          tile_address = pin_tile (self, tile_offset);
+        }
+        else {
+          tile_address = self->tile_addresses[tile_offset];
+          if ( G_UNLIKELY (tile_address == NULL) ) {
+            tile_address = load_tile (self, tile_offset);
+          }
         }
         ul = tile_address[ybto * self->tile_size + xbto];
         ur = tile_address[ybto * self->tile_size + xato];
         ll = tile_address[yato * self->tile_size + xbto];
         lr = tile_address[yato * self->tile_size + xato];
+        if ( G_UNLIKELY (self->concurrent) ) {
+          unpin_tile (self, tile_offset);
+        }
       }
       else {
         // We are spanning a tile edge, so we just get the pixels
@@ -1834,11 +2032,15 @@ synchronize_tile_file_with_memory_cache (UInt8Image *self)
   // sense.
   g_assert (self->tile_file != NULL);
 
-  guint ii;
-  for ( ii = 0 ; ii < self->tile_queue->length ; ii++ ) {
-    size_t tile_offset = GPOINTER_TO_INT (g_queue_peek_nth (self->tile_queue,
-                  ii));
-    cached_tile_to_disk (self, tile_offset);
+  size_t ii;
+  for ( ii = 0 ; ii < self->shard_count ; ii++ ) {
+    GList *link;
+    for ( link = self->shards[ii].tile_queue->head ; link != NULL ;
+          link = link->next ) {
+      size_t tile_offset = GPOINTER_TO_INT (link->data);
+      cached_tile_to_disk (self, tile_offset,
+                           self->tile_addresses[tile_offset]);
+    }
   }
 }
 
@@ -1882,14 +2084,15 @@ uint8_image_freeze (UInt8Image *self, FILE *file_pointer)
   // We don't bother serializing the cache -- its a pain to keep track
   // of and probably almost never worth it.
 
-  // We write the tile queue pointer away, so that when we later thaw
-  // the serialized version, we can tell if a cache file is in use or
-  // not (if it isn't tile_queue will be NULL).
-  write_count = fwrite (&(self->tile_queue), sizeof (GQueue *), 1, fp);
+  // We write a marker pointer away, so that when we later thaw the
+  // serialized version, we can tell if a cache file is in use or not
+  // (if it isn't the marker will be NULL).
+  gpointer tile_file_marker = self->tile_file;
+  write_count = fwrite (&tile_file_marker, sizeof (gpointer), 1, fp);
   g_assert (write_count == 1);
 
   // If there was no cache file...
-  if ( self->tile_queue == NULL ) {
+  if ( self->tile_file == NULL ) {
     // We store the contents of the first tile and are done.
     write_count = fwrite (self->tile_addresses[0], sizeof (uint8_t),
         self->tile_area, fp);
@@ -2132,6 +2335,57 @@ uint8_image_set_cache_size (UInt8Image* UNUSED(self), size_t UNUSED(size))
   g_assert_not_reached ();      // Stubbed out for now.
 }
 
+// Write every tile in the memory cache back to the disk cache, and
+// empty the memory cache.
+static void
+flush_tile_cache (UInt8Image *self)
+{
+  synchronize_tile_file_with_memory_cache (self);
+
+  size_t ii;
+  for ( ii = 0 ; ii < self->shard_count ; ii++ ) {
+    GQueue *tile_queue = self->shards[ii].tile_queue;
+    while ( !g_queue_is_empty (tile_queue) ) {
+      size_t tile_offset = GPOINTER_TO_INT (g_queue_pop_head (tile_queue));
+      g_assert (self->tile_pins[tile_offset] == 0);
+      self->tile_addresses[tile_offset] = NULL;
+    }
+  }
+}
+
+void
+uint8_image_set_concurrent_access (UInt8Image *self, gboolean concurrent)
+{
+  concurrent = (concurrent ? TRUE : FALSE);
+  if ( concurrent == self->concurrent ) {
+    return;
+  }
+
+  // Images which fit in a single tile never load or evict anything,
+  // so there is no cache to split up.
+  if ( self->tile_file != NULL ) {
+    flush_tile_cache (self);
+    free_tile_cache_shards (self);
+
+    size_t shard_count = 1;
+    if ( concurrent ) {
+      // A couple of shards per processor keeps lock contention low,
+      // but each shard needs a few slots of its own to be any use.
+      shard_count = MIN (2 * (size_t) g_get_num_processors (),
+                         self->cache_size_in_tiles / 4);
+      shard_count = MAX (shard_count, 1);
+    }
+    initialize_tile_cache_shards (self, shard_count);
+
+    // Concurrent mode does positioned I/O on the descriptor, which
+    // bypasses the stream buffer.
+    int return_code = fflush (self->tile_file);
+    g_assert (return_code == 0);
+  }
+
+  self->concurrent = concurrent;
+}
+
 void
 uint8_image_free (UInt8Image *self)
 {
@@ -2145,11 +2399,11 @@ uint8_image_free (UInt8Image *self)
   // Deallocate dynamic memory.
 
   g_free (self->tile_addresses);
+  g_free (self->tile_pins);
 
-  // If we didn't need a tile file, we also won't have a tile queue.
-  if ( self->tile_queue != NULL ) {
-    g_queue_free (self->tile_queue);
-  }
+  // If we didn't need a tile file, we also won't have any shards.
+  free_tile_cache_shards (self);
+  g_mutex_clear (&(self->tile_file_lock));
 
   g_free (self->cache);
 
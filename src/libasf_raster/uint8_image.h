@@ -5,8 +5,9 @@
 // accesses are spatially correlated.  A variety of useful methods are
 // implemented (filtering, subsetting, interpolating, etc.)
 //
-// Don't try to access the same instance concurrently.  Split your
-// images up into separate instances if you must parallelize things.
+// Don't try to access the same instance concurrently unless you have
+// first switched on concurrent access mode (see
+// uint8_image_set_concurrent_access below).
 //
 // For many methods, arguments of type ssize_t are used, but are not
 // allowed to be negative.  This is to help prevent people from
@@ -38,6 +39,17 @@
 #define UINT8_MAX 255
 #endif
 
+// One independently locked part of the tile cache.  Tiles are
+// assigned to shards by flattened tile offset modulo the number of
+// shards, and each shard owns a fixed subset of the cache slots.  The
+// lock is only used in concurrent access mode.
+typedef struct {
+  GMutex lock;			// Guards the rest of the shard.
+  GQueue *tile_queue;		// Offsets of tiles in shard, in load order.
+  uint8_t *slots;		// First cache slot owned by this shard.
+  size_t slot_count;		// Number of cache slots owned by this shard.
+} UInt8ImageCacheShard;
+
 // Instance structure.  Everything here is private and need not be
 // used or understood by client code, except for the size_x and size_y
 // fields.
@@ -53,8 +65,12 @@ typedef struct {
   size_t tile_area;             // Area of a tile, in pixels.
   uint8_t *cache;		// Memory cache.
   uint8_t **tile_addresses;	// Addresss of individual tiles in the cache.
-  GQueue *tile_queue;		// Queue of tile offsets kept in load order.
+  gint *tile_pins;		// Per-tile pin counts (pinned tiles stay put).
+  size_t shard_count;		// Number of cache shards (0 if no tile file).
+  UInt8ImageCacheShard *shards;	// The cache shards.
+  gboolean concurrent;		// True iff in concurrent access mode.
   FILE *tile_file;              // File with tiles stored contiguously.
+  GMutex tile_file_lock;	// Serializes tile file I/O where needed.
   GString *tile_file_name;  // Filename of the tile file
 } UInt8Image;
 
@@ -296,6 +312,10 @@ typedef enum {
   UINT8_IMAGE_SAMPLE_METHOD_BICUBIC
 } uint8_image_sample_method_t;
 
+// Sample the image at the possibly fractional position x, y.  The
+// bicubic method keeps its splines in static storage, so it must not
+// be used from several threads at once, even in concurrent access
+// mode.
 double
 uint8_image_sample (UInt8Image *self, double x, double y,
 		    uint8_image_sample_method_t sample_method);
@@ -420,6 +440,32 @@ uint8_image_get_cache_size (UInt8Image *self);
 void
 uint8_image_set_cache_size (UInt8Image *self, size_t size);
 
+///////////////////////////////////////////////////////////////////////////////
+//
+// Concurrent Access
+//
+// By default an instance may only be used by one thread at a time.
+// In concurrent access mode any number of threads may call the pixel,
+// region and sampling methods on the same instance at once.  The
+// memory cache is then split into several shards, each with its own
+// lock and its own share of the cache slots, so threads which miss in
+// different shards load tiles in parallel.  Tiles which are resident
+// are found without taking any lock at all.  A tile is pinned while a
+// thread is using it, and pinned tiles are never evicted.
+//
+// Threads writing the same pixel must still coordinate among
+// themselves, and the methods which create, store, freeze or free
+// instances, or which change the cache setup, must not be called
+// while other threads are using the instance.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Switch concurrent access mode on or off.  Switching flushes the
+// memory cache back to the tile file, so do it before the threads are
+// started, not while they are running.
+void
+uint8_image_set_concurrent_access (UInt8Image *self, gboolean concurrent);
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 // Freeing Instances
@@ -33,6 +33,8 @@
 #include "poly.h"
 #include "asf_meta.h"
 #include "float_image.h"
+#include "asf_raster.h"
+#include "vector.h"
 
 /* For use by the "classifier" in the polarimetry calculations
    Used by: classify.c and polarimetry.c
@@ -70,6 +72,44 @@ int deskew_dem(char *inDemSlant, char *inDemGround, char *outName,
                char *inSarName, int doRadiometric, char *inMaskName,
                char *outMaskName, int fill_holes, int fill_value,
                int which_gr_dem, int use_nearest_neighbor);
+int deskew_dem_to_buffers(char *inDemSlant, char *inDemGround,
+                          char *inSarName, int doRadiometric,
+                          char *inMaskName, int fill_holes, int fill_value,
+                          int which_gr_dem, int use_nearest_neighbor,
+                          image_buffer **outImage, meta_parameters **outMeta,
+                          image_buffer **outMask,
+                          meta_parameters **outMaskMeta);
+
+/* Prototypes from terrain_normals.c */
+/* Three consecutive rows of DEM points in ECEF coordinates (row 0 is the
+   line above, row 1 the current line, row 2 the line below), and the
+   unit terrain normals of the current line. */
+typedef struct {
+  int ns;
+  double a, e2;             /* ellipsoid used for the ECEF positions */
+  double *lat[3], *lon[3];  /* degrees */
+  double *x[3], *y[3], *z[3];
+  double *nx, *ny, *nz;
+  int count;                /* rows pushed so far, up to 3 */
+} terrain_rows;
+
+terrain_rows *terrain_rows_new(int ns, double a, double e2);
+void terrain_rows_free(terrain_rows *t);
+/* Drop the line above and append the given line, at the DEM heights. */
+void terrain_rows_push(terrain_rows *t, meta_parameters *meta, int line,
+                       const float *height);
+/* Normals for samples 1..ns-2 of the current line; both ends get 0. */
+void terrain_rows_normals(terrain_rows *t);
+/* Ulander cos(phi) (negative in layover) and, optionally, the local
+   incidence angle in degrees for the current line. */
+void terrain_rows_cosphi(const terrain_rows *t, const Vector *satpos,
+                         double *cosphi, double *local_incid);
+/* Angle between the normals and straight down, in degrees. */
+void terrain_rows_tilt(const terrain_rows *t, double *tilt);
+/* Ellipsoid incidence angle (radians) across a line, interpolated
+   between exact values every few samples. */
+void incidence_profile(meta_parameters *meta, int line, int ns,
+                       double *incid);
 
 /* Prototypes from create_dem_grid.c */
 int create_dem_grid(const char *demName, const char *sarName,
@@ -136,6 +176,30 @@ int classify(classifier_t *classifier, float entropy, float anisotropy,
 const char *get_cal_band_name(meta_parameters *meta, char *base);
 int find_band(meta_parameters *meta, char *name, int *ok);
 
+/* Prototypes from polarimetry_kernels.c */
+/* A line of 3x3 Hermitian matrices (coherency T3 or covariance C3), one
+   array per element of the upper triangle. */
+typedef struct {
+  int ns;
+  double *t11, *t22, *t33;
+  double *t12_re, *t12_im, *t13_re, *t13_im, *t23_re, *t23_im;
+} herm3_row;
+
+herm3_row *herm3_row_new(int ns);
+void herm3_row_free(herm3_row *r);
+void herm3_row_zero(herm3_row *r);
+/* Add a line of matrices (only their upper triangles are read). */
+void herm3_row_add_matrices(herm3_row *r, complexMatrix **m);
+/* Add the covariance matrices of a line of scattering matrices, for the
+   lexicographic basis (hh, sqrt(2) hv, vv). */
+void herm3_row_add_covariance(herm3_row *r, const quadPolS2Float *s2);
+/* Ensemble average: "sum" holds nrows lines added together, "mean" gets
+   their mean over a window of 2*hw+1 samples, clipped at the ends. */
+void herm3_row_box(const herm3_row *sum, int nrows, int hw, herm3_row *mean);
+/* Eigenvalues, largest magnitude first, and the magnitude of the first
+   component of each one's unit eigenvector. */
+void herm3_row_eigen(const herm3_row *t, double *lambda[3], double *v0[3]);
+
 /* Prototypes from polarimetry.c */
 void polarimetric_decomp(const char *inFile, const char *outFile,
                          int amplitude_band,
@@ -521,26 +521,6 @@ static void geo_compensate(struct deskew_dem_data *d,float *grDEM, float *in,
     }
 }
 
-static void geodetic_to_ecef(double lat, double lon, double h, Vector *v)
-{
-  const double a = 6378144.0;    // GEM-06 Ellipsoid.
-  const double e = 8.1827385e-2; // GEM-06 Eccentricity
-  const double e2 = e*e;
-
-  lat *= D2R;
-  lon *= D2R;
-
-  double sin_lat = sin(lat);
-  double cos_lat = cos(lat);
-
-  double f = sqrt(1 - e2*sin_lat*sin_lat);
-  double af = a/f;
-
-  v->x = (af + h)*cos_lat*cos(lon);
-  v->y = (af + h)*cos_lat*sin(lon);
-  v->z = (a*(1-e2)/f + h)*sin_lat;
-}
-
 static Vector get_satpos(meta_parameters *meta, int line)
 {
   int ns = meta->general->sample_count;
@@ -569,65 +549,6 @@ static Vector get_satpos(meta_parameters *meta, int line)
   return satpos;
 }
 
-static void calculate_vectors_for_line(meta_parameters *meta_img, float *demLine, int line, Vector **vectorLine, Vector *nextVectors, Vector *verticals)
-{
-  int jj;
-  double lat, lon;
-  int ns = meta_img->general->sample_count;
-
-  for(jj = 0; jj < ns; ++jj) {
-    Vector *v = MALLOC(sizeof(Vector));
-    meta_get_latLon(meta_img, line, jj, 0, &lat, &lon);
-    geodetic_to_ecef(lat, lon, demLine[jj], v);
-    vectorLine[jj] = v;
-
-    Vector v2;
-    geodetic_to_ecef(lat, lon, demLine[jj], &verticals[jj]);
-    geodetic_to_ecef(lat, lon, demLine[jj]+100, &v2);
-    vector_subtract(&verticals[jj], &v2);
-    vector_multiply(&verticals[jj], 1./vector_magnitude(&verticals[jj]));
-
-    meta_get_latLon(meta_img, line+1, jj, 0, &lat, &lon);
-    geodetic_to_ecef(lat, lon, demLine[jj], &nextVectors[jj]);
-  }
-}
-
-static void push_next_vector_line(Vector ***localVectors, Vector *nextVectors, Vector *verticals, meta_parameters *meta_img, float *demLine, int line)
-{
-  int ns = meta_img->general->sample_count;
-  Vector **vectorsLine = MALLOC(sizeof(Vector*)*ns);
-  calculate_vectors_for_line(meta_img, demLine, line, vectorsLine, nextVectors, verticals);
-
-  int i;
-  for(i = 0; i < ns; i++)
-    if(localVectors[0] != NULL)
-      vector_free(localVectors[0][i]);
-  FREE(localVectors[0]);
-
-  localVectors[0] = localVectors[1];
-  localVectors[1] = localVectors[2];
-  localVectors[2] = vectorsLine;
-}
-
-static Vector * calculate_normal(Vector ***localVectors, int sample)
-{
-  Vector *v1, *v2, *normal;
-
-  v1 = vector_copy(localVectors[0][sample]);
-  vector_subtract(v1, localVectors[2][sample]);
-
-  v2 = vector_copy(localVectors[1][sample-1]);
-  vector_subtract(v2, localVectors[1][sample+1]);
-
-  normal = vector_cross(v2, v1);
-  vector_multiply(normal, 1./vector_magnitude(normal));
-
-  vector_free(v1);
-  vector_free(v2);
-  
-  return normal;
-}
-
 /*
  * Not being used for now -- what we have in RTC is more accurate
 
@@ -648,35 +569,6 @@ calculate_local_incidence(Vector *n, Vector *satpos, Vector *p)
 }
 */
 
-static float
-calculate_correction(meta_parameters *meta_in, int line, int samp,
-                     Vector *satpos, Vector *n, Vector *p, Vector *p_next)
-{
-  // R: vector from ground point (p) to satellite (satpos)
-  Vector *R = vector_copy(satpos);
-  vector_subtract(R, p);
-  vector_multiply(R, 1./vector_magnitude(R));
-
-  Vector *x = vector_copy(p);
-  vector_subtract(x, p_next);
-  vector_multiply(x, 1./vector_magnitude(x));
-
-  // Rx: R cross x -- image plane normal
-  Vector *Rx = vector_cross(R,x);
-
-  // cos(phi) is the correction factor we need
-  double cosphi = vector_dot(Rx,n);
-  //if (cosphi < 0) cosphi = -cosphi;
-
-  vector_free(x);
-  vector_free(R);
-  vector_free(Rx);
-
-  // need to remove old correction factor (sin of the incidence angle)
-  double incid = meta_incid(meta_in, line, samp);
-  return cosphi / sin(incid);
-}
-
 static void shift_gr(struct deskew_dem_data *d, float *in, float *out)
 {
     int x, newX, ns=d->numSamples;
@@ -753,13 +645,15 @@ static void push_dem_lines(FILE * inDemGroundFp, meta_parameters *metaDEMground,
   backconverted_dem[2] = backconvertedDemLine;
 }
 
-static void filter_mask(char *maskName)
+// Grow the layover regions of the mask, which is either the file
+// maskName or, if that is NULL, the image buffer mask.
+static void filter_mask(char *maskName, image_buffer *mask)
 {
-  int ii, jj;
-  meta_parameters *meta = meta_read(maskName);
-  int nl = meta->general->line_count;
-  int ns = meta->general->sample_count;
-  FILE *fp = fopenImage (maskName, "r+b");
+  int ii, jj, kk;
+  meta_parameters *meta = maskName ? meta_read(maskName) : NULL;
+  int nl = meta ? meta->general->line_count : mask->nl;
+  int ns = meta ? meta->general->sample_count : mask->ns;
+  FILE *fp = meta ? fopenImage (maskName, "r+b") : NULL;
   float *buf = MALLOC(sizeof(float)*ns*5);
 
   int iter=1;
@@ -769,7 +663,11 @@ static void filter_mask(char *maskName)
     int num_image=0; 
     for (ii=0; ii<nl-5; ++ii) {
 
-      get_float_lines(fp, meta, ii, 5, buf);
+      if (fp)
+        get_float_lines(fp, meta, ii, 5, buf);
+      else
+        for (kk=0; kk<5; ++kk)
+          image_buffer_get_line(mask, 0, ii+kk, buf + kk*ns);
 
       int num_line = 0;
       int l = 2;         // this is the line we are working on, in the buffer
@@ -823,8 +721,10 @@ static void filter_mask(char *maskName)
         }
       }
        
-      if (num_line>0)
+      if (num_line>0 && fp)
         put_float_line(fp, meta, ii+2, buf + 2*ns);
+      else if (num_line>0)
+        image_buffer_put_line(mask, 0, ii+2, buf + 2*ns);
       num_image += num_line;
     }
     if (num_image == 0)
@@ -832,7 +732,8 @@ static void filter_mask(char *maskName)
     total += num_image;
     ++iter;
   }
-  FCLOSE(fp);
+  if (fp)
+    FCLOSE(fp);
 
   if (orig == 0) {
     asfPrintStatus("Layover smoothing took %d iterations.\n", iter);
@@ -844,21 +745,57 @@ static void filter_mask(char *maskName)
 
   asfPrintStatus("Writing filtered mask...\n");
   FREE(buf); 
-  meta_free(meta);
+  if (meta)
+    meta_free(meta);
 }
 
-/* inSarName can be NULL, in this case doRadiometric is ignored */
-/* inMaskName can be NULL, in this case outMaskName is ignored */
-int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
+// Where the corrected image and the layover/shadow mask go: the files
+// outName and outMaskName, or image buffers if outImage is not NULL.
+struct deskew_dem_output {
+  FILE *fp, *maskFp;
+  meta_parameters *meta;
+  image_buffer *image, *mask;
+};
+
+static void put_output_line(struct deskew_dem_output *o, int band, int line,
+                            float *buf)
+{
+  if (o->image)
+    image_buffer_put_line(o->image, band, line, buf);
+  else
+    put_band_float_line(o->fp, o->meta, band, line, buf);
+}
+
+static void put_mask_line(struct deskew_dem_output *o, int line, float *buf)
+{
+  if (o->mask)
+    image_buffer_put_line(o->mask, 0, line, buf);
+  else
+    put_float_line(o->maskFp, o->meta, line, buf);
+}
+
+static void set_mask_meta(meta_parameters *meta)
+{
+  // the mask has just 1 band, regardless of how many input has
+  meta->general->band_count = 1;
+  strcpy (meta->general->bands, "LAYOVER_MASK");
+
+  // mask doesn't really have a radiometry, just set amp
+  meta->general->radiometry = r_AMP;
+}
+
+static int deskew_dem_core (char *inDemSlant, char *inDemGround, char *outName,
             char *inSarName, int doRadiometric, char *inMaskName,
             char *outMaskName, int fill_holes, int fill_value,
-            int which_gr_dem, int use_nearest_neighbor)
+            int which_gr_dem, int use_nearest_neighbor,
+            image_buffer **outImage, image_buffer **outMask,
+            meta_parameters **outImageMeta, meta_parameters **outMaskMeta)
 {
   float *inSarLine;
-  FILE *inDemSlantFp, *inDemGroundFp = NULL, *inSarFp, *outFp,
-    *inMaskFp = NULL, *outMaskFp = NULL;
+  FILE *inDemSlantFp, *inDemGroundFp = NULL, *inSarFp, *inMaskFp = NULL;
   meta_parameters *metaDEMslant, *metaDEMground = NULL, *outMeta,
     *inSarMeta, *inMaskMeta = NULL;
+  struct deskew_dem_output out = { NULL, NULL, NULL, NULL, NULL };
   char **bands = NULL;
   char msg[256];
   int ns, inSarFlag, inMaskFlag, outMaskFlag;
@@ -866,10 +803,11 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
   struct deskew_dem_data d;
   int band_count = 1;           // in case no SAR image is passed in
   int save_locals = 0;          // locals calc doesn't seem to be working
+  int toBuffers = outImage != NULL;
 
   inSarFlag = inSarName != NULL;
   inMaskFlag = inMaskName != NULL;
-  outMaskFlag = outMaskName != NULL;
+  outMaskFlag = toBuffers ? outMask != NULL : outMaskName != NULL;
 
   inSarFp = NULL;
   inSarMeta = NULL;
@@ -940,7 +878,9 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
   if (inDemGround)
     inDemGroundFp = fopenImage (inDemGround, "rb");
 
-  outFp = fopenImage (outName, "wb");
+  out.meta = outMeta;
+  if (!toBuffers)
+    out.fp = fopenImage (outName, "wb");
   if (inSarFlag) {
     inSarFp = fopenImage (inSarName, "rb");
     outMeta->general->band_count = inSarMeta->general->band_count;
@@ -951,24 +891,26 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
       asfPrintError ("Cannot produce a mask without a SAR!\n");
     inMaskMeta = meta_read (inMaskName);
 
-    meta_general *smg = inSarMeta->general;
+    // The mask is read a line at a time into ns sample buffers, just
+    // like the DEM, so it has to match the output rather than the SAR
+    // image (which may be narrower, see below).
     meta_general *mmg = inMaskMeta->general;
-    if ((smg->line_count != mmg->line_count) ||
-        (smg->sample_count != mmg->sample_count)) {
-      asfPrintStatus (" SAR Image: %dx%d LxS.\n"
-                      "Mask Image: %dx%d LxS.\n",
-                      inSarMeta->general->line_count,
-                      inSarMeta->general->sample_count,
+    if ((d.numLines != mmg->line_count) ||
+        (d.numSamples != mmg->sample_count)) {
+      asfPrintStatus ("Output Image: %dx%d LxS.\n"
+                      "  Mask Image: %dx%d LxS.\n",
+                      d.numLines, d.numSamples,
                       inMaskMeta->general->line_count,
                       inMaskMeta->general->sample_count);
 
-      asfPrintError ("The mask and the SAR image must be the "
+      asfPrintError ("The mask and the slant range DEM must be the "
                      "same size.\n");
     }
   }
 
 /* output file's metadata is all set, now */
-  meta_write (outMeta, outName);
+  if (!toBuffers)
+    meta_write (outMeta, outName);
 
 /* Blather at user about what is going on */
   strcpy (msg, "");
@@ -990,8 +932,12 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
   asfPrintStatus (msg);
 
 /*Allocate input buffers.*/
+  // A SAR image narrower than the DEM is padded with zeros on the
+  // right as it is read, so the caller doesn't have to make a padded
+  // copy of it first.
+  int sarNs = inSarFlag ? inSarMeta->general->sample_count : 0;
   if (inSarFlag) {
-    inSarLine = (float *) MALLOC (sizeof (float) * ns);
+    inSarLine = (float *) CALLOC (sarNs > ns ? sarNs : ns, sizeof (float));
   }
   else {
     inSarLine = NULL;
@@ -1001,12 +947,11 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
   float angles[ns];
   float maskLine[ns];
   float outLine[ns];
-  Vector verticals[ns];
   float *localRadDemLines[3] = { NULL, NULL, NULL };
   float *localGeoDemLines[3] = { NULL, NULL, NULL };
   float *localbackconvertedDemLines[3] = { NULL, NULL, NULL };
-  Vector **localVectors[3] = { NULL, NULL, NULL };
-  Vector nextVectors[ns];
+  terrain_rows *rows = NULL;
+  double *cosphi = NULL, *incid = NULL, *tilt = NULL;
 
   n_layover = n_shadow = n_user = 0;
 
@@ -1033,20 +978,30 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
 /*Open the mask, if we have one*/
   if (inMaskFlag)
     inMaskFp = fopenImage (inMaskName, "rb");
-  if (outMaskFlag)
-    outMaskFp = fopenImage (outMaskName, "wb");
+  if (outMaskFlag && toBuffers)
+    out.mask = image_buffer_new (ns, d.numLines, 1);
+  else if (outMaskFlag)
+    out.maskFp = fopenImage (outMaskName, "wb");
+  if (toBuffers)
+    out.image = image_buffer_new (ns, d.numLines, band_count);
 
   push_dem_lines(inDemGroundFp, metaDEMground, inDemSlantFp, metaDEMslant, which_gr_dem,
                  &d, 0, outLine, localbackconvertedDemLines, localGeoDemLines, localRadDemLines);
-  if(doRadiometric)
-    push_next_vector_line(localVectors, nextVectors, verticals, inSarMeta, localRadDemLines[2], 0);
+  if(doRadiometric) {
+    // DEM points are placed on the GEM-06 ellipsoid
+    rows = terrain_rows_new(ns, 6378144.0, 8.1827385e-2*8.1827385e-2);
+    cosphi = MALLOC(sizeof(double)*ns);
+    incid = MALLOC(sizeof(double)*ns);
+    tilt = MALLOC(sizeof(double)*ns);
+    terrain_rows_push(rows, inSarMeta, 0, localRadDemLines[2]);
+  }
 
   /*Rectify data.*/
   for (y = 0; y < d.numLines; y++) {
     push_dem_lines(inDemGroundFp, metaDEMground, inDemSlantFp, metaDEMslant, which_gr_dem,
                    &d, y+1, outLine, localbackconvertedDemLines, localGeoDemLines, localRadDemLines);
     if(y < d.numLines - 1 && doRadiometric)
-      push_next_vector_line(localVectors, nextVectors, verticals, inSarMeta, localRadDemLines[2], y+1);
+      terrain_rows_push(rows, inSarMeta, y+1, localRadDemLines[2]);
 
     /* Make an empty mask */
     for (x = 0; x < ns; ++x)
@@ -1108,9 +1063,13 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
 #ifndef ALTERNATIVE_NORMALS
         // method from rtc
         Vector satpos = get_satpos(inSarMeta, y);
+        terrain_rows_normals(rows);
+        terrain_rows_cosphi(rows, &satpos, cosphi, NULL);
+        terrain_rows_tilt(rows, tilt);
+        incidence_profile(inSarMeta, y, ns, incid);
         for(x=1; x < ns-1; ++x) {
-          Vector * normal = calculate_normal(localVectors, x);
-          corrections[x] = calculate_correction(inSarMeta, y, x, &satpos, normal, localVectors[1][x], &nextVectors[x]);
+          // need to remove old correction factor (sin of the incidence angle)
+          corrections[x] = cosphi[x] / sin(incid[x]);
           // If the Ulander correction is ever negative, that is layover
           if (corrections[x] < 0) {
             if (maskLine[x] == MASK_NORMAL) {
@@ -1119,8 +1078,7 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
             }
             corrections[x] *= -1;
           }
-          angles[x] = R2D * acos(vector_dot(normal, &verticals[x]));
-          vector_free(normal);
+          angles[x] = tilt[x];
         }
 #else
         // method we'd like to use here in deskew_dem
@@ -1179,10 +1137,10 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
       mask_float_line (ns, fill_value, outLine,
                        maskLine, localbackconvertedDemLines[1], &d, !fill_holes);
 
-      put_band_float_line (outFp, outMeta, b, y, outLine);
+      put_output_line (&out, b, y, outLine);
     }
     if (outMaskFlag)
-      put_float_line (outMaskFp, outMeta, y, maskLine);
+      put_mask_line (&out, y, maskLine);
 
     asfLineMeter (y, d.numLines);
   }
@@ -1197,22 +1155,25 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
   }
 
 /*Write the updated mask*/
-  if (outMaskFlag) {
-    FCLOSE (outMaskFp);
+  if (outMaskFlag && toBuffers) {
+    *outMaskMeta = meta_copy (outMeta);
+    set_mask_meta (*outMaskMeta);
 
-    // the mask has just 1 band, regardless of how many input has
-    outMeta->general->band_count = 1;
-    strcpy (outMeta->general->bands, "LAYOVER_MASK");
-
-    // mask doesn't really have a radiometry, just set amp
-    outMeta->general->radiometry = r_AMP;
+    asfPrintStatus("Cleaning up layover/shadow mask...\n");
+    filter_mask(NULL, out.mask);
+  }
+  else if (outMaskFlag) {
+    FCLOSE (out.maskFp);
 
     // write the mask's metadata, then print mask stats
+    set_mask_meta (outMeta);
     meta_write (outMeta, outMaskName);
   
     asfPrintStatus("Cleaning up layover/shadow mask...\n");
-    filter_mask(outMaskName);
+    filter_mask(outMaskName, NULL);
+  }
 
+  if (outMaskFlag) {
     int tot = ns * d.numLines;
     asfPrintStatus ("Mask Statistics:\n"
                     "    Layover Pixels: %9d/%d (%f%%)\n"
@@ -1235,14 +1196,10 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
   }
   FREE(bands);
 
-  for(y = 0; y < 3; ++y) {
-    if (localVectors[y]) {
-      for(x = 0; x < ns; ++x) {
-        vector_free(localVectors[y][x]);
-      }
-    }
-    FREE(localVectors[y]);
-  }
+  terrain_rows_free(rows);
+  FREE(cosphi);
+  FREE(incid);
+  FREE(tilt);
 
   if (inSarFlag) {
     FREE (inSarLine);
@@ -1251,11 +1208,19 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
   }
   FCLOSE (inDemSlantFp);
   FCLOSE (inDemGroundFp);
-  FCLOSE (outFp);
   meta_free (metaDEMslant);
   if (metaDEMground)
     meta_free (metaDEMground);
-  meta_free (outMeta);
+  if (toBuffers) {
+    *outImage = out.image;
+    if (outMask)
+      *outMask = out.mask;
+    *outImageMeta = outMeta;
+  }
+  else {
+    FCLOSE (out.fp);
+    meta_free (outMeta);
+  }
   FREE (d.slantGR);
   FREE (d.groundSR);
   FREE (d.heightShiftSR);
@@ -1272,3 +1237,35 @@ int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
 
   return TRUE;
 }
+
+/* inSarName can be NULL, in this case doRadiometric is ignored */
+/* inMaskName can be NULL, in this case outMaskName is ignored */
+int deskew_dem (char *inDemSlant, char *inDemGround, char *outName,
+            char *inSarName, int doRadiometric, char *inMaskName,
+            char *outMaskName, int fill_holes, int fill_value,
+            int which_gr_dem, int use_nearest_neighbor)
+{
+  return deskew_dem_core (inDemSlant, inDemGround, outName, inSarName,
+                          doRadiometric, inMaskName, outMaskName, fill_holes,
+                          fill_value, which_gr_dem, use_nearest_neighbor,
+                          NULL, NULL, NULL, NULL);
+}
+
+/* Same as deskew_dem(), but the corrected image and the layover/shadow
+   mask are left in image buffers, along with their metadata, instead of
+   being written out.  outMask and outMaskMeta can be NULL if no mask is
+   wanted. */
+int deskew_dem_to_buffers (char *inDemSlant, char *inDemGround,
+            char *inSarName, int doRadiometric, char *inMaskName,
+            int fill_holes, int fill_value, int which_gr_dem,
+            int use_nearest_neighbor, image_buffer **outImage,
+            meta_parameters **outMeta, image_buffer **outMask,
+            meta_parameters **outMaskMeta)
+{
+  assert(outImage && outMeta);
+  assert(!outMask == !outMaskMeta);
+  return deskew_dem_core (inDemSlant, inDemGround, NULL, inSarName,
+                          doRadiometric, inMaskName, NULL, fill_holes,
+                          fill_value, which_gr_dem, use_nearest_neighbor,
+                          outImage, outMask, outMeta, outMaskMeta);
+}
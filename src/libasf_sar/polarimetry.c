@@ -1014,9 +1014,13 @@ static void dump_class_map(const char *base_filename, int wide)
   free(filename);
 }
 
+// Cloude-Pottier alpha of a unit eigenvector, from the first component
+// e of it: acos(|e|).  An eigenvector's sign (or, for a complex one, its
+// phase) is arbitrary, so only the magnitude means anything.  The T3
+// paths pass |v0| from herm3_row_eigen; this used to be |Re(v0)| of the
+// GSL eigenvector, which depended on the phase GSL happened to pick.
 static double calc_alpha_real(double e)
 {
-  // still not entirely clear why we have to put fabs() here
   double alpha = acos(fabs(e));
 
   // alpha should be 0-90
@@ -1028,12 +1032,6 @@ static double calc_alpha_real(double e)
   return alpha;
 }
 
-static double calc_alpha(gsl_complex z)
-{
-  // alpha: acos(e[0]), e=eigenvector of coherence matrix
-  return calc_alpha_real(GSL_REAL(z));
-}
-
 static void add_boundary(int wide)
 {
   const char *boundary_file = "classifications/ea_boundary.txt";
@@ -1202,13 +1200,63 @@ static void do_pauli_bands(int band1, int band2, int band3,
   }
 }
 
+// Line buffers shared by the decompositions below, allocated once for
+// the whole image.
+typedef struct {
+  herm3_row *sum;           // lines added together
+  herm3_row *mean;          // ensemble averaged matrices
+  double *lambda[3];        // eigenvalues, largest first
+  double *v0[3];            // |first component| of the eigenvectors
+  float *entropy, *anisotropy, *alpha;
+  float *Ps, *Pd, *Pv;
+} polarimetry_work;
+
+static polarimetry_work *polarimetry_work_new(int ns)
+{
+  polarimetry_work *w = MALLOC(sizeof(polarimetry_work));
+  int k;
+
+  w->sum = herm3_row_new(ns);
+  w->mean = herm3_row_new(ns);
+  for (k=0; k<3; ++k) {
+    w->lambda[k] = MALLOC(sizeof(double)*ns);
+    w->v0[k] = MALLOC(sizeof(double)*ns);
+  }
+  w->entropy = MALLOC(sizeof(float)*ns);
+  w->anisotropy = MALLOC(sizeof(float)*ns);
+  w->alpha = MALLOC(sizeof(float)*ns);
+  w->Ps = MALLOC(sizeof(float)*ns);
+  w->Pd = MALLOC(sizeof(float)*ns);
+  w->Pv = MALLOC(sizeof(float)*ns);
+
+  return w;
+}
+
+static void polarimetry_work_free(polarimetry_work *w)
+{
+  int k;
+
+  herm3_row_free(w->sum);
+  herm3_row_free(w->mean);
+  for (k=0; k<3; ++k) {
+    FREE(w->lambda[k]);
+    FREE(w->v0[k]);
+  }
+  FREE(w->entropy);
+  FREE(w->anisotropy);
+  FREE(w->alpha);
+  FREE(w->Ps);
+  FREE(w->Pd);
+  FREE(w->Pv);
+  FREE(w);
+}
+
 static void
 do_coherence_bands(int entropy_band, int anisotropy_band, int alpha_band,
                    int class_band,
                    PolarimetricImageRows *img_rows,
                    int line, int l, int multi, int chunk_size,
-                   gsl_matrix_complex *T, gsl_vector *eval,
-                   gsl_matrix_complex *evec, gsl_eigen_hermv_workspace *ws,
+                   polarimetry_work *w,
                    meta_parameters *outMeta, FILE *fout,
                    float *buf, classifier_t *classifier)
 {
@@ -1218,9 +1266,9 @@ do_coherence_bands(int entropy_band, int anisotropy_band, int alpha_band,
     int ns = outMeta->general->sample_count;
     int onl = outMeta->general->line_count;
 
-    float *entropy = MALLOC(sizeof(float)*ns);
-    float *anisotropy = MALLOC(sizeof(float)*ns);
-    float *alpha = MALLOC(sizeof(float)*ns);
+    float *entropy = w->entropy;
+    float *anisotropy = w->anisotropy;
+    float *alpha = w->alpha;
 
     // size of the horizontal window, used for ensemble averaging
     // actual window size is hw*2+1
@@ -1230,38 +1278,23 @@ do_coherence_bands(int entropy_band, int anisotropy_band, int alpha_band,
     else
       hw = 2; // 5 pixels averaging horizontally
 
-    // coherence -- do ensemble averaging for each element
-    int j;
-    for (j=0; j<ns; ++j) {
-      int ii,jj,m;
-      for (ii=0; ii<3; ++ii) {
-        for (jj=0; jj<3; ++jj) {
-          gsl_complex c = gsl_complex_rect(0,0);
-          int k,n=0;
-          for (m=0; m<chunk_size; ++m) {
-            for (k=j-hw;k<=j+hw;++k) {
-              if (k>=0 && k<ns && m+line>l && m+line<onl-l) {
-                ++n;
-                complexFloat f =
-                  img_rows->coh_lines[m][k]->coeff[ii][jj];
-                c = gsl_complex_add_real(c, f.real);
-                c = gsl_complex_add_imag(c, f.imag);
-              }
-            }
-          }
-          if (n>1) {
-            gsl_complex_div_real(c, (float)n);
-          }
-          gsl_matrix_complex_set(T,ii,jj,c);
-        }
+    // coherence -- do ensemble averaging for each element: add up the
+    // buffered lines inside the image, then a running sum across
+    int j, m, nrows = 0;
+    herm3_row_zero(w->sum);
+    for (m=0; m<chunk_size; ++m) {
+      if (m+line>l && m+line<onl-l) {
+        herm3_row_add_matrices(w->sum, img_rows->coh_lines[m]);
+        ++nrows;
       }
-      
-      gsl_eigen_hermv(T, eval, evec, ws);
-      gsl_eigen_hermv_sort(eval, evec, GSL_EIGEN_SORT_ABS_DESC);
-      
-      double e1 = gsl_vector_get(eval, 0);
-      double e2 = gsl_vector_get(eval, 1);
-      double e3 = gsl_vector_get(eval, 2);
+    }
+    herm3_row_box(w->sum, nrows, hw, w->mean);
+    herm3_row_eigen(w->mean, w->lambda, w->v0);
+
+    for (j=0; j<ns; ++j) {
+      double e1 = w->lambda[0][j];
+      double e2 = w->lambda[1][j];
+      double e3 = w->lambda[2][j];
       
       double eT = e1+e2+e3;
       
@@ -1310,9 +1343,9 @@ do_coherence_bands(int entropy_band, int anisotropy_band, int alpha_band,
       // this is the polar angle when expressing each eigenvector
       // in spherical coordinates.  the mean alpha is weighted by
       // the eigenvector (so weight by P1-3)
-      double alpha1 = calc_alpha(gsl_matrix_complex_get(evec, 0, 0));
-      double alpha2 = calc_alpha(gsl_matrix_complex_get(evec, 0, 1));
-      double alpha3 = calc_alpha(gsl_matrix_complex_get(evec, 0, 2));
+      double alpha1 = calc_alpha_real(w->v0[0][j]);
+      double alpha2 = calc_alpha_real(w->v0[1][j]);
+      double alpha3 = calc_alpha_real(w->v0[2][j]);
       
       alpha[j] = R2D*(P1*alpha1 + P2*alpha2 + P3*alpha3);
       if (!meta_is_valid_double(alpha[j]))
@@ -1351,10 +1384,6 @@ do_coherence_bands(int entropy_band, int anisotropy_band, int alpha_band,
       int anisotropy_index = anisotropy[j]*(float)HIST_SIZE;
       hist_vals[entropy_index][alpha_index][anisotropy_index] += 1;
     }
-
-    free(entropy);
-    free(anisotropy);
-    free(alpha);
   }
 }
 
@@ -1486,6 +1515,7 @@ static void solve_fd2(float hh2, float vv2, complexFloat hhvv,
 static void do_freeman(int band1, int band2, int band3,
                        PolarimetricImageRows *img_rows,
                        int line, int l, int multi, int chunk_size,
+                       polarimetry_work *w,
                        meta_parameters *outMeta, FILE *fout)
 {
   if (band1 >= 0 || band2 >= 0 || band3 >= 0)
@@ -1498,82 +1528,53 @@ static void do_freeman(int band1, int band2, int band3,
     int j, m;
     int ns = outMeta->general->sample_count;
 
-    float *hh2 = MALLOC(sizeof(float)*ns);
-    float *vv2 = MALLOC(sizeof(float)*ns);
-    float *hv2 = MALLOC(sizeof(float)*ns);
-    complexFloat *hhvv = MALLOC(sizeof(complexFloat)*ns);
-    float sf = 1.0 / (float)chunk_size;
-
+    // covariance matrix: <|hh|^2>, 2<|hv|^2>, <|vv|^2> on the diagonal,
+    // <hh conj(vv)> as the 1,3 element
+    herm3_row_zero(w->sum);
     if (multi) {
       // multilook case -- average all buffered lines to produce a
       // single output line
-      for (j=0; j<ns; ++j) {
-
-        hh2[j] = 0.0;
-        vv2[j] = 0.0;
-        hhvv[j] = complex_zero();
-        hv2[j] = 0.0;
-
-        for (m=0; m<chunk_size; ++m) {
-          complexFloat hh = img_rows->s2_lines[m][j].hh;
-          hh2[j] += complex_amp_sqr(hh);
-
-          complexFloat vv = img_rows->s2_lines[m][j].vv;
-          vv2[j] += complex_amp_sqr(vv);
-
-          hhvv[j] = complex_add(hhvv[j], complex_mul(hh, complex_conj(vv)));
-
-          hv2[j] += complex_amp_sqr(img_rows->s2_lines[m][j].hv);
-        }
-
-        hh2[j] *= sf;
-        vv2[j] *= sf;
-        hv2[j] *= sf;
-
-        hhvv[j] = complex_scale(hhvv[j], sf);
-      }
+      for (m=0; m<chunk_size; ++m)
+        herm3_row_add_covariance(w->sum, img_rows->s2_lines[m]);
+      herm3_row_box(w->sum, chunk_size, 0, w->mean);
     }
     else {
       // not multilooking -- no averaging necessary
-      for (j=0; j<ns; ++j) {
-        complexFloat hh = img_rows->s2_lines[l][j].hh;
-        hh2[j] = complex_amp_sqr(hh);
-
-        complexFloat vv = img_rows->s2_lines[l][j].vv;
-        vv2[j] = complex_amp_sqr(vv);
-
-        hhvv[j] = complex_mul(hh, complex_conj(vv));
-        hv2[j] = complex_amp_sqr(img_rows->s2_lines[l][j].hv);
-      }
+      herm3_row_add_covariance(w->sum, img_rows->s2_lines[l]);
+      herm3_row_box(w->sum, 1, 0, w->mean);
     }
 
-    float *Ps = MALLOC(sizeof(float)*ns);
-    float *Pd = MALLOC(sizeof(float)*ns);
-    float *Pv = MALLOC(sizeof(float)*ns);
+    float *Ps = w->Ps;
+    float *Pd = w->Pd;
+    float *Pv = w->Pv;
 
     // now calculate fs, fd and alpha or beta for each sample, and
     // from those we can get the Ps, Pd, and Pv values
     for (j=0; j<ns; ++j) {
       float fs, fd;
       complexFloat alpha, beta;
-      if (hhvv[j].real > 0) {
+      float hh2 = w->mean->t11[j];
+      float vv2 = w->mean->t33[j];
+      float hv2 = 0.5*w->mean->t22[j];
+      complexFloat hhvv = complex_new(w->mean->t13_re[j], w->mean->t13_im[j]);
+      if (hhvv.real > 0) {
         // Re(Shh*conj(Svv))>0 ==> alpha=-1, solve for fs, fd, and beta
-        solve_fd1(hh2[j], vv2[j], hhvv[j], &fs, &fd, &beta);
+        solve_fd1(hh2, vv2, hhvv, &fs, &fd, &beta);
         alpha = complex_new(-1, 0);
       }
       else {
         // Re(Shh*conj(Svv))<0 ==> beta=1, solve for fs, fd, and alpha
-        solve_fd2(hh2[j], vv2[j], hhvv[j], &fs, &fd, &alpha);
+        solve_fd2(hh2, vv2, hhvv, &fs, &fd, &alpha);
         beta = complex_new(1, 0);
       }
 
       // double-check the solution
-      verify_fd(hh2[j], vv2[j], hhvv[j], fs, fd, alpha, beta);
+      verify_fd(hh2, vv2, hhvv, fs, fd, alpha, beta);
 
       // now calculate the final contributions from each scattering mechanism
       Ps[j] = fs * (1. + complex_amp_sqr(beta));
       Pd[j] = fd * (1. + complex_amp_sqr(alpha));
-      Pv[j] = 8. * hv2[j];
+      Pv[j] = 8. * hv2;
 
       // convert to dB
       Ps[j] = 10*log10(Ps[j]*Ps[j]);
@@ -1581,30 +1582,21 @@ static void do_freeman(int band1, int band2, int band3,
       Pv[j] = 10*log10(Pv[j]*Pv[j]);
 
       // take care of blackfill
-      if (FLOAT_EQUIVALENT(hh2[j], 0.0001) &&
-	  FLOAT_EQUIVALENT(vv2[j], 0.0001) &&
-	  FLOAT_EQUIVALENT(hv2[j], 0.0001)) {
+      if (FLOAT_EQUIVALENT(hh2, 0.0001) &&
+	  FLOAT_EQUIVALENT(vv2, 0.0001) &&
+	  FLOAT_EQUIVALENT(hv2, 0.0001)) {
 	Ps[j] = 0.0;
 	Pd[j] = 0.0;
 	Pv[j] = 0.0;
       }
     }
 
-    free(hh2);
-    free(vv2);
-    free(hv2);
-    free(hhvv);
-
     if (band1 >= 0)
       put_band_float_line(fout, outMeta, band1, line, Ps);
     if (band2 >= 0)
       put_band_float_line(fout, outMeta, band2, line, Pd);
     if (band3 >= 0)
       put_band_float_line(fout, outMeta, band3, line, Pv);
-
-    free(Pd);
-    free(Ps);
-    free(Pv);
   }
 }
 
@@ -1935,12 +1927,8 @@ void polarimetric_decomp(const char *inFile, const char *outFile,
   //-----------------------------------------------------------------------
   // done setting up metadata, now write the data
 
-  // gsl infrastructure for calculating eigen- vals & vecs for the
-  // coherence matrix
-  gsl_matrix_complex *T = gsl_matrix_complex_alloc(3,3);
-  gsl_vector *eval = gsl_vector_alloc(3);
-  gsl_matrix_complex *evec = gsl_matrix_complex_alloc(3,3);
-  gsl_eigen_hermv_workspace *ws = gsl_eigen_hermv_alloc(3);
+  // line buffers for the coherence matrix & Freeman/Durden calculations
+  polarimetry_work *work = polarimetry_work_new(ns);
 
   // now loop through the lines of the output image
   for (i=0; i<onl; ++i) {
@@ -1967,11 +1955,11 @@ void polarimetric_decomp(const char *inFile, const char *outFile,
 
       // Freeman-Durden
       do_freeman(freeman_1_band, freeman_2_band, freeman_3_band,
-                 img_rows, i, l, multi, chunk_size, outMeta, fout);
+                 img_rows, i, l, multi, chunk_size, work, outMeta, fout);
 
       // do any polarimetry that uses the coherence matrix
       do_coherence_bands(entropy_band, anisotropy_band, alpha_band, class_band,
-                         img_rows, i, l, multi, chunk_size, T, eval, evec, ws,
+                         img_rows, i, l, multi, chunk_size, work,
                          outMeta, fout, buf, classifier);
                          
 
@@ -2014,10 +2002,7 @@ void polarimetric_decomp(const char *inFile, const char *outFile,
     do_class_map(classifier, class_band, wide, outFile);
   }
 
-  gsl_vector_free(eval);
-  gsl_eigen_hermv_free(ws);
-  gsl_matrix_complex_free(evec);
-  gsl_matrix_complex_free(T);
+  polarimetry_work_free(work);
 
   polarimetric_image_rows_free(img_rows);
 
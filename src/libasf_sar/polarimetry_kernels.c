@@ -0,0 +1,295 @@
+#include "asf.h"
+#include "asf_meta.h"
+#include "asf_sar.h"
+#include <math.h>
+#include <assert.h>
+#include <gsl/gsl_complex.h>
+#include <gsl/gsl_complex_math.h>
+#include <gsl/gsl_eigen.h>
+
+// Line-at-a-time kernels for the polarimetric decompositions: ensemble
+// averaging of 3x3 Hermitian matrices (T3 or C3) with running sums, and
+// their eigenvalues from the closed form for a cubic.  As in
+// terrain_normals.c, each matrix element is a plain array of doubles so
+// the per-pixel loops are simple enough for the compiler to vectorize.
+
+// Eigenvalues closer together than this, relative to the sum of their
+// magnitudes, go to gsl_eigen_hermv instead -- the closed form for the
+// eigenvectors divides by their differences.
+#define EIGEN_GAP_TOL 1e-4
+
+#define N_PLANES 9
+
+static void get_planes(const herm3_row *r, double *p[N_PLANES])
+{
+  p[0] = r->t11;
+  p[1] = r->t22;
+  p[2] = r->t33;
+  p[3] = r->t12_re;
+  p[4] = r->t12_im;
+  p[5] = r->t13_re;
+  p[6] = r->t13_im;
+  p[7] = r->t23_re;
+  p[8] = r->t23_im;
+}
+
+herm3_row *herm3_row_new(int ns)
+{
+  herm3_row *r = MALLOC(sizeof(herm3_row));
+
+  r->ns = ns;
+  r->t11 = CALLOC(ns, sizeof(double));
+  r->t22 = CALLOC(ns, sizeof(double));
+  r->t33 = CALLOC(ns, sizeof(double));
+  r->t12_re = CALLOC(ns, sizeof(double));
+  r->t12_im = CALLOC(ns, sizeof(double));
+  r->t13_re = CALLOC(ns, sizeof(double));
+  r->t13_im = CALLOC(ns, sizeof(double));
+  r->t23_re = CALLOC(ns, sizeof(double));
+  r->t23_im = CALLOC(ns, sizeof(double));
+
+  return r;
+}
+
+void herm3_row_free(herm3_row *r)
+{
+  if (r) {
+    double *p[N_PLANES];
+    int ii;
+    get_planes(r, p);
+    for (ii=0; ii<N_PLANES; ++ii)
+      FREE(p[ii]);
+    FREE(r);
+  }
+}
+
+void herm3_row_zero(herm3_row *r)
+{
+  double *p[N_PLANES];
+  int ii;
+
+  get_planes(r, p);
+  for (ii=0; ii<N_PLANES; ++ii)
+    memset(p[ii], 0, sizeof(double)*r->ns);
+}
+
+void herm3_row_add_matrices(herm3_row *r, complexMatrix **m)
+{
+  int j;
+
+  for (j=0; j<r->ns; ++j) {
+    complexFloat **c = m[j]->coeff;
+    r->t11[j] += c[0][0].real;
+    r->t22[j] += c[1][1].real;
+    r->t33[j] += c[2][2].real;
+    r->t12_re[j] += c[0][1].real;
+    r->t12_im[j] += c[0][1].imag;
+    r->t13_re[j] += c[0][2].real;
+    r->t13_im[j] += c[0][2].imag;
+    r->t23_re[j] += c[1][2].real;
+    r->t23_im[j] += c[1][2].imag;
+  }
+}
+
+void herm3_row_add_covariance(herm3_row *r, const quadPolS2Float *s2)
+{
+  const double sqrt2 = sqrt(2.0);
+  int j;
+
+  // k = (hh, sqrt(2) hv, vv), C3 = k k*
+  for (j=0; j<r->ns; ++j) {
+    double hh_re = s2[j].hh.real, hh_im = s2[j].hh.imag;
+    double hv_re = sqrt2*s2[j].hv.real, hv_im = sqrt2*s2[j].hv.imag;
+    double vv_re = s2[j].vv.real, vv_im = s2[j].vv.imag;
+
+    r->t11[j] += hh_re*hh_re + hh_im*hh_im;
+    r->t22[j] += hv_re*hv_re + hv_im*hv_im;
+    r->t33[j] += vv_re*vv_re + vv_im*vv_im;
+    r->t12_re[j] += hh_re*hv_re + hh_im*hv_im;
+    r->t12_im[j] += hh_im*hv_re - hh_re*hv_im;
+    r->t13_re[j] += hh_re*vv_re + hh_im*vv_im;
+    r->t13_im[j] += hh_im*vv_re - hh_re*vv_im;
+    r->t23_re[j] += hv_re*vv_re + hv_im*vv_im;
+    r->t23_im[j] += hv_im*vv_re - hv_re*vv_im;
+  }
+}
+
+void herm3_row_box(const herm3_row *sum, int nrows, int hw, herm3_row *mean)
+{
+  double *in[N_PLANES], *out[N_PLANES];
+  int ns = sum->ns;
+  int ii, j;
+
+  assert(sum != mean && mean->ns == ns && hw >= 0);
+
+  if (nrows <= 0) {
+    herm3_row_zero(mean);
+    return;
+  }
+
+  get_planes(sum, in);
+  get_planes(mean, out);
+  for (ii=0; ii<N_PLANES; ++ii) {
+    const double *x = in[ii];
+    double *y = out[ii];
+    double s = 0;
+
+    if (hw == 0) {
+      for (j=0; j<ns; ++j)
+        y[j] = x[j]/nrows;
+      continue;
+    }
+
+    // running sum over samples j-hw..j+hw, clipped at the ends
+    for (j=0; j<hw && j<ns; ++j)
+      s += x[j];
+    for (j=0; j<ns; ++j) {
+      int first = MAX(j-hw, 0);
+      int last = MIN(j+hw, ns-1);
+      if (j+hw < ns)
+        s += x[j+hw];
+      y[j] = s/((double)nrows*(last-first+1));
+      if (j-hw >= 0)
+        s -= x[j-hw];
+    }
+  }
+}
+
+// |first component|^2 of the unit eigenvector for eigenvalue lk, the
+// others being li and lj: the eigenvector-eigenvalue identity with the
+// minor of the 1,1 element.
+static double first_component_sqr(double lk, double li, double lj,
+                                  double a22, double a33, double a23_sqr)
+{
+  double v = ((lk-a22)*(lk-a33) - a23_sqr) / ((lk-li)*(lk-lj));
+  return v < 0 ? 0 : v > 1 ? 1 : v;
+}
+
+static void swap2(double *a, double *b, double *c, double *d)
+{
+  double tmp;
+  tmp = *a; *a = *b; *b = tmp;
+  tmp = *c; *c = *d; *d = tmp;
+}
+
+static void eigen_gsl(const herm3_row *t, int j, gsl_matrix_complex *A,
+                      gsl_vector *eval, gsl_matrix_complex *evec,
+                      gsl_eigen_hermv_workspace *ws,
+                      double *lambda[3], double *v0[3])
+{
+  gsl_complex a12 = gsl_complex_rect(t->t12_re[j], t->t12_im[j]);
+  gsl_complex a13 = gsl_complex_rect(t->t13_re[j], t->t13_im[j]);
+  gsl_complex a23 = gsl_complex_rect(t->t23_re[j], t->t23_im[j]);
+  int k;
+
+  gsl_matrix_complex_set(A, 0, 0, gsl_complex_rect(t->t11[j], 0));
+  gsl_matrix_complex_set(A, 1, 1, gsl_complex_rect(t->t22[j], 0));
+  gsl_matrix_complex_set(A, 2, 2, gsl_complex_rect(t->t33[j], 0));
+  gsl_matrix_complex_set(A, 0, 1, a12);
+  gsl_matrix_complex_set(A, 1, 0, gsl_complex_conjugate(a12));
+  gsl_matrix_complex_set(A, 0, 2, a13);
+  gsl_matrix_complex_set(A, 2, 0, gsl_complex_conjugate(a13));
+  gsl_matrix_complex_set(A, 1, 2, a23);
+  gsl_matrix_complex_set(A, 2, 1, gsl_complex_conjugate(a23));
+
+  gsl_eigen_hermv(A, eval, evec, ws);
+  gsl_eigen_hermv_sort(eval, evec, GSL_EIGEN_SORT_ABS_DESC);
+
+  for (k=0; k<3; ++k) {
+    lambda[k][j] = gsl_vector_get(eval, k);
+    v0[k][j] = gsl_complex_abs(gsl_matrix_complex_get(evec, 0, k));
+  }
+}
+
+void herm3_row_eigen(const herm3_row *t, double *lambda[3], double *v0[3])
+{
+  const double third = 1.0/3.0;
+  const double two_pi_3 = 2.0*M_PI/3.0;
+  int ns = t->ns;
+  int j, n_left = 0;
+
+  // Closed form (trigonometric solution of the characteristic cubic)
+  // for every sample; the ones whose eigenvalues nearly coincide are
+  // flagged with a negative v0[0] and redone below.
+  for (j=0; j<ns; ++j) {
+    double a11 = t->t11[j], a22 = t->t22[j], a33 = t->t33[j];
+    double r12 = t->t12_re[j], i12 = t->t12_im[j];
+    double r13 = t->t13_re[j], i13 = t->t13_im[j];
+    double r23 = t->t23_re[j], i23 = t->t23_im[j];
+    double a12_sqr = r12*r12 + i12*i12;
+    double a13_sqr = r13*r13 + i13*i13;
+    double a23_sqr = r23*r23 + i23*i23;
+
+    double q = (a11 + a22 + a33)*third;
+    double b11 = a11 - q, b22 = a22 - q, b33 = a33 - q;
+    double p2 = b11*b11 + b22*b22 + b33*b33 +
+      2*(a12_sqr + a13_sqr + a23_sqr);
+    double p = sqrt(p2/6.);
+
+    // A multiple of the identity (blackfill is all zeros): the
+    // eigenvectors are the unit vectors, as gsl_eigen_hermv returns them
+    if (p2 == 0) {
+      lambda[0][j] = lambda[1][j] = lambda[2][j] = q;
+      v0[0][j] = 1;
+      v0[1][j] = v0[2][j] = 0;
+      continue;
+    }
+
+    // det(A - qI), using Re(a12 a23 conj(a13)) for the Hermitian case
+    double det = b11*b22*b33
+      + 2*((r12*r23 - i12*i23)*r13 + (r12*i23 + i12*r23)*i13)
+      - b11*a23_sqr - b22*a13_sqr - b33*a12_sqr;
+    double r = det/(2*p*p*p);
+    if (r < -1) r = -1;
+    if (r > 1) r = 1;
+    double phi = acos(r)*third;
+
+    // l1 >= l2 >= l3
+    double l1 = q + 2*p*cos(phi);
+    double l3 = q + 2*p*cos(phi + two_pi_3);
+    double l2 = 3*q - l1 - l3;
+
+    double gap = MIN(l1 - l2, l2 - l3);
+    if (!(gap > EIGEN_GAP_TOL*(fabs(l1) + fabs(l2) + fabs(l3)))) {
+      v0[0][j] = -1;
+      ++n_left;
+      continue;
+    }
+
+    double v1 = first_component_sqr(l1, l2, l3, a22, a33, a23_sqr);
+    double v2 = first_component_sqr(l2, l1, l3, a22, a33, a23_sqr);
+    double v3 = first_component_sqr(l3, l1, l2, a22, a33, a23_sqr);
+
+    // Positive semidefinite matrices only have rounding error below
+    // zero, but order by magnitude anyway, as gsl_eigen_hermv_sort does
+    if (fabs(l3) > fabs(l2))
+      swap2(&l2, &l3, &v2, &v3);
+    if (fabs(l2) > fabs(l1))
+      swap2(&l1, &l2, &v1, &v2);
+    if (fabs(l3) > fabs(l2))
+      swap2(&l2, &l3, &v2, &v3);
+
+    lambda[0][j] = l1;
+    lambda[1][j] = l2;
+    lambda[2][j] = l3;
+    v0[0][j] = sqrt(v1);
+    v0[1][j] = sqrt(v2);
+    v0[2][j] = sqrt(v3);
+  }
+
+  if (n_left > 0) {
+    gsl_matrix_complex *A = gsl_matrix_complex_alloc(3,3);
+    gsl_vector *eval = gsl_vector_alloc(3);
+    gsl_matrix_complex *evec = gsl_matrix_complex_alloc(3,3);
+    gsl_eigen_hermv_workspace *ws = gsl_eigen_hermv_alloc(3);
+
+    for (j=0; j<ns; ++j)
+      if (v0[0][j] < 0)
+        eigen_gsl(t, j, A, eval, evec, ws, lambda, v0);
+
+    gsl_eigen_hermv_free(ws);
+    gsl_matrix_complex_free(evec);
+    gsl_vector_free(eval);
+    gsl_matrix_complex_free(A);
+  }
+}
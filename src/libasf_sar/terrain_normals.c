@@ -0,0 +1,216 @@
+#include "asf.h"
+#include "asf_meta.h"
+#include "asf_sar.h"
+#include "vector.h"
+#include <math.h>
+#include <assert.h>
+
+// Rows of DEM points in ECEF coordinates, and the terrain normals and
+// Ulander cos(phi) computed from them, shared by rtc() and deskew_dem().
+// Everything is kept as plain arrays of doubles, one per coordinate, so
+// the per-pixel loops below are simple enough for the compiler to
+// vectorize and nothing is allocated once the rows exist.
+
+// Samples between the points where meta_incid() is evaluated exactly;
+// the incidence angle is interpolated linearly in between.
+#define INCID_KNOT_SPACING 32
+
+terrain_rows *terrain_rows_new(int ns, double a, double e2)
+{
+  terrain_rows *t = MALLOC(sizeof(terrain_rows));
+  int ii;
+
+  t->ns = ns;
+  t->a = a;
+  t->e2 = e2;
+  for (ii=0; ii<3; ++ii) {
+    t->lat[ii] = MALLOC(sizeof(double)*ns);
+    t->lon[ii] = MALLOC(sizeof(double)*ns);
+    t->x[ii] = MALLOC(sizeof(double)*ns);
+    t->y[ii] = MALLOC(sizeof(double)*ns);
+    t->z[ii] = MALLOC(sizeof(double)*ns);
+  }
+  t->nx = CALLOC(ns, sizeof(double));
+  t->ny = CALLOC(ns, sizeof(double));
+  t->nz = CALLOC(ns, sizeof(double));
+  t->count = 0;
+
+  return t;
+}
+
+void terrain_rows_free(terrain_rows *t)
+{
+  int ii;
+
+  if (!t)
+    return;
+  for (ii=0; ii<3; ++ii) {
+    FREE(t->lat[ii]);
+    FREE(t->lon[ii]);
+    FREE(t->x[ii]);
+    FREE(t->y[ii]);
+    FREE(t->z[ii]);
+  }
+  FREE(t->nx);
+  FREE(t->ny);
+  FREE(t->nz);
+  FREE(t);
+}
+
+static void rotate(double *rows[3])
+{
+  double *tmp = rows[0];
+  rows[0] = rows[1];
+  rows[1] = rows[2];
+  rows[2] = tmp;
+}
+
+void terrain_rows_push(terrain_rows *t, meta_parameters *meta, int line,
+                       const float *height)
+{
+  int ns = t->ns;
+  int jj;
+
+  rotate(t->lat);
+  rotate(t->lon);
+  rotate(t->x);
+  rotate(t->y);
+  rotate(t->z);
+  if (t->count < 3)
+    ++t->count;
+
+  double *lat = t->lat[2], *lon = t->lon[2];
+  double *x = t->x[2], *y = t->y[2], *z = t->z[2];
+
+  for (jj=0; jj<ns; ++jj)
+    meta_get_latLon(meta, line, jj, 0, &lat[jj], &lon[jj]);
+
+  const double a = t->a, e2 = t->e2;
+  for (jj=0; jj<ns; ++jj) {
+    double sin_lat = sin(lat[jj]*D2R);
+    double cos_lat = cos(lat[jj]*D2R);
+    double af = a/sqrt(1. - e2*sin_lat*sin_lat);
+    double h = height[jj];
+
+    x[jj] = (af + h)*cos_lat*cos(lon[jj]*D2R);
+    y[jj] = (af + h)*cos_lat*sin(lon[jj]*D2R);
+    z[jj] = (af*(1.-e2) + h)*sin_lat;
+  }
+}
+
+void terrain_rows_normals(terrain_rows *t)
+{
+  int ns = t->ns;
+  int jj;
+
+  assert(t->count == 3);
+
+  const double *x0 = t->x[0], *y0 = t->y[0], *z0 = t->z[0];
+  const double *x1 = t->x[1], *y1 = t->y[1], *z1 = t->z[1];
+  const double *x2 = t->x[2], *y2 = t->y[2], *z2 = t->z[2];
+  double *nx = t->nx, *ny = t->ny, *nz = t->nz;
+
+  for (jj=1; jj<ns-1; ++jj) {
+    // v1: along track, the line above minus the line below
+    double v1x = x0[jj] - x2[jj];
+    double v1y = y0[jj] - y2[jj];
+    double v1z = z0[jj] - z2[jj];
+
+    // v2: across track, the previous sample minus the next one
+    double v2x = x1[jj-1] - x1[jj+1];
+    double v2y = y1[jj-1] - y1[jj+1];
+    double v2z = z1[jj-1] - z1[jj+1];
+
+    // normal = v2 x v1
+    double cx = v2y*v1z - v2z*v1y;
+    double cy = v2z*v1x - v2x*v1z;
+    double cz = v2x*v1y - v2y*v1x;
+    double m = 1./sqrt(cx*cx + cy*cy + cz*cz);
+
+    nx[jj] = cx*m;
+    ny[jj] = cy*m;
+    nz[jj] = cz*m;
+  }
+  nx[0] = ny[0] = nz[0] = 0;
+  nx[ns-1] = ny[ns-1] = nz[ns-1] = 0;
+}
+
+void terrain_rows_cosphi(const terrain_rows *t, const Vector *satpos,
+                         double *cosphi, double *local_incid)
+{
+  int ns = t->ns;
+  int jj;
+
+  const double *px = t->x[1], *py = t->y[1], *pz = t->z[1];
+  const double *nx = t->nx, *ny = t->ny, *nz = t->nz;
+  const double sx = satpos->x, sy = satpos->y, sz = satpos->z;
+
+  for (jj=1; jj<ns-1; ++jj) {
+    // R: unit vector from the ground point to the satellite
+    double rx = sx - px[jj];
+    double ry = sy - py[jj];
+    double rz = sz - pz[jj];
+    double m = 1./sqrt(rx*rx + ry*ry + rz*rz);
+    rx *= m; ry *= m; rz *= m;
+
+    // x: p cross R, the along track direction
+    double xx = py[jj]*rz - pz[jj]*ry;
+    double xy = pz[jj]*rx - px[jj]*rz;
+    double xz = px[jj]*ry - py[jj]*rx;
+    m = 1./sqrt(xx*xx + xy*xy + xz*xz);
+    xx *= m; xy *= m; xz *= m;
+
+    // R cross x -- the image plane normal
+    double ix = ry*xz - rz*xy;
+    double iy = rz*xx - rx*xz;
+    double iz = rx*xy - ry*xx;
+
+    cosphi[jj] = ix*nx[jj] + iy*ny[jj] + iz*nz[jj];
+    if (local_incid)
+      local_incid[jj] =
+        acos(-(rx*nx[jj] + ry*ny[jj] + rz*nz[jj])) * R2D;
+  }
+  cosphi[0] = cosphi[ns-1] = 0;
+  if (local_incid)
+    local_incid[0] = local_incid[ns-1] = 0;
+}
+
+void terrain_rows_tilt(const terrain_rows *t, double *tilt)
+{
+  int ns = t->ns;
+  int jj;
+
+  const double *lat = t->lat[1], *lon = t->lon[1];
+  const double *nx = t->nx, *ny = t->ny, *nz = t->nz;
+
+  // Angle between the normal and straight down, where "down" is the
+  // ellipsoid normal at the point, negated.
+  for (jj=1; jj<ns-1; ++jj) {
+    double cos_lat = cos(lat[jj]*D2R);
+    double ux = cos_lat*cos(lon[jj]*D2R);
+    double uy = cos_lat*sin(lon[jj]*D2R);
+    double uz = sin(lat[jj]*D2R);
+    tilt[jj] = acos(-(nx[jj]*ux + ny[jj]*uy + nz[jj]*uz)) * R2D;
+  }
+  tilt[0] = tilt[ns-1] = 0;
+}
+
+void incidence_profile(meta_parameters *meta, int line, int ns,
+                       double *incid)
+{
+  int jj, kk;
+
+  for (jj=0; jj<ns; jj+=INCID_KNOT_SPACING)
+    incid[jj] = meta_incid(meta, line, jj);
+  if ((ns-1) % INCID_KNOT_SPACING != 0)
+    incid[ns-1] = meta_incid(meta, line, ns-1);
+
+  for (jj=0; jj<ns-1; jj+=INCID_KNOT_SPACING) {
+    int end = jj + INCID_KNOT_SPACING;
+    if (end > ns-1)
+      end = ns-1;
+    double step = (incid[end] - incid[jj]) / (end - jj);
+    for (kk=jj+1; kk<end; ++kk)
+      incid[kk] = incid[jj] + step*(kk - jj);
+  }
+}
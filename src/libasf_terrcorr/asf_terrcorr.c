@@ -137,6 +137,25 @@ static int mini(int a, int b)
   return a < b ? a : b;
 }
 
+// Narrow the metadata down to columns startX..startX+width-1 of the
+// image it describes, the same way trim() does.
+static void trim_meta_columns(meta_parameters *meta, int startX, int width)
+{
+  meta->general->sample_count = width;
+  if (meta->sar) {
+    if (!meta_is_valid_double(meta->sar->line_increment))
+        meta->sar->line_increment = 1;
+    if (!meta_is_valid_double(meta->sar->sample_increment))
+        meta->sar->sample_increment = 1;
+    meta->general->start_sample += startX *
+        meta->sar->sample_increment * meta->general->sample_scaling;
+  }
+  else {
+    meta->general->start_sample += startX * meta->general->sample_scaling;
+  }
+  meta_get_corner_coords(meta);
+}
+
 static void update_meta_offsets(const char *filename, double t_offset,
                                 double x_offset)
 {
@@ -1145,8 +1164,7 @@ int asf_terrcorr_ext(char *sarFile_in, char *demFile_in, char *userMaskFile,
 {
   char *resampleFile = NULL, *srFile = NULL, *resampleFile_2 = NULL;
   char *demTrimSimSar = NULL, *demTrimSlant = NULL, *demGround = NULL;
-  char *lsMaskFile, *padFile = NULL, *userMaskClipped = NULL;
-  char *deskewDemFile = NULL, *deskewDemMask = NULL;
+  char *lsMaskFile, *userMaskClipped = NULL;
   char *output_dir;
   double demRes, sarRes, maskRes=-1;
   meta_parameters *metaSAR, *metaDEM, *metamask=NULL;
@@ -1570,37 +1588,31 @@ int asf_terrcorr_ext(char *sarFile_in, char *demFile_in, char *userMaskFile,
       ensure_ext(&demTrimSlant, "img");
       ensure_ext(&srFile, "img");
       asfPrintStatus("\nTerrain correcting slant range image...\n");
-      padFile = getOutName(output_dir, srFile, "_pad");
-      deskewDemFile = getOutName(output_dir, srFile, "_dd");
-      deskewDemMask = getOutName(output_dir, srFile, "_ddm");
-      trim(srFile, padFile, 0, 0, metaSAR->general->sample_count + PAD,
-           metaSAR->general->line_count);
-      deskew_dem(demTrimSlant, demGround, deskewDemFile, padFile, FALSE,
-                 userMaskClipped, deskewDemMask, do_interp, fill_value,
-                 which_dem, use_nearest_neighbor);
+
+      // The corrected image and the layover/shadow mask stay in memory
+      // (unless they don't fit) until they have been trimmed and, if
+      // requested, radiometrically corrected.  deskew_dem pads the SAR
+      // lines out to the DEM width as it reads them.
+      image_buffer *image, *mask;
+      meta_parameters *metaMask;
+      meta_free(metaSAR);
+      deskew_dem_to_buffers(demTrimSlant, demGround, srFile, FALSE,
+                            userMaskClipped, do_interp, fill_value,
+                            which_dem, use_nearest_neighbor,
+                            &image, &metaSAR, &mask, &metaMask);
 
       // After deskew_dem, there will likely be zeros on the left & right edges
       // of the image, we trim those off before finishing up.  Skip this for
       // Palsar L1.1, as the geolocation of that kind of data won't survive
       // the trimming & subsequent resampling
+      int startx = 0;
       if (!is_Palsar_L11) {
-          int startx, endx;
-          trim_zeros(deskewDemFile, outFile, &startx, &endx);
-          trim(deskewDemMask, lsMaskFile, startx, 0, endx,
-               metaSAR->general->line_count);
-      }
-      else {
-          copyImgAndMeta(deskewDemFile, outFile);
-          copyImgAndMeta(deskewDemMask, lsMaskFile);
+          int endx;
+          image_buffer_data_extent(image, 0, &startx, &endx);
+          trim_meta_columns(metaSAR, startx, endx - startx);
+          trim_meta_columns(metaMask, startx, endx - startx);
       }
 
-      meta_free(metaSAR);
-      metaSAR = meta_read(outFile);
-
-      clean(padFile);
-      clean(deskewDemFile);
-      clean(deskewDemMask);
-
 /*    
       Taking this out.  No need to degrade the image, now that we don't allow
       the user to specify a pixel size it should not be needed any longer,
@@ -1644,17 +1656,19 @@ int asf_terrcorr_ext(char *sarFile_in, char *demFile_in, char *userMaskFile,
         make_gr_dem(metaSAR, demChunk, grDem);
 
         asfPrintStatus("Performing radiometric correction...\n");
-        char *rtcFile = getOutName(output_dir, outFile, "_before_rtc");
-        renameImgAndMeta(outFile, rtcFile);
-        rtc(rtcFile, grDem, FALSE, NULL, outFile, save_incid_angles);
+        rtc_buffer(image, startx, metaSAR, grDem, save_incid_angles);
 
         asfPrintStatus("Radiometric correction complete.\n");
 
-        //clean(rtcFile);
         //clean(grDem);
         FREE(grDem);
-        FREE(rtcFile);
       }
+
+      image_buffer_store(image, startx, metaSAR, outFile);
+      image_buffer_store(mask, startx, metaMask, lsMaskFile);
+      image_buffer_free(image);
+      image_buffer_free(mask);
+      meta_free(metaMask);
   }
   else
   {
@@ -1703,9 +1717,6 @@ int asf_terrcorr_ext(char *sarFile_in, char *demFile_in, char *userMaskFile,
 
   FREE(resampleFile);
   FREE(srFile);
-  FREE(padFile);
-  FREE(deskewDemFile);
-  FREE(deskewDemMask);
   FREE(lsMaskFile);
   FREE(resampleFile_2);
   FREE(userMaskClipped);
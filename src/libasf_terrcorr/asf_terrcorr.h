@@ -2,6 +2,7 @@
 #define ASF_TERRCORR_H
 
 #include <asf_meta.h>
+#include <asf_raster.h>
 
 /**
    asf_terrcorr
@@ -69,6 +70,8 @@ int lay_seeds(int num_seeds, float *mask, long ns, long nl,
               float *good_pct_list);
 
 /* Prototypes from build_dem.c */
+#define DEM_INDEX_FILE "dem_index.txt"
+int build_dem_index(const char *dem_dir);
 char *build_dem(meta_parameters *meta, const char *dem_cla_arg,
                 const char *dir_for_tmp_dem);
 int get_dem_chunk(char *dem_in, char *dem_out, meta_parameters *metaDEM,
@@ -77,6 +80,8 @@ int get_dem_chunk(char *dem_in, char *dem_out, meta_parameters *metaDEM,
 /* Prototypes from rtc.c */
 int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
         char *output_file, int save_incid_angles);
+void rtc_buffer(image_buffer *image, int startX, meta_parameters *meta,
+                char *dem_file, int save_incid_angles);
 int uavsar_rtc(const char *input_file, const char *correction_file,
                const char *annotation_file, const char *output_file);
 int make_gr_dem(meta_parameters *meta_sar, const char *demBase, const char *output_name);
@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include <time.h>
 #include <ctype.h>
+#include <glib.h>
 
 #include "asf.h"
 #include "asf_meta.h"
@@ -93,29 +94,88 @@ int lineSegmentsIntersect(
   return TRUE;
 }
 
-// return TRUE if there is any overlap between the two scenes
-static int test_overlap(meta_parameters *meta1, meta_parameters *meta2)
+// The footprint of an image: its corners, going around the image, and
+// what we need to know to compare it against other footprints.  These
+// are what the DEM index stores for each DEM.
+typedef struct {
+    char *path;              // relative to the indexed directory
+    long long mtime, size;   // of the .meta and the .img file
+    int is_dem;
+    int projection;          // projection_type_t, -1 if not projected
+    double pixel_size;
+    double center_lat, center_lon;
+    double lat[4], lon[4];
+    double lat_lo, lat_hi, lon_lo, lon_hi;
+} footprint_t;
+
+static void footprint_extents(footprint_t *f)
 {
-    if (!meta_is_valid_double(meta1->general->center_longitude)) {
-        int nl = meta1->general->line_count;
-        int ns = meta1->general->sample_count;
-
-        meta_get_latLon(meta1, nl/2, ns/2, 0,
-            &meta1->general->center_latitude,
-            &meta1->general->center_longitude);
+    int i;
+    f->lat_lo = f->lat_hi = f->lat[0];
+    f->lon_lo = f->lon_hi = f->lon[0];
+    for (i=1; i<4; ++i) {
+        if (f->lat[i] < f->lat_lo) f->lat_lo = f->lat[i];
+        if (f->lat[i] > f->lat_hi) f->lat_hi = f->lat[i];
+        if (f->lon[i] < f->lon_lo) f->lon_lo = f->lon[i];
+        if (f->lon[i] > f->lon_hi) f->lon_hi = f->lon[i];
     }
+}
+
+static void get_footprint(meta_parameters *meta, footprint_t *f)
+{
+    int nl = meta->general->line_count;
+    int ns = meta->general->sample_count;
 
-    if (!meta_is_valid_double(meta2->general->center_longitude)) {
-        int nl = meta2->general->line_count;
-        int ns = meta2->general->sample_count;
+    if (meta_is_valid_double(meta->general->center_longitude)) {
+        f->center_lat = meta->general->center_latitude;
+        f->center_lon = meta->general->center_longitude;
+    }
+    else {
+        meta_get_latLon(meta, nl/2, ns/2, 0, &f->center_lat, &f->center_lon);
+    }
 
-        meta_get_latLon(meta2, nl/2, ns/2, 0,
-            &meta2->general->center_latitude,
-            &meta2->general->center_longitude);
+    if (meta->location) {
+        // use the location block if available
+        meta_location *ml = meta->location;
+        f->lat[0] = ml->lat_start_near_range;
+        f->lon[0] = ml->lon_start_near_range;
+        f->lat[1] = ml->lat_start_far_range;
+        f->lon[1] = ml->lon_start_far_range;
+        f->lat[2] = ml->lat_end_far_range;
+        f->lon[2] = ml->lon_end_far_range;
+        f->lat[3] = ml->lat_end_near_range;
+        f->lon[3] = ml->lon_end_near_range;
+    } else {
+        // must call meta_get_latLon for each corner
+        meta_get_latLon(meta, 0, 0, 0, &f->lat[0], &f->lon[0]);
+        meta_get_latLon(meta, nl-1, 0, 0, &f->lat[1], &f->lon[1]);
+        meta_get_latLon(meta, nl-1, ns-1, 0, &f->lat[2], &f->lon[2]);
+        meta_get_latLon(meta, 0, ns-1, 0, &f->lat[3], &f->lon[3]);
     }
 
-    int zone1 = utm_zone(meta1->general->center_longitude);
-    int zone2 = utm_zone(meta2->general->center_longitude);
+    f->is_dem = meta->general->image_data_type == DEM;
+    f->projection = meta->projection ? (int)meta->projection->type : -1;
+    f->pixel_size = meta->general->x_pixel_size;
+    footprint_extents(f);
+}
+
+// Quick rejection: TRUE if the lat/lon boxes of the two footprints
+// can't possibly overlap.  Boxes that straddle the dateline are never
+// rejected here.
+static int boxes_disjoint(const footprint_t *f1, const footprint_t *f2)
+{
+    if (f1->lat_hi < f2->lat_lo || f2->lat_hi < f1->lat_lo)
+        return TRUE;
+    if (f1->lon_hi - f1->lon_lo > 180 || f2->lon_hi - f2->lon_lo > 180)
+        return FALSE;
+    return f1->lon_hi < f2->lon_lo || f2->lon_hi < f1->lon_lo;
+}
+
+// return TRUE if there is any overlap between the two footprints
+static int test_overlap(const footprint_t *f1, const footprint_t *f2)
+{
+    int zone1 = utm_zone(f1->center_lon);
+    int zone2 = utm_zone(f2->center_lon);
 
     // if zone1 & zone2 differ by more than 1, we can stop now
     if (iabs(zone1-zone2) > 1) {
@@ -123,86 +183,25 @@ static int test_overlap(meta_parameters *meta1, meta_parameters *meta2)
     }
 
     // The Plan:
-    // Generate polygons for each metadata, then test of any pair of
+    // Generate polygons for each footprint, then test of any pair of
     // line segments between the polygons intersect.
 
-    // Other possibility: meta1 is completely contained within meta2,
+    // Other possibility: f1 is completely contained within f2,
     // or the reverse.
 
-    // corners of meta1.
-    double xp_1[5], yp_1[5];
-
-    if (meta1->location) {
-        // use the location block if available
-        latLon2UTM_zone(meta1->location->lat_start_near_range,
-            meta1->location->lon_start_near_range, 0, zone1, &xp_1[0], &yp_1[0]);
-        latLon2UTM_zone(meta1->location->lat_start_far_range,
-            meta1->location->lon_start_far_range, 0, zone1, &xp_1[1], &yp_1[1]);
-        latLon2UTM_zone(meta1->location->lat_end_far_range,
-            meta1->location->lon_end_far_range, 0, zone1, &xp_1[2], &yp_1[2]);
-        latLon2UTM_zone(meta1->location->lat_end_near_range,
-            meta1->location->lon_end_near_range, 0, zone1, &xp_1[3], &yp_1[3]);
-    } else {
-        double lat, lon;
-        int nl1 = meta1->general->line_count;
-        int ns1 = meta1->general->sample_count;
-
-        // must call meta_get_latLon for each corner
-        meta_get_latLon(meta1, 0, 0, 0, &lat, &lon);
-        latLon2UTM_zone(lat, lon, 0, zone1, &xp_1[0], &yp_1[0]);
-
-        meta_get_latLon(meta1, nl1-1, 0, 0, &lat, &lon);
-        latLon2UTM_zone(lat, lon, 0, zone1, &xp_1[1], &yp_1[1]);
-
-        meta_get_latLon(meta1, nl1-1, ns1-1, 0, &lat, &lon);
-        latLon2UTM_zone(lat, lon, 0, zone1, &xp_1[2], &yp_1[2]);
-
-        meta_get_latLon(meta1, 0, ns1-1, 0, &lat, &lon);
-        latLon2UTM_zone(lat, lon, 0, zone1, &xp_1[3], &yp_1[3]);
+    // corners of both, closing the polygons
+    double xp_1[5], yp_1[5], xp_2[5], yp_2[5];
+    int i, j;
+    for (i = 0; i < 4; ++i) {
+        latLon2UTM_zone(f1->lat[i], f1->lon[i], 0, zone1, &xp_1[i], &yp_1[i]);
+        latLon2UTM_zone(f2->lat[i], f2->lon[i], 0, zone1, &xp_2[i], &yp_2[i]);
     }
-
-    // close the polygon
     xp_1[4] = xp_1[0];
     yp_1[4] = yp_1[0];
-
-    // corners of meta2.
-    double xp_2[5], yp_2[5];
-
-    if (meta2->location) {
-        // use the location block if available
-        latLon2UTM_zone(meta2->location->lat_start_near_range,
-            meta2->location->lon_start_near_range, 0, zone1, &xp_2[0], &yp_2[0]);
-        latLon2UTM_zone(meta2->location->lat_start_far_range,
-            meta2->location->lon_start_far_range, 0, zone1, &xp_2[1], &yp_2[1]);
-        latLon2UTM_zone(meta2->location->lat_end_far_range,
-            meta2->location->lon_end_far_range, 0, zone1, &xp_2[2], &yp_2[2]);
-        latLon2UTM_zone(meta2->location->lat_end_near_range,
-            meta2->location->lon_end_near_range, 0, zone1, &xp_2[3], &yp_2[3]);
-    } else {
-        double lat, lon;
-        int nl2 = meta2->general->line_count;
-        int ns2 = meta2->general->sample_count;
-
-        // must call meta_get_latLon for each corner
-        meta_get_latLon(meta2, 0, 0, 0, &lat, &lon);
-        latLon2UTM_zone(lat, lon, 0, zone1, &xp_2[0], &yp_2[0]);
-
-        meta_get_latLon(meta2, nl2-1, 0, 0, &lat, &lon);
-        latLon2UTM_zone(lat, lon, 0, zone1, &xp_2[1], &yp_2[1]);
-
-        meta_get_latLon(meta2, nl2-1, ns2-1, 0, &lat, &lon);
-        latLon2UTM_zone(lat, lon, 0, zone1, &xp_2[2], &yp_2[2]);
-
-        meta_get_latLon(meta2, 0, ns2-1, 0, &lat, &lon);
-        latLon2UTM_zone(lat, lon, 0, zone1, &xp_2[3], &yp_2[3]);
-    }
-
-    // close the polygon
     xp_2[4] = xp_2[0];
     yp_2[4] = yp_2[0];
 
     // loop over each pair of line segments, testing for intersection
-    int i, j;
     for (i = 0; i < 4; ++i) {
         for (j = 0; j < 4; ++j) {
             if (lineSegmentsIntersect(
@@ -214,7 +213,7 @@ static int test_overlap(meta_parameters *meta1, meta_parameters *meta2)
         }
     }
 
-    // test for containment: meta2 in meta1
+    // test for containment: f2 in f1
     int all_in=TRUE;
     for (i=0; i<4; ++i) {
         if (!pnpoly(5, xp_1, yp_1, xp_2[i], yp_2[i])) {
@@ -226,7 +225,7 @@ static int test_overlap(meta_parameters *meta1, meta_parameters *meta2)
     if (all_in)
         return TRUE;
 
-    // test for containment: meta1 in meta2
+    // test for containment: f1 in f2
     all_in = TRUE;
     for (i=0; i<4; ++i) {
         if (!pnpoly(5, xp_2, yp_2, xp_1[i], yp_1[i])) {
@@ -242,166 +241,310 @@ static int test_overlap(meta_parameters *meta1, meta_parameters *meta2)
     return FALSE;
 }
 
-// this is just to make the recursive searching of directories look nice
-static char *spaces(int n)
+// DEM index.  A directory of DEMs can hold a text file, DEM_INDEX_FILE,
+// with one line per .img file found anywhere below the directory:
+//   <meta mtime> <img size> <is dem> <projection> <pixel size>
+//   <center lat> <center lon> <4 x corner lat, lon> <relative path>
+// Finding the DEMs that cover a scene then only needs this one file,
+// instead of a meta_read() of every DEM in the tree.  The index is
+// checked against the directory on every search (a stat() per file),
+// and only the metadata of files that are new or have changed since it
+// was written gets read; files that are gone are dropped.  Even with
+// tens of thousands of tiles a pass over the bounding boxes takes well
+// under a millisecond, so they are simply kept in a list.
+
+#define DEM_INDEX_HEADER "# ASF DEM index, version 1"
+
+static void footprint_free(gpointer p)
 {
-    int i;
-    static char buf[256];
-    for (i=0; i<256; ++i)
-        buf[i] = i<n*3 ? ' ' : '\0';
-    return buf;
+    footprint_t *f = (footprint_t*)p;
+    FREE(f->path);
+    FREE(f);
+}
+
+static char *index_file_name(const char *dem_dir)
+{
+    char *ret = MALLOC(sizeof(char)*(strlen(dem_dir)+strlen(DEM_INDEX_FILE)+2));
+    sprintf(ret, "%s%c%s", dem_dir, DIR_SEPARATOR, DEM_INDEX_FILE);
+    return ret;
 }
 
-// forward declaration of the wrapper that calls process_dir or
-// process_file as appropriate
-static void process(const char *what, int level, int recursive,
-                    char *overlapping_dems[], int *next_dem_number,
-                    meta_parameters *meta, int *n_dems_total);
-
-// process all things in a directory.  Calls "process" to decide
-// if the "thing" is a dir (process_dir) or a file (process_file)
-static void process_dir(const char *dir, int top, int recursive,
-                        char *overlapping_dems[], int *next_dem_number,
-                        meta_parameters *meta, int *n_dems_total)
+// Returns NULL if the directory has no (usable) index
+static GPtrArray *read_dem_index(const char *dem_dir)
 {
-  char name[1024];
-  struct dirent *dp;
-  DIR *dfd;
+    char *index_file = index_file_name(dem_dir);
+    FILE *fp = fopen(index_file, "r");
+    FREE(index_file);
+    if (!fp)
+        return NULL;
 
-  if ((dfd = opendir(dir)) == NULL) {
-    asfPrintStatus("  Cannot open %s\n",dir);
-    return; // error
-  }
-  while ((dp = readdir(dfd)) != NULL) {
-    // skip current, parent dir entries
-    if (strcmp(dp->d_name, ".")==0 || strcmp(dp->d_name, "..")==0) {
-      continue;
+    char line[2048];
+    if (!fgets(line, sizeof(line), fp) ||
+        strncmp(line, DEM_INDEX_HEADER, strlen(DEM_INDEX_HEADER)) != 0)
+    {
+        asfPrintWarning("Ignoring DEM index in %s, it is not one we "
+                        "can read.\n", dem_dir);
+        fclose(fp);
+        return NULL;
     }
-    if (strlen(dir)+strlen(dp->d_name)+2 > sizeof(name)) {
-      asfPrintWarning("dirwalk: name %s/%s exceeds buffersize.\n",
-                      dir, dp->d_name);
-      closedir(dfd);
-      return; // error
+
+    GPtrArray *entries = g_ptr_array_new_with_free_func(footprint_free);
+    while (fgets(line, sizeof(line), fp)) {
+        footprint_t f;
+        int n = 0;
+        while (strlen(line) > 0 && isspace(line[strlen(line)-1]))
+            line[strlen(line)-1] = '\0';
+        if (sscanf(line, "%lld %lld %d %d %lf %lf %lf "
+                   "%lf %lf %lf %lf %lf %lf %lf %lf %n",
+                   &f.mtime, &f.size, &f.is_dem, &f.projection,
+                   &f.pixel_size, &f.center_lat, &f.center_lon,
+                   &f.lat[0], &f.lon[0], &f.lat[1], &f.lon[1],
+                   &f.lat[2], &f.lon[2], &f.lat[3], &f.lon[3], &n) != 15 ||
+            line[n] == '\0')
+        {
+            asfPrintWarning("Bad line in the DEM index in %s:\n  %s\n",
+                            dem_dir, line);
+            continue;
+        }
+        f.path = STRDUP(line + n);
+        footprint_extents(&f);
+
+        footprint_t *entry = MALLOC(sizeof(footprint_t));
+        *entry = f;
+        g_ptr_array_add(entries, entry);
     }
-    else {
-      // process this entry
-      sprintf(name, "%s%c%s", dir, DIR_SEPARATOR, dp->d_name);
-      process(name, top, recursive, overlapping_dems, next_dem_number,
-          meta, n_dems_total);
+    fclose(fp);
+
+    return entries;
+}
+
+static int write_dem_index(const char *dem_dir, GPtrArray *entries)
+{
+    char *index_file = index_file_name(dem_dir);
+    char *tmp_file = appendStr(index_file, ".tmp");
+    unsigned int i;
+
+    // Write a new file and move it into place, so that anyone reading
+    // the index while it's being updated sees either the old or the
+    // new one.
+    FILE *fp = fopen(tmp_file, "w");
+    if (!fp) {
+        asfPrintWarning("Could not write the DEM index in %s\n", dem_dir);
+        FREE(index_file);
+        FREE(tmp_file);
+        return FALSE;
     }
-  }
-  closedir(dfd);
+
+    fprintf(fp, "%s\n", DEM_INDEX_HEADER);
+    for (i=0; i<entries->len; ++i) {
+        footprint_t *f = g_ptr_array_index(entries, i);
+        fprintf(fp, "%lld %lld %d %d %.10g %.10f %.10f "
+                "%.10f %.10f %.10f %.10f %.10f %.10f %.10f %.10f %s\n",
+                f->mtime, f->size, f->is_dem, f->projection, f->pixel_size,
+                f->center_lat, f->center_lon, f->lat[0], f->lon[0],
+                f->lat[1], f->lon[1], f->lat[2], f->lon[2],
+                f->lat[3], f->lon[3], f->path);
+    }
+    fclose(fp);
+
+    remove(index_file);
+    int ok = rename(tmp_file, index_file) == 0;
+    if (!ok) {
+        asfPrintWarning("Could not write the DEM index in %s\n", dem_dir);
+        remove(tmp_file);
+    }
+
+    FREE(index_file);
+    FREE(tmp_file);
+    return ok;
 }
 
-// if a file is a .img file, test it for overlap, otherwise do nothing
-static void process_file(const char *file, int level,
-                         char *overlapping_dems[], int *next_dem_number,
-                         meta_parameters *meta, int *n_dems_total)
+// Add a footprint to "entries" for every .img file in dem_dir/rel_dir and
+// below.  Footprints in "old" are reused for files that haven't changed.
+static void index_dir(const char *dem_dir, const char *rel_dir,
+                      GHashTable *old, GPtrArray *entries, int *n_read)
 {
-    char *base = get_filename(file);
-    char *ext = findExt(base);
-    if (ext && strcmp_case(ext, ".img") == 0)
-    {
-        char *does;
-        ++(*n_dems_total);
+    char dir[1024], name[1024], rel_name[1024];
+    struct dirent *dp;
+    DIR *dfd;
 
-        char *meta_filename = appendExt(file, ".meta");
-        meta_parameters *meta_dem = meta_read(meta_filename);
-
-        if (meta_dem->general->image_data_type != DEM) {
-            does = "Not a DEM";
-        } else if (test_overlap(meta, meta_dem)) {
-            // overlaps!
-            overlapping_dems[*next_dem_number] = STRDUP(file);
-            ++(*next_dem_number);
-            does = "Overlaps";
-        } else {
-            does = "No";
+    if (strlen(rel_dir) > 0)
+        snprintf(dir, sizeof(dir), "%s%c%s", dem_dir, DIR_SEPARATOR, rel_dir);
+    else
+        snprintf(dir, sizeof(dir), "%s", dem_dir);
+
+    if ((dfd = opendir(dir)) == NULL) {
+        asfPrintStatus("  Cannot open %s\n", dir);
+        return;
+    }
+    while ((dp = readdir(dfd)) != NULL) {
+        struct stat stbuf;
+
+        // skip current, parent dir entries
+        if (strcmp(dp->d_name, ".")==0 || strcmp(dp->d_name, "..")==0)
+            continue;
+        if (strlen(dir)+strlen(dp->d_name)+2 > sizeof(name)) {
+            asfPrintWarning("dirwalk: name %s/%s exceeds buffersize.\n",
+                            dir, dp->d_name);
+            continue;
         }
+        sprintf(name, "%s%c%s", dir, DIR_SEPARATOR, dp->d_name);
+        if (strlen(rel_dir) > 0)
+            sprintf(rel_name, "%s%c%s", rel_dir, DIR_SEPARATOR, dp->d_name);
+        else
+            strcpy(rel_name, dp->d_name);
 
-        free(meta_filename);
-        meta_free(meta_dem);
+        if (stat(name, &stbuf) == -1) {
+            asfPrintStatus("  Cannot access: %s\n", name);
+            continue;
+        }
+        if ((stbuf.st_mode & S_IFMT) == S_IFDIR) {
+            index_dir(dem_dir, rel_name, old, entries, n_read);
+            continue;
+        }
 
-        asfPrintStatus("  %s%s - %s\n", spaces(level), base, does);
-    }
-    else if (ext && (strcmp_case(ext, ".meta") == 0 ||
-                     strcmp_case(ext, ".ddr") == 0)) {
-        // silently ignore the .meta, etc files -- they will be picked up
-        // when processing the corresponding .img file
-        ;
-    }
-    else {
-        // loudly ignore other stuff in the directory
-        asfPrintStatus("  %s%s (ignored)\n", spaces(level), base);
+        char *ext = findExt(dp->d_name);
+        if (!ext || strcmp_case(ext, ".img") != 0)
+            continue;
+
+        // A DEM's footprint is in its metadata, so that is the file whose
+        // time stamp tells us whether the entry is still good.
+        struct stat meta_stbuf;
+        char *meta_name = appendExt(name, ".meta");
+        if (stat(meta_name, &meta_stbuf) == -1) {
+            asfPrintStatus("  %s has no metadata (ignored)\n", rel_name);
+            FREE(meta_name);
+            continue;
+        }
+
+        footprint_t *f = old ? g_hash_table_lookup(old, rel_name) : NULL;
+        if (f && f->mtime == (long long)meta_stbuf.st_mtime &&
+            f->size == (long long)stbuf.st_size)
+        {
+            // unchanged, take it over from the old index
+            g_hash_table_steal(old, rel_name);
+        }
+        else {
+            meta_parameters *meta_dem = meta_read(meta_name);
+            f = MALLOC(sizeof(footprint_t));
+            f->path = STRDUP(rel_name);
+            f->mtime = (long long)meta_stbuf.st_mtime;
+            f->size = (long long)stbuf.st_size;
+            get_footprint(meta_dem, f);
+            meta_free(meta_dem);
+            ++(*n_read);
+        }
+        g_ptr_array_add(entries, f);
+        FREE(meta_name);
     }
-    FREE(base);
+    closedir(dfd);
 }
 
-// calls either process_dir or process_file, above
-static void process(const char *what, int level, int recursive,
-                    char *overlapping_dems[], int *next_dem_number,
-                    meta_parameters *meta, int *n_dems_total)
+// Reads the DEM index of a directory and brings it up to date: files
+// that are new or whose metadata changed are read, and files that are
+// gone are dropped.  The index is only rewritten if anything changed.
+static GPtrArray *update_dem_index(const char *dem_dir)
 {
-  struct stat stbuf;
+    GPtrArray *old_entries = read_dem_index(dem_dir);
+    GHashTable *old = NULL;
+    unsigned int i;
+    int n_read = 0, n_removed = 0;
+
+    if (old_entries) {
+        // the hash table takes over ownership of the old entries
+        old = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                    footprint_free);
+        for (i=0; i<old_entries->len; ++i) {
+            footprint_t *f = g_ptr_array_index(old_entries, i);
+            g_hash_table_replace(old, f->path, f);
+        }
+        g_ptr_array_set_free_func(old_entries, NULL);
+        g_ptr_array_free(old_entries, TRUE);
+    }
 
-  if (stat(what, &stbuf) == -1) {
-    asfPrintStatus("  Cannot access: %s\n", what);
-    return;
-  }
+    GPtrArray *entries = g_ptr_array_new_with_free_func(footprint_free);
+    index_dir(dem_dir, "", old, entries, &n_read);
 
-  char *base = get_filename(what);
-
-  if ((stbuf.st_mode & S_IFMT) == S_IFDIR) {
-      if (level==0 || recursive) {
-          asfPrintStatus("  %s%s/\n", spaces(level), base);
-          process_dir(what, level+1, recursive, overlapping_dems,
-              next_dem_number, meta, n_dems_total);
-      }
-      else {
-          asfPrintStatus("  %s%s (skipped)\n", spaces(level), base);
-      }
-  }
-  else {
-      process_file(what, level, overlapping_dems, next_dem_number,
-          meta, n_dems_total);
-  }
+    // whatever index_dir didn't take over from the old index is gone
+    if (old) {
+        n_removed = g_hash_table_size(old);
+        g_hash_table_destroy(old);
+    }
 
-  FREE(base);
+    if (!old || n_read > 0 || n_removed > 0) {
+        asfPrintStatus("Indexed %d files in %s (%d new or changed, "
+                       "%d removed).\n",
+                       entries->len, dem_dir, n_read, n_removed);
+        write_dem_index(dem_dir, entries);
+    }
+    return entries;
 }
 
-// in a given directory, find all overlapping dems.  Calls
-// "process" to do the real work
-static char **find_overlapping_dems_dir(meta_parameters *meta,
-                                        const char *dem_dir,
-                                        int *n_dems_total)
+// External entry point
+// Brings the DEM index of a directory up to date, creating it if
+// necessary.  Returns the number of DEMs in the index.
+int build_dem_index(const char *dem_dir)
 {
-    int i,n=0;
-    const int recursive = TRUE;
+    GPtrArray *entries = update_dem_index(dem_dir);
+    unsigned int i;
+    int n_dems = 0;
+
+    for (i=0; i<entries->len; ++i)
+        if (((footprint_t*)g_ptr_array_index(entries, i))->is_dem)
+            ++n_dems;
 
-    // hard-coded limit of 100 dems
-    const int max_dems = 100;
-    char **overlapping_dems = MALLOC(sizeof(char*)*max_dems);
-    for (i=0; i<max_dems; ++i)
-        overlapping_dems[i] = NULL;
+    g_ptr_array_free(entries, TRUE);
+    return n_dems;
+}
 
-    process(dem_dir, 0, recursive, overlapping_dems, &n, meta,
-        n_dems_total);
+// in a given directory, find all overlapping dems and add them (with
+// the directory prepended) to "found"
+static void find_overlapping_dems_dir(const footprint_t *scene,
+                                      const char *dem_dir,
+                                      GPtrArray *found, int *n_dems_total)
+{
+    // Checking the index against the directory only takes a stat() per
+    // file, and DEMs come and go, so it is done every time.
+    GPtrArray *entries = update_dem_index(dem_dir);
+    unsigned int i;
+    int n = 0;
+
+    for (i=0; i<entries->len; ++i) {
+        footprint_t *f = g_ptr_array_index(entries, i);
+        if (!f->is_dem)
+            continue;
+        ++(*n_dems_total);
+        if (!boxes_disjoint(scene, f) && test_overlap(scene, f)) {
+            char *file = MALLOC(sizeof(char)*(strlen(dem_dir)+strlen(f->path)+2));
+            sprintf(file, "%s%c%s", dem_dir, DIR_SEPARATOR, f->path);
+            g_ptr_array_add(found, file);
+            ++n;
+        }
+    }
+    g_ptr_array_free(entries, TRUE);
 
-    if (n > 0) {
-        asfPrintStatus("Found %d overlapping dem%s:\n", n, n==1?"":"s");
-        for (i=0; i<max_dems; ++i)
-            if (overlapping_dems[i])
-                asfPrintStatus("  %s\n", overlapping_dems[i]);
+    if (n == 0)
+        asfPrintStatus("No overlapping DEMs found in: %s\n", dem_dir);
+}
 
-        return overlapping_dems;
-    } else {
-        if (*n_dems_total == 0)
-            asfPrintStatus("No DEMs found in: %s\n", dem_dir);
-        else
-            asfPrintStatus("No overlapping DEMs found in: %s\n", dem_dir);
-        free(overlapping_dems);
+// Turns the list built up by find_overlapping_dems_dir into the NULL
+// terminated array we hand back, or NULL if it is empty.
+static char **overlapping_dems_list(GPtrArray *found)
+{
+    unsigned int i;
+
+    if (found->len == 0) {
+        g_ptr_array_free(found, TRUE);
         return NULL;
     }
+
+    asfPrintStatus("Found %d overlapping dem%s:\n", found->len,
+                   found->len == 1 ? "" : "s");
+    for (i=0; i<found->len; ++i)
+        asfPrintStatus("    %s\n", (char*)g_ptr_array_index(found, i));
+
+    g_ptr_array_add(found, NULL);
+    return (char**)g_ptr_array_free(found, FALSE);
 }
 
 // given a metadata file, and a file that contains a list of
@@ -411,14 +554,8 @@ static char **find_overlapping_dems(meta_parameters *meta,
                                     const char *file_with_dem_dirs,
                                     int *n_dems_found)
 {
-    // hard-coded limit of 100 dems
-    int i;
-    const int max_dems = 100;
-    char **overlapping_dems = MALLOC(sizeof(char*)*max_dems);
-    for (i=0; i<max_dems; ++i)
-        overlapping_dems[i] = NULL;
-
-    *n_dems_found = 0;
+    GPtrArray *found = g_ptr_array_new();
+    footprint_t scene;
     int n_dirs_checked = 0;
     int n_dems_total = 0;
     char line[512];
@@ -428,46 +565,26 @@ static char **find_overlapping_dems(meta_parameters *meta,
         asfPrintError("Failed to open: %s\n", file_with_dem_dirs);
     }
 
+    get_footprint(meta, &scene);
     while (NULL != fgets(line, 512, fp)) {
-        while (isspace(line[strlen(line)-1])) line[strlen(line)-1] = '\0';
+        while (strlen(line) > 0 && isspace(line[strlen(line)-1]))
+            line[strlen(line)-1] = '\0';
+        if (strlen(line) == 0)
+            continue;
         asfPrintStatus("Looking for DEMs in directory: %s\n", line);
-        char **dems = find_overlapping_dems_dir(meta, line, &n_dems_total);
-        if (dems) {
-            char **p = dems;
-            while (*p) {
-                if (*n_dems_found < 100) {
-                    overlapping_dems[*n_dems_found] = STRDUP(*p);
-                    ++(*n_dems_found);
-                } else {
-                    asfPrintWarning("Too many DEMS!");
-                }
-                free(*p);
-                ++(*p);
-            }
-            free(dems);
-        }
+        find_overlapping_dems_dir(&scene, line, found, &n_dems_total);
         ++n_dirs_checked;
     }
     fclose(fp);
 
+    *n_dems_found = found->len;
     asfPrintStatus("In %d directories, found %d DEMS.  %d overlapped.\n",
         n_dirs_checked, n_dems_total, *n_dems_found);
 
-    if (*n_dems_found > 0) {
-        asfPrintStatus("Found %d overlapping dem%s:\n", *n_dems_found,
-            *n_dems_found == 1 ? "" : "s");
-        for (i=0; i<max_dems; ++i)
-            if (overlapping_dems[i])
-                asfPrintStatus("    %s\n", overlapping_dems[i]);
-
-        return overlapping_dems;
-    } else {
+    char **ret = overlapping_dems_list(found);
+    if (!ret)
         asfPrintWarning("No DEMs found!\n");
-        free(overlapping_dems);
-        return NULL;
-    }
-
-    // not reached
+    return ret;
 }
 
 static int try_ext(const char *filename, const char *ext)
@@ -702,9 +819,14 @@ char *build_dem(meta_parameters *meta, const char *dem_cla_arg,
     // Eliminated case (1) -- try case (2)
     if (is_dir_s(dem_cla_arg)) {
         asfPrintStatus("%s: directory containing DEMs.\n", dem_cla_arg);
-        int n;
-        list_of_dems =
-            find_overlapping_dems_dir(meta, dem_cla_arg, &n);
+        GPtrArray *found = g_ptr_array_new();
+        footprint_t scene;
+        int n = 0;
+        get_footprint(meta, &scene);
+        find_overlapping_dems_dir(&scene, dem_cla_arg, found, &n);
+        if (n == 0)
+            asfPrintStatus("No DEMs found in: %s\n", dem_cla_arg);
+        list_of_dems = overlapping_dems_list(found);
     }
     else {
         // this is case (3)
@@ -735,6 +857,11 @@ char *build_dem(meta_parameters *meta, const char *dem_cla_arg,
             utm_zone(meta->general->center_longitude), lat_lo, lat_hi,
             lon_lo, lon_hi, meta->general->no_data);
 
+        char **p;
+        for (p = list_of_dems; *p; ++p)
+            FREE(*p);
+        g_free(list_of_dems);
+
         asfPrintStatus("Constructed DEM: %s\n", built_dem);
         return built_dem;
     }
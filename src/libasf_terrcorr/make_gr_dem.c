@@ -355,7 +355,7 @@ int make_gr_dem_ext(meta_parameters *meta_sar, const char *demImg, const char *d
   if (0)
     demData = read_dem(meta_dem, demImg);
   else
-    fi_dem = float_image_new_from_metadata(meta_dem, demImg);
+    fi_dem = float_image_band_new_from_metadata_mapped(meta_dem, 0, demImg);
 
   if (demData)
     asfPrintStatus("Old method: reading entire DEM.\n");
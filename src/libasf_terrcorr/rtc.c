@@ -1,5 +1,6 @@
 #include <asf_raster.h>
 #include <asf_terrcorr.h>
+#include <asf_sar.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -46,28 +47,6 @@ static int isDecomposition(char *bandExt)
   return found;
 }
 
-static void geodetic_to_ecef(double lat, double lon, double h, Vector *v)
-{
-  //const double a = 6378144.0;    // GEM-06 Ellipsoid.
-  //const double e = 8.1827385e-2; // GEM-06 Eccentricity
-  const double a = 6378137.0000;
-  const double e2 = 6.69437999014e-3;
-  //const double e2 = e*e;
-
-  lat *= D2R;
-  lon *= D2R;
-
-  double sin_lat = sin(lat);
-  double cos_lat = cos(lat);
-
-  double f = sqrt(1. - e2*sin_lat*sin_lat);
-  double af = a/f;
-
-  v->x = (af + h)*cos_lat*cos(lon);
-  v->y = (af + h)*cos_lat*sin(lon);
-  v->z = (af*(1.-e2) + h)*sin_lat;
-}
-
 static Vector get_satpos(meta_parameters *meta, int line)
 {
   int ns = meta->general->sample_count;
@@ -96,162 +75,51 @@ static Vector get_satpos(meta_parameters *meta, int line)
   return satpos;
 }
 
-static void calculate_vectors_for_line(meta_parameters *meta_dem, meta_parameters *meta_img, int line, FILE *dem_fp, Vector **vectorLine, Vector *nextVectors)
+// Where rtc_core() reads the image lines it corrects and puts them back:
+// a pair of files, or columns startX onwards of an image buffer.
+struct rtc_io {
+  FILE *fpIn, *fpOut;
+  meta_parameters *meta_in, *meta_out;
+  image_buffer *image;
+  int startX;
+  float *line;
+};
+
+static void read_band_line(struct rtc_io *io, int band, int line, float *buf)
 {
-  int jj;
-  double lat, lon;
-  int ns = meta_img->general->sample_count;
-  float demLine[ns];
-
-  get_float_line(dem_fp, meta_dem, line, demLine);
-
-  for(jj = 0; jj < ns; ++jj) {
-    Vector *v = MALLOC(sizeof(Vector));
-    meta_get_latLon(meta_img, line, jj, 0, &lat, &lon);
-    geodetic_to_ecef(lat, lon, demLine[jj], v);
-    vectorLine[jj] = v;
+  if (io->image) {
+    image_buffer_get_line(io->image, band, line, io->line);
+    memcpy(buf, io->line + io->startX,
+           sizeof(float)*io->meta_in->general->sample_count);
   }
+  else
+    get_band_float_line(io->fpIn, io->meta_in, band, line, buf);
 }
 
-static void push_next_vector_line(Vector ***localVectors, Vector *nextVectors, meta_parameters *meta_dem, meta_parameters *meta_img, FILE *dem_fp, int line)
+static void write_band_line(struct rtc_io *io, int band, int line,
+                            float *buf)
 {
-  int ns = meta_img->general->sample_count;
-  Vector **vectorsLine = MALLOC(sizeof(Vector*)*ns);
-  calculate_vectors_for_line(meta_dem, meta_img, line, dem_fp, vectorsLine, nextVectors);
-
-  int i;
-  for(i = 0; i < ns; i++)
-    if(localVectors[0] != NULL)
-      vector_free(localVectors[0][i]);
-  FREE(localVectors[0]);
-
-  localVectors[0] = localVectors[1];
-  localVectors[1] = localVectors[2];
-  localVectors[2] = vectorsLine;
-}
-
-static Vector * calculate_normal(Vector ***localVectors, int sample)
-{
-  Vector *v1, *v2, *normal;
-
-  v1 = vector_copy(localVectors[0][sample]);
-  vector_subtract(v1, localVectors[2][sample]);
-
-  v2 = vector_copy(localVectors[1][sample-1]);
-  vector_subtract(v2, localVectors[1][sample+1]);
-
-  normal = vector_cross(v2, v1);
-  vector_multiply(normal, 1./vector_magnitude(normal));
-
-  vector_free(v1);
-  vector_free(v2);
- /*
-  v1 = vector_copy(localVectors[1][sample]);
-  v2 = vector_copy(localVectors[1][sample]);
-  vector_subtract(v1, localVectors[2][sample]);
-  vector_subtract(v2, localVectors[1][sample+1]);
-  normal = vector_cross(v1, v2);
-  vector_multiply(normal, 1./vector_magnitude(normal));
-  vector_free(v1);
-  vector_free(v2);
- */
-  return normal;
-}
-
-static float
-calculate_local_incidence(Vector *n, Vector *satpos, Vector *p)
-                          
-{
-  // R: vector from ground point (p) to satellite (satpos)
-  Vector *R = vector_copy(satpos);
-  vector_subtract(R, p);
-  vector_multiply(R, -1./vector_magnitude(R));
-
-  double local_incidence = acos(vector_dot(n,R)) * R2D;
-
-  vector_free(R);
-
-  return local_incidence;
-}
-
-static float
-calculate_correction(meta_parameters *meta_in, int line, int samp,
-                     Vector *satpos, Vector *n, Vector *p, Vector *p_next, float incid_angle)
-{
-
-  // R: vector from ground point (p) to satellite (satpos)
-  Vector *R = vector_copy(satpos);
-  vector_subtract(R, p);
-  vector_multiply(R, 1./vector_magnitude(R));
-
-  Vector *x = vector_cross(p,R);
-  vector_multiply(x, 1./vector_magnitude(x));
-
-  // Rx: R cross x -- image plane normal
-  Vector *Rx = vector_cross(R,x);
-
-  // cos(phi) is the correction factor we need
-  double cosphi = vector_dot(Rx,n);
-  if (cosphi < 0) cosphi = -cosphi;
-
-  vector_free(x);
-  vector_free(R);
-  vector_free(Rx);
-
-  // need to remove old correction factor (sin of the incidence angle)
-  return cosphi / sin(incid_angle);
+  if (io->image) {
+    image_buffer_get_line(io->image, band, line, io->line);
+    memcpy(io->line + io->startX, buf,
+           sizeof(float)*io->meta_in->general->sample_count);
+    image_buffer_put_line(io->image, band, line, io->line);
+  }
+  else
+    put_band_float_line(io->fpOut, io->meta_out, band, line, buf);
 }
 
-int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
-        char *output_file, int save_incid_angles)
+static void rtc_core(struct rtc_io *io, meta_parameters *meta_dem,
+                     FILE *dem_fp, int save_incid_angles)
 {
-  // always save these for now
-  save_incid_angles = TRUE;
-
-  //asfPrintStatus("Input file: %s\n", input_file);
-  //asfPrintStatus("DEM: %s\n", dem_file);
-  //asfPrintStatus("Output file: %s\n", output_file);
-  //asfPrintStatus("Layover/shadow mask: %s\n",
-  //               maskFlag ? mask_file : "none");
-  asfPrintStatus("Save incid angles: %s\n\n", save_incid_angles ? "Yes" : "No");
-
-  char *inputImg = appendExt(input_file, ".img");
-  char *inputMeta = appendExt(input_file, ".meta");
-  char *demImg = appendExt(dem_file, ".img");
-  char *demMeta = appendExt(dem_file, ".meta");
-  char *outputImg = appendExt(output_file, ".img");
-  char *outputMeta = appendExt(output_file, ".meta");
-  char *maskImg = maskFlag ? appendExt(mask_file, ".img") : NULL;
-  char *maskMeta = maskFlag ? appendExt(mask_file, ".meta") : NULL;
+  meta_parameters *meta_in = io->meta_in;
   char *sideProductsMetaName=NULL;
   meta_parameters *side_meta=NULL;
   FILE *fpSide = NULL;
 
-  if (!fileExists(inputImg))
-    asfPrintError("Not found: %s\n", inputImg);
-  if (!fileExists(inputMeta))
-    asfPrintError("Not found: %s\n", inputMeta);
-  if (!fileExists(demImg))
-    asfPrintError("Not found: %s\n", demImg);
-  if (!fileExists(demMeta))
-    asfPrintError("Not found: %s\n", demMeta);
-  if (maskFlag) {
-    if (!fileExists(maskImg))
-      asfPrintError("Not found: %s\n", maskImg);
-    if (!fileExists(maskMeta))
-      asfPrintError("Not found: %s\n", maskMeta);
-  }
-
-  asfPrintStatus("Reading metadata...\n");
-  meta_parameters *meta_in = meta_read(inputMeta);
-  if (!meta_in) asfPrintError("Failed to read metadata: %s\n", inputMeta);
-  meta_parameters *meta_out = meta_copy(meta_in);
-  meta_parameters *meta_dem = meta_read(demMeta);
-  if (!meta_dem) asfPrintError("Failed to read metadata: %s\n", demMeta);
-
   if(save_incid_angles) {
     const char *tmpdir = get_asf_tmp_dir();
-    char *sideProductsImgName = MALLOC(sizeof(char)*(strlen(tmpdir)+strlen(output_file)+64));
+    char *sideProductsImgName = MALLOC(sizeof(char)*(strlen(tmpdir)+64));
     sprintf(sideProductsImgName, "%s%cterrcorr_side_products.img", 
 	    tmpdir, DIR_SEPARATOR);
     sideProductsMetaName = appendExt(sideProductsImgName, ".meta");
@@ -280,24 +148,24 @@ int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
                    nl, ns, dnl, dns);
   }
 
-  Vector **localVectors[3] = { NULL, NULL, NULL };
-  Vector nextVectors[ns];
-
-  FILE *fpIn = FOPEN(inputImg, "rb");
-  FILE *fpOut = FOPEN(outputImg, "wb");
-  FILE *dem_fp = FOPEN(demImg, "rb");
+  // DEM points are placed on the WGS84 ellipsoid
+  terrain_rows *rows = terrain_rows_new(ns, 6378137.0, 6.69437999014e-3);
+  double *cosphi = MALLOC(sizeof(double)*ns);
+  double *incid = MALLOC(sizeof(double)*ns);
+  double *local_incid = MALLOC(sizeof(double)*ns);
 
   float corr[ns];
   float incid_angles[ns];
   float bufIn[ns];
   float bufOut[ns];
+  float demLine[ns];
 
   asfPrintStatus("Applying radiometric correction...\n");
 
   int ii, jj, kk;
-  for(ii = 1; ii < 3; ++ii) {
-    localVectors[ii] = MALLOC(sizeof(Vector**)*ns);
-    calculate_vectors_for_line(meta_in, meta_dem, ii - 1, dem_fp, localVectors[ii], nextVectors);
+  for(ii = 0; ii < 2; ++ii) {
+    get_float_line(dem_fp, meta_dem, ii, demLine);
+    terrain_rows_push(rows, meta_in, ii, demLine);
   }
 
   for (jj=0; jj<ns; ++jj) {
@@ -320,7 +188,7 @@ int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
   // We aren't applying the correction to the edges of the image
   // (corr[jj] == 1 for the whole row)
   for(kk = 0; kk < nb; ++kk) {
-    get_band_float_line(fpIn, meta_in, kk, 0, bufIn);
+    read_band_line(io, kk, 0, bufIn);
     if (strstr(bands[kk], "PHASE") != NULL) {
       for (jj=0; jj<ns; ++jj)
 	bufOut[jj] = bufIn[jj];
@@ -334,24 +202,25 @@ int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
 	bufOut[jj] = 
 	  get_rad_cal_dn(meta_in, 0, jj, bands[kk], bufIn[jj], corr[jj]);
     }
-    put_band_float_line(fpOut, meta_out, kk, 0, bufOut);
+    write_band_line(io, kk, 0, bufOut);
   }
 
   for(ii = 1; ii < nl - 1; ++ii) {
-    push_next_vector_line(localVectors, nextVectors, meta_dem, meta_in, dem_fp,
-			  ii + 1);
+    get_float_line(dem_fp, meta_dem, ii + 1, demLine);
+    terrain_rows_push(rows, meta_in, ii + 1, demLine);
+    terrain_rows_normals(rows);
     corr[0] = corr[ns-1] = 1;
     Vector satpos = get_satpos(meta_in, ii);
-    incid_angles[0] = incid_angles[nl-1] = 0;
+    incid_angles[0] = incid_angles[ns-1] = 0;
 
     // calculate the Ulander correction for this line
+    incidence_profile(meta_in, ii, ns, incid);
+    terrain_rows_cosphi(rows, &satpos, cosphi,
+                        save_incid_angles ? local_incid : NULL);
     for(jj = 1; jj < ns - 1; ++jj) {
-      incid_angles[jj] = meta_incid(meta_in, ii, jj);
-      Vector * normal = calculate_normal(localVectors, jj);
-      corr[jj] = calculate_correction(meta_in, ii, jj, &satpos, normal, 
-				      localVectors[1][jj], &nextVectors[jj], 
-				      incid_angles[jj]);
-      vector_free(normal);
+      incid_angles[jj] = incid[jj];
+      // need to remove old correction factor (sin of the incidence angle)
+      corr[jj] = fabs(cosphi[jj]) / sin(incid[jj]);
     }
 
     // saving some intermediate products if requested
@@ -364,20 +233,15 @@ int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
       for (jj=0; jj<ns; ++jj)
         tmp_buf[jj] = corr[jj] * sin(incid_angles[jj]);
       put_band_float_line(fpSide, side_meta, 3, ii, tmp_buf);
-      for (jj=1; jj<ns-1; ++jj) {
-        Vector * normal = calculate_normal(localVectors, jj);
-        tmp_buf[jj] = calculate_local_incidence(normal, &satpos,
-				      localVectors[1][jj]);
-        vector_free(normal);
-      }
-      tmp_buf[jj] = tmp_buf[jj-1] = 0;
+      for (jj=0; jj<ns; ++jj)
+        tmp_buf[jj] = local_incid[jj];
       put_band_float_line(fpSide, side_meta, 1, ii, tmp_buf);
       FREE(tmp_buf);
     }
 
     // correct all the bands with the calculated scale factor
     for (kk=0; kk<nb; ++kk) {
-      get_band_float_line(fpIn, meta_in, kk, ii, bufIn);
+      read_band_line(io, kk, ii, bufIn);
 
       // we never apply the correction to phase
       if (strstr(bands[kk], "PHASE") != NULL) {
@@ -397,7 +261,7 @@ int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
       }
 
       // write out the corrected line
-      put_band_float_line(fpOut, meta_out, kk, ii, bufOut);
+      write_band_line(io, kk, ii, bufOut);
     }
 
     asfLineMeter(ii+1, nl);
@@ -406,7 +270,7 @@ int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
   // bottom line of the image, here we are cheating and reusing the previous
   // line's correction factors
   for(kk = 0; kk < nb; ++kk) {
-    get_band_float_line(fpIn, meta_in, kk, nl-1, bufIn);
+    read_band_line(io, kk, nl-1, bufIn);
     if (strstr(bands[kk], "PHASE") != NULL) {
       for (jj=0; jj<ns; ++jj)
 	bufOut[jj] = bufIn[jj];
@@ -420,32 +284,85 @@ int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
 	bufOut[jj] = 
 	  get_rad_cal_dn(meta_in, nl-1, jj, bands[kk], bufIn[jj], corr[jj]);
     }
-    put_band_float_line(fpOut, meta_out, kk, nl-1, bufIn);
+    write_band_line(io, kk, nl-1, bufIn);
   }
 
-  for(ii = 0; ii < 3; ++ii) {
-    for(jj = 0; jj < ns; ++jj) {
-      vector_free(localVectors[ii][jj]);
-    }
-    FREE(localVectors[ii]);
-  }
+  terrain_rows_free(rows);
+  FREE(cosphi);
+  FREE(incid);
+  FREE(local_incid);
 
-  FCLOSE(fpOut);
-  FCLOSE(fpIn);
   if (fpSide) FCLOSE(fpSide);
 
-  // update output metadata
-  for (ii=0; ii<meta_out->general->band_count; ii++) {
+  for (ii=0; ii<nb; ii++) {
     FREE(bands[ii]);
   }
   FREE(bands);
-  meta_write(meta_out, outputMeta);
 
   if (save_incid_angles) {
     meta_write(side_meta, sideProductsMetaName);
     meta_free(side_meta);
     FREE(sideProductsMetaName);
   }
+}
+
+int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
+        char *output_file, int save_incid_angles)
+{
+  // always save these for now
+  save_incid_angles = TRUE;
+
+  //asfPrintStatus("Input file: %s\n", input_file);
+  //asfPrintStatus("DEM: %s\n", dem_file);
+  //asfPrintStatus("Output file: %s\n", output_file);
+  //asfPrintStatus("Layover/shadow mask: %s\n",
+  //               maskFlag ? mask_file : "none");
+  asfPrintStatus("Save incid angles: %s\n\n", save_incid_angles ? "Yes" : "No");
+
+  char *inputImg = appendExt(input_file, ".img");
+  char *inputMeta = appendExt(input_file, ".meta");
+  char *demImg = appendExt(dem_file, ".img");
+  char *demMeta = appendExt(dem_file, ".meta");
+  char *outputImg = appendExt(output_file, ".img");
+  char *outputMeta = appendExt(output_file, ".meta");
+  char *maskImg = maskFlag ? appendExt(mask_file, ".img") : NULL;
+  char *maskMeta = maskFlag ? appendExt(mask_file, ".meta") : NULL;
+
+  if (!fileExists(inputImg))
+    asfPrintError("Not found: %s\n", inputImg);
+  if (!fileExists(inputMeta))
+    asfPrintError("Not found: %s\n", inputMeta);
+  if (!fileExists(demImg))
+    asfPrintError("Not found: %s\n", demImg);
+  if (!fileExists(demMeta))
+    asfPrintError("Not found: %s\n", demMeta);
+  if (maskFlag) {
+    if (!fileExists(maskImg))
+      asfPrintError("Not found: %s\n", maskImg);
+    if (!fileExists(maskMeta))
+      asfPrintError("Not found: %s\n", maskMeta);
+  }
+
+  asfPrintStatus("Reading metadata...\n");
+  meta_parameters *meta_in = meta_read(inputMeta);
+  if (!meta_in) asfPrintError("Failed to read metadata: %s\n", inputMeta);
+  meta_parameters *meta_out = meta_copy(meta_in);
+  meta_parameters *meta_dem = meta_read(demMeta);
+  if (!meta_dem) asfPrintError("Failed to read metadata: %s\n", demMeta);
+
+  struct rtc_io io = { NULL, NULL, meta_in, meta_out, NULL, 0, NULL };
+  io.fpIn = FOPEN(inputImg, "rb");
+  io.fpOut = FOPEN(outputImg, "wb");
+  FILE *dem_fp = FOPEN(demImg, "rb");
+
+  rtc_core(&io, meta_dem, dem_fp, save_incid_angles);
+
+  FCLOSE(io.fpOut);
+  FCLOSE(io.fpIn);
+  FCLOSE(dem_fp);
+
+  // update output metadata
+  meta_write(meta_out, outputMeta);
 
   meta_free(meta_out);
   meta_free(meta_in);
@@ -462,3 +379,39 @@ int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
 
   return FALSE;
 }
+
+// Radiometrically correct an image that is still in memory: the columns
+// from startX on of the image buffer, which meta describes, are
+// corrected in place using the ground range DEM dem_file.
+void rtc_buffer(image_buffer *image, int startX, meta_parameters *meta,
+                char *dem_file, int save_incid_angles)
+{
+  char *demImg = appendExt(dem_file, ".img");
+  char *demMeta = appendExt(dem_file, ".meta");
+
+  if (!fileExists(demImg))
+    asfPrintError("Not found: %s\n", demImg);
+  if (!fileExists(demMeta))
+    asfPrintError("Not found: %s\n", demMeta);
+
+  meta_parameters *meta_dem = meta_read(demMeta);
+  if (!meta_dem) asfPrintError("Failed to read metadata: %s\n", demMeta);
+
+  assert(startX + meta->general->sample_count <= image->ns);
+  assert(meta->general->band_count == image->nb);
+
+  // always save these for now, as rtc() does
+  save_incid_angles = TRUE;
+
+  struct rtc_io io = { NULL, NULL, meta, meta, image, startX, NULL };
+  io.line = MALLOC(sizeof(float)*image->ns);
+  FILE *dem_fp = FOPEN(demImg, "rb");
+
+  rtc_core(&io, meta_dem, dem_fp, save_incid_angles);
+
+  FCLOSE(dem_fp);
+  FREE(io.line);
+  meta_free(meta_dem);
+  FREE(demImg);
+  FREE(demMeta);
+}
@@ -39,7 +39,8 @@
 /******************************************************************************
 NAME: raster_calc
 
-SYNOPSIS:  raster_calc [-log <file>] <out.ext> "exp" <inA.ext> [<inB.ext> [...]]
+SYNOPSIS:  raster_calc [-log <file>] [-nodata <value>]
+                       <out.ext> "exp" <inA.ext> [<inB.ext> [...]]
 
 DESCRIPTION:
 	Calculates an output image based on some mathematical function of the
@@ -83,14 +84,15 @@ BUGS:
 #include "expression.h"
 
 #define MAXIMGS 20
-#define VERSION 1.5
+#define VERSION 1.6
 
 static
 void usage(char *name)
 {
  printf("\n"
 	"USAGE:\n"
-	"   %s [-log <file>] <out.ext> \"exp\" <inA.ext> [<inB.ext> [...]]\n",
+	"   %s [-log <file>] [-nodata <value>]\n"
+	"      <out.ext> \"exp\" <inA.ext> [<inB.ext> [...]]\n",
 	name);
  printf("\n"
 	"REQUIRED ARGUMENTS:\n"
@@ -101,7 +103,10 @@ void usage(char *name)
 	"OPTIONAL ARGUMENTS:\n"
 	"   [<inB.ext>]      Optional second input image with extension.\n"
 	"   [...]            Optional additional images with extension.\n"
-	"   [-log <file>]    Option to have output written to a log file.\n");
+	"   [-log <file>]    Option to have output written to a log file.\n"
+	"   [-nodata <value>]\n"
+	"                    Pixels where any input used by the expression has\n"
+	"                    this value get it in the output as well.\n");
  printf("\n"
 	"DESCRIPTION:\n"
 	"   Creates an output ASF tools format image based upon the\n"
@@ -118,6 +123,7 @@ int main(int argc,char **argv)
   char *expression;
   char *outFile,*inFiles[MAXIMGS];
   int input_count;
+  double nodata = NAN;
   extern int currArg;         /* in cla.h from asf.h; initialized to 1 */
 
   fLog=NULL;
@@ -132,6 +138,10 @@ int main(int argc,char **argv)
       fLog = FOPEN(logFile,"a");
       logflag=TRUE;
     }
+    else if (strmatch(key,"-nodata")) {
+      CHECK_ARG(1); /*one double argument: no data value */
+      nodata = atof(GET_ARG(1));
+    }
   }
 
   outFile = argv[currArg++];
@@ -142,7 +152,7 @@ int main(int argc,char **argv)
 
   asfSplashScreen(argc, argv);
 
-  raster_calc(outFile, expression, input_count, inFiles);
+  raster_calc_ext(outFile, expression, input_count, inFiles, nodata);
 
   exit(EXIT_SUCCESS);
 }
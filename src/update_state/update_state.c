@@ -190,6 +190,8 @@ void update_state(const char *inFile, const char *outFile, int num, double spaci
   }
 
   meta_parameters *out_meta = meta_copy(in_meta);
+  // same image, new metadata
+  out_meta->general->byte_order = in_meta->general->byte_order;
 
   int nl = in_meta->general->line_count;
   int ns = in_meta->general->sample_count;